@@ -27,21 +27,45 @@
 #include "QXmppUtils.h"
 
 #include <QCryptographicHash>
-#include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QHostInfo>
+#include <QMessageAuthenticationCode>
 #include <QNetworkInterface>
+#include <QSet>
 #include <QTimer>
 #include <QUdpSocket>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
 
 #define STUN_ID_SIZE 12
 #define STUN_RTO_INTERVAL 500
 #define STUN_RTO_MAX 7
 
+// pacing of ordinary ICE checks (Ta), see RFC 8445 - 14.2
+#define ICE_CHECK_INTERVAL 50
+// how long regular nomination waits for higher-priority pairs
+#define ICE_NOMINATION_TIMEOUT 1000
+
 static const quint32 STUN_MAGIC = 0x2112A442;
 static const quint16 STUN_HEADER = 20;
 static const quint8 STUN_IPV4 = 0x01;
 static const quint8 STUN_IPV6 = 0x02;
 
+// maximum number of datagrams read with a single system call
+static const int udpBatchSize = 32;
+
+// maximum number of batches read per wakeup, so that a flooded socket cannot
+// starve the event loop
+static const int udpMaximumBatches = 4;
+
+// size of the pooled receive buffers, which hold the largest UDP datagram
+static const int udpBufferSize = 65535;
+
 static const char *gathering_states[] = {
     "new",
     "gathering",
@@ -135,15 +159,51 @@ static bool isCompatibleAddress(const QHostAddress &a1, const QHostAddress &a2)
         isIPv6LinkLocalAddress(a1) == isIPv6LinkLocalAddress(a2);
 }
 
-static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
+// Returns the bit used to flag the presence of an attribute which has no
+// "empty" value in QXmppStunMessage.
+static quint32 attributeFlag(quint16 type)
+{
+    switch (type) {
+    case ChangeRequest:
+        return 0x001;
+    case ChannelNumber:
+        return 0x002;
+    case DataAttr:
+        return 0x004;
+    case Lifetime:
+        return 0x008;
+    case Nonce:
+        return 0x010;
+    case Priority:
+        return 0x020;
+    case Realm:
+        return 0x040;
+    case RequestedTransport:
+        return 0x080;
+    case ReservationToken:
+        return 0x100;
+    case Software:
+        return 0x200;
+    case Username:
+        return 0x400;
+    default:
+        return 0;
+    }
+}
+
+// Fills the 16 byte pad used to XOR IPv6 addresses.
+static void xorPad(uchar *pad, const QByteArray &xorId)
+{
+    qToBigEndian(STUN_MAGIC, pad);
+    memcpy(pad + 4, xorId.constData(), STUN_ID_SIZE);
+}
+
+static bool decodeAddress(const uchar *data, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
 {
     if (a_length < 4)
         return false;
-    quint8 reserved, protocol;
-    quint16 rawPort;
-    stream >> reserved;
-    stream >> protocol;
-    stream >> rawPort;
+    const quint8 protocol = data[1];
+    const quint16 rawPort = qFromBigEndian<quint16>(data + 2);
     if (xorId.isEmpty())
         port = rawPort;
     else
@@ -151,93 +211,119 @@ static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &a
     if (protocol == STUN_IPV4) {
         if (a_length != 8)
             return false;
-        quint32 addr;
-        stream >> addr;
+        const quint32 addr = qFromBigEndian<quint32>(data + 4);
         if (xorId.isEmpty())
-            address = QHostAddress(addr);
+            address.setAddress(addr);
         else
-            address = QHostAddress(addr ^ STUN_MAGIC);
+            address.setAddress(addr ^ STUN_MAGIC);
     } else if (protocol == STUN_IPV6) {
         if (a_length != 20)
             return false;
         Q_IPV6ADDR addr;
-        stream.readRawData((char *)&addr, sizeof(addr));
+        memcpy(&addr, data + 4, sizeof(addr));
         if (!xorId.isEmpty()) {
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+            uchar xpad[16];
+            xorPad(xpad, xorId);
             for (int i = 0; i < 16; i++)
                 addr[i] ^= xpad[i];
         }
-        address = QHostAddress(addr);
+        address.setAddress(addr);
     } else {
         return false;
     }
     return true;
 }
 
-static void encodeAddress(QDataStream &stream, quint16 type, const QHostAddress &address, quint16 port, const QByteArray &xorId = QByteArray())
+static void appendUint16(QByteArray &buffer, quint16 value)
+{
+    uchar data[2];
+    qToBigEndian(value, data);
+    buffer.append(reinterpret_cast<const char *>(data), sizeof(data));
+}
+
+static void appendUint32(QByteArray &buffer, quint32 value)
+{
+    uchar data[4];
+    qToBigEndian(value, data);
+    buffer.append(reinterpret_cast<const char *>(data), sizeof(data));
+}
+
+static void appendAttribute(QByteArray &buffer, quint16 type, const char *data, int size)
+{
+    appendUint16(buffer, type);
+    appendUint16(buffer, size);
+    buffer.append(data, size);
+    if (size % 4)
+        buffer.append(4 - (size % 4), '\0');
+}
+
+static void encodeAddress(QByteArray &buffer, quint16 type, const QHostAddress &address, quint16 port, const QByteArray &xorId = QByteArray())
 {
     const quint8 reserved = 0;
     if (address.protocol() == QAbstractSocket::IPv4Protocol) {
-        stream << type;
-        stream << quint16(8);
-        stream << reserved;
-        stream << quint8(STUN_IPV4);
+        appendUint16(buffer, type);
+        appendUint16(buffer, 8);
+        buffer.append(char(reserved));
+        buffer.append(char(STUN_IPV4));
         quint32 addr = address.toIPv4Address();
         if (!xorId.isEmpty()) {
             port ^= (STUN_MAGIC >> 16);
             addr ^= STUN_MAGIC;
         }
-        stream << port;
-        stream << addr;
+        appendUint16(buffer, port);
+        appendUint32(buffer, addr);
     } else if (address.protocol() == QAbstractSocket::IPv6Protocol) {
-        stream << type;
-        stream << quint16(20);
-        stream << reserved;
-        stream << quint8(STUN_IPV6);
+        appendUint16(buffer, type);
+        appendUint16(buffer, 20);
+        buffer.append(char(reserved));
+        buffer.append(char(STUN_IPV6));
         Q_IPV6ADDR addr = address.toIPv6Address();
         if (!xorId.isEmpty()) {
             port ^= (STUN_MAGIC >> 16);
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+            uchar xpad[16];
+            xorPad(xpad, xorId);
             for (int i = 0; i < 16; i++)
                 addr[i] ^= xpad[i];
         }
-        stream << port;
-        stream.writeRawData((char *)&addr, sizeof(addr));
+        appendUint16(buffer, port);
+        buffer.append(reinterpret_cast<const char *>(&addr), sizeof(addr));
     } else {
         qWarning("Cannot write STUN attribute for unknown IP version");
     }
 }
 
-static void addAddress(QDataStream &stream, quint16 type, const QHostAddress &host, quint16 port, const QByteArray &xorId = QByteArray())
+static void addAddress(QByteArray &buffer, quint16 type, const QHostAddress &host, quint16 port, const QByteArray &xorId = QByteArray())
 {
     if (port && !host.isNull() &&
         (host.protocol() == QAbstractSocket::IPv4Protocol ||
          host.protocol() == QAbstractSocket::IPv6Protocol)) {
-        encodeAddress(stream, type, host, port, xorId);
+        encodeAddress(buffer, type, host, port, xorId);
     }
 }
 
-static void encodeString(QDataStream &stream, quint16 type, const QString &string)
+static void encodeString(QByteArray &buffer, quint16 type, const QString &string)
 {
     const QByteArray utf8string = string.toUtf8();
-    stream << type;
-    stream << quint16(utf8string.size());
-    stream.writeRawData(utf8string.data(), utf8string.size());
-    if (utf8string.size() % 4) {
-        const QByteArray padding(4 - (utf8string.size() % 4), 0);
-        stream.writeRawData(padding.data(), padding.size());
-    }
+    appendAttribute(buffer, type, utf8string.constData(), utf8string.size());
 }
 
-static void setBodyLength(QByteArray &buffer, qint16 length)
+static void setBodyLength(QByteArray &buffer, quint16 length)
 {
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
-    stream.device()->seek(2);
-    stream << length;
+    qToBigEndian(length, reinterpret_cast<uchar *>(buffer.data()) + 2);
+}
+
+// Computes the MESSAGE-INTEGRITY of the given message prefix, as if its
+// header announced a body of the given length.
+static QByteArray messageIntegrity(QMessageAuthenticationCode *mac, const char *data, int size, quint16 length)
+{
+    uchar header[4];
+    memcpy(header, data, 2);
+    qToBigEndian(length, header + 2);
+
+    mac->reset();
+    mac->addData(reinterpret_cast<const char *>(header), sizeof(header));
+    mac->addData(data + sizeof(header), size - int(sizeof(header)));
+    return mac->result();
 }
 
 /// Constructs a new QXmppStunMessage.
@@ -254,6 +340,7 @@ QXmppStunMessage::QXmppStunMessage()
       useCandidate(false),
       m_cookie(STUN_MAGIC),
       m_type(0),
+      m_attributes(0),
       m_changeRequest(0),
       m_channelNumber(0),
       m_lifetime(0),
@@ -319,7 +406,7 @@ quint32 QXmppStunMessage::changeRequest() const
 void QXmppStunMessage::setChangeRequest(quint32 changeRequest)
 {
     m_changeRequest = changeRequest;
-    m_attributes << ChangeRequest;
+    m_attributes |= attributeFlag(ChangeRequest);
 }
 
 /// Returns the CHANNEL-NUMBER attribute.
@@ -336,7 +423,7 @@ quint16 QXmppStunMessage::channelNumber() const
 void QXmppStunMessage::setChannelNumber(quint16 channelNumber)
 {
     m_channelNumber = channelNumber;
-    m_attributes << ChannelNumber;
+    m_attributes |= attributeFlag(ChannelNumber);
 }
 
 /// Returns the DATA attribute.
@@ -351,7 +438,7 @@ QByteArray QXmppStunMessage::data() const
 void QXmppStunMessage::setData(const QByteArray &data)
 {
     m_data = data;
-    m_attributes << DataAttr;
+    m_attributes |= attributeFlag(DataAttr);
 }
 
 /// Returns the LIFETIME attribute, indicating the duration in seconds for
@@ -370,7 +457,7 @@ quint32 QXmppStunMessage::lifetime() const
 void QXmppStunMessage::setLifetime(quint32 lifetime)
 {
     m_lifetime = lifetime;
-    m_attributes << Lifetime;
+    m_attributes |= attributeFlag(Lifetime);
 }
 
 /// Returns the NONCE attribute.
@@ -387,7 +474,7 @@ QByteArray QXmppStunMessage::nonce() const
 void QXmppStunMessage::setNonce(const QByteArray &nonce)
 {
     m_nonce = nonce;
-    m_attributes << Nonce;
+    m_attributes |= attributeFlag(Nonce);
 }
 
 /// Returns the PRIORITY attribute, the priority that would be assigned to
@@ -406,7 +493,7 @@ quint32 QXmppStunMessage::priority() const
 void QXmppStunMessage::setPriority(quint32 priority)
 {
     m_priority = priority;
-    m_attributes << Priority;
+    m_attributes |= attributeFlag(Priority);
 }
 
 /// Returns the REALM attribute.
@@ -423,7 +510,7 @@ QString QXmppStunMessage::realm() const
 void QXmppStunMessage::setRealm(const QString &realm)
 {
     m_realm = realm;
-    m_attributes << Realm;
+    m_attributes |= attributeFlag(Realm);
 }
 
 /// Returns the REQUESTED-TRANSPORT attribute.
@@ -440,7 +527,7 @@ quint8 QXmppStunMessage::requestedTransport() const
 void QXmppStunMessage::setRequestedTransport(quint8 requestedTransport)
 {
     m_requestedTransport = requestedTransport;
-    m_attributes << RequestedTransport;
+    m_attributes |= attributeFlag(RequestedTransport);
 }
 
 /// Returns the RESERVATION-TOKEN attribute.
@@ -458,7 +545,7 @@ void QXmppStunMessage::setReservationToken(const QByteArray &reservationToken)
 {
     m_reservationToken = reservationToken;
     m_reservationToken.resize(8);
-    m_attributes << ReservationToken;
+    m_attributes |= attributeFlag(ReservationToken);
 }
 
 /// Returns the SOFTWARE attribute, containing a textual description of the
@@ -477,7 +564,7 @@ QString QXmppStunMessage::software() const
 void QXmppStunMessage::setSoftware(const QString &software)
 {
     m_software = software;
-    m_attributes << Software;
+    m_attributes |= attributeFlag(Software);
 }
 
 /// Returns the USERNAME attribute, containing the username to use for
@@ -496,7 +583,7 @@ QString QXmppStunMessage::username() const
 void QXmppStunMessage::setUsername(const QString &username)
 {
     m_username = username;
-    m_attributes << Username;
+    m_attributes |= attributeFlag(Username);
 }
 
 /// Decodes a QXmppStunMessage and checks its integrity using the given key.
@@ -507,41 +594,85 @@ void QXmppStunMessage::setUsername(const QString &username)
 
 bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, QStringList *errors)
 {
-    QStringList silent;
-    if (!errors)
-        errors = &silent;
+    return decode(buffer.constData(), buffer.size(), key, errors);
+}
+
+/// Decodes a QXmppStunMessage from the given raw data and checks its
+/// integrity using the given key.
+///
+/// The attributes are read in place, the data is not copied. Error
+/// descriptions are only built if \a errors is not null.
+///
+/// \param data
+/// \param size
+/// \param key
+/// \param errors
+
+bool QXmppStunMessage::decode(const char *data, int size, const QByteArray &key, QStringList *errors)
+{
+    if (key.isEmpty())
+        return decode(data, size, static_cast<QMessageAuthenticationCode *>(nullptr), errors);
+
+    QMessageAuthenticationCode integrity(QCryptographicHash::Sha1, key);
+    return decode(data, size, &integrity, errors);
+}
+
+/// Decodes a QXmppStunMessage from the given raw data and checks its
+/// integrity using the given HMAC-SHA1 context.
+///
+/// Keeping one context per credential avoids preparing the key for every
+/// message. If \a integrity is null, MESSAGE-INTEGRITY is not checked.
+///
+/// \param data
+/// \param size
+/// \param integrity
+/// \param errors
 
-    if (buffer.size() < STUN_HEADER) {
-        *errors << QLatin1String("Received a truncated STUN packet");
+bool QXmppStunMessage::decode(const char *data, int size, QMessageAuthenticationCode *integrity, QStringList *errors)
+{
+    if (size < STUN_HEADER) {
+        if (errors)
+            *errors << QLatin1String("Received a truncated STUN packet");
         return false;
     }
 
     // parse STUN header
-    QDataStream stream(buffer);
-    quint16 length;
-    stream >> m_type;
-    stream >> length;
-    stream >> m_cookie;
-    stream.readRawData(m_id.data(), m_id.size());
-
-    if (length != buffer.size() - STUN_HEADER) {
-        *errors << QLatin1String("Received an invalid STUN packet");
+    const auto *ptr = reinterpret_cast<const uchar *>(data);
+    const quint16 length = qFromBigEndian<quint16>(ptr + 2);
+    if (length != size - STUN_HEADER) {
+        if (errors)
+            *errors << QLatin1String("Received an invalid STUN packet");
         return false;
     }
+    m_type = qFromBigEndian<quint16>(ptr);
+    m_cookie = qFromBigEndian<quint32>(ptr + 4);
+    memcpy(m_id.data(), data + 8, STUN_ID_SIZE);
+    ptr += STUN_HEADER;
 
     // parse STUN attributes
     int done = 0;
     bool after_integrity = false;
     while (done < length) {
-        quint16 a_type, a_length;
-        stream >> a_type;
-        stream >> a_length;
+        if (length - done < 4) {
+            if (errors)
+                *errors << QLatin1String("Received a truncated STUN attribute");
+            return false;
+        }
+        const uchar *attr = ptr + done;
+        const quint16 a_type = qFromBigEndian<quint16>(attr);
+        const quint16 a_length = qFromBigEndian<quint16>(attr + 2);
         const int pad_length = 4 * ((a_length + 3) / 4) - a_length;
+        const uchar *value = attr + 4;
+        if (length - done - 4 < a_length + pad_length) {
+            if (errors)
+                *errors << QLatin1String("Received a truncated STUN attribute");
+            return false;
+        }
 
         // only FINGERPRINT is allowed after MESSAGE-INTEGRITY
         if (after_integrity && a_type != Fingerprint) {
-            *errors << QString("Skipping attribute %1 after MESSAGE-INTEGRITY").arg(QString::number(a_type));
-            stream.skipRawData(a_length + pad_length);
+            if (errors)
+                *errors << QString("Skipping attribute %1 after MESSAGE-INTEGRITY").arg(QString::number(a_type));
             done += 4 + a_length + pad_length;
             continue;
         }
@@ -550,23 +681,16 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // PRIORITY
             if (a_length != sizeof(m_priority))
                 return false;
-            stream >> m_priority;
-            m_attributes << Priority;
+            m_priority = qFromBigEndian<quint32>(value);
+            m_attributes |= attributeFlag(Priority);
 
         } else if (a_type == ErrorCode) {
 
             // ERROR-CODE
             if (a_length < 4)
                 return false;
-            quint16 reserved;
-            quint8 errorCodeHigh, errorCodeLow;
-            stream >> reserved;
-            stream >> errorCodeHigh;
-            stream >> errorCodeLow;
-            errorCode = errorCodeHigh * 100 + errorCodeLow;
-            QByteArray phrase(a_length - 4, 0);
-            stream.readRawData(phrase.data(), phrase.size());
-            errorPhrase = QString::fromUtf8(phrase);
+            errorCode = value[2] * 100 + value[3];
+            errorPhrase = QString::fromUtf8(reinterpret_cast<const char *>(value + 4), a_length - 4);
 
         } else if (a_type == UseCandidate) {
 
@@ -580,79 +704,69 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANNEL-NUMBER
             if (a_length != 4)
                 return false;
-            stream >> m_channelNumber;
-            stream.skipRawData(2);
-            m_attributes << ChannelNumber;
+            m_channelNumber = qFromBigEndian<quint16>(value);
+            m_attributes |= attributeFlag(ChannelNumber);
 
         } else if (a_type == DataAttr) {
 
             // DATA
-            m_data.resize(a_length);
-            stream.readRawData(m_data.data(), m_data.size());
-            m_attributes << DataAttr;
+            m_data = QByteArray(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(DataAttr);
 
         } else if (a_type == Lifetime) {
 
             // LIFETIME
             if (a_length != sizeof(m_lifetime))
                 return false;
-            stream >> m_lifetime;
-            m_attributes << Lifetime;
+            m_lifetime = qFromBigEndian<quint32>(value);
+            m_attributes |= attributeFlag(Lifetime);
 
         } else if (a_type == Nonce) {
 
             // NONCE
-            m_nonce.resize(a_length);
-            stream.readRawData(m_nonce.data(), m_nonce.size());
-            m_attributes << Nonce;
+            m_nonce = QByteArray(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(Nonce);
 
         } else if (a_type == Realm) {
 
             // REALM
-            QByteArray utf8Realm(a_length, 0);
-            stream.readRawData(utf8Realm.data(), utf8Realm.size());
-            m_realm = QString::fromUtf8(utf8Realm);
-            m_attributes << Realm;
+            m_realm = QString::fromUtf8(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(Realm);
 
         } else if (a_type == RequestedTransport) {
 
             // REQUESTED-TRANSPORT
             if (a_length != 4)
                 return false;
-            stream >> m_requestedTransport;
-            stream.skipRawData(3);
-            m_attributes << RequestedTransport;
+            m_requestedTransport = value[0];
+            m_attributes |= attributeFlag(RequestedTransport);
 
         } else if (a_type == ReservationToken) {
 
             // RESERVATION-TOKEN
             if (a_length != 8)
                 return false;
-            m_reservationToken.resize(a_length);
-            stream.readRawData(m_reservationToken.data(), m_reservationToken.size());
-            m_attributes << ReservationToken;
+            m_reservationToken = QByteArray(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(ReservationToken);
 
         } else if (a_type == Software) {
 
             // SOFTWARE
-            QByteArray utf8Software(a_length, 0);
-            stream.readRawData(utf8Software.data(), utf8Software.size());
-            m_software = QString::fromUtf8(utf8Software);
-            m_attributes << Software;
+            m_software = QString::fromUtf8(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(Software);
 
         } else if (a_type == Username) {
 
             // USERNAME
-            QByteArray utf8Username(a_length, 0);
-            stream.readRawData(utf8Username.data(), utf8Username.size());
-            m_username = QString::fromUtf8(utf8Username);
-            m_attributes << Username;
+            m_username = QString::fromUtf8(reinterpret_cast<const char *>(value), a_length);
+            m_attributes |= attributeFlag(Username);
 
         } else if (a_type == MappedAddress) {
 
             // MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, mappedHost, mappedPort)) {
-                *errors << QLatin1String("Bad MAPPED-ADDRESS");
+            if (!decodeAddress(value, a_length, mappedHost, mappedPort)) {
+                if (errors)
+                    *errors << QLatin1String("Bad MAPPED-ADDRESS");
                 return false;
             }
 
@@ -661,54 +775,60 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANGE-REQUEST
             if (a_length != sizeof(m_changeRequest))
                 return false;
-            stream >> m_changeRequest;
-            m_attributes << ChangeRequest;
+            m_changeRequest = qFromBigEndian<quint32>(value);
+            m_attributes |= attributeFlag(ChangeRequest);
 
         } else if (a_type == SourceAddress) {
 
             // SOURCE-ADDRESS
-            if (!decodeAddress(stream, a_length, sourceHost, sourcePort)) {
-                *errors << QLatin1String("Bad SOURCE-ADDRESS");
+            if (!decodeAddress(value, a_length, sourceHost, sourcePort)) {
+                if (errors)
+                    *errors << QLatin1String("Bad SOURCE-ADDRESS");
                 return false;
             }
 
         } else if (a_type == ChangedAddress) {
 
             // CHANGED-ADDRESS
-            if (!decodeAddress(stream, a_length, changedHost, changedPort)) {
-                *errors << QLatin1String("Bad CHANGED-ADDRESS");
+            if (!decodeAddress(value, a_length, changedHost, changedPort)) {
+                if (errors)
+                    *errors << QLatin1String("Bad CHANGED-ADDRESS");
                 return false;
             }
 
         } else if (a_type == OtherAddress) {
 
             // OTHER-ADDRESS
-            if (!decodeAddress(stream, a_length, otherHost, otherPort)) {
-                *errors << QLatin1String("Bad OTHER-ADDRESS");
+            if (!decodeAddress(value, a_length, otherHost, otherPort)) {
+                if (errors)
+                    *errors << QLatin1String("Bad OTHER-ADDRESS");
                 return false;
             }
 
         } else if (a_type == XorMappedAddress) {
 
             // XOR-MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorMappedHost, xorMappedPort, m_id)) {
-                *errors << QLatin1String("Bad XOR-MAPPED-ADDRESS");
+            if (!decodeAddress(value, a_length, xorMappedHost, xorMappedPort, m_id)) {
+                if (errors)
+                    *errors << QLatin1String("Bad XOR-MAPPED-ADDRESS");
                 return false;
             }
 
         } else if (a_type == XorPeerAddress) {
 
             // XOR-PEER-ADDRESS
-            if (!decodeAddress(stream, a_length, xorPeerHost, xorPeerPort, m_id)) {
-                *errors << QLatin1String("Bad XOR-PEER-ADDRESS");
+            if (!decodeAddress(value, a_length, xorPeerHost, xorPeerPort, m_id)) {
+                if (errors)
+                    *errors << QLatin1String("Bad XOR-PEER-ADDRESS");
                 return false;
             }
 
         } else if (a_type == XorRelayedAddress) {
 
             // XOR-RELAYED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorRelayedHost, xorRelayedPort, m_id)) {
-                *errors << QLatin1String("Bad XOR-RELAYED-ADDRESS");
+            if (!decodeAddress(value, a_length, xorRelayedHost, xorRelayedPort, m_id)) {
+                if (errors)
+                    *errors << QLatin1String("Bad XOR-RELAYED-ADDRESS");
                 return false;
             }
 
@@ -717,15 +837,14 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // MESSAGE-INTEGRITY
             if (a_length != 20)
                 return false;
-            QByteArray integrity(20, 0);
-            stream.readRawData(integrity.data(), integrity.size());
-
-            // check HMAC-SHA1
-            if (!key.isEmpty()) {
-                QByteArray copy = buffer.left(STUN_HEADER + done);
-                setBodyLength(copy, done + 24);
-                if (integrity != QXmppUtils::generateHmacSha1(key, copy)) {
-                    *errors << QLatin1String("Bad message integrity");
+
+            // check HMAC-SHA1, the header must announce a body ending
+            // right after MESSAGE-INTEGRITY
+            if (integrity) {
+                const QByteArray expected = messageIntegrity(integrity, data, STUN_HEADER + done, done + 24);
+                if (memcmp(expected.constData(), value, 20) != 0) {
+                    if (errors)
+                        *errors << QLatin1String("Bad message integrity");
                     return false;
                 }
             }
@@ -738,15 +857,21 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // FINGERPRINT
             if (a_length != 4)
                 return false;
-            quint32 fingerprint;
-            stream >> fingerprint;
-
-            // check CRC32
-            QByteArray copy = buffer.left(STUN_HEADER + done);
-            setBodyLength(copy, done + 8);
-            const quint32 expected = QXmppUtils::generateCrc32(copy) ^ 0x5354554eL;
-            if (fingerprint != expected) {
-                *errors << QLatin1String("Bad fingerprint");
+            const quint32 fingerprint = qFromBigEndian<quint32>(value);
+
+            // check CRC32, FINGERPRINT is normally the last attribute so
+            // the header already announces the right length
+            quint32 expected;
+            if (done + 8 == length) {
+                expected = QXmppUtils::generateCrc32(QByteArray::fromRawData(data, STUN_HEADER + done));
+            } else {
+                QByteArray copy(data, STUN_HEADER + done);
+                setBodyLength(copy, done + 8);
+                expected = QXmppUtils::generateCrc32(copy);
+            }
+            if (fingerprint != (expected ^ 0x5354554eL)) {
+                if (errors)
+                    *errors << QLatin1String("Bad fingerprint");
                 return false;
             }
 
@@ -758,24 +883,21 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             /// ICE-CONTROLLING
             if (a_length != 8)
                 return false;
-            iceControlling.resize(a_length);
-            stream.readRawData(iceControlling.data(), iceControlling.size());
+            iceControlling = QByteArray(reinterpret_cast<const char *>(value), a_length);
 
         } else if (a_type == IceControlled) {
 
             /// ICE-CONTROLLED
             if (a_length != 8)
                 return false;
-            iceControlled.resize(a_length);
-            stream.readRawData(iceControlled.data(), iceControlled.size());
+            iceControlled = QByteArray(reinterpret_cast<const char *>(value), a_length);
 
         } else {
 
             // Unknown attribute
-            stream.skipRawData(a_length);
-            *errors << QStringLiteral("Skipping unknown attribute %1").arg(QString::number(a_type));
+            if (errors)
+                *errors << QStringLiteral("Skipping unknown attribute %1").arg(QString::number(a_type));
         }
-        stream.skipRawData(pad_length);
         done += 4 + a_length + pad_length;
     }
     return true;
@@ -790,168 +912,177 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint) const
 {
     QByteArray buffer;
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    encode(&buffer, key, addFingerprint);
+    return buffer;
+}
+
+/// Encodes the current QXmppStunMessage into the given buffer, optionally
+/// calculating the message integrity attribute using the given key.
+///
+/// The previous contents of \a buffer are replaced, but its storage is
+/// reused so that encoding successive messages into the same buffer does
+/// not allocate.
+///
+/// \param buffer
+/// \param key
+/// \param addFingerprint
+
+void QXmppStunMessage::encode(QByteArray *buffer, const QByteArray &key, bool addFingerprint) const
+{
+    if (key.isEmpty()) {
+        encode(buffer, static_cast<QMessageAuthenticationCode *>(nullptr), addFingerprint);
+    } else {
+        QMessageAuthenticationCode integrity(QCryptographicHash::Sha1, key);
+        encode(buffer, &integrity, addFingerprint);
+    }
+}
+
+/// Encodes the current QXmppStunMessage into the given buffer, optionally
+/// calculating the message integrity attribute using the given HMAC-SHA1
+/// context.
+///
+/// \param buffer
+/// \param integrity
+/// \param addFingerprint
+
+void QXmppStunMessage::encode(QByteArray *buffer, QMessageAuthenticationCode *integrity, bool addFingerprint) const
+{
+    // keep the storage when clearing the buffer
+    buffer->reserve(qMax(buffer->capacity(), 256));
+    buffer->resize(0);
 
     // encode STUN header
-    quint16 length = 0;
-    stream << m_type;
-    stream << length;
-    stream << m_cookie;
-    stream.writeRawData(m_id.data(), m_id.size());
+    appendUint16(*buffer, m_type);
+    appendUint16(*buffer, 0);
+    appendUint32(*buffer, m_cookie);
+    buffer->append(m_id);
 
     // MAPPED-ADDRESS
-    addAddress(stream, MappedAddress, mappedHost, mappedPort);
+    addAddress(*buffer, MappedAddress, mappedHost, mappedPort);
 
     // CHANGE-REQUEST
-    if (m_attributes.contains(ChangeRequest)) {
-        stream << quint16(ChangeRequest);
-        stream << quint16(sizeof(m_changeRequest));
-        stream << m_changeRequest;
+    if (m_attributes & attributeFlag(ChangeRequest)) {
+        appendUint16(*buffer, ChangeRequest);
+        appendUint16(*buffer, sizeof(m_changeRequest));
+        appendUint32(*buffer, m_changeRequest);
     }
 
     // SOURCE-ADDRESS
-    addAddress(stream, SourceAddress, sourceHost, sourcePort);
+    addAddress(*buffer, SourceAddress, sourceHost, sourcePort);
 
     // CHANGED-ADDRESS
-    addAddress(stream, ChangedAddress, changedHost, changedPort);
+    addAddress(*buffer, ChangedAddress, changedHost, changedPort);
 
     // OTHER-ADDRESS
-    addAddress(stream, OtherAddress, otherHost, otherPort);
+    addAddress(*buffer, OtherAddress, otherHost, otherPort);
 
     // XOR-MAPPED-ADDRESS
-    addAddress(stream, XorMappedAddress, xorMappedHost, xorMappedPort, m_id);
+    addAddress(*buffer, XorMappedAddress, xorMappedHost, xorMappedPort, m_id);
 
     // XOR-PEER-ADDRESS
-    addAddress(stream, XorPeerAddress, xorPeerHost, xorPeerPort, m_id);
+    addAddress(*buffer, XorPeerAddress, xorPeerHost, xorPeerPort, m_id);
 
     // XOR-RELAYED-ADDRESS
-    addAddress(stream, XorRelayedAddress, xorRelayedHost, xorRelayedPort, m_id);
+    addAddress(*buffer, XorRelayedAddress, xorRelayedHost, xorRelayedPort, m_id);
 
     // ERROR-CODE
     if (errorCode) {
-        const quint16 reserved = 0;
-        const quint8 errorCodeHigh = errorCode / 100;
-        const quint8 errorCodeLow = errorCode % 100;
         const QByteArray phrase = errorPhrase.toUtf8();
-        stream << quint16(ErrorCode);
-        stream << quint16(phrase.size() + 4);
-        stream << reserved;
-        stream << errorCodeHigh;
-        stream << errorCodeLow;
-        stream.writeRawData(phrase.data(), phrase.size());
-        if (phrase.size() % 4) {
-            const QByteArray padding(4 - (phrase.size() % 4), 0);
-            stream.writeRawData(padding.data(), padding.size());
-        }
+        appendUint16(*buffer, ErrorCode);
+        appendUint16(*buffer, phrase.size() + 4);
+        appendUint16(*buffer, 0);
+        buffer->append(char(errorCode / 100));
+        buffer->append(char(errorCode % 100));
+        buffer->append(phrase);
+        if (phrase.size() % 4)
+            buffer->append(4 - (phrase.size() % 4), '\0');
     }
 
     // PRIORITY
-    if (m_attributes.contains(Priority)) {
-        stream << quint16(Priority);
-        stream << quint16(sizeof(m_priority));
-        stream << m_priority;
+    if (m_attributes & attributeFlag(Priority)) {
+        appendUint16(*buffer, Priority);
+        appendUint16(*buffer, sizeof(m_priority));
+        appendUint32(*buffer, m_priority);
     }
 
     // USE-CANDIDATE
     if (useCandidate) {
-        stream << quint16(UseCandidate);
-        stream << quint16(0);
+        appendUint16(*buffer, UseCandidate);
+        appendUint16(*buffer, 0);
     }
 
     // CHANNEL-NUMBER
-    if (m_attributes.contains(ChannelNumber)) {
-        stream << quint16(ChannelNumber);
-        stream << quint16(4);
-        stream << m_channelNumber;
-        stream << quint16(0);
+    if (m_attributes & attributeFlag(ChannelNumber)) {
+        appendUint16(*buffer, ChannelNumber);
+        appendUint16(*buffer, 4);
+        appendUint16(*buffer, m_channelNumber);
+        appendUint16(*buffer, 0);
     }
 
     // DATA
-    if (m_attributes.contains(DataAttr)) {
-        stream << quint16(DataAttr);
-        stream << quint16(m_data.size());
-        stream.writeRawData(m_data.data(), m_data.size());
-        if (m_data.size() % 4) {
-            const QByteArray padding(4 - (m_data.size() % 4), 0);
-            stream.writeRawData(padding.data(), padding.size());
-        }
-    }
+    if (m_attributes & attributeFlag(DataAttr))
+        appendAttribute(*buffer, DataAttr, m_data.constData(), m_data.size());
 
     // LIFETIME
-    if (m_attributes.contains(Lifetime)) {
-        stream << quint16(Lifetime);
-        stream << quint16(sizeof(m_lifetime));
-        stream << m_lifetime;
+    if (m_attributes & attributeFlag(Lifetime)) {
+        appendUint16(*buffer, Lifetime);
+        appendUint16(*buffer, sizeof(m_lifetime));
+        appendUint32(*buffer, m_lifetime);
     }
 
     // NONCE
-    if (m_attributes.contains(Nonce)) {
-        stream << quint16(Nonce);
-        stream << quint16(m_nonce.size());
-        stream.writeRawData(m_nonce.data(), m_nonce.size());
-    }
+    if (m_attributes & attributeFlag(Nonce))
+        appendAttribute(*buffer, Nonce, m_nonce.constData(), m_nonce.size());
 
     // REALM
-    if (m_attributes.contains(Realm))
-        encodeString(stream, Realm, m_realm);
+    if (m_attributes & attributeFlag(Realm))
+        encodeString(*buffer, Realm, m_realm);
 
     // REQUESTED-TRANSPORT
-    if (m_attributes.contains(RequestedTransport)) {
-        const QByteArray reserved(3, 0);
-        stream << quint16(RequestedTransport);
-        stream << quint16(4);
-        stream << m_requestedTransport;
-        stream.writeRawData(reserved.data(), reserved.size());
+    if (m_attributes & attributeFlag(RequestedTransport)) {
+        appendUint16(*buffer, RequestedTransport);
+        appendUint16(*buffer, 4);
+        buffer->append(char(m_requestedTransport));
+        buffer->append(3, '\0');
     }
 
     // RESERVATION-TOKEN
-    if (m_attributes.contains(ReservationToken)) {
-        stream << quint16(ReservationToken);
-        stream << quint16(m_reservationToken.size());
-        stream.writeRawData(m_reservationToken.data(), m_reservationToken.size());
-    }
+    if (m_attributes & attributeFlag(ReservationToken))
+        appendAttribute(*buffer, ReservationToken, m_reservationToken.constData(), m_reservationToken.size());
 
     // SOFTWARE
-    if (m_attributes.contains(Software))
-        encodeString(stream, Software, m_software);
+    if (m_attributes & attributeFlag(Software))
+        encodeString(*buffer, Software, m_software);
 
     // USERNAME
-    if (m_attributes.contains(Username))
-        encodeString(stream, Username, m_username);
+    if (m_attributes & attributeFlag(Username))
+        encodeString(*buffer, Username, m_username);
 
     // ICE-CONTROLLING or ICE-CONTROLLED
-    if (!iceControlling.isEmpty()) {
-        stream << quint16(IceControlling);
-        stream << quint16(iceControlling.size());
-        stream.writeRawData(iceControlling.data(), iceControlling.size());
-    } else if (!iceControlled.isEmpty()) {
-        stream << quint16(IceControlled);
-        stream << quint16(iceControlled.size());
-        stream.writeRawData(iceControlled.data(), iceControlled.size());
-    }
+    if (!iceControlling.isEmpty())
+        appendAttribute(*buffer, IceControlling, iceControlling.constData(), iceControlling.size());
+    else if (!iceControlled.isEmpty())
+        appendAttribute(*buffer, IceControlled, iceControlled.constData(), iceControlled.size());
 
     // set body length
-    setBodyLength(buffer, buffer.size() - STUN_HEADER);
+    setBodyLength(*buffer, buffer->size() - STUN_HEADER);
 
     // MESSAGE-INTEGRITY
-    if (!key.isEmpty()) {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 24);
-        QByteArray integrity = QXmppUtils::generateHmacSha1(key, buffer);
-        stream << quint16(MessageIntegrity);
-        stream << quint16(integrity.size());
-        stream.writeRawData(integrity.data(), integrity.size());
+    if (integrity) {
+        const quint16 length = buffer->size() - STUN_HEADER + 24;
+        const QByteArray hmac = messageIntegrity(integrity, buffer->constData(), buffer->size(), length);
+        setBodyLength(*buffer, length);
+        appendAttribute(*buffer, MessageIntegrity, hmac.constData(), hmac.size());
     }
 
     // FINGERPRINT
     if (addFingerprint) {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 8);
-        quint32 fingerprint = QXmppUtils::generateCrc32(buffer) ^ 0x5354554eL;
-        stream << quint16(Fingerprint);
-        stream << quint16(sizeof(fingerprint));
-        stream << fingerprint;
+        setBodyLength(*buffer, buffer->size() - STUN_HEADER + 8);
+        const quint32 fingerprint = QXmppUtils::generateCrc32(*buffer) ^ 0x5354554eL;
+        appendUint16(*buffer, Fingerprint);
+        appendUint16(*buffer, sizeof(fingerprint));
+        appendUint32(*buffer, fingerprint);
     }
-
-    return buffer;
 }
 
 /// If the given packet looks like a STUN message, returns the message
@@ -967,18 +1098,15 @@ quint16 QXmppStunMessage::peekType(const QByteArray &buffer, quint32 &cookie, QB
         return 0;
 
     // parse STUN header
-    QDataStream stream(buffer);
-    quint16 type;
-    quint16 length;
-    stream >> type;
-    stream >> length;
-    stream >> cookie;
+    const auto *ptr = reinterpret_cast<const uchar *>(buffer.constData());
+    const quint16 type = qFromBigEndian<quint16>(ptr);
+    const quint16 length = qFromBigEndian<quint16>(ptr + 2);
+    cookie = qFromBigEndian<quint32>(ptr + 4);
 
     if (length != buffer.size() - STUN_HEADER)
         return 0;
 
-    id.resize(STUN_ID_SIZE);
-    stream.readRawData(id.data(), id.size());
+    id = buffer.mid(8, STUN_ID_SIZE);
     return type;
 }
 
@@ -1037,29 +1165,29 @@ QString QXmppStunMessage::toString() const
     dumpLines << QStringLiteral(" id %1").arg(QString::fromLatin1(m_id.toHex()));
 
     // attributes
-    if (m_attributes.contains(ChannelNumber))
+    if (m_attributes & attributeFlag(ChannelNumber))
         dumpLines << QStringLiteral(" * CHANNEL-NUMBER %1").arg(QString::number(m_channelNumber));
     if (errorCode)
         dumpLines << QStringLiteral(" * ERROR-CODE %1 %2")
                          .arg(QString::number(errorCode), errorPhrase);
-    if (m_attributes.contains(Lifetime))
+    if (m_attributes & attributeFlag(Lifetime))
         dumpLines << QStringLiteral(" * LIFETIME %1").arg(QString::number(m_lifetime));
-    if (m_attributes.contains(Nonce))
+    if (m_attributes & attributeFlag(Nonce))
         dumpLines << QStringLiteral(" * NONCE %1").arg(QString::fromLatin1(m_nonce));
-    if (m_attributes.contains(Realm))
+    if (m_attributes & attributeFlag(Realm))
         dumpLines << QStringLiteral(" * REALM %1").arg(m_realm);
-    if (m_attributes.contains(RequestedTransport))
+    if (m_attributes & attributeFlag(RequestedTransport))
         dumpLines << QStringLiteral(" * REQUESTED-TRANSPORT 0x%1").arg(QString::number(m_requestedTransport, 16));
-    if (m_attributes.contains(ReservationToken))
+    if (m_attributes & attributeFlag(ReservationToken))
         dumpLines << QStringLiteral(" * RESERVATION-TOKEN %1").arg(QString::fromLatin1(m_reservationToken.toHex()));
-    if (m_attributes.contains(Software))
+    if (m_attributes & attributeFlag(Software))
         dumpLines << QStringLiteral(" * SOFTWARE %1").arg(m_software);
-    if (m_attributes.contains(Username))
+    if (m_attributes & attributeFlag(Username))
         dumpLines << QStringLiteral(" * USERNAME %1").arg(m_username);
     if (mappedPort)
         dumpLines << QStringLiteral(" * MAPPED-ADDRESS %1 %2")
                          .arg(mappedHost.toString(), QString::number(mappedPort));
-    if (m_attributes.contains(ChangeRequest))
+    if (m_attributes & attributeFlag(ChangeRequest))
         dumpLines << QStringLiteral(" * CHANGE-REQUEST %1")
                          .arg(QString::number(m_changeRequest));
     if (sourcePort)
@@ -1080,7 +1208,7 @@ QString QXmppStunMessage::toString() const
     if (xorRelayedPort)
         dumpLines << QStringLiteral(" * XOR-RELAYED-ADDRESS %1 %2")
                          .arg(xorRelayedHost.toString(), QString::number(xorRelayedPort));
-    if (m_attributes.contains(Priority))
+    if (m_attributes & attributeFlag(Priority))
         dumpLines << QStringLiteral(" * PRIORITY %1").arg(QString::number(m_priority));
     if (!iceControlling.isEmpty())
         dumpLines << QStringLiteral(" * ICE-CONTROLLING %1")
@@ -1174,6 +1302,7 @@ QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
       m_turnPort(0),
       m_channelNumber(0x4000),
       m_lifetime(600),
+      m_integrity(QCryptographicHash::Sha1),
       m_state(UnconnectedState)
 {
 
@@ -1192,6 +1321,9 @@ QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
     m_channelTimer->setInterval(500 * 1000);
     connect(m_channelTimer, &QTimer::timeout,
             this, &QXmppTurnAllocation::refreshChannels);
+
+    // reserve the read buffer so that relaying data does not allocate
+    m_readBuffer.reserve(udpBufferSize);
 }
 
 /// Destroys the TURN allocation.
@@ -1238,6 +1370,7 @@ void QXmppTurnAllocation::disconnectFromHost()
 
     // clear channels and any outstanding transactions
     m_channels.clear();
+    m_channelsByAddress.clear();
     for (auto *transaction : m_transactions)
         delete transaction;
     m_transactions.clear();
@@ -1278,28 +1411,32 @@ QXmppJingleCandidate QXmppTurnAllocation::localCandidate(int component) const
 
 void QXmppTurnAllocation::readyRead()
 {
-    QByteArray buffer;
     QHostAddress remoteHost;
     quint16 remotePort;
     while (socket->hasPendingDatagrams()) {
         const qint64 size = socket->pendingDatagramSize();
-        buffer.resize(size);
-        socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        handleDatagram(buffer, remoteHost, remotePort);
+        m_readBuffer.resize(size);
+        socket->readDatagram(m_readBuffer.data(), m_readBuffer.size(), &remoteHost, &remotePort);
+        handleDatagram(m_readBuffer, remoteHost, remotePort);
     }
 }
 
-void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
+void QXmppTurnAllocation::handleDatagram(QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
 {
     // demultiplex channel data
     if (buffer.size() >= 4 && (buffer[0] & 0xc0) == 0x40) {
-        QDataStream stream(buffer);
-        quint16 channel, length;
-        stream >> channel;
-        stream >> length;
-        if (m_state == ConnectedState && m_channels.contains(channel) && length <= buffer.size() - 4) {
-            emit datagramReceived(buffer.mid(4, length), m_channels[channel].first,
-                                  m_channels[channel].second);
+        const auto *header = reinterpret_cast<const uchar *>(buffer.constData());
+        const quint16 channel = qFromBigEndian<quint16>(header);
+        const quint16 length = qFromBigEndian<quint16>(header + 2);
+        const auto it = m_channels.constFind(channel);
+        if (m_state == ConnectedState && it != m_channels.constEnd() && length <= buffer.size() - 4) {
+            // copy the peer address, receivers may bind new channels
+            const Address peer = it.value();
+
+            // strip the header in place, dropping any padding
+            buffer.truncate(4 + length);
+            buffer.remove(0, 4);
+            emit datagramReceived(buffer, peer.first, peer.second);
         }
         return;
     }
@@ -1344,16 +1481,16 @@ void QXmppTurnAllocation::refresh()
 
 void QXmppTurnAllocation::refreshChannels()
 {
-    for (const auto &channel : m_channels.keys()) {
+    for (auto it = m_channels.constBegin(); it != m_channels.constEnd(); ++it) {
         QXmppStunMessage request;
         request.setType(QXmppStunMessage::ChannelBind | QXmppStunMessage::Request);
         request.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
         request.setNonce(m_nonce);
         request.setRealm(m_realm);
         request.setUsername(m_username);
-        request.setChannelNumber(channel);
-        request.xorPeerHost = m_channels[channel].first;
-        request.xorPeerPort = m_channels[channel].second;
+        request.setChannelNumber(it.key());
+        request.xorPeerHost = it.value().first;
+        request.xorPeerPort = it.value().second;
         m_transactions << new QXmppStunTransaction(request, this);
     }
 }
@@ -1442,6 +1579,7 @@ void QXmppTurnAllocation::transactionFinished()
         QCryptographicHash hash(QCryptographicHash::Md5);
         hash.addData((m_username + ":" + m_realm + ":" + m_password).toUtf8());
         m_key = hash.result();
+        m_integrity.setKey(m_key);
 
         // retry request
         QXmppStunMessage request(transaction->request());
@@ -1485,7 +1623,7 @@ void QXmppTurnAllocation::transactionFinished()
             warning(QStringLiteral("ChannelBind failed: %1 %2").arg(QString::number(reply.errorCode), reply.errorPhrase));
 
             // remove channel
-            m_channels.remove(transaction->request().channelNumber());
+            m_channelsByAddress.remove(m_channels.take(transaction->request().channelNumber()));
             if (m_channels.isEmpty())
                 m_channelTimer->stop();
             return;
@@ -1515,12 +1653,17 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
     if (m_state != ConnectedState)
         return -1;
 
+    // ChannelData frames carry a 16-bit length
+    if (data.size() > 0xffff)
+        return -1;
+
     const Address addr = qMakePair(host, port);
-    quint16 channel = m_channels.key(addr);
+    quint16 channel = m_channelsByAddress.value(addr);
 
     if (!channel) {
         channel = m_channelNumber++;
         m_channels.insert(channel, addr);
+        m_channelsByAddress.insert(addr, channel);
 
         // bind channel
         QXmppStunMessage request;
@@ -1539,14 +1682,15 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
             m_channelTimer->start();
     }
 
-    // send data
-    QByteArray channelData;
-    channelData.reserve(4 + data.size());
-    QDataStream stream(&channelData, QIODevice::WriteOnly);
-    stream << channel;
-    stream << quint16(data.size());
-    stream.writeRawData(data.data(), data.size());
-    if (socket->writeDatagram(channelData, m_turnHost, m_turnPort) == channelData.size())
+    // frame data as ChannelData, media is written from GStreamer's streaming
+    // threads so each thread reuses its own buffer
+    static thread_local QByteArray channelBuffer;
+    channelBuffer.resize(4 + data.size());
+    auto *header = reinterpret_cast<uchar *>(channelBuffer.data());
+    qToBigEndian<quint16>(channel, header);
+    qToBigEndian<quint16>(quint16(data.size()), header + 2);
+    memcpy(header + 4, data.constData(), data.size());
+    if (socket->writeDatagram(channelBuffer, m_turnHost, m_turnPort) == channelBuffer.size())
         return data.size();
     else
         return -1;
@@ -1554,7 +1698,8 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
 
 void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 {
-    socket->writeDatagram(message.encode(m_key), m_turnHost, m_turnPort);
+    message.encode(&m_stunBuffer, m_key.isEmpty() ? nullptr : &m_integrity);
+    socket->writeDatagram(m_stunBuffer, m_turnHost, m_turnPort);
 #ifdef QXMPP_DEBUG_STUN
     logSent(QStringLiteral("TURN packet to %1 port %2\n%3").arg(m_turnHost.toString(), QString::number(m_turnPort), message.toString()));
 #endif
@@ -1599,17 +1744,111 @@ QXmppJingleCandidate QXmppUdpTransport::localCandidate(int component) const
     return candidate;
 }
 
+#ifdef Q_OS_LINUX
+static bool fromSockAddr(const sockaddr_storage &storage, QHostAddress &host, quint16 &port)
+{
+    if (storage.ss_family == AF_INET) {
+        const auto &addr = reinterpret_cast<const sockaddr_in &>(storage);
+        host.setAddress(ntohl(addr.sin_addr.s_addr));
+        port = ntohs(addr.sin_port);
+    } else if (storage.ss_family == AF_INET6) {
+        const auto &addr = reinterpret_cast<const sockaddr_in6 &>(storage);
+        Q_IPV6ADDR ip6;
+        memcpy(&ip6, &addr.sin6_addr, sizeof(ip6));
+        host.setAddress(ip6);
+        if (addr.sin6_scope_id)
+            host.setScopeId(QNetworkInterface::interfaceNameFromIndex(addr.sin6_scope_id));
+        port = ntohs(addr.sin6_port);
+    } else {
+        return false;
+    }
+    return true;
+}
+#endif
+
 void QXmppUdpTransport::readyRead()
 {
-    QByteArray buffer;
+    // a regular read lets QUdpSocket re-arm its notifier
+    if (m_socket->hasPendingDatagrams())
+        readDatagram();
+
+    // drain the remaining datagrams, the notifier fires again if some are
+    // still pending after the last batch
+    for (int i = 0; i < udpMaximumBatches && readBatch() == udpBatchSize; ++i) {
+    }
+}
+
+// Reads up to udpBatchSize pending datagrams and returns how many were read.
+int QXmppUdpTransport::readBatch()
+{
+    if (!m_socket->isOpen())
+        return 0;
+
+#ifdef Q_OS_LINUX
+    const int fd = int(m_socket->socketDescriptor());
+    if (fd < 0)
+        return 0;
+
+    mmsghdr messages[udpBatchSize];
+    iovec vectors[udpBatchSize];
+    sockaddr_storage addresses[udpBatchSize];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < udpBatchSize; ++i) {
+        if (m_buffers.size() <= i) {
+            m_buffers << QByteArray();
+            m_buffers.last().reserve(udpBufferSize);
+        }
+        QByteArray &buffer = m_buffers[i];
+        buffer.resize(udpBufferSize);
+
+        vectors[i].iov_base = buffer.data();
+        vectors[i].iov_len = udpBufferSize;
+        messages[i].msg_hdr.msg_name = &addresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const int count = ::recvmmsg(fd, messages, udpBatchSize, MSG_DONTWAIT, nullptr);
+    if (count <= 0)
+        return 0;
+
     QHostAddress remoteHost;
     quint16 remotePort;
-    while (m_socket->hasPendingDatagrams()) {
-        const qint64 size = m_socket->pendingDatagramSize();
-        buffer.resize(size);
-        m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
+    for (int i = 0; i < count; ++i) {
+        if (!fromSockAddr(addresses[i], remoteHost, remotePort))
+            continue;
+
+        QByteArray &buffer = m_buffers[i];
+        buffer.resize(messages[i].msg_len);
         emit datagramReceived(buffer, remoteHost, remotePort);
+
+        // do not recycle a buffer which a receiver kept a reference to
+        if (!buffer.isDetached()) {
+            buffer = QByteArray();
+            buffer.reserve(udpBufferSize);
+        }
     }
+    return count;
+#else
+    int count = 0;
+    while (count < udpBatchSize && m_socket->hasPendingDatagrams() && readDatagram())
+        ++count;
+    return count;
+#endif
+}
+
+// Reads the next pending datagram. Returns false on error.
+bool QXmppUdpTransport::readDatagram()
+{
+    QByteArray buffer(int(qMax<qint64>(0, m_socket->pendingDatagramSize())), Qt::Uninitialized);
+    QHostAddress remoteHost;
+    quint16 remotePort;
+    if (m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort) < 0)
+        return false;
+
+    emit datagramReceived(buffer, remoteHost, remotePort);
+    return true;
 }
 
 qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
@@ -1638,6 +1877,7 @@ public:
 
     bool nominated;
     bool nominating;
+    QString foundation;
     QXmppJingleCandidate remote;
     QXmppJingleCandidate reflexive;
     QXmppIceTransport *transport;
@@ -1655,7 +1895,7 @@ static bool candidatePairPtrLessThan(const CandidatePair *p1, const CandidatePai
 }
 
 CandidatePair::CandidatePair(int component, bool controlling, QObject *parent)
-    : QXmppLoggable(parent), nominated(false), nominating(false), transport(nullptr), transaction(nullptr), m_component(component), m_controlling(controlling), m_state(WaitingState)
+    : QXmppLoggable(parent), nominated(false), nominating(false), transport(nullptr), transaction(nullptr), m_component(component), m_controlling(controlling), m_state(FrozenState)
 {
 }
 
@@ -1697,7 +1937,9 @@ class QXmppIcePrivate
 {
 public:
     QXmppIcePrivate();
+    QMessageAuthenticationCode *integrity(bool local) const;
 
+    bool aggressiveNomination;
     bool iceControlling;
     QString localUser;
     QString localPassword;
@@ -1705,29 +1947,57 @@ public:
     QString remotePassword;
     QList<QPair<QHostAddress, quint16>> stunServers;
     QByteArray tieBreaker;
+
+    // the checklist spans all components
+    QMap<int, QXmppIceComponent *> components;
+    QElapsedTimer checkClock;
+
+    // HMAC-SHA1 contexts for the local and remote passwords
+    mutable QMessageAuthenticationCode localIntegrity;
+    mutable QMessageAuthenticationCode remoteIntegrity;
 };
 
 QXmppIcePrivate::QXmppIcePrivate()
-    : iceControlling(false)
+    : aggressiveNomination(true),
+      iceControlling(false),
+      localIntegrity(QCryptographicHash::Sha1),
+      remoteIntegrity(QCryptographicHash::Sha1)
 {
     localUser = QXmppUtils::generateStanzaHash(4);
     localPassword = QXmppUtils::generateStanzaHash(22);
+    localIntegrity.setKey(localPassword.toUtf8());
     tieBreaker = QXmppUtils::generateRandomBytes(8);
 }
 
+// Returns the context used to compute MESSAGE-INTEGRITY with the local or
+// remote password, or null if that password is not known.
+QMessageAuthenticationCode *QXmppIcePrivate::integrity(bool local) const
+{
+    if (local)
+        return localPassword.isEmpty() ? nullptr : &localIntegrity;
+    else
+        return remotePassword.isEmpty() ? nullptr : &remoteIntegrity;
+}
+
 struct QXmppIceTransportDetails {
     QXmppIceTransport *transport;
     QHostAddress stunHost;
     quint16 stunPort;
 };
 
+// A remote transport address as seen from one of our transports.
+typedef QPair<QXmppIceTransport *, QPair<QHostAddress, quint16>> QXmppIcePairAddress;
+
 class QXmppIceComponentPrivate
 {
 public:
     QXmppIceComponentPrivate(int component, QXmppIcePrivate *config, QXmppIceComponent *qq);
     bool addRemoteCandidate(const QXmppJingleCandidate &candidate);
+    void addPair(CandidatePair *pair);
     CandidatePair *findPair(QXmppStunTransaction *transaction);
     void performCheck(CandidatePair *pair, bool nominate);
+    void unfreeze(const QString &foundation);
+    void updateNomination();
     void setSockets(QList<QUdpSocket *> sockets);
     void setTurnServer(const QHostAddress &host, quint16 port);
     void setTurnUser(const QString &user);
@@ -1747,11 +2017,20 @@ public:
     QList<QXmppJingleCandidate> remoteCandidates;
 
     QList<CandidatePair *> pairs;
+    QHash<QXmppIcePairAddress, CandidatePair *> pairsByAddress;
+    QHash<QByteArray, CandidatePair *> pairsByTransactionId;
     QList<QXmppIceTransport *> transports;
-    QTimer *timer;
+
+    // connectivity checks
+    bool checking;
+    qint64 validTime;
 
     // STUN server
     QMap<QXmppStunTransaction *, QXmppIceTransportDetails> stunTransactions;
+    QHash<QByteArray, QXmppStunTransaction *> stunTransactionsById;
+
+    // reused to encode outgoing STUN messages
+    QByteArray stunBuffer;
 
     // TURN server
     QXmppTurnAllocation *turnAllocation;
@@ -1762,7 +2041,7 @@ private:
 };
 
 QXmppIceComponentPrivate::QXmppIceComponentPrivate(int component_, QXmppIcePrivate *config_, QXmppIceComponent *qq)
-    : activePair(nullptr), component(component_), config(config_), fallbackPair(nullptr), gatheringState(QXmppIceConnection::NewGatheringState), peerReflexivePriority(0), timer(nullptr), turnAllocation(nullptr), turnConfigured(false), q(qq)
+    : activePair(nullptr), component(component_), config(config_), fallbackPair(nullptr), gatheringState(QXmppIceConnection::NewGatheringState), peerReflexivePriority(0), checking(false), validTime(-1), turnAllocation(nullptr), turnConfigured(false), q(qq)
 {
 }
 
@@ -1791,7 +2070,7 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
         auto *pair = new CandidatePair(component, config->iceControlling, q);
         pair->remote = candidate;
         pair->transport = transport;
-        pairs << pair;
+        addPair(pair);
 
         if (!fallbackPair && local.type() == QXmppJingleCandidate::HostType)
             fallbackPair = pair;
@@ -1802,13 +2081,17 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
     return true;
 }
 
+void QXmppIceComponentPrivate::addPair(CandidatePair *pair)
+{
+    pair->foundation = pair->transport->localCandidate(component).foundation() + QLatin1Char(':') + pair->remote.foundation();
+    pairs << pair;
+    pairsByAddress.insert(qMakePair(pair->transport, qMakePair(pair->remote.host(), pair->remote.port())), pair);
+}
+
 CandidatePair *QXmppIceComponentPrivate::findPair(QXmppStunTransaction *transaction)
 {
-    for (auto *pair : pairs) {
-        if (pair->transaction == transaction)
-            return pair;
-    }
-    return nullptr;
+    CandidatePair *pair = pairsByTransactionId.value(transaction->request().id());
+    return (pair && pair->transaction == transaction) ? pair : nullptr;
 }
 
 void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
@@ -1820,13 +2103,53 @@ void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
     message.setUsername(QStringLiteral("%1:%2").arg(config->remoteUser, config->localUser));
     if (config->iceControlling) {
         message.iceControlling = config->tieBreaker;
-        message.useCandidate = true;
+        message.useCandidate = nominate;
     } else {
         message.iceControlled = config->tieBreaker;
     }
     pair->nominating = nominate;
     pair->setState(CandidatePair::InProgressState);
+    if (pair->transaction)
+        pairsByTransactionId.remove(pair->transaction->request().id());
     pair->transaction = new QXmppStunTransaction(message, q);
+    pairsByTransactionId.insert(message.id(), pair);
+}
+
+// Unfreezes the pairs with the given foundation in all components,
+// see RFC 8445 - 7.2.5.3.3. Updating Candidate Pair States
+void QXmppIceComponentPrivate::unfreeze(const QString &foundation)
+{
+    for (auto *socket : config->components) {
+        for (auto *pair : qAsConst(socket->d->pairs)) {
+            if (pair->state() == CandidatePair::FrozenState && pair->foundation == foundation)
+                pair->setState(CandidatePair::WaitingState);
+        }
+    }
+}
+
+// With regular nomination, the controlling agent nominates the best valid
+// pair once no pair of higher priority can still succeed, or once those
+// pairs have had ICE_NOMINATION_TIMEOUT to do so.
+void QXmppIceComponentPrivate::updateNomination()
+{
+    if (!checking || !config->iceControlling || config->aggressiveNomination || validTime < 0)
+        return;
+
+    for (auto *pair : qAsConst(pairs)) {
+        if (pair->nominated || (pair->nominating && pair->state() == CandidatePair::InProgressState))
+            return;
+    }
+
+    bool pending = false;
+    for (auto *pair : qAsConst(pairs)) {
+        if (pair->state() == CandidatePair::SucceededState) {
+            if (!pending || config->checkClock.elapsed() - validTime >= ICE_NOMINATION_TIMEOUT)
+                performCheck(pair, true);
+            return;
+        } else if (pair->state() != CandidatePair::FailedState) {
+            pending = true;
+        }
+    }
 }
 
 void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
@@ -1835,6 +2158,9 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
     // clear previous candidates and sockets
     localCandidates.clear();
     qDeleteAll(pairs);
+    pairs.clear();
+    pairsByAddress.clear();
+    pairsByTransactionId.clear();
     for (auto *transport : transports)
         if (transport != turnAllocation)
             delete transport;
@@ -1856,6 +2182,7 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
 
     // start STUN checks
     stunTransactions.clear();
+    stunTransactionsById.clear();
     for (auto &stunServer : config->stunServers) {
         QXmppStunMessage request;
         request.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
@@ -1868,6 +2195,7 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
             request.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
             auto *transaction = new QXmppStunTransaction(request, q);
             stunTransactions.insert(transaction, { transport, stunServer.first, stunServer.second });
+            stunTransactionsById.insert(request.id(), transaction);
         }
     }
 
@@ -1898,9 +2226,8 @@ void QXmppIceComponentPrivate::setTurnPassword(const QString &password)
 
 void QXmppIceComponentPrivate::writeStun(const QXmppStunMessage &message, QXmppIceTransport *transport, const QHostAddress &address, quint16 port)
 {
-    const QString messagePassword = (message.type() & 0xFF00) ? config->localPassword : config->remotePassword;
-    const QByteArray data = message.encode(messagePassword.toUtf8());
-    transport->writeDatagram(data, address, port);
+    message.encode(&stunBuffer, config->integrity(message.type() & 0xFF00));
+    transport->writeDatagram(stunBuffer, address, port);
 #ifdef QXMPP_DEBUG_STUN
     q->logSent(QStringLiteral("STUN packet to %1 port %2\n%3").arg(address.toString(), QString::number(port), message.toString()));
 #endif
@@ -1916,11 +2243,6 @@ QXmppIceComponent::QXmppIceComponent(int component, QXmppIcePrivate *config, QOb
 
     d = new QXmppIceComponentPrivate(component, config, this);
 
-    d->timer = new QTimer(this);
-    d->timer->setInterval(500);
-    connect(d->timer, &QTimer::timeout,
-            this, &QXmppIceComponent::checkCandidates);
-
     d->turnAllocation = new QXmppTurnAllocation(this);
     connect(d->turnAllocation, &QXmppTurnAllocation::connected,
             this, &QXmppIceComponent::turnConnected);
@@ -1955,20 +2277,6 @@ int QXmppIceComponent::component() const
     return d->component;
 }
 
-void QXmppIceComponent::checkCandidates()
-{
-    if (d->config->remoteUser.isEmpty())
-        return;
-    debug(QStringLiteral("Checking remote candidates"));
-
-    for (auto *pair : d->pairs) {
-        if (pair->state() == CandidatePair::WaitingState) {
-            d->performCheck(pair, d->config->iceControlling);
-            break;
-        }
-    }
-}
-
 /// Stops ICE connectivity checks and closes the underlying sockets.
 
 void QXmppIceComponent::close()
@@ -1976,19 +2284,20 @@ void QXmppIceComponent::close()
     for (auto *transport : d->transports)
         transport->disconnectFromHost();
     d->turnAllocation->disconnectFromHost();
-    d->timer->stop();
+    d->checking = false;
     d->activePair = nullptr;
 }
 
 /// Starts ICE connectivity checks.
+///
+/// The checks themselves are paced by the QXmppIceConnection.
 
 void QXmppIceComponent::connectToHost()
 {
     if (d->activePair)
         return;
 
-    checkCandidates();
-    d->timer->start();
+    d->checking = true;
 }
 
 /// Returns true if ICE negotiation completed, false otherwise.
@@ -2005,51 +2314,74 @@ QList<QXmppJingleCandidate> QXmppIceComponent::localCandidates() const
     return d->localCandidates;
 }
 
+/// Returns the local candidate of the selected pair, or a null candidate
+/// if ICE negotiation did not complete.
+///
+/// \since QXmpp 1.4
+
+QXmppJingleCandidate QXmppIceComponent::selectedLocalCandidate() const
+{
+    if (!d->activePair)
+        return QXmppJingleCandidate();
+    return d->activePair->transport->localCandidate(d->component);
+}
+
+/// Returns the remote candidate of the selected pair, or a null candidate
+/// if ICE negotiation did not complete.
+///
+/// \since QXmpp 1.4
+
+QXmppJingleCandidate QXmppIceComponent::selectedRemoteCandidate() const
+{
+    if (!d->activePair)
+        return QXmppJingleCandidate();
+    return d->activePair->remote;
+}
+
 void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
 {
     auto *transport = qobject_cast<QXmppIceTransport *>(sender());
     if (!transport)
         return;
 
+    // once a pair is selected, pass media through without looking any
+    // further: the first two bits of a STUN message are zero, whereas
+    // those of an RTP or RTCP packet hold the version (RFC 7983)
+    if (d->activePair && !buffer.isEmpty() && (quint8(buffer.at(0)) & 0xc0)) {
+        emit datagramReceived(buffer);
+        return;
+    }
+
     // if this is not a STUN message, emit it
     quint32 messageCookie;
     QByteArray messageId;
     quint16 messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
     if (!messageType || messageCookie != STUN_MAGIC) {
         // use this as an opportunity to flag a potential pair
-        for (auto *pair : d->pairs) {
-            if (pair->remote.host() == remoteHost &&
-                pair->remote.port() == remotePort) {
-                d->fallbackPair = pair;
-                break;
-            }
-        }
+        CandidatePair *pair = d->pairsByAddress.value(qMakePair(transport, qMakePair(remoteHost, remotePort)));
+        if (pair)
+            d->fallbackPair = pair;
         emit datagramReceived(buffer);
         return;
     }
 
     // check if it's STUN
-    QXmppStunTransaction *stunTransaction = nullptr;
-    for (auto *t : d->stunTransactions.keys()) {
-        if (t->request().id() == messageId &&
-            d->stunTransactions.value(t).transport == transport) {
-            stunTransaction = t;
-            break;
-        }
-    }
+    QXmppStunTransaction *stunTransaction = d->stunTransactionsById.value(messageId);
+    if (stunTransaction && d->stunTransactions.value(stunTransaction).transport != transport)
+        stunTransaction = nullptr;
 
     // determine password to use
-    QString messagePassword;
+    QMessageAuthenticationCode *messageIntegrity = nullptr;
     if (!stunTransaction) {
-        messagePassword = (messageType & 0xFF00) ? d->config->remotePassword : d->config->localPassword;
-        if (messagePassword.isEmpty())
+        messageIntegrity = d->config->integrity(!(messageType & 0xFF00));
+        if (!messageIntegrity)
             return;
     }
 
     // parse STUN message
     QXmppStunMessage message;
     QStringList errors;
-    if (!message.decode(buffer, messagePassword.toUtf8(), &errors)) {
+    if (!message.decode(buffer.constData(), buffer.size(), messageIntegrity, &errors)) {
         for (const auto &error : errors)
             warning(error);
         return;
@@ -2113,17 +2445,12 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         }
 
         // construct pair
-        for (auto *ptr : d->pairs) {
-            if (ptr->transport == transport && ptr->remote.host() == remoteHost && ptr->remote.port() == remotePort) {
-                pair = ptr;
-                break;
-            }
-        }
+        pair = d->pairsByAddress.value(qMakePair(transport, qMakePair(remoteHost, remotePort)));
         if (!pair) {
             pair = new CandidatePair(d->component, d->config->iceControlling, this);
             pair->remote = remoteCandidate;
             pair->transport = transport;
-            d->pairs << pair;
+            d->addPair(pair);
 
             std::sort(d->pairs.begin(), d->pairs.end(), candidatePairPtrLessThan);
         }
@@ -2134,7 +2461,7 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         case CandidatePair::FailedState:
             // send a triggered connectivity test
             if (!d->config->remoteUser.isEmpty())
-                d->performCheck(pair, pair->nominating || d->config->iceControlling || message.useCandidate);
+                d->performCheck(pair, pair->nominating || (d->config->iceControlling && d->config->aggressiveNomination) || message.useCandidate);
             break;
         case CandidatePair::InProgressState:
             // FIXME: force retransmit now
@@ -2149,12 +2476,7 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     } else if (message.messageClass() == QXmppStunMessage::Response || message.messageClass() == QXmppStunMessage::Error) {
 
         // find the pair for this transaction
-        for (auto *ptr : d->pairs) {
-            if (ptr->transaction && ptr->transaction->request().id() == message.id()) {
-                pair = ptr;
-                break;
-            }
-        }
+        pair = d->pairsByTransactionId.value(message.id());
         if (!pair)
             return;
 
@@ -2172,7 +2494,7 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
 
     // signal completion
     if (pair && pair->nominated) {
-        d->timer->stop();
+        d->checking = false;
         if (!d->activePair || pair->priority() > d->activePair->priority()) {
             info(QStringLiteral("ICE pair selected %1 (priority: %2)").arg(pair->toString(), QString::number(pair->priority())));
             const bool wasConnected = (d->activePair != nullptr);
@@ -2204,11 +2526,16 @@ void QXmppIceComponent::transactionFinished()
                 // outgoing media can flow
                 pair->nominated = true;
             }
+            if (d->validTime < 0)
+                d->validTime = d->config->checkClock.isValid() ? d->config->checkClock.elapsed() : 0;
+            d->unfreeze(pair->foundation);
         } else {
             debug(QStringLiteral("ICE forward check failed %1 (error %2)").arg(pair->toString(), transaction->response().errorPhrase));
             pair->setState(CandidatePair::FailedState);
         }
+        d->pairsByTransactionId.remove(transaction->request().id());
         pair->transaction = nullptr;
+        d->updateNomination();
         return;
     }
 
@@ -2261,6 +2588,7 @@ void QXmppIceComponent::transactionFinished()
             debug(QStringLiteral("STUN test failed (error %1)").arg(transaction->response().errorPhrase));
         }
         d->stunTransactions.remove(transaction);
+        d->stunTransactionsById.remove(transaction->request().id());
         updateGatheringState();
         return;
     }
@@ -2274,6 +2602,20 @@ void QXmppIceComponent::turnConnected()
     debug(QStringLiteral("Adding relayed candidate %1 port %2").arg(candidate.host().toString(), QString::number(candidate.port())));
     d->localCandidates << candidate;
 
+    // pair it with the remote candidates received so far, which could not
+    // be paired while the relayed address was unknown
+    for (const auto &remote : qAsConst(d->remoteCandidates)) {
+        if (!isCompatibleAddress(candidate.host(), remote.host()) ||
+            d->pairsByAddress.contains(qMakePair(static_cast<QXmppIceTransport *>(d->turnAllocation), qMakePair(remote.host(), remote.port()))))
+            continue;
+
+        auto *pair = new CandidatePair(d->component, d->config->iceControlling, this);
+        pair->remote = remote;
+        pair->transport = d->turnAllocation;
+        d->addPair(pair);
+    }
+    std::sort(d->pairs.begin(), d->pairs.end(), candidatePairPtrLessThan);
+
     emit localCandidatesChanged();
     updateGatheringState();
 }
@@ -2432,8 +2774,9 @@ class QXmppIceConnectionPrivate : public QXmppIcePrivate
 public:
     QXmppIceConnectionPrivate();
 
-    QMap<int, QXmppIceComponent *> components;
+    QTimer *checkTimer;
     QTimer *connectTimer;
+    qint64 nominatedTime;
 
     QXmppIceConnection::GatheringState gatheringState;
 
@@ -2444,7 +2787,7 @@ public:
 };
 
 QXmppIceConnectionPrivate::QXmppIceConnectionPrivate()
-    : connectTimer(nullptr), gatheringState(QXmppIceConnection::NewGatheringState), turnPort(0)
+    : checkTimer(nullptr), connectTimer(nullptr), nominatedTime(-1), gatheringState(QXmppIceConnection::NewGatheringState), turnPort(0)
 {
 }
 
@@ -2455,6 +2798,11 @@ QXmppIceConnectionPrivate::QXmppIceConnectionPrivate()
 QXmppIceConnection::QXmppIceConnection(QObject *parent)
     : QXmppLoggable(parent), d(new QXmppIceConnectionPrivate())
 {
+    // timer to pace connectivity checks
+    d->checkTimer = new QTimer(this);
+    d->checkTimer->setInterval(ICE_CHECK_INTERVAL);
+    connect(d->checkTimer, &QTimer::timeout,
+            this, &QXmppIceConnection::slotCheck);
 
     // timer to limit connection time to 30 seconds
     d->connectTimer = new QTimer(this);
@@ -2549,6 +2897,7 @@ bool QXmppIceConnection::bind(const QList<QHostAddress> &addresses)
 
 void QXmppIceConnection::close()
 {
+    d->checkTimer->stop();
     d->connectTimer->stop();
     for (auto *socket : d->components.values())
         socket->close();
@@ -2561,9 +2910,13 @@ void QXmppIceConnection::connectToHost()
     if (isConnected() || d->connectTimer->isActive())
         return;
 
+    d->checkClock.start();
+    d->nominatedTime = -1;
     for (auto *socket : d->components.values())
         socket->connectToHost();
     d->connectTimer->start();
+    d->checkTimer->start();
+    slotCheck();
 }
 
 /// Returns true if ICE negotiation completed, false otherwise.
@@ -2581,6 +2934,78 @@ QXmppIceConnection::GatheringState QXmppIceConnection::gatheringState() const
     return d->gatheringState;
 }
 
+/// Returns the interval in milliseconds between two ordinary connectivity
+/// checks (Ta), which is shared by all components.
+///
+/// \since QXmpp 1.4
+
+int QXmppIceConnection::checkInterval() const
+{
+    return d->checkTimer->interval();
+}
+
+/// Sets the interval in milliseconds between two ordinary connectivity
+/// checks (Ta), which is shared by all components.
+///
+/// The default is 50 milliseconds, see RFC 8445.
+///
+/// \since QXmpp 1.4
+
+void QXmppIceConnection::setCheckInterval(int msecs)
+{
+    d->checkTimer->setInterval(msecs);
+}
+
+/// Returns whether the controlling agent uses aggressive nomination.
+///
+/// \since QXmpp 1.4
+
+bool QXmppIceConnection::aggressiveNomination() const
+{
+    return d->aggressiveNomination;
+}
+
+/// Sets whether the controlling agent uses aggressive nomination.
+///
+/// With aggressive nomination, which is the default, every connectivity
+/// check nominates its pair and the first pair to succeed is selected.
+/// Otherwise the best valid pair is nominated once no pair of higher
+/// priority can still succeed.
+///
+/// \note This has no effect on the controlled agent.
+///
+/// \since QXmpp 1.4
+
+void QXmppIceConnection::setAggressiveNomination(bool aggressive)
+{
+    d->aggressiveNomination = aggressive;
+}
+
+/// Returns the time in milliseconds from connectToHost() to the first
+/// successful connectivity check, or -1 if no check succeeded yet.
+///
+/// \since QXmpp 1.4
+
+qint64 QXmppIceConnection::timeToFirstValidPair() const
+{
+    qint64 time = -1;
+    for (auto *socket : d->components.values()) {
+        if (socket->d->validTime >= 0 && (time < 0 || socket->d->validTime < time))
+            time = socket->d->validTime;
+    }
+    return time;
+}
+
+/// Returns the time in milliseconds from connectToHost() until a pair was
+/// nominated for every component, or -1 if negotiation did not complete.
+///
+/// \since QXmpp 1.4
+
+qint64 QXmppIceConnection::timeToNominated() const
+{
+    return d->nominatedTime;
+}
+
 /// Sets whether the local party has the ICE controlling role.
 ///
 /// \a note This must be called only once, immediately after creating
@@ -2632,6 +3057,7 @@ void QXmppIceConnection::setRemoteUser(const QString &user)
 void QXmppIceConnection::setRemotePassword(const QString &password)
 {
     d->remotePassword = password;
+    d->remoteIntegrity.setKey(password.toUtf8());
 }
 
 /// Sets multiple STUN servers to use to determine server-reflexive addresses
@@ -2703,12 +3129,73 @@ void QXmppIceConnection::setTurnPassword(const QString &password)
         socket->d->setTurnPassword(password);
 }
 
+// Starts the next ordinary connectivity check, see RFC 8445 - 6.1.4.2.
+// Performing a Connectivity Check
+
+void QXmppIceConnection::slotCheck()
+{
+    if (d->remoteUser.isEmpty())
+        return;
+
+    QXmppIceComponent *checkSocket = nullptr;
+    CandidatePair *checkPair = nullptr;
+    for (int pass = 0; pass < 2 && !checkPair; ++pass) {
+        if (pass) {
+            // there is no waiting pair, unfreeze the best pair of each
+            // foundation which has no pending check
+            QSet<QString> pending;
+            for (auto *socket : qAsConst(d->components)) {
+                if (!socket->d->checking)
+                    continue;
+                for (auto *pair : qAsConst(socket->d->pairs)) {
+                    if (pair->state() == CandidatePair::WaitingState ||
+                        pair->state() == CandidatePair::InProgressState)
+                        pending.insert(pair->foundation);
+                }
+            }
+            for (auto *socket : qAsConst(d->components)) {
+                if (!socket->d->checking)
+                    continue;
+                for (auto *pair : qAsConst(socket->d->pairs)) {
+                    if (pair->state() == CandidatePair::FrozenState && !pending.contains(pair->foundation)) {
+                        pair->setState(CandidatePair::WaitingState);
+                        pending.insert(pair->foundation);
+                    }
+                }
+            }
+        }
+
+        // pick the waiting pair with the highest priority
+        for (auto *socket : qAsConst(d->components)) {
+            if (!socket->d->checking)
+                continue;
+            for (auto *pair : qAsConst(socket->d->pairs)) {
+                if (pair->state() == CandidatePair::WaitingState) {
+                    if (!checkPair || pair->priority() > checkPair->priority()) {
+                        checkSocket = socket;
+                        checkPair = pair;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    if (checkPair)
+        checkSocket->d->performCheck(checkPair, d->iceControlling && d->aggressiveNomination);
+
+    for (auto *socket : qAsConst(d->components))
+        socket->d->updateNomination();
+}
+
 void QXmppIceConnection::slotConnected()
 {
     for (auto *socket : d->components.values())
         if (!socket->isConnected())
             return;
-    info(QStringLiteral("ICE negotiation completed"));
+    d->nominatedTime = d->checkClock.isValid() ? d->checkClock.elapsed() : 0;
+    info(QStringLiteral("ICE negotiation completed in %1 ms (first valid pair after %2 ms)").arg(QString::number(d->nominatedTime), QString::number(timeToFirstValidPair())));
+    d->checkTimer->stop();
     d->connectTimer->stop();
     emit connected();
 }
@@ -2741,6 +3228,7 @@ void QXmppIceConnection::slotGatheringStateChanged()
 void QXmppIceConnection::slotTimeout()
 {
     warning(QStringLiteral("ICE negotiation timed out"));
+    d->checkTimer->stop();
     for (auto *socket : d->components.values())
         socket->close();
     emit disconnected();
@@ -31,6 +31,7 @@
 
 class CandidatePair;
 class QDataStream;
+class QMessageAuthenticationCode;
 class QUdpSocket;
 class QTimer;
 class QXmppIceComponentPrivate;
@@ -113,7 +114,11 @@ public:
     void setUsername(const QString &username);
 
     QByteArray encode(const QByteArray &key = QByteArray(), bool addFingerprint = true) const;
+    void encode(QByteArray *buffer, const QByteArray &key = QByteArray(), bool addFingerprint = true) const;
+    void encode(QByteArray *buffer, QMessageAuthenticationCode *integrity, bool addFingerprint = true) const;
     bool decode(const QByteArray &buffer, const QByteArray &key = QByteArray(), QStringList *errors = nullptr);
+    bool decode(const char *data, int size, const QByteArray &key = QByteArray(), QStringList *errors = nullptr);
+    bool decode(const char *data, int size, QMessageAuthenticationCode *integrity, QStringList *errors = nullptr);
     QString toString() const;
     static quint16 peekType(const QByteArray &buffer, quint32 &cookie, QByteArray &id);
 
@@ -144,7 +149,7 @@ private:
     quint16 m_type;
 
     // attributes
-    QSet<quint16> m_attributes;
+    quint32 m_attributes;
     quint32 m_changeRequest;
     quint16 m_channelNumber;
     QByteArray m_data;
@@ -173,6 +178,9 @@ public:
     bool isConnected() const;
     QList<QXmppJingleCandidate> localCandidates() const;
 
+    QXmppJingleCandidate selectedLocalCandidate() const;
+    QXmppJingleCandidate selectedRemoteCandidate() const;
+
     static QList<QHostAddress> discoverAddresses();
     static QList<QUdpSocket *> reservePorts(const QList<QHostAddress> &addresses, int count, QObject *parent = nullptr);
 
@@ -182,7 +190,6 @@ public Q_SLOTS:
     qint64 sendDatagram(const QByteArray &datagram);
 
 private Q_SLOTS:
-    void checkCandidates();
     void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
     void turnConnected();
     void transactionFinished();
@@ -283,9 +290,18 @@ public:
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
 
+    int checkInterval() const;
+    void setCheckInterval(int msecs);
+
+    bool aggressiveNomination() const;
+    void setAggressiveNomination(bool aggressive);
+
     bool bind(const QList<QHostAddress> &addresses);
     bool isConnected() const;
 
+    qint64 timeToFirstValidPair() const;
+    qint64 timeToNominated() const;
+
     // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
     ///
     /// Returns the ICE gathering state, that is the discovery of local
@@ -317,6 +333,7 @@ public Q_SLOTS:
     void connectToHost();
 
 private Q_SLOTS:
+    void slotCheck();
     void slotConnected();
     void slotGatheringStateChanged();
     void slotTimeout();
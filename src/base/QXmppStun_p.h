@@ -26,6 +26,9 @@
 
 #include "QXmppStun.h"
 
+#include <QHash>
+#include <QMessageAuthenticationCode>
+
 class QUdpSocket;
 class QTimer;
 
@@ -142,7 +145,7 @@ private Q_SLOTS:
     void writeStun(const QXmppStunMessage &message);
 
 private:
-    void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void handleDatagram(QByteArray &datagram, const QHostAddress &host, quint16 port);
     void setState(AllocationState state);
 
     QUdpSocket *socket;
@@ -158,15 +161,19 @@ private:
     // channels
     typedef QPair<QHostAddress, quint16> Address;
     quint16 m_channelNumber;
-    QMap<quint16, Address> m_channels;
+    QHash<quint16, Address> m_channels;
+    QHash<Address, quint16> m_channelsByAddress;
 
     // state
     quint32 m_lifetime;
     QByteArray m_key;
+    QMessageAuthenticationCode m_integrity;
     QString m_realm;
     QByteArray m_nonce;
     AllocationState m_state;
     QList<QXmppStunTransaction *> m_transactions;
+    QByteArray m_readBuffer;
+    QByteArray m_stunBuffer;
 };
 
 /// \internal
@@ -192,7 +199,11 @@ private Q_SLOTS:
     void readyRead();
 
 private:
+    bool readDatagram();
+    int readBatch();
+
     QUdpSocket *m_socket;
+    QList<QByteArray> m_buffers;
 };
 
 #endif
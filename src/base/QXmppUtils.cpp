@@ -32,18 +32,18 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QDomElement>
+#include <QMessageAuthenticationCode>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #include <QRandomGenerator>
 #endif
-#include <QRegExp>
 #include <QString>
 #include <QStringList>
 #include <QUuid>
 #include <QXmlStreamWriter>
+#include <QtEndian>
 
 // adapted from public domain source by Ross Williams and Eric Durbin
-// FIXME : is this valid for big-endian machines?
-static quint32 crctable[256] = {
+static const quint32 crctable[256] = {
     0x00000000L, 0x77073096L, 0xEE0E612CL, 0x990951BAL,
     0x076DC419L, 0x706AF48FL, 0xE963A535L, 0x9E6495A3L,
     0x0EDB8832L, 0x79DCB8A4L, 0xE0D5E91EL, 0x97D2D988L,
@@ -110,35 +110,101 @@ static quint32 crctable[256] = {
     0xB40BBE37L, 0xC30C8EA1L, 0x5A05DF1BL, 0x2D02EF8DL
 };
 
+// Parses exactly \a count decimal digits.
+static inline bool parseDigits(const QChar *str, int count, int &value)
+{
+    value = 0;
+    for (int i = 0; i < count; ++i) {
+        const ushort c = str[i].unicode();
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Parses a time zone of the form "Z" or "+hh:mm"/"-hh:mm" at the start of
+// \a str and returns the number of characters consumed, or 0 on failure.
+static inline int parseTimezone(const QChar *str, int size, int &offset)
+{
+    offset = 0;
+    if (size >= 1 && str[0] == QLatin1Char('Z'))
+        return 1;
+
+    int hours, minutes;
+    if (size >= 6 &&
+        (str[0] == QLatin1Char('+') || str[0] == QLatin1Char('-')) &&
+        parseDigits(str + 1, 2, hours) &&
+        str[3] == QLatin1Char(':') &&
+        parseDigits(str + 4, 2, minutes)) {
+        offset = hours * 3600 + minutes * 60;
+        if (str[0] == QLatin1Char('-'))
+            offset = -offset;
+        return 6;
+    }
+    return 0;
+}
+
+// Writes \a value as \a count decimal digits.
+static inline QChar *writeDigits(QChar *out, int value, int count)
+{
+    for (int i = count - 1; i >= 0; --i) {
+        out[i] = QLatin1Char('0' + value % 10);
+        value /= 10;
+    }
+    return out + count;
+}
+
 ///
 /// Parses a date-time from a string according to
 /// \xep{0082}: XMPP Date and Time Profiles.
 ///
 QDateTime QXmppUtils::datetimeFromString(const QString &str)
 {
-    QRegExp tzRe(QStringLiteral("(Z|([+-])([0-9]{2}):([0-9]{2}))"));
-    int tzPos = tzRe.indexIn(str, 19);
-    if (str.size() < 20 || tzPos < 0)
+    // yyyy-MM-ddThh:mm:ss[.s+](Z|(+|-)hh:mm)
+    const int size = str.size();
+    if (size < 20)
         return QDateTime();
 
-    // process date and time
-    QDateTime dt = QDateTime::fromString(str.left(19), QStringLiteral("yyyy-MM-ddThh:mm:ss"));
-    dt.setTimeSpec(Qt::UTC);
+    const QChar *data = str.constData();
+    int year, month, day, hour, minute, second;
+    if (!parseDigits(data, 4, year) || data[4] != QLatin1Char('-') ||
+        !parseDigits(data + 5, 2, month) || data[7] != QLatin1Char('-') ||
+        !parseDigits(data + 8, 2, day) || data[10] != QLatin1Char('T') ||
+        !parseDigits(data + 11, 2, hour) || data[13] != QLatin1Char(':') ||
+        !parseDigits(data + 14, 2, minute) || data[16] != QLatin1Char(':') ||
+        !parseDigits(data + 17, 2, second))
+        return QDateTime();
 
-    // process milliseconds
-    if (tzPos > 20 && str.at(19) == '.') {
-        QString millis = (str.mid(20, tzPos - 20) + QStringLiteral("000")).left(3);
-        dt = dt.addMSecs(millis.toInt());
+    // process fractional seconds, only milliseconds are kept
+    int pos = 19;
+    int msecs = 0;
+    if (data[pos] == QLatin1Char('.')) {
+        int digits = 0;
+        for (++pos; pos < size; ++pos, ++digits) {
+            const ushort c = data[pos].unicode();
+            if (c < '0' || c > '9')
+                break;
+            if (digits < 3)
+                msecs = msecs * 10 + (c - '0');
+        }
+        for (; digits < 3; ++digits)
+            msecs *= 10;
     }
 
     // process time zone
-    if (tzRe.cap(1) != QStringLiteral("Z")) {
-        int offset = tzRe.cap(3).toInt() * 3600 + tzRe.cap(4).toInt() * 60;
-        if (tzRe.cap(2) == QStringLiteral("+"))
-            dt = dt.addSecs(-offset);
-        else
-            dt = dt.addSecs(offset);
-    }
+    int offset;
+    if (!parseTimezone(data + pos, size - pos, offset))
+        return QDateTime();
+
+    const QDate date(year, month, day);
+    const QTime time(hour, minute, second, msecs);
+    if (!date.isValid() || !time.isValid())
+        return QDateTime();
+
+    QDateTime dt(date, time, Qt::UTC);
+    if (offset)
+        dt = dt.addSecs(-offset);
     return dt;
 }
 
@@ -148,11 +214,39 @@ QDateTime QXmppUtils::datetimeFromString(const QString &str)
 ///
 QString QXmppUtils::datetimeToString(const QDateTime &dt)
 {
-    QDateTime utc = dt.toUTC();
-    if (utc.time().msec())
-        return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ss.zzzZ"));
-    else
-        return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ssZ"));
+    const QDateTime utc = dt.toUTC();
+    const QDate date = utc.date();
+    const QTime time = utc.time();
+    if (!date.isValid() || !time.isValid())
+        return QString();
+
+    // years which do not fit into four digits
+    if (date.year() < 0 || date.year() > 9999) {
+        if (time.msec())
+            return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ss.zzzZ"));
+        else
+            return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ssZ"));
+    }
+
+    QString str(time.msec() ? 24 : 20, Qt::Uninitialized);
+    QChar *out = str.data();
+    out = writeDigits(out, date.year(), 4);
+    *out++ = QLatin1Char('-');
+    out = writeDigits(out, date.month(), 2);
+    *out++ = QLatin1Char('-');
+    out = writeDigits(out, date.day(), 2);
+    *out++ = QLatin1Char('T');
+    out = writeDigits(out, time.hour(), 2);
+    *out++ = QLatin1Char(':');
+    out = writeDigits(out, time.minute(), 2);
+    *out++ = QLatin1Char(':');
+    out = writeDigits(out, time.second(), 2);
+    if (time.msec()) {
+        *out++ = QLatin1Char('.');
+        out = writeDigits(out, time.msec(), 3);
+    }
+    *out = QLatin1Char('Z');
+    return str;
 }
 
 ///
@@ -161,21 +255,10 @@ QString QXmppUtils::datetimeToString(const QDateTime &dt)
 ///
 int QXmppUtils::timezoneOffsetFromString(const QString &str)
 {
-    QRegExp tzRe(QStringLiteral("(Z|([+-])([0-9]{2}):([0-9]{2}))"));
-    if (!tzRe.exactMatch(str))
-        return 0;
-
-    // No offset from UTC
-    if (tzRe.cap(1) == QStringLiteral("Z"))
+    int offset;
+    if (parseTimezone(str.constData(), str.size(), offset) != str.size())
         return 0;
-
-    // Calculate offset
-    const int offset = tzRe.cap(3).toInt() * 3600 +
-        tzRe.cap(4).toInt() * 60;
-    if (tzRe.cap(2) == QStringLiteral("-"))
-        return -offset;
-    else
-        return offset;
+    return offset;
 }
 
 ///
@@ -187,8 +270,14 @@ QString QXmppUtils::timezoneOffsetToString(int secs)
     if (!secs)
         return QStringLiteral("Z");
 
-    const QTime tzoTime = QTime(0, 0, 0).addSecs(qAbs(secs));
-    return (secs < 0 ? QStringLiteral("-") : QStringLiteral("+")) + tzoTime.toString(QStringLiteral("hh:mm"));
+    const int minutes = qAbs(secs) / 60;
+    QString str(6, Qt::Uninitialized);
+    QChar *out = str.data();
+    *out++ = secs < 0 ? QLatin1Char('-') : QLatin1Char('+');
+    out = writeDigits(out, (minutes / 60) % 24, 2);
+    *out++ = QLatin1Char(':');
+    writeDigits(out, minutes % 60, 2);
+    return str;
 }
 
 /// Returns the domain for the given \a jid.
@@ -228,51 +317,57 @@ QString QXmppUtils::jidToBareJid(const QString &jid)
     return jid.left(pos);
 }
 
+// Lookup tables for the "slicing-by-8" CRC32 algorithm, which consumes
+// eight bytes per iteration: table[k][n] is the CRC of byte n followed
+// by k zero bytes.
+struct QXmppCrc32Tables {
+    QXmppCrc32Tables()
+    {
+        for (int n = 0; n < 256; ++n) {
+            table[0][n] = crctable[n];
+            for (int k = 1; k < 8; ++k)
+                table[k][n] = (table[k - 1][n] >> 8) ^ crctable[table[k - 1][n] & 0xff];
+        }
+    }
+
+    quint32 table[8][256];
+};
+
 /// Calculates the CRC32 checksum for the given input.
 
 quint32 QXmppUtils::generateCrc32(const QByteArray &in)
 {
-    quint32 result = 0xffffffff;
-    for (char n : in)
-        result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)n]);
-    return result ^= 0xffffffff;
-}
-
-static QByteArray generateHmac(QCryptographicHash::Algorithm algorithm, const QByteArray &key, const QByteArray &text)
-{
-    QCryptographicHash hasher(algorithm);
+    static const QXmppCrc32Tables tables;
+    const auto &t = tables.table;
 
-    const int B = 64;
-    QByteArray kpad = key + QByteArray(B - key.size(), 0);
-
-    QByteArray ba;
-    for (int i = 0; i < B; ++i)
-        ba += kpad[i] ^ 0x5c;
-
-    QByteArray tmp;
-    for (int i = 0; i < B; ++i)
-        tmp += kpad[i] ^ 0x36;
-    hasher.addData(tmp);
-    hasher.addData(text);
-    ba += hasher.result();
-
-    hasher.reset();
-    hasher.addData(ba);
-    return hasher.result();
+    const auto *data = reinterpret_cast<const uchar *>(in.constData());
+    int size = in.size();
+    quint32 result = 0xffffffff;
+    for (; size >= 8; data += 8, size -= 8) {
+        const quint32 one = qFromLittleEndian<quint32>(data) ^ result;
+        const quint32 two = qFromLittleEndian<quint32>(data + 4);
+        result = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^
+            t[5][(one >> 16) & 0xff] ^ t[4][one >> 24] ^
+            t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^
+            t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+    }
+    for (; size > 0; ++data, --size)
+        result = (result >> 8) ^ t[0][(result & 0xff) ^ *data];
+    return result ^ 0xffffffff;
 }
 
 /// Generates the MD5 HMAC for the given \a key and \a text.
 
 QByteArray QXmppUtils::generateHmacMd5(const QByteArray &key, const QByteArray &text)
 {
-    return generateHmac(QCryptographicHash::Md5, key, text);
+    return QMessageAuthenticationCode::hash(text, key, QCryptographicHash::Md5);
 }
 
 /// Generates the SHA1 HMAC for the given \a key and \a text.
 
 QByteArray QXmppUtils::generateHmacSha1(const QByteArray &key, const QByteArray &text)
 {
-    return generateHmac(QCryptographicHash::Sha1, key, text);
+    return QMessageAuthenticationCode::hash(text, key, QCryptographicHash::Sha1);
 }
 
 /// Generates a random integer x between 0 and N-1.
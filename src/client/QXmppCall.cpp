@@ -44,9 +44,11 @@ QXmppCallPrivate::QXmppCallPrivate(QXmppCall *qq)
       manager(0),
       state(QXmppCall::ConnectingState),
       nextId(0),
+      statisticsTimer(nullptr),
       q(qq)
 {
     qRegisterMetaType<QXmppCall::State>();
+    qRegisterMetaType<QList<QXmppCallStats>>();
 
     filterGStreamerFormats(videoCodecs);
     filterGStreamerFormats(audioCodecs);
@@ -483,9 +485,12 @@ QXmppJingleIq::Content QXmppCallPrivate::localContent(QXmppCallStream *stream) c
     content.setPayloadTypes(stream->d->payloadTypes);
 
     // transport
+    const QList<QXmppJingleCandidate> candidates = stream->d->connection->localCandidates();
     content.setTransportUser(stream->d->connection->localUser());
     content.setTransportPassword(stream->d->connection->localPassword());
-    content.setTransportCandidates(stream->d->connection->localCandidates());
+    content.setTransportCandidates(candidates);
+    for (const auto &candidate : candidates)
+        stream->d->announcedCandidates.insert(candidate.id());
 
     return content;
 }
@@ -533,10 +538,14 @@ void QXmppCallPrivate::setState(QXmppCall::State newState)
         state = newState;
         Q_EMIT q->stateChanged(state);
 
-        if (state == QXmppCall::ActiveState)
+        if (state == QXmppCall::ActiveState) {
+            if (statisticsTimer->interval() > 0)
+                statisticsTimer->start();
             Q_EMIT q->connected();
-        else if (state == QXmppCall::FinishedState)
+        } else if (state == QXmppCall::FinishedState) {
+            statisticsTimer->stop();
             Q_EMIT q->finished();
+        }
     }
 }
 
@@ -570,6 +579,11 @@ QXmppCall::QXmppCall(const QString &jid, QXmppCall::Direction direction, QXmppCa
     d->jid = jid;
     d->ownJid = parent->client()->configuration().jid();
     d->manager = parent;
+
+    d->statisticsTimer = new QTimer(this);
+    d->statisticsTimer->setInterval(5000);
+    connect(d->statisticsTimer, &QTimer::timeout,
+            this, &QXmppCall::updateStatistics);
 }
 
 QXmppCall::~QXmppCall()
@@ -631,6 +645,60 @@ QXmppCallStream *QXmppCall::videoStream() const
     return d->findStreamByMedia(VIDEO_MEDIA);
 }
 
+/// Returns the current quality statistics of each stream.
+///
+/// \since QXmpp 1.4
+
+QList<QXmppCallStats> QXmppCall::statistics() const
+{
+    QList<QXmppCallStats> statistics;
+    for (auto stream : d->streams)
+        statistics << stream->d->statistics();
+    return statistics;
+}
+
+/// Returns the interval in milliseconds at which statisticsUpdated() is
+/// emitted while the call is active.
+///
+/// \since QXmpp 1.4
+
+int QXmppCall::statisticsInterval() const
+{
+    return d->statisticsTimer->interval();
+}
+
+/// Sets the interval in milliseconds at which statisticsUpdated() is
+/// emitted while the call is active, 0 disables periodic updates.
+///
+/// The default is 5000 milliseconds.
+///
+/// \since QXmpp 1.4
+
+void QXmppCall::setStatisticsInterval(int msecs)
+{
+    d->statisticsTimer->setInterval(msecs);
+    if (msecs <= 0)
+        d->statisticsTimer->stop();
+    else if (d->state == ActiveState)
+        d->statisticsTimer->start();
+}
+
+/// Emits the current statistics and reports them as gauges.
+
+void QXmppCall::updateStatistics()
+{
+    const QList<QXmppCallStats> stats = statistics();
+    for (const auto &stream : stats) {
+        const QString prefix = QStringLiteral("call.") + stream.media();
+        setGauge(prefix + QStringLiteral(".packets-lost"), stream.packetsLost());
+        setGauge(prefix + QStringLiteral(".jitter"), stream.jitter());
+        setGauge(prefix + QStringLiteral(".round-trip-time"), stream.roundTripTime());
+        setGauge(prefix + QStringLiteral(".send-bitrate"), stream.sendBitrate());
+        setGauge(prefix + QStringLiteral(".receive-bitrate"), stream.receiveBitrate());
+    }
+    emit statisticsUpdated(stats);
+}
+
 void QXmppCall::terminated()
 {
     // close streams
@@ -660,6 +728,8 @@ void QXmppCall::hangup()
 
 /// Sends a transport-info to inform the remote party of new local candidates.
 ///
+/// Candidates are trickled as described in XEP-0176: only those which the
+/// remote party was not told about yet are sent.
 
 void QXmppCall::localCandidatesChanged()
 {
@@ -675,12 +745,29 @@ void QXmppCall::localCandidatesChanged()
     if (!stream)
         return;
 
+    QList<QXmppJingleCandidate> candidates;
+    for (const auto &candidate : conn->localCandidates()) {
+        if (!stream->d->announcedCandidates.contains(candidate.id())) {
+            stream->d->announcedCandidates.insert(candidate.id());
+            candidates << candidate;
+        }
+    }
+    if (candidates.isEmpty())
+        return;
+
+    QXmppJingleIq::Content content;
+    content.setCreator(stream->creator());
+    content.setName(stream->name());
+    content.setTransportUser(conn->localUser());
+    content.setTransportPassword(conn->localPassword());
+    content.setTransportCandidates(candidates);
+
     QXmppJingleIq iq;
     iq.setTo(d->jid);
     iq.setType(QXmppIq::Set);
     iq.setAction(QXmppJingleIq::TransportInfo);
     iq.setSid(d->sid);
-    iq.addContent(d->localContent(stream));
+    iq.addContent(content);
     d->sendRequest(iq);
 }
 
@@ -24,6 +24,7 @@
 #ifndef QXMPPCALL_H
 #define QXMPPCALL_H
 
+#include "QXmppCallStats.h"
 #include "QXmppCallStream.h"
 #include "QXmppClientExtension.h"
 #include "QXmppLogger.h"
@@ -75,6 +76,10 @@ public:
     QXmppCallStream *audioStream() const;
     QXmppCallStream *videoStream() const;
 
+    QList<QXmppCallStats> statistics() const;
+    int statisticsInterval() const;
+    void setStatisticsInterval(int msecs);
+
 signals:
     /// \brief This signal is emitted when a call is connected.
     ///
@@ -98,6 +103,16 @@ signals:
     /// \brief This signal is emitted when a stream is created.
     void streamCreated(QXmppCallStream *stream);
 
+    ///
+    /// \brief This signal is emitted periodically with the quality
+    /// statistics of each stream while the call is active.
+    ///
+    /// \sa setStatisticsInterval()
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void statisticsUpdated(const QList<QXmppCallStats> &statistics);
+
 public slots:
     void accept();
     void hangup();
@@ -106,6 +121,7 @@ public slots:
 private slots:
     void localCandidatesChanged();
     void terminated();
+    void updateStatistics();
 
 private:
     QXmppCall(const QString &jid, QXmppCall::Direction direction, QXmppCallManager *parent);
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppCallStats.h"
+
+#include <QSharedData>
+
+class QXmppCallStatsPrivate : public QSharedData
+{
+public:
+    QXmppCallStatsPrivate();
+
+    QString media;
+    quint64 packetsSent;
+    quint64 bytesSent;
+    quint64 packetsReceived;
+    quint64 bytesReceived;
+    qint64 packetsLost;
+    double jitter;
+    double roundTripTime;
+    quint64 sendBitrate;
+    quint64 receiveBitrate;
+    QXmppJingleCandidate localCandidate;
+    QXmppJingleCandidate remoteCandidate;
+};
+
+QXmppCallStatsPrivate::QXmppCallStatsPrivate()
+    : packetsSent(0),
+      bytesSent(0),
+      packetsReceived(0),
+      bytesReceived(0),
+      packetsLost(0),
+      jitter(0),
+      roundTripTime(0),
+      sendBitrate(0),
+      receiveBitrate(0)
+{
+}
+
+/// Constructs empty statistics.
+
+QXmppCallStats::QXmppCallStats()
+    : d(new QXmppCallStatsPrivate)
+{
+}
+
+/// Constructs a copy of \a other.
+
+QXmppCallStats::QXmppCallStats(const QXmppCallStats &other) = default;
+
+QXmppCallStats::~QXmppCallStats() = default;
+
+/// Assigns \a other to these statistics.
+
+QXmppCallStats &QXmppCallStats::operator=(const QXmppCallStats &other) = default;
+
+/// Returns the stream's media type, e.g. "audio" or "video".
+
+QString QXmppCallStats::media() const
+{
+    return d->media;
+}
+
+/// Sets the stream's media type.
+
+void QXmppCallStats::setMedia(const QString &media)
+{
+    d->media = media;
+}
+
+/// Returns the number of RTP packets sent.
+
+quint64 QXmppCallStats::packetsSent() const
+{
+    return d->packetsSent;
+}
+
+/// Sets the number of RTP packets sent.
+
+void QXmppCallStats::setPacketsSent(quint64 packets)
+{
+    d->packetsSent = packets;
+}
+
+/// Returns the number of RTP payload bytes sent.
+
+quint64 QXmppCallStats::bytesSent() const
+{
+    return d->bytesSent;
+}
+
+/// Sets the number of RTP payload bytes sent.
+
+void QXmppCallStats::setBytesSent(quint64 bytes)
+{
+    d->bytesSent = bytes;
+}
+
+/// Returns the number of RTP packets received.
+
+quint64 QXmppCallStats::packetsReceived() const
+{
+    return d->packetsReceived;
+}
+
+/// Sets the number of RTP packets received.
+
+void QXmppCallStats::setPacketsReceived(quint64 packets)
+{
+    d->packetsReceived = packets;
+}
+
+/// Returns the number of RTP payload bytes received.
+
+quint64 QXmppCallStats::bytesReceived() const
+{
+    return d->bytesReceived;
+}
+
+/// Sets the number of RTP payload bytes received.
+
+void QXmppCallStats::setBytesReceived(quint64 bytes)
+{
+    d->bytesReceived = bytes;
+}
+
+/// Returns the number of incoming RTP packets which were lost, as per
+/// RFC 3550 this is negative if duplicates were received.
+
+qint64 QXmppCallStats::packetsLost() const
+{
+    return d->packetsLost;
+}
+
+/// Sets the number of incoming RTP packets which were lost.
+
+void QXmppCallStats::setPacketsLost(qint64 packets)
+{
+    d->packetsLost = packets;
+}
+
+/// Returns the interarrival jitter of incoming RTP packets in milliseconds.
+
+double QXmppCallStats::jitter() const
+{
+    return d->jitter;
+}
+
+/// Sets the interarrival jitter of incoming RTP packets in milliseconds.
+
+void QXmppCallStats::setJitter(double jitter)
+{
+    d->jitter = jitter;
+}
+
+/// Returns the round-trip time in milliseconds, as computed from the
+/// remote party's RTCP receiver reports.
+
+double QXmppCallStats::roundTripTime() const
+{
+    return d->roundTripTime;
+}
+
+/// Sets the round-trip time in milliseconds.
+
+void QXmppCallStats::setRoundTripTime(double roundTripTime)
+{
+    d->roundTripTime = roundTripTime;
+}
+
+/// Returns the estimated bitrate of outgoing RTP in bits per second.
+
+quint64 QXmppCallStats::sendBitrate() const
+{
+    return d->sendBitrate;
+}
+
+/// Sets the estimated bitrate of outgoing RTP in bits per second.
+
+void QXmppCallStats::setSendBitrate(quint64 bitrate)
+{
+    d->sendBitrate = bitrate;
+}
+
+/// Returns the estimated bitrate of incoming RTP in bits per second.
+
+quint64 QXmppCallStats::receiveBitrate() const
+{
+    return d->receiveBitrate;
+}
+
+/// Sets the estimated bitrate of incoming RTP in bits per second.
+
+void QXmppCallStats::setReceiveBitrate(quint64 bitrate)
+{
+    d->receiveBitrate = bitrate;
+}
+
+/// Returns the local candidate of the selected ICE pair for RTP, which is
+/// null until ICE negotiation completes.
+
+QXmppJingleCandidate QXmppCallStats::localCandidate() const
+{
+    return d->localCandidate;
+}
+
+/// Sets the local candidate of the selected ICE pair for RTP.
+
+void QXmppCallStats::setLocalCandidate(const QXmppJingleCandidate &candidate)
+{
+    d->localCandidate = candidate;
+}
+
+/// Returns the remote candidate of the selected ICE pair for RTP, which is
+/// null until ICE negotiation completes.
+
+QXmppJingleCandidate QXmppCallStats::remoteCandidate() const
+{
+    return d->remoteCandidate;
+}
+
+/// Sets the remote candidate of the selected ICE pair for RTP.
+
+void QXmppCallStats::setRemoteCandidate(const QXmppJingleCandidate &candidate)
+{
+    d->remoteCandidate = candidate;
+}
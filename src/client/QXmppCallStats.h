@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCALLSTATS_H
+#define QXMPPCALLSTATS_H
+
+#include "QXmppJingleIq.h"
+
+#include <QMetaType>
+#include <QSharedDataPointer>
+
+class QXmppCallStatsPrivate;
+
+///
+/// \brief The QXmppCallStats class holds quality statistics for one media
+/// stream of a call, as read from its RTP session and its ICE connection.
+///
+/// \note THIS API IS NOT FINALIZED YET
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppCallStats
+{
+public:
+    QXmppCallStats();
+    QXmppCallStats(const QXmppCallStats &other);
+    ~QXmppCallStats();
+
+    QXmppCallStats &operator=(const QXmppCallStats &other);
+
+    QString media() const;
+    void setMedia(const QString &media);
+
+    quint64 packetsSent() const;
+    void setPacketsSent(quint64 packets);
+
+    quint64 bytesSent() const;
+    void setBytesSent(quint64 bytes);
+
+    quint64 packetsReceived() const;
+    void setPacketsReceived(quint64 packets);
+
+    quint64 bytesReceived() const;
+    void setBytesReceived(quint64 bytes);
+
+    qint64 packetsLost() const;
+    void setPacketsLost(qint64 packets);
+
+    double jitter() const;
+    void setJitter(double jitter);
+
+    double roundTripTime() const;
+    void setRoundTripTime(double roundTripTime);
+
+    quint64 sendBitrate() const;
+    void setSendBitrate(quint64 bitrate);
+
+    quint64 receiveBitrate() const;
+    void setReceiveBitrate(quint64 bitrate);
+
+    QXmppJingleCandidate localCandidate() const;
+    void setLocalCandidate(const QXmppJingleCandidate &candidate);
+
+    QXmppJingleCandidate remoteCandidate() const;
+    void setRemoteCandidate(const QXmppJingleCandidate &candidate);
+
+private:
+    QSharedDataPointer<QXmppCallStatsPrivate> d;
+};
+
+Q_DECLARE_METATYPE(QXmppCallStats)
+
+#endif
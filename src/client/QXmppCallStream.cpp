@@ -27,10 +27,12 @@
 #include "QXmppCall_p.h"
 #include "QXmppStun.h"
 
-#include <cstring>
-
 #include <gst/gst.h>
 
+// size of the pooled buffers received packets are copied to, larger
+// packets get a buffer of their own
+static const guint RECEIVE_BUFFER_SIZE = 1500;
+
 QXmppCallStreamPrivate::QXmppCallStreamPrivate(QXmppCallStream *parent, GstElement *pipeline_,
                                                GstElement *rtpbin_, QString media_, QString creator_,
                                                QString name_, int id_)
@@ -94,6 +96,14 @@ QXmppCallStreamPrivate::QXmppCallStreamPrivate(QXmppCallStream *parent, GstEleme
     g_object_set(apprtpsrc, "is-live", true, "max-latency", 5000000, nullptr);
     g_object_set(apprtcpsrc, "is-live", true, nullptr);
 
+    receivePool = gst_buffer_pool_new();
+    GstStructure *poolConfig = gst_buffer_pool_get_config(receivePool);
+    gst_buffer_pool_config_set_params(poolConfig, nullptr, RECEIVE_BUFFER_SIZE, 0, 0);
+    if (!gst_buffer_pool_set_config(receivePool, poolConfig) ||
+        !gst_buffer_pool_set_active(receivePool, true)) {
+        qFatal("Failed to activate receive buffer pool");
+    }
+
     connect(connection->component(RTP_COMPONENT), &QXmppIceComponent::datagramReceived,
             [&](const QByteArray &datagram) { datagramReceived(datagram, apprtpsrc); });
     connect(connection->component(RTCP_COMPONENT), &QXmppIceComponent::datagramReceived,
@@ -129,6 +139,10 @@ QXmppCallStreamPrivate::~QXmppCallStreamPrivate()
         !gst_bin_remove(GST_BIN(pipeline), iceReceiveBin)) {
         qFatal("Failed to remove bins from pipeline");
     }
+
+    // buffers still held by the pipeline are freed once they are released
+    gst_buffer_pool_set_active(receivePool, false);
+    gst_object_unref(receivePool);
 }
 
 GstFlowReturn QXmppCallStreamPrivate::sendDatagram(GstElement *appsink, int component)
@@ -150,34 +164,121 @@ GstFlowReturn QXmppCallStreamPrivate::sendDatagram(GstElement *appsink, int comp
         qFatal("Could not map buffer");
         return GST_FLOW_ERROR;
     }
-    QByteArray datagram;
-    datagram.resize(mapInfo.size);
-    std::memcpy(datagram.data(), mapInfo.data, mapInfo.size);
-    gst_buffer_unmap(buffer, &mapInfo);
-    gst_sample_unref(sample);
 
+    // the socket only reads the packet until sendDatagram() returns,
+    // so it can use the mapped memory directly
+    const QByteArray datagram = QByteArray::fromRawData(reinterpret_cast<const char *>(mapInfo.data), int(mapInfo.size));
+    GstFlowReturn ret = GST_FLOW_OK;
     if (connection->component(component)->isConnected() &&
         connection->component(component)->sendDatagram(datagram) != datagram.size()) {
-        return GST_FLOW_ERROR;
+        ret = GST_FLOW_ERROR;
     }
-    return GST_FLOW_OK;
+    gst_buffer_unmap(buffer, &mapInfo);
+    gst_sample_unref(sample);
+    return ret;
 }
 
 void QXmppCallStreamPrivate::datagramReceived(const QByteArray &datagram, GstElement *appsrc)
 {
-    GstBuffer *buffer = gst_buffer_new_and_alloc(datagram.size());
-    GstMapInfo mapInfo;
-    if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_WRITE)) {
-        qFatal("Could not map buffer");
-        return;
+    // copy the packet to a pooled buffer, which returns to the pool once
+    // GStreamer releases it, so that the socket can reuse its own buffer
+    GstBuffer *buffer = nullptr;
+    if (guint(datagram.size()) > RECEIVE_BUFFER_SIZE ||
+        gst_buffer_pool_acquire_buffer(receivePool, &buffer, nullptr) != GST_FLOW_OK) {
+        buffer = gst_buffer_new_allocate(nullptr, datagram.size(), nullptr);
     }
-    std::memcpy(mapInfo.data, datagram.data(), mapInfo.size);
-    gst_buffer_unmap(buffer, &mapInfo);
+    gst_buffer_fill(buffer, 0, datagram.constData(), datagram.size());
+    gst_buffer_set_size(buffer, datagram.size());
+
     GstFlowReturn ret;
     g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
     gst_buffer_unref(buffer);
 }
 
+QXmppCallStats QXmppCallStreamPrivate::statistics() const
+{
+    QXmppCallStats stats;
+    stats.setMedia(media);
+
+    // selected ICE pair
+    QXmppIceComponent *component = connection->component(RTP_COMPONENT);
+    stats.setLocalCandidate(component->selectedLocalCandidate());
+    stats.setRemoteCandidate(component->selectedRemoteCandidate());
+
+    // RTP session
+    GObject *rtpSession = nullptr;
+    g_signal_emit_by_name(rtpbin, "get-session", static_cast<uint>(id), &rtpSession);
+    if (!rtpSession)
+        return stats;
+    GstStructure *sessionStats = nullptr;
+    g_object_get(rtpSession, "stats", &sessionStats, nullptr);
+    g_object_unref(rtpSession);
+    if (!sessionStats)
+        return stats;
+
+    quint64 packetsSent = 0, bytesSent = 0, sendBitrate = 0;
+    quint64 packetsReceived = 0, bytesReceived = 0, receiveBitrate = 0;
+    qint64 packetsLost = 0;
+    double jitter = 0, roundTripTime = 0;
+
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    const GValue *sourceStats = gst_structure_get_value(sessionStats, "source-stats");
+    const GValueArray *sources = sourceStats ? static_cast<const GValueArray *>(g_value_get_boxed(sourceStats)) : nullptr;
+    for (guint i = 0; sources && i < sources->n_values; ++i) {
+        const GstStructure *source = gst_value_get_structure(&sources->values[i]);
+        gboolean internal = FALSE;
+        guint64 packets = 0, octets = 0, bitrate = 0;
+        gst_structure_get_boolean(source, "internal", &internal);
+        gst_structure_get_uint64(source, "bitrate", &bitrate);
+
+        if (internal) {
+            // our own source
+            gst_structure_get_uint64(source, "packets-sent", &packets);
+            gst_structure_get_uint64(source, "octets-sent", &octets);
+            packetsSent += packets;
+            bytesSent += octets;
+            sendBitrate += bitrate;
+            continue;
+        }
+
+        // a remote source
+        gint lost = 0, clockRate = 0;
+        guint sourceJitter = 0;
+        gst_structure_get_uint64(source, "packets-received", &packets);
+        gst_structure_get_uint64(source, "octets-received", &octets);
+        gst_structure_get_int(source, "packets-lost", &lost);
+        gst_structure_get_int(source, "clock-rate", &clockRate);
+        gst_structure_get_uint(source, "jitter", &sourceJitter);
+        packetsReceived += packets;
+        bytesReceived += octets;
+        receiveBitrate += bitrate;
+        packetsLost += lost;
+        if (clockRate > 0)
+            jitter = qMax(jitter, sourceJitter * 1000.0 / clockRate);
+
+        // the remote party's receiver reports about our source, the
+        // round-trip time is expressed in 1/65536 seconds
+        gboolean haveReport = FALSE;
+        guint roundTrip = 0;
+        gst_structure_get_boolean(source, "have-rb", &haveReport);
+        if (haveReport && gst_structure_get_uint(source, "rb-round-trip", &roundTrip))
+            roundTripTime = qMax(roundTripTime, roundTrip * 1000.0 / 65536);
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    gst_structure_free(sessionStats);
+
+    stats.setPacketsSent(packetsSent);
+    stats.setBytesSent(bytesSent);
+    stats.setSendBitrate(sendBitrate);
+    stats.setPacketsReceived(packetsReceived);
+    stats.setBytesReceived(bytesReceived);
+    stats.setReceiveBitrate(receiveBitrate);
+    stats.setPacketsLost(packetsLost);
+    stats.setJitter(jitter);
+    stats.setRoundTripTime(roundTripTime);
+    return stats;
+}
+
 void QXmppCallStreamPrivate::addEncoder(QXmppCallPrivate::GstCodec &codec)
 {
     // Remove old encoder and payloader if they exist
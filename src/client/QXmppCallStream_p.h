@@ -24,6 +24,7 @@
 #ifndef QXMPPCALLSTREAM_P_H
 #define QXMPPCALLSTREAM_P_H
 
+#include "QXmppCallStats.h"
 #include "QXmppCall_p.h"
 #include "QXmppJingleIq.h"
 
@@ -31,6 +32,7 @@
 
 #include <QList>
 #include <QObject>
+#include <QSet>
 #include <QString>
 
 class QXmppIceConnection;
@@ -67,6 +69,7 @@ public:
     void addDecoder(GstPad *pad, QXmppCallPrivate::GstCodec &codec);
     void addRtpSender(GstPad *pad);
     void addRtcpSender(GstPad *pad);
+    QXmppCallStats statistics() const;
 
     QXmppCallStream *q;
 
@@ -87,6 +90,7 @@ public:
     GstElement *apprtcpsrc;
     GstElement *apprtpsink;
     GstElement *apprtcpsink;
+    GstBufferPool *receivePool;
 
     std::function<void(GstPad *)> sendPadCB;
     std::function<void(GstPad *)> receivePadCB;
@@ -98,6 +102,9 @@ public:
     int id;
 
     QList<QXmppJinglePayloadType> payloadTypes;
+
+    // ids of the local candidates the remote party was told about
+    QSet<QString> announcedCandidates;
 };
 
 #endif
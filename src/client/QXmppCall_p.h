@@ -31,6 +31,8 @@
 
 #include <QList>
 
+class QTimer;
+
 //  W A R N I N G
 //  -------------
 //
@@ -104,6 +106,9 @@ public:
     QList<QXmppCallStream *> streams;
     int nextId;
 
+    // Quality statistics
+    QTimer *statisticsTimer;
+
     // Supported codecs
     QList<GstCodec> videoCodecs = {
         { .pt = 100, .name = "H264", .channels = 1, .clockrate = 90000, .gstPay = "rtph264pay", .gstDepay = "rtph264depay", .gstEnc = "x264enc", .gstDec = "avdec_h264", .encProps = { { "tune", 4 }, { "speed-preset", 3 }, {"byte-stream", true}, { "bitrate", 512 } } },
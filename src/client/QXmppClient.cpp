@@ -53,10 +53,16 @@ void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
     if (ext) {
         presence.setCapabilityHash("sha-1");
         presence.setCapabilityNode(ext->clientCapabilitiesNode());
-        presence.setCapabilityVer(ext->capabilities().verificationString());
+        presence.setCapabilityVer(ext->capabilitiesVerificationString());
     }
 }
 
+void QXmppClientPrivate::invalidateCapabilities()
+{
+    if (auto* ext = q->findExtension<QXmppDiscoveryManager>())
+        ext->invalidateCapabilities();
+}
+
 int QXmppClientPrivate::getNextReconnectTime() const
 {
     if (reconnectionTries < 5)
@@ -198,6 +204,7 @@ bool QXmppClient::insertExtension(int index, QXmppClientExtension* extension)
     extension->setParent(this);
     extension->setClient(this);
     d->extensions.insert(index, extension);
+    d->invalidateCapabilities();
     return true;
 }
 
@@ -211,6 +218,7 @@ bool QXmppClient::removeExtension(QXmppClientExtension* extension)
     if (d->extensions.contains(extension)) {
         d->extensions.removeAll(extension);
         delete extension;
+        d->invalidateCapabilities();
         return true;
     } else {
         qWarning("Cannot remove extension, it was never added");
@@ -323,6 +331,18 @@ bool QXmppClient::isConnected() const
     return d->stream->isConnected();
 }
 
+///
+/// Returns true if the client is connected and the previous stream was
+/// resumed using \xep{0198}: Stream Management. In that case the server
+/// still answers the requests sent before the connection was lost.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppClient::isStreamResumed() const
+{
+    return d->stream->isStreamResumed();
+}
+
 ///
 /// Returns true if the current client state is "active", false if it is
 /// "inactive". See \xep{0352}: Client State Indication for details.
@@ -537,9 +557,11 @@ void QXmppClient::_q_streamConnected()
     emit connected();
     emit stateChanged(QXmppClient::ConnectedState);
 
-    // send initial presence
-    if (d->stream->isAuthenticated())
+    // send initial presence, extensions may have changed since it was set
+    if (d->stream->isAuthenticated()) {
+        d->addProperCapability(d->clientPresence);
         sendPacket(d->clientPresence);
+    }
 }
 
 void QXmppClient::_q_streamDisconnected()
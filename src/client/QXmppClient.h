@@ -179,6 +179,7 @@ public:
 
     bool isAuthenticated() const;
     bool isConnected() const;
+    bool isStreamResumed() const;
 
     bool isActive() const;
     void setActive(bool active);
@@ -66,6 +66,7 @@ public:
     bool isActive;
 
     void addProperCapability(QXmppPresence &presence);
+    void invalidateCapabilities();
     int getNextReconnectTime() const;
 
     static QStringList discoveryFeatures();
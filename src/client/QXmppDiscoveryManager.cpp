@@ -42,6 +42,11 @@ public:
     QString clientType;
     QString clientName;
     QXmppDataForm clientInfoForm;
+
+    // cached capabilities, rebuilt lazily after invalidation
+    bool capabilitiesValid = false;
+    QXmppDiscoveryIq capabilities;
+    QByteArray verificationString;
 };
 
 QXmppDiscoveryManager::QXmppDiscoveryManager()
@@ -106,7 +111,33 @@ QString QXmppDiscoveryManager::requestItems(const QString& jid, const QString& n
 ///
 /// Returns the client's full capabilities.
 ///
+/// The result is cached and only rebuilt after the client's extensions or
+/// identity settings have changed.
+///
 QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
+{
+    if (!d->capabilitiesValid) {
+        d->capabilities = buildCapabilities();
+        d->verificationString = d->capabilities.verificationString();
+        d->capabilitiesValid = true;
+    }
+    return d->capabilities;
+}
+
+/// \cond
+QByteArray QXmppDiscoveryManager::capabilitiesVerificationString()
+{
+    if (!d->capabilitiesValid)
+        capabilities();
+    return d->verificationString;
+}
+
+void QXmppDiscoveryManager::invalidateCapabilities()
+{
+    d->capabilitiesValid = false;
+}
+
+QXmppDiscoveryIq QXmppDiscoveryManager::buildCapabilities()
 {
     QXmppDiscoveryIq iq;
     iq.setType(QXmppIq::Result);
@@ -148,6 +179,7 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
 
     return iq;
 }
+/// \endcond
 
 /// Sets the capabilities node of the local XMPP client.
 ///
@@ -168,6 +200,7 @@ void QXmppDiscoveryManager::setClientCapabilitiesNode(const QString& node)
 void QXmppDiscoveryManager::setClientCategory(const QString& category)
 {
     d->clientCategory = category;
+    d->capabilitiesValid = false;
 }
 
 /// Sets the type of the local XMPP client.
@@ -180,6 +213,7 @@ void QXmppDiscoveryManager::setClientCategory(const QString& category)
 void QXmppDiscoveryManager::setClientType(const QString& type)
 {
     d->clientType = type;
+    d->capabilitiesValid = false;
 }
 
 /// Sets the name of the local XMPP client.
@@ -189,6 +223,7 @@ void QXmppDiscoveryManager::setClientType(const QString& type)
 void QXmppDiscoveryManager::setClientName(const QString& name)
 {
     d->clientName = name;
+    d->capabilitiesValid = false;
 }
 
 /// Returns the capabilities node of the local XMPP client.
@@ -242,6 +277,7 @@ QXmppDataForm QXmppDiscoveryManager::clientInfoForm() const
 void QXmppDiscoveryManager::setClientInfoForm(const QXmppDataForm& form)
 {
     d->clientInfoForm = form;
+    d->capabilitiesValid = false;
 }
 
 /// \cond
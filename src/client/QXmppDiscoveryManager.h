@@ -77,7 +77,14 @@ Q_SIGNALS:
     void itemsReceived(const QXmppDiscoveryIq&);
 
 private:
+    QXmppDiscoveryIq buildCapabilities();
+    QByteArray capabilitiesVerificationString();
+    void invalidateCapabilities();
+
     QXmppDiscoveryManagerPrivate* d;
+
+    friend class QXmppClient;
+    friend class QXmppClientPrivate;
 };
 
 #endif  // QXMPPDISCOVERYMANAGER_H
@@ -31,8 +31,231 @@
 #include "QXmppUtils.h"
 
 #include <QDomElement>
+#include <QHash>
+#include <QSet>
+
+class QXmppMamArchivedMessagePrivate : public QSharedData
+{
+public:
+    QString queryId;
+    QString archiveId;
+    QString stanzaId;
+    QString from;
+    QString stamp;
+    QDomElement forwardedElement;
+};
+
+/// \cond
+struct QXmppMamSynchronization
+{
+    QString jid;
+    QDateTime start;
+    // archive id after which the next page starts
+    QString after;
+    // id of the query currently in flight
+    QString queryId;
+    // archive id of the last message received in the current page
+    QString last;
+    // messages of the current page
+    QList<QXmppMessage> messages;
+    QSet<QString> stanzaIds;
+};
+
+class QXmppMamManagerPrivate
+{
+public:
+    QXmppMamMessageStore *store = nullptr;
+    int maximumConcurrentSynchronizations = 3;
+    int synchronizationPageSize = 100;
+    bool batchDeliveryEnabled = false;
+
+    // messages of the current page by query id, for batch delivery
+    QHash<QString, QList<QXmppMamArchivedMessage>> batches;
+
+    // synchronizations by conversation JID
+    QHash<QString, QXmppMamSynchronization> synchronizations;
+    // JIDs of synchronizations waiting for a free slot
+    QStringList pendingSynchronizations;
+    // JIDs of the running synchronizations by query id
+    QHash<QString, QString> synchronizationQueries;
+    // queries of cancelled synchronizations whose results are dropped
+    QSet<QString> discardedQueries;
+};
+
+static QXmppMamQueryIq mamQueryIq(const QString &to,
+                                  const QString &node,
+                                  const QString &jid,
+                                  const QDateTime &start,
+                                  const QDateTime &end,
+                                  const QXmppResultSetQuery &resultSetQuery)
+{
+    QList<QXmppDataForm::Field> fields;
+
+    QXmppDataForm::Field hiddenField(QXmppDataForm::Field::HiddenField);
+    hiddenField.setKey("FORM_TYPE");
+    hiddenField.setValue(ns_mam);
+    fields << hiddenField;
+
+    if (!jid.isEmpty()) {
+        QXmppDataForm::Field jidField;
+        jidField.setKey("with");
+        jidField.setValue(jid);
+        fields << jidField;
+    }
+
+    if (start.isValid()) {
+        QXmppDataForm::Field startField;
+        startField.setKey("start");
+        startField.setValue(QXmppUtils::datetimeToString(start));
+        fields << startField;
+    }
+
+    if (end.isValid()) {
+        QXmppDataForm::Field endField;
+        endField.setKey("end");
+        endField.setValue(QXmppUtils::datetimeToString(end));
+        fields << endField;
+    }
+
+    QXmppDataForm form;
+    form.setType(QXmppDataForm::Submit);
+    form.setFields(fields);
+
+    QXmppMamQueryIq queryIq;
+    queryIq.setTo(to);
+    queryIq.setNode(node);
+    queryIq.setQueryId(queryIq.id()); /* reuse the IQ id as query id */
+    queryIq.setForm(form);
+    queryIq.setResultSetQuery(resultSetQuery);
+    return queryIq;
+}
+
+static QXmppMessage parseForwardedMessage(const QDomElement &forwardedElement)
+{
+    QXmppMessage message;
+    message.parse(forwardedElement.firstChildElement("message"));
+
+    QDomElement delayElement = forwardedElement.firstChildElement("delay");
+    if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery) {
+        const QString stamp = delayElement.attribute("stamp");
+        message.setStamp(QXmppUtils::datetimeFromString(stamp));
+    }
+    return message;
+}
+/// \endcond
+
+QXmppMamArchivedMessage::QXmppMamArchivedMessage()
+    : d(new QXmppMamArchivedMessagePrivate)
+{
+}
 
 /// \cond
+QXmppMamArchivedMessage::QXmppMamArchivedMessage(const QString &queryId, const QDomElement &resultElement)
+    : d(new QXmppMamArchivedMessagePrivate)
+{
+    d->queryId = queryId;
+    d->archiveId = resultElement.attribute("id");
+    d->forwardedElement = resultElement.firstChildElement("forwarded");
+
+    const QDomElement messageElement = d->forwardedElement.firstChildElement("message");
+    d->from = messageElement.attribute("from");
+
+    const QDomElement delayElement = d->forwardedElement.firstChildElement("delay");
+    if (delayElement.namespaceURI() == ns_delayed_delivery)
+        d->stamp = delayElement.attribute("stamp");
+
+    for (auto child = messageElement.firstChildElement("stanza-id");
+         !child.isNull();
+         child = child.nextSiblingElement("stanza-id")) {
+        if (child.namespaceURI() == ns_sid) {
+            d->stanzaId = child.attribute("id");
+            break;
+        }
+    }
+}
+/// \endcond
+
+QXmppMamArchivedMessage::QXmppMamArchivedMessage(const QXmppMamArchivedMessage &) = default;
+
+QXmppMamArchivedMessage::~QXmppMamArchivedMessage() = default;
+
+QXmppMamArchivedMessage &QXmppMamArchivedMessage::operator=(const QXmppMamArchivedMessage &) = default;
+
+///
+/// Returns the ID of the query this message was received for.
+///
+QString QXmppMamArchivedMessage::queryId() const
+{
+    return d->queryId;
+}
+
+///
+/// Returns the ID of the message in the archive.
+///
+/// This is the stanza ID assigned by the archive and can be used to page
+/// through the archive.
+///
+QString QXmppMamArchivedMessage::archiveId() const
+{
+    return d->archiveId;
+}
+
+///
+/// Returns the \xep{0359}: Unique and Stable Stanza IDs stanza ID contained in
+/// the message itself, if any.
+///
+QString QXmppMamArchivedMessage::stanzaId() const
+{
+    return d->stanzaId;
+}
+
+///
+/// Returns the JID of the sender of the message.
+///
+QString QXmppMamArchivedMessage::from() const
+{
+    return d->from;
+}
+
+///
+/// Returns the time the message was archived at.
+///
+QDateTime QXmppMamArchivedMessage::stamp() const
+{
+    return QXmppUtils::datetimeFromString(d->stamp);
+}
+
+///
+/// Returns the raw forwarded element containing the message.
+///
+QDomElement QXmppMamArchivedMessage::element() const
+{
+    return d->forwardedElement;
+}
+
+///
+/// Decodes and returns the complete message.
+///
+QXmppMessage QXmppMamArchivedMessage::message() const
+{
+    if (d->forwardedElement.isNull())
+        return QXmppMessage();
+    return parseForwardedMessage(d->forwardedElement);
+}
+
+/// \cond
+QXmppMamMessageStore::~QXmppMamMessageStore() = default;
+
+QXmppMamManager::QXmppMamManager()
+    : d(new QXmppMamManagerPrivate)
+{
+}
+
+QXmppMamManager::~QXmppMamManager()
+{
+    delete d;
+}
+
 QStringList QXmppMamManager::discoveryFeatures() const
 {
     // XEP-0313: Message Archive Management
@@ -48,28 +271,105 @@ bool QXmppMamManager::handleStanza(const QDomElement &element)
             QString queryId = resultElement.attribute("queryid");
             if (!forwardedElement.isNull() && forwardedElement.namespaceURI() == ns_forwarding) {
                 QDomElement messageElement = forwardedElement.firstChildElement("message");
-                QDomElement delayElement = forwardedElement.firstChildElement("delay");
-                if (!messageElement.isNull()) {
-                    QXmppMessage message;
-                    message.parse(messageElement);
-                    if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery) {
-                        const QString stamp = delayElement.attribute("stamp");
-                        message.setStamp(QXmppUtils::datetimeFromString(stamp));
+                if (!messageElement.isNull() && !d->discardedQueries.contains(queryId)) {
+                    const QString syncJid = d->synchronizationQueries.value(queryId);
+                    if (syncJid.isEmpty() && d->batchDeliveryEnabled) {
+                        // decoding is deferred until the application asks for it
+                        d->batches[queryId] << QXmppMamArchivedMessage(queryId, resultElement);
+                    } else if (syncJid.isEmpty()) {
+                        emit archivedMessageReceived(queryId, parseForwardedMessage(forwardedElement));
+                    } else {
+                        QXmppMessage message = parseForwardedMessage(forwardedElement);
+
+                        // the result id is the stanza id assigned by the archive
+                        auto &sync = d->synchronizations[syncJid];
+                        const QString stanzaId = resultElement.attribute("id");
+                        if (!stanzaId.isEmpty()) {
+                            message.setStanzaId(stanzaId);
+                            message.setStanzaIdBy(element.attribute("from", client()->configuration().jidBare()));
+                            sync.last = stanzaId;
+                        }
+
+                        if (stanzaId.isEmpty() ||
+                            (!sync.stanzaIds.contains(stanzaId) &&
+                             !(d->store && d->store->containsMessage(syncJid, stanzaId)))) {
+                            sync.stanzaIds.insert(stanzaId);
+                            sync.messages << message;
+                        }
                     }
-                    emit archivedMessageReceived(queryId, message);
                 }
             }
             return true;
         }
+    } else if (element.tagName() == "iq" && d->discardedQueries.remove(element.attribute("id"))) {
+        return true;
+    } else if (element.tagName() == "iq" &&
+               (element.attribute("type") == "result" || element.attribute("type") == "error") &&
+               d->synchronizationQueries.contains(element.attribute("id"))) {
+        const QString queryId = element.attribute("id");
+        const QString jid = d->synchronizationQueries.take(queryId);
+        auto &sync = d->synchronizations[jid];
+
+        QXmppMamResultIq result;
+        result.parse(element);
+
+        if (result.type() == QXmppIq::Error) {
+            d->synchronizations.remove(jid);
+            emit synchronizationFailed(jid, result.error());
+            startNextSynchronizations();
+            return true;
+        }
+
+        // deliver the page
+        const QList<QXmppMessage> messages = sync.messages;
+        QString lastArchiveId = result.resultSetReply().last();
+        if (lastArchiveId.isEmpty())
+            lastArchiveId = sync.last.isEmpty() ? sync.after : sync.last;
+        sync.after = lastArchiveId;
+        sync.last.clear();
+        sync.messages.clear();
+        sync.stanzaIds.clear();
+
+        if (!messages.isEmpty()) {
+            if (d->store)
+                d->store->storeMessages(jid, messages, lastArchiveId);
+            emit messagesSynchronized(jid, messages);
+        }
+
+        // the synchronization may have been cancelled meanwhile
+        if (!d->synchronizations.contains(jid))
+            return true;
+
+        if (result.complete() || result.resultSetReply().last().isEmpty()) {
+            d->synchronizations.remove(jid);
+            emit synchronizationFinished(jid);
+            startNextSynchronizations();
+        } else {
+            sendSynchronizationQuery(jid);
+        }
+        return true;
     } else if (QXmppMamResultIq::isMamResultIq(element)) {
         QXmppMamResultIq result;
         result.parse(element);
+
+        const auto batch = d->batches.take(result.id());
+        if (d->batchDeliveryEnabled)
+            emit archivedMessagesReceived(result.id(), batch);
+
         emit resultsRecieved(result.id(), result.resultSetReply(), result.complete());
         return true;
     }
 
     return false;
 }
+
+void QXmppMamManager::setClient(QXmppClient *client)
+{
+    QXmppClientExtension::setClient(client);
+
+    connect(client, &QXmppClient::connected,
+            this, &QXmppMamManager::_q_connected);
+}
 /// \endcond
 
 /// Retrieves archived messages. For each received message, the
@@ -98,45 +398,243 @@ QString QXmppMamManager::retrieveArchivedMessages(const QString &to,
                                                   const QDateTime &end,
                                                   const QXmppResultSetQuery &resultSetQuery)
 {
-    QList<QXmppDataForm::Field> fields;
+    const QXmppMamQueryIq queryIq = mamQueryIq(to, node, jid, start, end, resultSetQuery);
+    client()->sendPacket(queryIq);
+    return queryIq.queryId();
+}
 
-    QXmppDataForm::Field hiddenField(QXmppDataForm::Field::HiddenField);
-    hiddenField.setKey("FORM_TYPE");
-    hiddenField.setValue(ns_mam);
-    fields << hiddenField;
+///
+/// Returns the local message store used to synchronize conversations.
+///
+/// \since QXmpp 1.4
+///
+QXmppMamMessageStore *QXmppMamManager::messageStore() const
+{
+    return d->store;
+}
 
-    if (!jid.isEmpty()) {
-        QXmppDataForm::Field jidField;
-        jidField.setKey("with");
-        jidField.setValue(jid);
-        fields << jidField;
+///
+/// Sets the local message store used to synchronize conversations.
+///
+/// The store is used to find the point from which to continue synchronizing
+/// and to skip messages that have already been stored. The manager does not
+/// take ownership of the store.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::setMessageStore(QXmppMamMessageStore *store)
+{
+    d->store = store;
+}
+
+///
+/// Returns the maximum number of conversations that are synchronized
+/// concurrently.
+///
+/// By default this is 3.
+///
+/// \since QXmpp 1.4
+///
+int QXmppMamManager::maximumConcurrentSynchronizations() const
+{
+    return d->maximumConcurrentSynchronizations;
+}
+
+///
+/// Sets the maximum number of conversations that are synchronized
+/// concurrently.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::setMaximumConcurrentSynchronizations(int count)
+{
+    d->maximumConcurrentSynchronizations = qMax(1, count);
+    startNextSynchronizations();
+}
+
+///
+/// Returns true if archived messages are delivered page by page as
+/// QXmppMamArchivedMessage records.
+///
+/// \sa setBatchDeliveryEnabled()
+///
+/// \since QXmpp 1.4
+///
+bool QXmppMamManager::isBatchDeliveryEnabled() const
+{
+    return d->batchDeliveryEnabled;
+}
+
+///
+/// Sets whether archived messages are delivered page by page.
+///
+/// When enabled, the messages received for queries sent with
+/// retrieveArchivedMessages() are collected and delivered at once by
+/// archivedMessagesReceived() when the page is complete, instead of emitting
+/// archivedMessageReceived() for each message. The messages are not decoded
+/// completely until QXmppMamArchivedMessage::message() is called.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::setBatchDeliveryEnabled(bool enabled)
+{
+    d->batchDeliveryEnabled = enabled;
+}
+
+///
+/// Returns the number of messages requested per page while synchronizing.
+///
+/// By default this is 100.
+///
+/// \since QXmpp 1.4
+///
+int QXmppMamManager::synchronizationPageSize() const
+{
+    return d->synchronizationPageSize;
+}
+
+///
+/// Sets the number of messages requested per page while synchronizing.
+///
+/// The server may return fewer messages per page.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::setSynchronizationPageSize(int size)
+{
+    d->synchronizationPageSize = size;
+}
+
+///
+/// Synchronizes the conversation with \a jid from the user's archive.
+///
+/// The archive is paged through automatically, starting after the newest
+/// message in the messageStore(). If the store has no messages of the
+/// conversation, the synchronization starts at \a start, or at the beginning
+/// of the archive if \a start is invalid.
+///
+/// New messages are reported page by page using messagesSynchronized() and
+/// passed to the message store. Once the end of the archive has been reached,
+/// synchronizationFinished() is emitted.
+///
+/// Up to maximumConcurrentSynchronizations() conversations are synchronized
+/// at the same time, others are queued. Synchronizations interrupted by a
+/// disconnection are continued after reconnecting.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::synchronize(const QString &jid, const QDateTime &start)
+{
+    if (d->synchronizations.contains(jid))
+        return;
+
+    QXmppMamSynchronization sync;
+    sync.jid = jid;
+    sync.start = start;
+    if (d->store)
+        sync.after = d->store->lastArchiveId(jid);
+    d->synchronizations.insert(jid, sync);
+    d->pendingSynchronizations << jid;
+
+    startNextSynchronizations();
+}
+
+///
+/// Synchronizes the conversations with each of the given \a jids.
+///
+/// \sa synchronize()
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::synchronize(const QStringList &jids, const QDateTime &start)
+{
+    for (const auto &jid : jids)
+        synchronize(jid, start);
+}
+
+///
+/// Cancels the synchronization of the conversation with \a jid.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMamManager::cancelSynchronization(const QString &jid)
+{
+    const auto itr = d->synchronizations.find(jid);
+    if (itr == d->synchronizations.end())
+        return;
+
+    if (d->synchronizationQueries.remove(itr->queryId))
+        d->discardedQueries.insert(itr->queryId);
+    d->pendingSynchronizations.removeAll(jid);
+    d->synchronizations.erase(itr);
+
+    startNextSynchronizations();
+}
+
+///
+/// Returns true if the conversation with \a jid is being synchronized or is
+/// queued for synchronization.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppMamManager::isSynchronizing(const QString &jid) const
+{
+    return d->synchronizations.contains(jid);
+}
+
+void QXmppMamManager::_q_connected()
+{
+    // the stream was resumed, the queries in flight will still be answered
+    if (client()->isStreamResumed()) {
+        startNextSynchronizations();
+        return;
     }
 
-    if (start.isValid()) {
-        QXmppDataForm::Field startField;
-        startField.setKey("start");
-        startField.setValue(QXmppUtils::datetimeToString(start));
-        fields << startField;
+    d->batches.clear();
+
+    // queries sent before the disconnection will not be answered, restart
+    // them after the last complete page, the partial page is requested again
+    const QStringList jids = d->synchronizationQueries.values();
+    d->synchronizationQueries.clear();
+    d->discardedQueries.clear();
+    for (const auto &jid : jids) {
+        auto &sync = d->synchronizations[jid];
+        sync.last.clear();
+        sync.messages.clear();
+        sync.stanzaIds.clear();
+        sendSynchronizationQuery(jid);
     }
 
-    if (end.isValid()) {
-        QXmppDataForm::Field endField;
-        endField.setKey("end");
-        endField.setValue(QXmppUtils::datetimeToString(end));
-        fields << endField;
+    startNextSynchronizations();
+}
+
+void QXmppMamManager::startNextSynchronizations()
+{
+    if (!client())
+        return;
+
+    while (d->synchronizationQueries.size() < d->maximumConcurrentSynchronizations &&
+           !d->pendingSynchronizations.isEmpty()) {
+        sendSynchronizationQuery(d->pendingSynchronizations.takeFirst());
     }
+}
 
-    QXmppDataForm form;
-    form.setType(QXmppDataForm::Submit);
-    form.setFields(fields);
+void QXmppMamManager::sendSynchronizationQuery(const QString &jid)
+{
+    auto &sync = d->synchronizations[jid];
 
-    QXmppMamQueryIq queryIq;
-    QString queryId = queryIq.id(); /* reuse the IQ id as query id */
-    queryIq.setTo(to);
-    queryIq.setNode(node);
-    queryIq.setQueryId(queryId);
-    queryIq.setForm(form);
-    queryIq.setResultSetQuery(resultSetQuery);
+    QXmppResultSetQuery resultSetQuery;
+    resultSetQuery.setMax(d->synchronizationPageSize);
+    resultSetQuery.setAfter(sync.after);
+
+    // the start time is only needed as long as there is no archive id
+    const QXmppMamQueryIq queryIq = mamQueryIq(QString(), QString(), jid,
+                                               sync.after.isEmpty() ? sync.start : QDateTime(),
+                                               QDateTime(),
+                                               resultSetQuery);
+    sync.queryId = queryIq.queryId();
+    d->synchronizationQueries.insert(sync.queryId, jid);
+
+    // if this fails, the query is sent again once we are connected
     client()->sendPacket(queryIq);
-    return queryId;
 }
@@ -25,11 +25,91 @@
 #define QXMPPMAMMANAGER_H
 
 #include "QXmppClientExtension.h"
+#include "QXmppMessage.h"
 #include "QXmppResultSet.h"
 
 #include <QDateTime>
+#include <QDomElement>
+#include <QSharedDataPointer>
 
-class QXmppMessage;
+class QXmppMamArchivedMessagePrivate;
+class QXmppMamManagerPrivate;
+
+///
+/// \brief The QXmppMamArchivedMessage class is a lightweight record of a
+/// message received from a \xep{0313}: Message Archive Management archive.
+///
+/// Only the IDs, the sender and the time stamp are extracted from the
+/// stanza. The complete message is decoded when message() is called.
+///
+/// \sa QXmppMamManager::setBatchDeliveryEnabled()
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppMamArchivedMessage
+{
+public:
+    QXmppMamArchivedMessage();
+    QXmppMamArchivedMessage(const QXmppMamArchivedMessage &);
+    ~QXmppMamArchivedMessage();
+
+    QXmppMamArchivedMessage &operator=(const QXmppMamArchivedMessage &);
+
+    QString queryId() const;
+    QString archiveId() const;
+    QString stanzaId() const;
+    QString from() const;
+    QDateTime stamp() const;
+
+    QDomElement element() const;
+    QXmppMessage message() const;
+
+private:
+    QXmppMamArchivedMessage(const QString &queryId, const QDomElement &resultElement);
+
+    QSharedDataPointer<QXmppMamArchivedMessagePrivate> d;
+    friend class QXmppMamManager;
+};
+
+///
+/// \brief The QXmppMamMessageStore class is the interface to the local
+/// message storage used by QXmppMamManager to synchronize conversations.
+///
+/// Messages are identified by the stanza ID assigned by the archive
+/// (\xep{0359}: Unique and Stable Stanza IDs), which is also the ID used to
+/// page through the archive.
+///
+/// \sa QXmppMamManager::synchronize()
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppMamMessageStore
+{
+public:
+    virtual ~QXmppMamMessageStore();
+
+    ///
+    /// Returns the archive ID of the newest stored message of the
+    /// conversation with \a jid or an empty string if there is none.
+    ///
+    /// Synchronization continues after this message.
+    ///
+    virtual QString lastArchiveId(const QString &jid) = 0;
+
+    ///
+    /// Returns true if the message with the archive's \a stanzaId has already
+    /// been stored for the conversation with \a jid.
+    ///
+    virtual bool containsMessage(const QString &jid, const QString &stanzaId) = 0;
+
+    ///
+    /// Stores a batch of \a messages of the conversation with \a jid.
+    ///
+    /// \a lastArchiveId is the archive ID of the newest message received so
+    /// far and should be returned by lastArchiveId() from now on.
+    ///
+    virtual void storeMessages(const QString &jid, const QList<QXmppMessage> &messages, const QString &lastArchiveId) = 0;
+};
 
 ///
 /// \brief The QXmppMamManager class makes it possible to access message
@@ -52,6 +132,9 @@ class QXMPP_EXPORT QXmppMamManager : public QXmppClientExtension
     Q_OBJECT
 
 public:
+    QXmppMamManager();
+    ~QXmppMamManager() override;
+
     QString retrieveArchivedMessages(const QString &to = QString(),
                                      const QString &node = QString(),
                                      const QString &jid = QString(),
@@ -59,6 +142,23 @@ public:
                                      const QDateTime &end = QDateTime(),
                                      const QXmppResultSetQuery &resultSetQuery = QXmppResultSetQuery());
 
+    QXmppMamMessageStore *messageStore() const;
+    void setMessageStore(QXmppMamMessageStore *store);
+
+    int maximumConcurrentSynchronizations() const;
+    void setMaximumConcurrentSynchronizations(int count);
+
+    bool isBatchDeliveryEnabled() const;
+    void setBatchDeliveryEnabled(bool enabled);
+
+    int synchronizationPageSize() const;
+    void setSynchronizationPageSize(int size);
+
+    void synchronize(const QString &jid, const QDateTime &start = QDateTime());
+    void synchronize(const QStringList &jids, const QDateTime &start = QDateTime());
+    void cancelSynchronization(const QString &jid);
+    bool isSynchronizing(const QString &jid) const;
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement &element) override;
@@ -69,10 +169,61 @@ Q_SIGNALS:
     void archivedMessageReceived(const QString &queryId,
                                  const QXmppMessage &message);
 
+    ///
+    /// This signal is emitted with all messages of a page when batch delivery
+    /// is enabled. It is emitted right before resultsRecieved().
+    ///
+    /// \sa setBatchDeliveryEnabled()
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void archivedMessagesReceived(const QString &queryId,
+                                  const QList<QXmppMamArchivedMessage> &messages);
+
     /// This signal is emitted when all results for a request have been received
     void resultsRecieved(const QString &queryId,
                          const QXmppResultSetReply &resultSetReply,
                          bool complete);
+
+    ///
+    /// This signal is emitted when a page of new messages of the conversation
+    /// with \a jid has been synchronized.
+    ///
+    /// Messages already contained in the messageStore() are not included.
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void messagesSynchronized(const QString &jid, const QList<QXmppMessage> &messages);
+
+    ///
+    /// This signal is emitted when the conversation with \a jid has been
+    /// synchronized completely.
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void synchronizationFinished(const QString &jid);
+
+    ///
+    /// This signal is emitted when the archive returned an error while
+    /// synchronizing the conversation with \a jid.
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void synchronizationFailed(const QString &jid, const QXmppStanza::Error &error);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client) override;
+    /// \endcond
+
+private Q_SLOTS:
+    void _q_connected();
+
+private:
+    void startNextSynchronizations();
+    void sendSynchronizationQuery(const QString &jid);
+
+    QXmppMamManagerPrivate *d;
 };
 
 #endif
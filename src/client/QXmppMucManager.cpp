@@ -30,7 +30,10 @@
 #include "QXmppMucIq.h"
 #include "QXmppUtils.h"
 
+#include <algorithm>
+
 #include <QDomElement>
+#include <QHash>
 #include <QMap>
 
 class QXmppMucManagerPrivate
@@ -43,12 +46,30 @@ class QXmppMucRoomPrivate
 {
 public:
     QString ownJid() const { return jid + "/" + nickName; }
+    bool isOwnPresence(const QXmppPresence &presence) const;
+    void clearParticipants(QXmppMucRoom *room);
+
     QXmppClient *client;
     QXmppDiscoveryManager *discoManager;
     QXmppMucRoom::Actions allowedActions;
     QString jid;
     QString name;
-    QMap<QString, QXmppPresence> participants;
+
+    // occupants indexed by occupant JID
+    //
+    // The full presence is kept rather than a reduced record, as
+    // participantPresence() exposes extensions such as entity capabilities
+    // and vCard updates. QXmppPresence is implicitly shared, so each entry
+    // only references the parsed stanza.
+    QHash<QString, QXmppPresence> participants;
+    // sorted list of occupant JIDs, rebuilt lazily
+    mutable QStringList participantList;
+    mutable bool participantListValid = false;
+
+    // bulk join: occupant presences are collected silently until our own
+    // presence arrives
+    bool bulkJoinEnabled = false;
+
     QString password;
     QMap<QString, QXmppMucItem> permissions;
     QSet<QString> permissionsQueue;
@@ -56,6 +77,21 @@ public:
     QString subject;
 };
 
+bool QXmppMucRoomPrivate::isOwnPresence(const QXmppPresence &presence) const
+{
+    return presence.from() == ownJid() || presence.mucStatusCodes().contains(110);
+}
+
+void QXmppMucRoomPrivate::clearParticipants(QXmppMucRoom *room)
+{
+    const QStringList removed = participants.keys();
+    participants.clear();
+    participantListValid = false;
+    for (const auto &jid : removed)
+        emit room->participantRemoved(jid);
+    emit room->participantsChanged();
+}
+
 /// Constructs a new QXmppMucManager.
 
 QXmppMucManager::QXmppMucManager()
@@ -267,6 +303,38 @@ bool QXmppMucRoom::join()
     return d->client->sendPacket(packet);
 }
 
+///
+/// Returns true if occupant presences received while joining are collected
+/// and announced at once.
+///
+/// \sa setBulkJoinEnabled()
+///
+/// \since QXmpp 1.4
+///
+bool QXmppMucRoom::isBulkJoinEnabled() const
+{
+    return d->bulkJoinEnabled;
+}
+
+///
+/// Sets whether occupant presences received while joining are collected
+/// and announced at once.
+///
+/// When enabled, no participantAdded() or participantsChanged() signals are
+/// emitted for the occupants the room sends before our own presence. Once our
+/// own presence arrives, participantsLoaded() is emitted with the complete
+/// list of occupants, followed by a single participantsChanged() and joined().
+/// Changes after that are reported incrementally as usual.
+///
+/// This is recommended for rooms with many occupants.
+///
+/// \since QXmpp 1.4
+///
+void QXmppMucRoom::setBulkJoinEnabled(bool enabled)
+{
+    d->bulkJoinEnabled = enabled;
+}
+
 /// Kicks the specified user from the chat room.
 ///
 /// The specified \a jid is the Occupant JID of the form "room@service/nick".
@@ -372,8 +440,9 @@ void QXmppMucRoom::setNickName(const QString &nickName)
 
 QString QXmppMucRoom::participantFullJid(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid).mucItem().jid();
+    const auto itr = d->participants.constFind(jid);
+    if (itr != d->participants.constEnd())
+        return itr.value().mucItem().jid();
     else
         return QString();
 }
@@ -384,8 +453,9 @@ QString QXmppMucRoom::participantFullJid(const QString &jid) const
 
 QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid);
+    const auto itr = d->participants.constFind(jid);
+    if (itr != d->participants.constEnd())
+        return itr.value();
 
     QXmppPresence presence;
     presence.setFrom(jid);
@@ -395,7 +465,22 @@ QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
 
 QStringList QXmppMucRoom::participants() const
 {
-    return d->participants.keys();
+    if (!d->participantListValid) {
+        d->participantList = d->participants.keys();
+        std::sort(d->participantList.begin(), d->participantList.end());
+        d->participantListValid = true;
+    }
+    return d->participantList;
+}
+
+///
+/// Returns the number of participants in the room.
+///
+/// \since QXmpp 1.4
+///
+int QXmppMucRoom::participantCount() const
+{
+    return d->participants.size();
 }
 
 QString QXmppMucRoom::password() const
@@ -532,11 +617,7 @@ void QXmppMucRoom::_q_disconnected()
     const bool wasJoined = isJoined();
 
     // clear chat room participants
-    const QStringList removed = d->participants.keys();
-    d->participants.clear();
-    for (const auto &jid : removed)
-        emit participantRemoved(jid);
-    emit participantsChanged();
+    d->clearParticipants(this);
 
     // update available actions
     if (d->allowedActions != NoAction) {
@@ -597,12 +678,32 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
     if (QXmppUtils::jidToBareJid(jid) != d->jid)
         return;
 
+    // until our own presence arrives the room is sending us its occupants
+    const bool bulkJoining = d->bulkJoinEnabled && !isJoined();
+
     if (presence.type() == QXmppPresence::Available) {
-        const bool added = !d->participants.contains(jid);
-        d->participants.insert(jid, presence);
+        const bool isOwnPresence = d->isOwnPresence(presence);
+
+        // the service may have modified our nickname
+        if (isOwnPresence && !isJoined()) {
+            const QString newNick = QXmppUtils::jidToResource(jid);
+            if (newNick != d->nickName) {
+                d->nickName = newNick;
+                emit nickNameChanged(newNick);
+            }
+        }
+
+        auto itr = d->participants.find(jid);
+        const bool added = itr == d->participants.end();
+        if (added) {
+            d->participants.insert(jid, presence);
+            d->participantListValid = false;
+        } else {
+            itr.value() = presence;
+        }
 
         // refresh allowed actions
-        if (jid == d->ownJid()) {
+        if (isOwnPresence) {
 
             QXmppMucItem mucItem = presence.mucItem();
             Actions newActions = NoAction;
@@ -623,10 +724,23 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
             }
         }
 
-        if (added) {
+        if (bulkJoining) {
+            // occupants are announced all at once with our own presence
+            if (!isOwnPresence)
+                return;
+
+            emit participantsLoaded(participants());
+            emit participantsChanged();
+
+            // request room information
+            if (d->discoManager)
+                d->discoManager->requestInfo(d->jid);
+
+            emit joined();
+        } else if (added) {
             emit participantAdded(jid);
             emit participantsChanged();
-            if (jid == d->ownJid()) {
+            if (isOwnPresence) {
                 // request room information
                 if (d->discoManager)
                     d->discoManager->requestInfo(d->jid);
@@ -637,11 +751,20 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
             emit participantChanged(jid);
         }
     } else if (presence.type() == QXmppPresence::Unavailable) {
-        if (d->participants.contains(jid)) {
-            d->participants.insert(jid, presence);
+        auto itr = d->participants.find(jid);
+        if (itr != d->participants.end()) {
+            if (bulkJoining && jid != d->ownJid()) {
+                // the occupant left before we were announced any
+                d->participants.erase(itr);
+                d->participantListValid = false;
+                return;
+            }
+
+            itr.value() = presence;
 
             emit participantRemoved(jid);
             d->participants.remove(jid);
+            d->participantListValid = false;
             emit participantsChanged();
 
             // check whether this was our own presence
@@ -661,11 +784,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
                 }
 
                 // clear chat room participants
-                const QStringList removed = d->participants.keys();
-                d->participants.clear();
-                for (const auto &jid : removed)
-                    emit participantRemoved(jid);
-                emit participantsChanged();
+                d->clearParticipants(this);
 
                 // update available actions
                 if (d->allowedActions != NoAction) {
@@ -679,6 +798,12 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         }
     } else if (presence.type() == QXmppPresence::Error) {
         if (presence.isMucSupported()) {
+            // discard occupants collected while joining
+            if (bulkJoining) {
+                d->participants.clear();
+                d->participantListValid = false;
+            }
+
             // emit error
             emit error(presence.error());
 
@@ -171,6 +171,10 @@ public:
     /// These JIDs are Occupant JIDs of the form "room@service/nick".
     ///
     QStringList participants() const;
+    int participantCount() const;
+
+    bool isBulkJoinEnabled() const;
+    void setBulkJoinEnabled(bool enabled);
 
     // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
     /// Returns the chat room password.
@@ -227,6 +231,16 @@ Q_SIGNALS:
     void participantsChanged();
     /// \endcond
 
+    ///
+    /// This signal is emitted once the complete list of participants has been
+    /// received while joining with bulk join enabled.
+    ///
+    /// \sa setBulkJoinEnabled()
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void participantsLoaded(const QStringList &jids);
+
     /// This signal is emitted when the room's permissions are received.
     void permissionsReceived(const QList<QXmppMucItem> &permissions);
 
@@ -105,6 +105,7 @@ public:
     QString smId;
     bool canResume;
     bool isResuming;
+    bool isResumed;
     QString resumeHost;
     quint16 resumePort;
 
@@ -120,7 +121,7 @@ private:
 };
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
-    : nextSrvRecordIdx(0), redirectPort(0), bindModeAvailable(false), sessionAvailable(false), sessionStarted(false), isAuthenticated(false), saslClient(nullptr), streamManagementAvailable(false), canResume(false), isResuming(false), resumePort(0), clientStateIndicationEnabled(false), pingTimer(nullptr), timeoutTimer(nullptr), q(qq)
+    : nextSrvRecordIdx(0), redirectPort(0), bindModeAvailable(false), sessionAvailable(false), sessionStarted(false), isAuthenticated(false), saslClient(nullptr), streamManagementAvailable(false), canResume(false), isResuming(false), isResumed(false), resumePort(0), clientStateIndicationEnabled(false), pingTimer(nullptr), timeoutTimer(nullptr), q(qq)
 {
 }
 
@@ -281,10 +282,22 @@ bool QXmppOutgoingClient::isClientStateIndicationEnabled() const
     return d->clientStateIndicationEnabled;
 }
 
+///
+/// Returns true if the current stream is the previous one resumed using
+/// \xep{0198}: Stream Management, rather than a new session.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppOutgoingClient::isStreamResumed() const
+{
+    return d->isResumed;
+}
+
 void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
     d->isAuthenticated = false;
+    d->isResumed = false;
     if (!d->redirectHost.isEmpty() && d->redirectPort > 0) {
         d->connectToHost(d->redirectHost, d->redirectPort);
         d->redirectHost = QString();
@@ -695,6 +708,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         streamManagementResumed.parse(nodeRecv);
         setAcknowledgedSequenceNumber(streamManagementResumed.h());
         d->isResuming = false;
+        d->isResumed = true;
 
         enableStreamManagement(false);
         // we are connected now
@@ -33,6 +33,8 @@
 #include "QXmppTransferManager_p.h"
 #include "QXmppUtils.h"
 
+#include <algorithm>
+
 #include <QCryptographicHash>
 #include <QDomElement>
 #include <QElapsedTimer>
@@ -42,12 +44,52 @@
 #include <QHostAddress>
 #include <QMetaMethod>
 #include <QNetworkInterface>
+#include <QSet>
+#include <QThread>
 #include <QTime>
 #include <QTimer>
 #include <QUrl>
 
 // time to try to connect to a SOCKS host (7 seconds)
 const int socksTimeout = 7000;
+const int ibbMinimumBlockSize = 512;
+const int progressInterval = 100;
+const qint64 fileMapWindowSize = 1024 * 1024;
+
+static const struct
+{
+    QCryptographicHash::Algorithm algorithm;
+    const char *name;
+} hashAlgorithms[] = {
+    { QCryptographicHash::Md5, "md5" },
+    { QCryptographicHash::Sha1, "sha-1" },
+    { QCryptographicHash::Sha224, "sha-224" },
+    { QCryptographicHash::Sha256, "sha-256" },
+    { QCryptographicHash::Sha384, "sha-384" },
+    { QCryptographicHash::Sha512, "sha-512" },
+    { QCryptographicHash::Sha3_256, "sha3-256" },
+    { QCryptographicHash::Sha3_512, "sha3-512" },
+};
+
+static QString hashAlgorithmName(QCryptographicHash::Algorithm algorithm)
+{
+    for (const auto &entry : hashAlgorithms) {
+        if (entry.algorithm == algorithm)
+            return QString::fromLatin1(entry.name);
+    }
+    return QString();
+}
+
+static bool hashAlgorithmFromName(const QString &name, QCryptographicHash::Algorithm &algorithm)
+{
+    for (const auto &entry : hashAlgorithms) {
+        if (name == QLatin1String(entry.name)) {
+            algorithm = entry.algorithm;
+            return true;
+        }
+    }
+    return false;
+}
 
 static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
 {
@@ -64,13 +106,18 @@ public:
 
     QDateTime date;
     QByteArray hash;
+    QCryptographicHash::Algorithm hashAlgorithm;
     QString name;
     QString description;
     qint64 size;
+    bool rangeSupported;
+    qint64 rangeOffset;
+    qint64 rangeLength;
+    QByteArray rangeHash;
 };
 
 QXmppTransferFileInfoPrivate::QXmppTransferFileInfoPrivate()
-    : size(0)
+    : hashAlgorithm(QCryptographicHash::Md5), size(0), rangeSupported(false), rangeOffset(0), rangeLength(0)
 {
 }
 
@@ -108,6 +155,30 @@ void QXmppTransferFileInfo::setHash(const QByteArray &hash)
     d->hash = hash;
 }
 
+///
+/// Returns the algorithm used to compute the file's hash.
+///
+/// \since QXmpp 1.4
+///
+QCryptographicHash::Algorithm QXmppTransferFileInfo::hashAlgorithm() const
+{
+    return d->hashAlgorithm;
+}
+
+///
+/// Sets the algorithm used to compute the file's hash.
+///
+/// MD5 hashes are advertised as described in \xep{0096}: SI File Transfer,
+/// other algorithms use \xep{0300}: Use of Cryptographic Hash Functions in
+/// XMPP.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferFileInfo::setHashAlgorithm(QCryptographicHash::Algorithm algorithm)
+{
+    d->hashAlgorithm = algorithm;
+}
+
 QString QXmppTransferFileInfo::name() const
 {
     return d->name;
@@ -138,9 +209,97 @@ void QXmppTransferFileInfo::setSize(qint64 size)
     d->size = size;
 }
 
+///
+/// Returns whether ranged transfers are supported, or requested when the
+/// file information is part of the answer to an offer.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppTransferFileInfo::isRangeSupported() const
+{
+    return d->rangeSupported;
+}
+
+///
+/// Sets whether ranged transfers are supported.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferFileInfo::setRangeSupported(bool supported)
+{
+    d->rangeSupported = supported;
+}
+
+///
+/// Returns the position in the file at which the requested range starts.
+///
+/// \since QXmpp 1.4
+///
+qint64 QXmppTransferFileInfo::rangeOffset() const
+{
+    return d->rangeOffset;
+}
+
+///
+/// Sets the position in the file at which the requested range starts.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferFileInfo::setRangeOffset(qint64 offset)
+{
+    d->rangeOffset = offset;
+}
+
+///
+/// Returns the number of bytes in the requested range, or 0 if the range
+/// extends to the end of the file.
+///
+/// \since QXmpp 1.4
+///
+qint64 QXmppTransferFileInfo::rangeLength() const
+{
+    return d->rangeLength;
+}
+
+///
+/// Sets the number of bytes in the requested range. 0 means the range
+/// extends to the end of the file.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferFileInfo::setRangeLength(qint64 length)
+{
+    d->rangeLength = length;
+}
+
+///
+/// Returns the SHA-256 hash of the data preceding the requested range, which
+/// the receiver of a resumed transfer already holds.
+///
+/// \since QXmpp 1.4
+///
+QByteArray QXmppTransferFileInfo::rangeHash() const
+{
+    return d->rangeHash;
+}
+
+///
+/// Sets the SHA-256 hash of the data preceding the requested range.
+///
+/// The sender compares it with its own copy of the file before sending the
+/// range, so that a resumed transfer does not complete a different file.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferFileInfo::setRangeHash(const QByteArray &hash)
+{
+    d->rangeHash = hash;
+}
+
 bool QXmppTransferFileInfo::isNull() const
 {
-    return d->date.isNull() && d->description.isEmpty() && d->hash.isEmpty() && d->name.isEmpty() && d->size == 0;
+    return d->date.isNull() && d->description.isEmpty() && d->hash.isEmpty() && d->name.isEmpty() && d->size == 0 &&
+        !d->rangeSupported && d->rangeOffset == 0 && d->rangeLength == 0 && d->rangeHash.isEmpty();
 }
 
 QXmppTransferFileInfo &QXmppTransferFileInfo::operator=(const QXmppTransferFileInfo &other)
@@ -153,6 +312,7 @@ bool QXmppTransferFileInfo::operator==(const QXmppTransferFileInfo &other) const
 {
     return other.d->size == d->size &&
         other.d->hash == d->hash &&
+        other.d->hashAlgorithm == d->hashAlgorithm &&
         other.d->name == d->name;
 }
 
@@ -160,9 +320,32 @@ void QXmppTransferFileInfo::parse(const QDomElement &element)
 {
     d->date = QXmppUtils::datetimeFromString(element.attribute("date"));
     d->hash = QByteArray::fromHex(element.attribute("hash").toLatin1());
+    d->hashAlgorithm = QCryptographicHash::Md5;
     d->name = element.attribute("name");
     d->size = element.attribute("size").toLongLong();
     d->description = element.firstChildElement("desc").text();
+
+    const QDomElement rangeElement = element.firstChildElement("range");
+    d->rangeSupported = !rangeElement.isNull();
+    d->rangeOffset = rangeElement.attribute("offset").toLongLong();
+    d->rangeLength = rangeElement.attribute("length").toLongLong();
+    d->rangeHash.clear();
+    for (QDomElement hashElement = rangeElement.firstChildElement("hash");
+         !hashElement.isNull() && d->rangeHash.isEmpty();
+         hashElement = hashElement.nextSiblingElement("hash")) {
+        if (hashElement.namespaceURI() == ns_hashes &&
+            hashElement.attribute("algo") == hashAlgorithmName(QCryptographicHash::Sha256))
+            d->rangeHash = QByteArray::fromBase64(hashElement.text().toLatin1());
+    }
+
+    // XEP-0300: Use of Cryptographic Hash Functions in XMPP
+    for (QDomElement hashElement = element.firstChildElement("hash");
+         !hashElement.isNull() && d->hash.isEmpty();
+         hashElement = hashElement.nextSiblingElement("hash")) {
+        if (hashElement.namespaceURI() == ns_hashes &&
+            hashAlgorithmFromName(hashElement.attribute("algo"), d->hashAlgorithm))
+            d->hash = QByteArray::fromBase64(hashElement.text().toLatin1());
+    }
 }
 
 void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
@@ -171,7 +354,7 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_stream_initiation_file_transfer);
     if (d->date.isValid())
         writer->writeAttribute("date", QXmppUtils::datetimeToString(d->date));
-    if (!d->hash.isEmpty())
+    if (!d->hash.isEmpty() && d->hashAlgorithm == QCryptographicHash::Md5)
         writer->writeAttribute("hash", d->hash.toHex());
     if (!d->name.isEmpty())
         writer->writeAttribute("name", d->name);
@@ -179,20 +362,122 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
         writer->writeAttribute("size", QString::number(d->size));
     if (!d->description.isEmpty())
         writer->writeTextElement("desc", d->description);
+    if (d->rangeSupported || d->rangeOffset > 0 || d->rangeLength > 0 || !d->rangeHash.isEmpty()) {
+        writer->writeStartElement("range");
+        if (d->rangeOffset > 0)
+            writer->writeAttribute("offset", QString::number(d->rangeOffset));
+        if (d->rangeLength > 0)
+            writer->writeAttribute("length", QString::number(d->rangeLength));
+        if (!d->rangeHash.isEmpty()) {
+            writer->writeStartElement("hash");
+            writer->writeDefaultNamespace(ns_hashes);
+            writer->writeAttribute("algo", hashAlgorithmName(QCryptographicHash::Sha256));
+            writer->writeCharacters(d->rangeHash.toBase64());
+            writer->writeEndElement();
+        }
+        writer->writeEndElement();
+    }
+    if (!d->hash.isEmpty() && d->hashAlgorithm != QCryptographicHash::Md5) {
+        writer->writeStartElement("hash");
+        writer->writeDefaultNamespace(ns_hashes);
+        writer->writeAttribute("algo", hashAlgorithmName(d->hashAlgorithm));
+        writer->writeCharacters(d->hash.toBase64());
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 
+class QXmppTransferManagerPrivate
+{
+public:
+    QXmppTransferManagerPrivate(QXmppTransferManager *qq);
+
+    QXmppTransferIncomingJob *getIncomingJobByRequestId(const QString &jid, const QString &id);
+    QXmppTransferIncomingJob *getIncomingJobBySid(const QString &jid, const QString &sid);
+    QXmppTransferOutgoingJob *getOutgoingJobByRequestId(const QString &jid, const QString &id);
+    QXmppTransferOutgoingJob *getOutgoingJobByIbbId(const QString &jid, const QString &id);
+
+    void addJob(QXmppTransferJob *job);
+    void removeJob(QXmppTransferJob *job);
+    void unindexJob(QXmppTransferJob *job);
+    void setRequestId(QXmppTransferJob *job, const QString &id);
+
+    QXmppTransferOutgoingJob *createOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid);
+    void sendOffer(QXmppTransferJob *job);
+
+    void ibbClose(QXmppTransferJob *job);
+    void ibbSendBlocks(QXmppTransferJob *job);
+    QXmppTransferHasher *createHasher(QCryptographicHash::Algorithm algorithm);
+    void startHasher(QXmppTransferJob *job, QCryptographicHash::Algorithm algorithm);
+    void verifyPrefix(QXmppTransferJob *job, const QByteArray &hash);
+
+    bool acquireBandwidth(QXmppTransferJob *job);
+    void chargeBandwidth(qint64 bytes);
+    void releaseJob(QXmppTransferJob *job);
+    void refillTokens();
+    void schedule();
+    void waitForBandwidth(QXmppTransferJob *job, int delay);
+
+    // transfer scheduling
+    int maximumActiveTransfers;
+    qint64 rateLimit;
+    qint64 tokens;
+    qint64 tokenTime;
+    QElapsedTimer tokenClock;
+    QList<QXmppTransferJob *> activeJobs;
+    QList<QXmppTransferJob *> waitingJobs;
+    QTimer *scheduleTimer;
+
+    QCryptographicHash::Algorithm hashAlgorithm;
+    QThread *hashThread;
+    bool deferredHashing;
+
+    int ibbBlockSize;
+    int ibbWindowSize;
+    int socksBlockSize;
+    int socksStaggerDelay;
+    int socksMaximumAttempts;
+    qint64 socksLowWatermark;
+    qint64 socksHighWatermark;
+    QSet<QXmppTransferJob *> jobs;
+    QHash<QString, QXmppTransferJob *> jobsByRequestId;
+    QHash<QString, QXmppTransferJob *> jobsByStreamHash;
+    QHash<QPair<QString, QString>, QXmppTransferIncomingJob *> incomingJobsBySid;
+    int finishedJobRetention;
+    QString proxy;
+    bool proxyOnly;
+    QXmppSocksServer *socksServer;
+    QXmppTransferJob::Methods supportedMethods;
+
+private:
+    QXmppTransferJob *getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id);
+    QXmppTransferManager *q;
+};
+
 class QXmppTransferJobPrivate
 {
 public:
     QXmppTransferJobPrivate();
+    void releaseHasher();
+    void releasePrefixHasher();
+    bool mapFileWindow();
+    qint64 transferEnd() const;
 
     int blockSize;
     QXmppClient *client;
     QXmppTransferJob::Direction direction;
     qint64 done;
     QXmppTransferJob::Error error;
-    QCryptographicHash hash;
+    QXmppTransferManagerPrivate *manager;
+    int priority;
+    QElapsedTimer progressTimer;
+    QXmppTransferHasher *hasher;
+    bool hashPending;
+    bool offerPending;
+    QXmppTransferHasher *prefixHasher;
+    QByteArray prefixHash;
+    bool prefixPending;
+    QXmppTransferJob::Error prefixError;
     QIODevice *iodevice;
     QString offerId;
     QString jid;
@@ -207,13 +492,26 @@ public:
 
     // file meta-data
     QXmppTransferFileInfo fileInfo;
+    qint64 rangeOffset;
+    qint64 rangeLength;
 
     // for in-band bytestreams
     int ibbSequence;
+    bool ibbEndOfStream;
+    QList<QPair<QString, qint64>> ibbPending;
 
     // for socks5 bytestreams
     QTcpSocket *socksSocket;
     QXmppByteStreamIq::StreamHost socksProxy;
+    QString socksStreamHash;
+    qint64 socksLowWatermark;
+    qint64 socksHighWatermark;
+    QByteArray sendBuffer;
+    uchar *fileMap;
+    qint64 fileMapEnd;
+    qint64 fileMapOffset;
+    qint64 fileMapPosition;
+    qint64 fileMapSize;
 };
 
 QXmppTransferJobPrivate::QXmppTransferJobPrivate()
@@ -222,16 +520,82 @@ QXmppTransferJobPrivate::QXmppTransferJobPrivate()
       direction(QXmppTransferJob::IncomingDirection),
       done(0),
       error(QXmppTransferJob::NoError),
-      hash(QCryptographicHash::Md5),
+      manager(nullptr),
+      priority(0),
+      hasher(nullptr),
+      hashPending(false),
+      offerPending(false),
+      prefixHasher(nullptr),
+      prefixPending(false),
+      prefixError(QXmppTransferJob::NoError),
       iodevice(nullptr),
       method(QXmppTransferJob::NoMethod),
       state(QXmppTransferJob::OfferState),
       deviceIsOwn(false),
+      rangeOffset(0),
+      rangeLength(0),
       ibbSequence(0),
-      socksSocket(nullptr)
+      ibbEndOfStream(false),
+      socksSocket(nullptr),
+      socksLowWatermark(2 * 16384),
+      socksHighWatermark(4 * 16384),
+      fileMap(nullptr),
+      fileMapEnd(0),
+      fileMapOffset(0),
+      fileMapPosition(0),
+      fileMapSize(0)
 {
 }
 
+static void releaseTransferHasher(QXmppTransferHasher *&hasher)
+{
+    if (hasher) {
+        hasher->cancel();
+        hasher->deleteLater();
+        hasher = nullptr;
+    }
+}
+
+void QXmppTransferJobPrivate::releaseHasher()
+{
+    releaseTransferHasher(hasher);
+}
+
+void QXmppTransferJobPrivate::releasePrefixHasher()
+{
+    releaseTransferHasher(prefixHasher);
+}
+
+// Maps the window of the file which follows the current one. The file size is
+// checked first, so that a file which was truncated in the meantime fails the
+// transfer instead of faulting on pages beyond its end.
+bool QXmppTransferJobPrivate::mapFileWindow()
+{
+    auto *file = static_cast<QFile *>(iodevice);
+    if (fileMap) {
+        file->unmap(fileMap);
+        fileMap = nullptr;
+    }
+
+    fileMapOffset += fileMapSize;
+    fileMapPosition = 0;
+    fileMapSize = qMin(fileMapWindowSize, fileMapEnd - fileMapOffset);
+    if (file->size() < fileMapOffset + fileMapSize)
+        return false;
+
+    fileMap = file->map(fileMapOffset, fileMapSize);
+    return fileMap != nullptr;
+}
+
+// Returns the position in the file at which the transfer ends, or 0 if the
+// file size is unknown.
+qint64 QXmppTransferJobPrivate::transferEnd() const
+{
+    if (rangeLength > 0)
+        return rangeOffset + rangeLength;
+    return fileInfo.size();
+}
+
 QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppClient *client, QObject *parent)
     : QXmppLoggable(parent),
       d(new QXmppTransferJobPrivate)
@@ -243,6 +607,12 @@ QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Directi
 
 QXmppTransferJob::~QXmppTransferJob()
 {
+    // the manager finds jobs by keys which are released with the job
+    if (d->manager)
+        d->manager->unindexJob(this);
+
+    d->releaseHasher();
+    d->releasePrefixHasher();
     delete d;
 }
 
@@ -273,6 +643,66 @@ void QXmppTransferJob::accept(const QString &filePath)
     }
 }
 
+///
+/// Call this method if you wish to accept an incoming transfer job and
+/// continue a previously interrupted download of the same file.
+///
+/// If \a filePath already contains the beginning of the file and the sender
+/// supports ranged transfers as described in \xep{0096}: SI File Transfer,
+/// only the missing part of the file is requested. Otherwise the file is
+/// truncated and received in full.
+///
+/// The request carries a hash of the data already received, so that the
+/// sender can refuse to complete a different file. Senders that ignore it
+/// leave the beginning of the file unverified until the file hash, if any,
+/// is checked at the end of the transfer.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferJob::resume(const QString &filePath)
+{
+    if (d->direction == IncomingDirection && d->state == OfferState && !d->iodevice) {
+        auto *file = new QFile(filePath, this);
+        if (!file->open(QIODevice::ReadWrite)) {
+            warning(QString("Could not write to %1").arg(filePath));
+            abort();
+            return;
+        }
+
+        qint64 offset = 0;
+        if (d->fileInfo.isRangeSupported() && file->size() < d->fileInfo.size())
+            offset = file->size();
+        if (!file->resize(offset) || !file->seek(offset)) {
+            warning(QString("Could not resume writing to %1").arg(filePath));
+            abort();
+            return;
+        }
+
+        // the data already on disk is part of the file hash
+        if (offset > 0 && d->hasher)
+            QMetaObject::invokeMethod(d->hasher, "addFileData", Qt::QueuedConnection, Q_ARG(QString, filePath), Q_ARG(qint64, offset));
+
+        d->rangeOffset = offset;
+        d->done = offset;
+        d->iodevice = file;
+        d->deviceIsOwn = true;
+        setLocalFileUrl(QUrl::fromLocalFile(filePath));
+
+        // the offer is answered once the received data has been hashed
+        if (offset > 0 && d->manager) {
+            d->prefixPending = true;
+            d->prefixHasher = d->manager->createHasher(QCryptographicHash::Sha256);
+            connect(d->prefixHasher, &QXmppTransferHasher::finished,
+                    this, &QXmppTransferJob::_q_prefixHashFinished);
+            QMetaObject::invokeMethod(d->prefixHasher, "addFileData", Qt::QueuedConnection, Q_ARG(QString, filePath), Q_ARG(qint64, offset));
+            QMetaObject::invokeMethod(d->prefixHasher, "finish", Qt::QueuedConnection);
+            return;
+        }
+
+        setState(QXmppTransferJob::StartState);
+    }
+}
+
 /// Call this method if you wish to accept an incoming transfer job.
 ///
 
@@ -376,6 +806,29 @@ qint64 QXmppTransferJob::speed() const
     return (d->done * 1000.0) / elapsed;
 }
 
+///
+/// Returns the job's priority.
+///
+/// \since QXmpp 1.4
+///
+int QXmppTransferJob::priority() const
+{
+    return d->priority;
+}
+
+///
+/// Sets the job's priority.
+///
+/// When the manager limits the number of active transfers or their rate,
+/// outgoing jobs with a higher priority are served first.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferJob::setPriority(int priority)
+{
+    d->priority = priority;
+}
+
 QXmppTransferJob::State QXmppTransferJob::state() const
 {
     return d->state;
@@ -391,6 +844,72 @@ void QXmppTransferJob::setState(QXmppTransferJob::State state)
     }
 }
 
+// Emits progress() at most every progressInterval milliseconds, and once
+// all data has been transferred.
+void QXmppTransferJob::updateProgress()
+{
+    const qint64 total = fileSize();
+    if (d->progressTimer.isValid() &&
+        d->progressTimer.elapsed() < progressInterval &&
+        (!total || d->done < total))
+        return;
+
+    d->progressTimer.start();
+    emit progress(d->done, total);
+}
+
+void QXmppTransferJob::_q_hashFinished(const QByteArray &hash)
+{
+    d->releaseHasher();
+
+    if (d->direction == OutgoingDirection) {
+        d->fileInfo.setHash(hash);
+
+        // the offer was waiting for the hash
+        if (d->offerPending && d->state == OfferState) {
+            d->offerPending = false;
+            if (hash.isEmpty())
+                terminate(FileAccessError);
+            else if (d->manager)
+                d->manager->sendOffer(this);
+        }
+    } else if (d->hashPending) {
+        d->hashPending = false;
+        terminate(hash == d->fileInfo.hash() ? NoError : FileCorruptError);
+    }
+}
+
+void QXmppTransferJob::_q_prefixHashFinished(const QByteArray &hash)
+{
+    d->releasePrefixHasher();
+    if (!d->prefixPending)
+        return;
+    d->prefixPending = false;
+
+    if (d->direction == IncomingDirection) {
+        // answer the offer with the hash of the data already received
+        d->prefixHash = hash;
+        if (d->state == OfferState)
+            setState(QXmppTransferJob::StartState);
+        return;
+    }
+
+    if (hash.isEmpty()) {
+        d->prefixError = FileAccessError;
+    } else if (hash != d->prefixHash) {
+        warning(QStringLiteral("The receiver holds a different beginning of %1").arg(d->fileInfo.name()));
+        d->prefixError = FileCorruptError;
+    }
+
+    // resume sending, or stop the transfer once it has started
+    if (d->state == TransferState) {
+        if (d->prefixError != NoError)
+            terminate(d->prefixError);
+        else if (d->manager)
+            d->manager->waitForBandwidth(this, 0);
+    }
+}
+
 void QXmppTransferJob::_q_terminated()
 {
     emit stateChanged(d->state);
@@ -408,6 +927,28 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
     d->error = cause;
     d->state = FinishedState;
 
+    // outgoing files keep being hashed after a successful transfer
+    if (cause != NoError || d->direction == IncomingDirection)
+        d->releaseHasher();
+    d->releasePrefixHasher();
+    d->prefixPending = false;
+
+    // release buffers, unacknowledged blocks no longer refer to the job
+    if (d->manager)
+        d->manager->unindexJob(this);
+    d->sendBuffer.clear();
+    d->ibbPending.clear();
+
+    // release file mapping
+    if (d->fileMapEnd) {
+        auto *file = static_cast<QFile *>(d->iodevice);
+        if (d->fileMap)
+            file->unmap(d->fileMap);
+        file->seek(d->fileMapOffset + d->fileMapPosition);
+        d->fileMap = nullptr;
+        d->fileMapEnd = 0;
+    }
+
     // close IO device
     if (d->iodevice && d->deviceIsOwn)
         d->iodevice->close();
@@ -424,22 +965,35 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
 
 /// \cond
 QXmppTransferIncomingJob::QXmppTransferIncomingJob(const QString &jid, QXmppClient *client, QObject *parent)
-    : QXmppTransferJob(jid, IncomingDirection, client, parent), m_candidateClient(nullptr), m_candidateTimer(nullptr)
+    : QXmppTransferJob(jid, IncomingDirection, client, parent), m_candidateTimer(nullptr), m_candidateDelay(0), m_maximumCandidates(1)
 {
 }
 
 void QXmppTransferIncomingJob::checkData()
 {
-    if ((d->fileInfo.size() && d->done != d->fileInfo.size()) ||
-        (!d->fileInfo.hash().isEmpty() && d->hash.result() != d->fileInfo.hash()))
+    if (d->hashPending)
+        return;
+
+    if (d->transferEnd() && d->done != d->transferEnd()) {
         terminate(QXmppTransferJob::FileCorruptError);
-    else
+    } else if (!d->fileInfo.hash().isEmpty() && d->hasher) {
+        // wait for the hashing thread to catch up
+        d->hashPending = true;
+        QMetaObject::invokeMethod(d->hasher, "finish", Qt::QueuedConnection);
+    } else {
         terminate(QXmppTransferJob::NoError);
+    }
 }
 
 void QXmppTransferIncomingJob::connectToNextHost()
 {
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
     if (m_streamCandidates.isEmpty()) {
+        if (!m_candidates.isEmpty())
+            return;
+
         // could not connect to any stream host
         QXmppByteStreamIq response;
         response.setId(m_streamOfferId);
@@ -454,36 +1008,52 @@ void QXmppTransferIncomingJob::connectToNextHost()
         return;
     }
 
+    if (m_candidates.size() >= qMax(1, m_maximumCandidates))
+        return;
+
     // try next host
-    m_candidateHost = m_streamCandidates.takeFirst();
-    info(QString("Connecting to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    const QXmppByteStreamIq::StreamHost host = m_streamCandidates.takeFirst();
+    info(QString("Connecting to streamhost: %1 (%2 %3)").arg(host.jid(), host.host(), QString::number(host.port())));
 
     const QString hostName = streamHash(d->sid,
                                         d->jid,
                                         d->client->configuration().jid());
 
     // try to connect to stream host
-    m_candidateClient = new QXmppSocksClient(m_candidateHost.host(), m_candidateHost.port(), this);
-    m_candidateTimer = new QTimer(this);
-
-    connect(m_candidateClient, &QAbstractSocket::disconnected,
-            this, &QXmppTransferIncomingJob::_q_candidateDisconnected);
-    connect(m_candidateClient, &QXmppSocksClient::ready,
+    auto *candidate = new QXmppSocksClient(host.host(), host.port(), this);
+    m_candidates.insert(candidate, host);
+
+    connect(candidate, &QAbstractSocket::stateChanged, this, [this, candidate](QAbstractSocket::SocketState state) {
+        if (state == QAbstractSocket::UnconnectedState)
+            candidateFailed(candidate);
+    });
+    connect(candidate, &QXmppSocksClient::ready,
             this, &QXmppTransferIncomingJob::_q_candidateReady);
-    connect(m_candidateTimer, &QTimer::timeout,
-            this, &QXmppTransferIncomingJob::_q_candidateDisconnected);
+    QTimer::singleShot(socksTimeout, candidate, [this, candidate]() {
+        candidateFailed(candidate);
+    });
+    candidate->connectToHost(hostName, 0);
 
-    m_candidateTimer->setSingleShot(true);
-    m_candidateTimer->start(socksTimeout);
-    m_candidateClient->connectToHost(hostName, 0);
+    // race the next host if this one does not answer quickly
+    if (!m_streamCandidates.isEmpty())
+        m_candidateTimer->start(m_candidateDelay);
 }
 
-void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
+void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq, int staggerDelay, int maximumAttempts)
 {
 
     m_streamCandidates = iq.streamHosts();
     m_streamOfferId = iq.id();
     m_streamOfferFrom = iq.from();
+    m_candidateDelay = staggerDelay;
+    m_maximumCandidates = maximumAttempts;
+
+    if (!m_candidateTimer) {
+        m_candidateTimer = new QTimer(this);
+        m_candidateTimer->setSingleShot(true);
+        connect(m_candidateTimer, &QTimer::timeout,
+                this, &QXmppTransferIncomingJob::connectToNextHost);
+    }
 
     connectToNextHost();
 }
@@ -494,24 +1064,40 @@ bool QXmppTransferIncomingJob::writeData(const QByteArray &data)
     if (written < 0)
         return false;
     d->done += written;
-    if (!d->fileInfo.hash().isEmpty())
-        d->hash.addData(data);
-    progress(d->done, d->fileInfo.size());
+    if (d->hasher)
+        QMetaObject::invokeMethod(d->hasher, "addData", Qt::QueuedConnection, Q_ARG(QByteArray, data));
+    updateProgress();
     return true;
 }
 
 void QXmppTransferIncomingJob::_q_candidateReady()
 {
-    if (!m_candidateClient)
+    auto *candidate = qobject_cast<QXmppSocksClient *>(sender());
+    if (!candidate || !m_candidates.contains(candidate))
         return;
 
-    info(QString("Connected to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    const QXmppByteStreamIq::StreamHost host = m_candidates.take(candidate);
+    if (d->state == QXmppTransferJob::FinishedState) {
+        candidate->deleteLater();
+        return;
+    }
+
+    info(QString("Connected to streamhost: %1 (%2 %3)").arg(host.jid(), host.host(), QString::number(host.port())));
+
+    // cancel the other attempts
+    m_candidateTimer->stop();
+    m_streamCandidates.clear();
+    const auto others = m_candidates.keys();
+    m_candidates.clear();
+    for (auto *other : others) {
+        other->disconnect(this);
+        other->abort();
+        other->deleteLater();
+    }
 
     setState(QXmppTransferJob::TransferState);
-    d->socksSocket = m_candidateClient;
-    m_candidateClient = nullptr;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = nullptr;
+    candidate->disconnect(this);
+    d->socksSocket = candidate;
 
     connect(d->socksSocket, &QIODevice::readyRead, this, &QXmppTransferIncomingJob::_q_receiveData);
     connect(d->socksSocket, &QAbstractSocket::disconnected, this, &QXmppTransferIncomingJob::_q_disconnected);
@@ -521,24 +1107,24 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     ackIq.setTo(m_streamOfferFrom);
     ackIq.setType(QXmppIq::Result);
     ackIq.setSid(d->sid);
-    ackIq.setStreamHostUsed(m_candidateHost.jid());
+    ackIq.setStreamHostUsed(host.jid());
     d->client->sendPacket(ackIq);
 }
 
-void QXmppTransferIncomingJob::_q_candidateDisconnected()
+void QXmppTransferIncomingJob::candidateFailed(QXmppSocksClient *candidate)
 {
-    if (!m_candidateClient)
+    if (!m_candidates.contains(candidate))
         return;
 
-    warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    const QXmppByteStreamIq::StreamHost host = m_candidates.take(candidate);
+    warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(host.jid(), host.host(), QString::number(host.port())));
 
-    m_candidateClient->deleteLater();
-    m_candidateClient = nullptr;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = nullptr;
+    candidate->disconnect(this);
+    candidate->deleteLater();
 
     // try next host
-    connectToNextHost();
+    if (d->state != QXmppTransferJob::FinishedState)
+        connectToNextHost();
 }
 
 void QXmppTransferIncomingJob::_q_disconnected()
@@ -559,11 +1145,68 @@ void QXmppTransferIncomingJob::_q_receiveData()
         writeData(d->socksSocket->readAll());
 
         // if we have received all the data, stop here
-        if (fileSize() && d->done >= fileSize())
+        if (d->transferEnd() && d->done >= d->transferEnd())
             checkData();
     }
 }
 
+QXmppTransferHasher::QXmppTransferHasher(QCryptographicHash::Algorithm algorithm)
+    : m_hash(algorithm)
+{
+}
+
+void QXmppTransferHasher::cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void QXmppTransferHasher::addData(const QByteArray &data)
+{
+    m_hash.addData(data);
+}
+
+void QXmppTransferHasher::hashFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit finished(QByteArray());
+        return;
+    }
+
+    QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+    qint64 length;
+    while ((length = file.read(buffer.data(), buffer.size())) > 0) {
+        if (m_cancelled.loadAcquire())
+            return;
+        m_hash.addData(buffer.constData(), int(length));
+    }
+
+    // an empty hash reports a read error
+    emit finished(length == 0 ? m_hash.result() : QByteArray());
+}
+
+void QXmppTransferHasher::addFileData(const QString &filePath, qint64 length)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+    while (length > 0 && !m_cancelled.loadAcquire()) {
+        const qint64 read = file.read(buffer.data(), qMin<qint64>(buffer.size(), length));
+        if (read <= 0)
+            return;
+        m_hash.addData(buffer.constData(), int(read));
+        length -= read;
+    }
+}
+
+void QXmppTransferHasher::finish()
+{
+    if (!m_cancelled.loadAcquire())
+        emit finished(m_hash.result());
+}
+
 QXmppTransferOutgoingJob::QXmppTransferOutgoingJob(const QString &jid, QXmppClient *client, QObject *parent)
     : QXmppTransferJob(jid, OutgoingDirection, client, parent)
 {
@@ -590,6 +1233,23 @@ void QXmppTransferOutgoingJob::startSending()
 {
     setState(QXmppTransferJob::TransferState);
 
+    // local files are written to the socket from memory mapped windows, rather
+    // than read into the send buffer first, if the file cannot be mapped it is
+    // read instead
+    auto *file = qobject_cast<QFile *>(d->iodevice);
+    if (file && !file->isSequential() && file->size() > file->pos()) {
+        d->fileMapEnd = file->size();
+        if (d->transferEnd())
+            d->fileMapEnd = qMin(d->fileMapEnd, file->pos() + d->transferEnd() - d->done);
+        d->fileMapOffset = file->pos();
+        d->fileMapPosition = 0;
+        d->fileMapSize = 0;
+        if (!d->mapFileWindow()) {
+            d->fileMapEnd = 0;
+            d->fileMapSize = 0;
+        }
+    }
+
     connect(d->socksSocket, &QIODevice::bytesWritten, this, &QXmppTransferOutgoingJob::_q_sendData);
     connect(d->iodevice, &QIODevice::readyRead, this, &QXmppTransferOutgoingJob::_q_sendData);
 
@@ -601,12 +1261,189 @@ void QXmppTransferOutgoingJob::_q_disconnected()
     if (d->state == QXmppTransferJob::FinishedState)
         return;
 
-    if (fileSize() && d->done != fileSize())
+    if (d->transferEnd() && d->done != d->transferEnd())
         terminate(QXmppTransferJob::ProtocolError);
     else
         terminate(QXmppTransferJob::NoError);
 }
 
+void QXmppTransferOutgoingJob::_q_sendData()
+{
+    if (d->state != QXmppTransferJob::TransferState)
+        return;
+
+    // wait until the receiver's data has been checked
+    if (d->prefixPending)
+        return;
+    if (d->prefixError != QXmppTransferJob::NoError) {
+        terminate(d->prefixError);
+        return;
+    }
+
+    // don't saturate the outgoing socket
+    if (d->socksSocket->bytesToWrite() > d->socksLowWatermark)
+        return;
+
+    while (d->socksSocket->bytesToWrite() < d->socksHighWatermark) {
+        // check whether we have written the whole file
+        if ((d->fileMapEnd && d->fileMapOffset + d->fileMapPosition >= d->fileMapEnd) ||
+            (d->transferEnd() && d->done >= d->transferEnd())) {
+            if (!d->socksSocket->bytesToWrite())
+                terminate(QXmppTransferJob::NoError);
+            return;
+        }
+
+        if (d->manager && !d->manager->acquireBandwidth(this))
+            return;
+
+        qint64 length;
+        if (d->fileMapEnd) {
+            if (d->fileMapPosition >= d->fileMapSize && !d->mapFileWindow()) {
+                warning(QStringLiteral("Could not map file at offset %1").arg(d->fileMapOffset));
+                terminate(QXmppTransferJob::FileAccessError);
+                return;
+            }
+            length = qMin<qint64>(d->blockSize, d->fileMapSize - d->fileMapPosition);
+            d->socksSocket->write(reinterpret_cast<const char *>(d->fileMap + d->fileMapPosition), length);
+            d->fileMapPosition += length;
+        } else {
+            if (d->sendBuffer.size() != d->blockSize)
+                d->sendBuffer.resize(d->blockSize);
+
+            qint64 maxLength = d->blockSize;
+            if (d->rangeLength > 0)
+                maxLength = qMin(maxLength, d->transferEnd() - d->done);
+            length = d->iodevice->read(d->sendBuffer.data(), maxLength);
+            if (length < 0) {
+                terminate(QXmppTransferJob::FileAccessError);
+                return;
+            } else if (!length) {
+                // wait for more data
+                return;
+            }
+            d->socksSocket->write(d->sendBuffer.constData(), length);
+        }
+
+        if (d->manager)
+            d->manager->chargeBandwidth(length);
+        d->done += length;
+        updateProgress();
+    }
+}
+/// \endcond
+
+QXmppTransferManagerPrivate::QXmppTransferManagerPrivate(QXmppTransferManager *qq)
+    : hashAlgorithm(QCryptographicHash::Md5),
+      hashThread(nullptr),
+      deferredHashing(false),
+      maximumActiveTransfers(0),
+      rateLimit(0),
+      tokens(0),
+      tokenTime(0),
+      scheduleTimer(nullptr),
+      ibbBlockSize(4096),
+      ibbWindowSize(1),
+      socksBlockSize(16384),
+      socksStaggerDelay(250),
+      socksMaximumAttempts(3),
+      socksLowWatermark(2 * 16384),
+      socksHighWatermark(4 * 16384),
+      finishedJobRetention(-1),
+      proxyOnly(false), socksServer(nullptr), supportedMethods(QXmppTransferJob::AnyMethod), q(qq)
+{
+}
+
+QXmppTransferJob *QXmppTransferManagerPrivate::getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id)
+{
+    auto *job = jobsByRequestId.value(id);
+    if (job &&
+        job->d->direction == direction &&
+        job->d->jid == jid &&
+        job->d->requestId == id)
+        return job;
+    return nullptr;
+}
+
+QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobByRequestId(const QString &jid, const QString &id)
+{
+    return static_cast<QXmppTransferIncomingJob *>(getJobByRequestId(QXmppTransferJob::IncomingDirection, jid, id));
+}
+
+QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
+{
+    return incomingJobsBySid.value(qMakePair(jid, sid));
+}
+
+QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId(const QString &jid, const QString &id)
+{
+    return static_cast<QXmppTransferOutgoingJob *>(getJobByRequestId(QXmppTransferJob::OutgoingDirection, jid, id));
+}
+
+static int ibbPendingIndex(const QXmppTransferJobPrivate *d, const QString &id)
+{
+    for (int i = 0; i < d->ibbPending.size(); ++i) {
+        if (d->ibbPending.at(i).first == id)
+            return i;
+    }
+    return -1;
+}
+
+QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByIbbId(const QString &jid, const QString &id)
+{
+    auto *job = jobsByRequestId.value(id);
+    if (job &&
+        job->d->direction == QXmppTransferJob::OutgoingDirection &&
+        job->d->jid == jid)
+        return static_cast<QXmppTransferOutgoingJob *>(job);
+    return nullptr;
+}
+
+void QXmppTransferManagerPrivate::addJob(QXmppTransferJob *job)
+{
+    job->d->manager = this;
+    jobs.insert(job);
+    if (job->d->direction == QXmppTransferJob::IncomingDirection)
+        incomingJobsBySid.insert(qMakePair(job->d->jid, job->d->sid), static_cast<QXmppTransferIncomingJob *>(job));
+    if (!job->d->requestId.isEmpty())
+        jobsByRequestId.insert(job->d->requestId, job);
+}
+
+// Removes the job once it has been destroyed, its lookup keys were already
+// removed by its destructor.
+void QXmppTransferManagerPrivate::removeJob(QXmppTransferJob *job)
+{
+    jobs.remove(job);
+}
+
+template<typename Key, typename Job>
+static void removeIndexEntry(QHash<Key, Job *> &index, const Key &key, QXmppTransferJob *job)
+{
+    const auto itr = index.find(key);
+    if (itr != index.end() && itr.value() == job)
+        index.erase(itr);
+}
+
+// Removes the job from the lookup tables, using the keys it was indexed by.
+void QXmppTransferManagerPrivate::unindexJob(QXmppTransferJob *job)
+{
+    removeIndexEntry(jobsByRequestId, job->d->requestId, job);
+    for (const auto &pending : qAsConst(job->d->ibbPending))
+        removeIndexEntry(jobsByRequestId, pending.first, job);
+    removeIndexEntry(jobsByStreamHash, job->d->socksStreamHash, job);
+    if (job->d->direction == QXmppTransferJob::IncomingDirection)
+        removeIndexEntry(incomingJobsBySid, qMakePair(job->d->jid, job->d->sid), job);
+}
+
+void QXmppTransferManagerPrivate::setRequestId(QXmppTransferJob *job, const QString &id)
+{
+    if (!job->d->requestId.isEmpty() && jobsByRequestId.value(job->d->requestId) == job)
+        jobsByRequestId.remove(job->d->requestId);
+    job->d->requestId = id;
+    if (!id.isEmpty() && jobs.contains(job))
+        jobsByRequestId.insert(id, job);
+}
+
+/// \cond
 void QXmppTransferOutgoingJob::_q_proxyReady()
 {
     // activate stream
@@ -616,97 +1453,285 @@ void QXmppTransferOutgoingJob::_q_proxyReady()
     streamIq.setTo(d->socksProxy.jid());
     streamIq.setSid(d->sid);
     streamIq.setActivate(d->jid);
-    d->requestId = streamIq.id();
+    d->manager->setRequestId(this, streamIq.id());
     d->client->sendPacket(streamIq);
 }
 
-void QXmppTransferOutgoingJob::_q_sendData()
+/// \endcond
+
+// Creates an outgoing job for the given device. If the job could be started,
+// it is registered with the manager but its offer is not sent yet.
+QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::createOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid)
 {
-    if (d->state != QXmppTransferJob::TransferState)
-        return;
+    auto *job = new QXmppTransferOutgoingJob(jid, q->client(), q);
+    if (sid.isEmpty())
+        job->d->sid = QXmppUtils::generateStanzaHash();
+    else
+        job->d->sid = sid;
+    job->d->fileInfo = fileInfo;
+    job->d->iodevice = device;
 
-    // don't saturate the outgoing socket
-    if (d->socksSocket->bytesToWrite() > 2 * d->blockSize)
-        return;
+    // check file is open
+    if (!device || !device->isReadable()) {
+        job->terminate(QXmppTransferJob::FileAccessError);
+        return job;
+    }
 
-    // check whether we have written the whole file
-    if (d->fileInfo.size() && d->done >= d->fileInfo.size()) {
-        if (!d->socksSocket->bytesToWrite())
-            terminate(QXmppTransferJob::NoError);
-        return;
+    // random access devices can send any part of the file
+    if (!device->isSequential())
+        job->d->fileInfo.setRangeSupported(true);
+
+    // check we support some methods
+    if (!supportedMethods) {
+        job->terminate(QXmppTransferJob::ProtocolError);
+        return job;
     }
 
-    char *buffer = new char[d->blockSize];
-    qint64 length = d->iodevice->read(buffer, d->blockSize);
-    if (length < 0) {
-        delete[] buffer;
-        terminate(QXmppTransferJob::FileAccessError);
+    // start job
+    addJob(job);
+
+    QObject::connect(job, &QObject::destroyed, q, &QXmppTransferManager::_q_jobDestroyed);
+    QObject::connect(job, QOverload<QXmppTransferJob::Error>::of(&QXmppTransferJob::error), q, &QXmppTransferManager::_q_jobError);
+    QObject::connect(job, &QXmppTransferJob::finished, q, &QXmppTransferManager::_q_jobFinished);
+    return job;
+}
+
+// Sends the stream initiation offer for an outgoing job.
+void QXmppTransferManagerPrivate::sendOffer(QXmppTransferJob *job)
+{
+    // collect supported stream methods
+    QXmppDataForm form;
+    form.setType(QXmppDataForm::Form);
+
+    QXmppDataForm::Field methodField(QXmppDataForm::Field::ListSingleField);
+    methodField.setKey("stream-method");
+    if (supportedMethods & QXmppTransferJob::InBandMethod)
+        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_ibb)));
+    if (supportedMethods & QXmppTransferJob::SocksMethod)
+        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_bytestreams)));
+    form.setFields(QList<QXmppDataForm::Field>() << methodField);
+
+    QXmppStreamInitiationIq request;
+    request.setType(QXmppIq::Set);
+    request.setTo(job->d->jid);
+    request.setProfile(QXmppStreamInitiationIq::FileTransfer);
+    request.setFileInfo(job->d->fileInfo);
+    request.setFeatureForm(form);
+    request.setSiId(job->d->sid);
+    setRequestId(job, request.id());
+    q->client()->sendPacket(request);
+}
+
+// Creates a hasher running on a thread shared by all jobs.
+QXmppTransferHasher *QXmppTransferManagerPrivate::createHasher(QCryptographicHash::Algorithm algorithm)
+{
+    if (!hashThread) {
+        hashThread = new QThread(q);
+        hashThread->setObjectName(QStringLiteral("QXmppTransferManager hashing"));
+        hashThread->start(QThread::LowPriority);
+    }
+
+    auto *hasher = new QXmppTransferHasher(algorithm);
+    hasher->moveToThread(hashThread);
+    return hasher;
+}
+
+void QXmppTransferManagerPrivate::startHasher(QXmppTransferJob *job, QCryptographicHash::Algorithm algorithm)
+{
+    job->d->hasher = createHasher(algorithm);
+    QObject::connect(job->d->hasher, &QXmppTransferHasher::finished,
+                     job, &QXmppTransferJob::_q_hashFinished);
+}
+
+// Compares the data preceding the requested range with the receiver's hash.
+// No data is sent until the comparison is done.
+void QXmppTransferManagerPrivate::verifyPrefix(QXmppTransferJob *job, const QByteArray &hash)
+{
+    job->d->prefixHash = hash;
+    job->d->prefixPending = true;
+
+    auto *file = qobject_cast<QFile *>(job->d->iodevice);
+    if (file && !file->fileName().isEmpty()) {
+        job->d->prefixHasher = createHasher(QCryptographicHash::Sha256);
+        QObject::connect(job->d->prefixHasher, &QXmppTransferHasher::finished,
+                         job, &QXmppTransferJob::_q_prefixHashFinished);
+        QMetaObject::invokeMethod(job->d->prefixHasher, "addFileData", Qt::QueuedConnection, Q_ARG(QString, file->fileName()), Q_ARG(qint64, job->d->rangeOffset));
+        QMetaObject::invokeMethod(job->d->prefixHasher, "finish", Qt::QueuedConnection);
         return;
-    } else {
-        d->socksSocket->write(buffer, length);
-        delete[] buffer;
-        d->done += length;
-        emit progress(d->done, fileSize());
     }
+
+    // other devices are hashed in place
+    QIODevice *device = job->d->iodevice;
+    const qint64 position = device->pos();
+    QCryptographicHash prefix(QCryptographicHash::Sha256);
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    qint64 remaining = job->d->rangeOffset;
+    bool ok = device->seek(0);
+    while (ok && remaining > 0) {
+        const qint64 length = device->read(buffer.data(), qMin<qint64>(buffer.size(), remaining));
+        if (length <= 0) {
+            ok = false;
+        } else {
+            prefix.addData(buffer.constData(), int(length));
+            remaining -= length;
+        }
+    }
+    ok = device->seek(position) && ok;
+    job->_q_prefixHashFinished(ok ? prefix.result() : QByteArray());
 }
-/// \endcond
 
-class QXmppTransferManagerPrivate
+// Returns true if the job may send a block now, the data actually sent must
+// then be charged with chargeBandwidth(). Otherwise the job is queued and
+// resumed once it may send again.
+bool QXmppTransferManagerPrivate::acquireBandwidth(QXmppTransferJob *job)
 {
-public:
-    QXmppTransferManagerPrivate(QXmppTransferManager *qq);
+    if (!activeJobs.contains(job)) {
+        if (maximumActiveTransfers > 0 && activeJobs.size() >= maximumActiveTransfers) {
+            waitForBandwidth(job, -1);
+            return false;
+        }
+        activeJobs.append(job);
+    }
 
-    QXmppTransferIncomingJob *getIncomingJobByRequestId(const QString &jid, const QString &id);
-    QXmppTransferIncomingJob *getIncomingJobBySid(const QString &jid, const QString &sid);
-    QXmppTransferOutgoingJob *getOutgoingJobByRequestId(const QString &jid, const QString &id);
+    if (rateLimit <= 0)
+        return true;
 
-    int ibbBlockSize;
-    QList<QXmppTransferJob *> jobs;
-    QString proxy;
-    bool proxyOnly;
-    QXmppSocksServer *socksServer;
-    QXmppTransferJob::Methods supportedMethods;
+    // the bucket may go into debt so that blocks larger than the
+    // bucket can be sent
+    refillTokens();
+    if (tokens <= 0) {
+        waitForBandwidth(job, int((1 - tokens) * 1000 / rateLimit) + 1);
+        return false;
+    }
+    return true;
+}
 
-private:
-    QXmppTransferJob *getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id);
-    QXmppTransferManager *q;
-};
+void QXmppTransferManagerPrivate::chargeBandwidth(qint64 bytes)
+{
+    if (rateLimit > 0)
+        tokens -= bytes;
+}
 
-QXmppTransferManagerPrivate::QXmppTransferManagerPrivate(QXmppTransferManager *qq)
-    : ibbBlockSize(4096), proxyOnly(false), socksServer(nullptr), supportedMethods(QXmppTransferJob::AnyMethod), q(qq)
+void QXmppTransferManagerPrivate::releaseJob(QXmppTransferJob *job)
 {
+    waitingJobs.removeAll(job);
+    if (activeJobs.removeAll(job) && !waitingJobs.isEmpty())
+        scheduleTimer->start(0);
 }
 
-QXmppTransferJob *QXmppTransferManagerPrivate::getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id)
+void QXmppTransferManagerPrivate::refillTokens()
+{
+    // allow bursts of a tenth of a second
+    const qint64 capacity = qMax<qint64>(1, rateLimit / 10);
+    if (!tokenClock.isValid()) {
+        tokenClock.start();
+        tokenTime = 0;
+        tokens = capacity;
+        return;
+    }
+
+    // debt is paid back before the bucket fills up again, however long the
+    // bucket was idle
+    const qint64 now = tokenClock.nsecsElapsed();
+    const qint64 missing = capacity - tokens;
+    if (missing <= 0 || now - tokenTime >= missing * 1000000000 / rateLimit) {
+        tokens = capacity;
+        tokenTime = now;
+        return;
+    }
+
+    const qint64 added = (now - tokenTime) * rateLimit / 1000000000;
+    if (added > 0) {
+        tokens += added;
+        tokenTime += added * 1000000000 / rateLimit;
+    }
+}
+
+// Resumes the waiting jobs, highest priority first.
+void QXmppTransferManagerPrivate::schedule()
 {
+    QList<QXmppTransferJob *> jobs = waitingJobs;
+    waitingJobs.clear();
+    std::stable_sort(jobs.begin(), jobs.end(), [](QXmppTransferJob *a, QXmppTransferJob *b) {
+        return a->d->priority > b->d->priority;
+    });
+
     for (auto *job : jobs) {
-        if (job->d->direction == direction &&
-            job->d->jid == jid &&
-            job->d->requestId == id)
-            return job;
+        if (job->d->state != QXmppTransferJob::TransferState)
+            continue;
+
+        if (job->d->method == QXmppTransferJob::SocksMethod)
+            static_cast<QXmppTransferOutgoingJob *>(job)->_q_sendData();
+        else if (job->d->method == QXmppTransferJob::InBandMethod)
+            ibbSendBlocks(job);
     }
-    return nullptr;
 }
 
-QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobByRequestId(const QString &jid, const QString &id)
+void QXmppTransferManagerPrivate::waitForBandwidth(QXmppTransferJob *job, int delay)
 {
-    return static_cast<QXmppTransferIncomingJob *>(getJobByRequestId(QXmppTransferJob::IncomingDirection, jid, id));
+    if (!waitingJobs.contains(job))
+        waitingJobs.append(job);
+
+    // jobs waiting for a free slot are resumed by releaseJob()
+    if (delay >= 0 && (!scheduleTimer->isActive() || scheduleTimer->remainingTime() > delay))
+        scheduleTimer->start(delay);
 }
 
-QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
+void QXmppTransferManagerPrivate::ibbClose(QXmppTransferJob *job)
 {
-    for (auto *job : jobs) {
-        if (job->d->direction == QXmppTransferJob::IncomingDirection &&
-            job->d->jid == jid &&
-            job->d->sid == sid)
-            return static_cast<QXmppTransferIncomingJob *>(job);
-    }
-    return nullptr;
+    QXmppIbbCloseIq closeIq;
+    closeIq.setTo(job->d->jid);
+    closeIq.setSid(job->d->sid);
+    setRequestId(job, closeIq.id());
+    for (const auto &pending : qAsConst(job->d->ibbPending))
+        jobsByRequestId.remove(pending.first);
+    job->d->ibbPending.clear();
+    q->client()->sendPacket(closeIq);
 }
 
-QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId(const QString &jid, const QString &id)
+// Sends data blocks until the window of unacknowledged blocks is full, and
+// closes the bytestream once all data has been acknowledged.
+void QXmppTransferManagerPrivate::ibbSendBlocks(QXmppTransferJob *job)
 {
-    return static_cast<QXmppTransferOutgoingJob *>(getJobByRequestId(QXmppTransferJob::OutgoingDirection, jid, id));
+    // wait until the receiver's data has been checked
+    if (job->d->prefixPending)
+        return;
+    if (job->d->prefixError != QXmppTransferJob::NoError) {
+        job->terminate(job->d->prefixError);
+        return;
+    }
+
+    const int windowSize = qMax(1, ibbWindowSize);
+    while (!job->d->ibbEndOfStream && job->d->ibbPending.size() < windowSize) {
+        if (!acquireBandwidth(job))
+            return;
+
+        qint64 maxLength = job->d->blockSize;
+        if (job->d->rangeLength > 0)
+            maxLength = qMin(maxLength, job->d->transferEnd() - job->d->iodevice->pos());
+
+        const QByteArray buffer = maxLength > 0 ? job->d->iodevice->read(maxLength) : QByteArray();
+        if (buffer.isEmpty()) {
+            job->d->ibbEndOfStream = true;
+            break;
+        }
+
+        QXmppIbbDataIq dataIq;
+        dataIq.setTo(job->d->jid);
+        dataIq.setSid(job->d->sid);
+        dataIq.setSequence(quint16(job->d->ibbSequence));
+        dataIq.setPayload(buffer);
+        chargeBandwidth(buffer.size());
+        job->d->ibbSequence = quint16(job->d->ibbSequence + 1);
+        job->d->ibbPending.append(qMakePair(dataIq.id(), qint64(buffer.size())));
+        jobsByRequestId.insert(dataIq.id(), job);
+        q->client()->sendPacket(dataIq);
+    }
+
+    if (job->d->ibbEndOfStream && job->d->ibbPending.isEmpty()) {
+        ibbClose(job);
+        job->terminate(QXmppTransferJob::NoError);
+    }
 }
 
 /// Constructs a QXmppTransferManager to handle incoming and outgoing
@@ -716,6 +1741,12 @@ QXmppTransferManager::QXmppTransferManager()
 {
     d = new QXmppTransferManagerPrivate(this);
 
+    d->scheduleTimer = new QTimer(this);
+    d->scheduleTimer->setSingleShot(true);
+    connect(d->scheduleTimer, &QTimer::timeout, this, [this]() {
+        d->schedule();
+    });
+
     // start SOCKS server
     d->socksServer = new QXmppSocksServer(this);
     connect(d->socksServer, &QXmppSocksServer::newConnection, this, &QXmppTransferManager::_q_socksServerConnected);
@@ -727,19 +1758,30 @@ QXmppTransferManager::QXmppTransferManager()
 
 QXmppTransferManager::~QXmppTransferManager()
 {
+    // the jobs are deleted after the manager's private data
+    for (auto *job : qAsConst(d->jobs))
+        job->d->manager = nullptr;
+
+    if (d->hashThread) {
+        for (auto *job : d->jobs) {
+            job->d->releaseHasher();
+            job->d->releasePrefixHasher();
+        }
+        d->hashThread->quit();
+        d->hashThread->wait();
+    }
     delete d;
 }
 
 void QXmppTransferManager::byteStreamIqReceived(const QXmppByteStreamIq &iq)
 {
     // handle IQ from proxy
-    for (auto *job : d->jobs) {
-        if (job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id()) {
-            if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0) {
-                job->d->socksProxy = iq.streamHosts().first();
-                socksServerSendOffer(job);
-                return;
-            }
+    auto *job = d->jobsByRequestId.value(iq.id());
+    if (job && job->d->socksProxy.jid() == iq.from() && job->d->requestId == iq.id()) {
+        if (iq.type() == QXmppIq::Result && iq.streamHosts().size() > 0) {
+            job->d->socksProxy = iq.streamHosts().first();
+            socksServerSendOffer(job);
+            return;
         }
     }
 
@@ -812,7 +1854,7 @@ void QXmppTransferManager::byteStreamSetReceived(const QXmppByteStreamIq &iq)
         return;
     }
 
-    job->connectToHosts(iq);
+    job->connectToHosts(iq, d->socksStaggerDelay, d->socksMaximumAttempts);
 }
 
 /// \cond
@@ -928,7 +1970,7 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
 
     // write data
     job->writeData(iq.payload());
-    job->d->ibbSequence++;
+    job->d->ibbSequence = quint16(job->d->ibbSequence + 1);
 
     // acknowledge the packet
     response.setType(QXmppIq::Result);
@@ -971,7 +2013,7 @@ void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
 
 void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
 {
-    QXmppTransferJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
+    QXmppTransferJob *job = d->getOutgoingJobByIbbId(iq.from(), iq.id());
     if (!job ||
         job->method() != QXmppTransferJob::InBandMethod ||
         job->state() == QXmppTransferJob::FinishedState)
@@ -981,92 +2023,102 @@ void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
     if (!job->d->iodevice->isOpen())
         return;
 
-    if (iq.type() == QXmppIq::Result) {
-        const QByteArray buffer = job->d->iodevice->read(job->d->blockSize);
-        job->setState(QXmppTransferJob::TransferState);
-        if (buffer.size()) {
-            // send next data block
-            QXmppIbbDataIq dataIq;
-            dataIq.setTo(job->d->jid);
-            dataIq.setSid(job->d->sid);
-            dataIq.setSequence(job->d->ibbSequence++);
-            dataIq.setPayload(buffer);
-            job->d->requestId = dataIq.id();
-            client()->sendPacket(dataIq);
-
-            job->d->done += buffer.size();
-            job->progress(job->d->done, job->fileSize());
-        } else {
-            // close the bytestream
-            QXmppIbbCloseIq closeIq;
-            closeIq.setTo(job->d->jid);
-            closeIq.setSid(job->d->sid);
-            job->d->requestId = closeIq.id();
-            client()->sendPacket(closeIq);
-
-            job->terminate(QXmppTransferJob::NoError);
+    if (job->d->requestId == iq.id()) {
+        // response to the bytestream open request
+        d->setRequestId(job, QString());
+        if (iq.type() == QXmppIq::Result) {
+            job->setState(QXmppTransferJob::TransferState);
+            d->ibbSendBlocks(job);
+        } else if (iq.type() == QXmppIq::Error) {
+            const QXmppStanza::Error error = iq.error();
+            if (error.condition() == QXmppStanza::Error::ResourceConstraint &&
+                job->d->blockSize / 2 >= ibbMinimumBlockSize) {
+                // the receiver prefers a smaller block size, try again
+                job->d->blockSize /= 2;
+
+                QXmppIbbOpenIq openIq;
+                openIq.setTo(job->d->jid);
+                openIq.setSid(job->d->sid);
+                openIq.setBlockSize(job->d->blockSize);
+                d->setRequestId(job, openIq.id());
+                client()->sendPacket(openIq);
+            } else {
+                d->ibbClose(job);
+                job->terminate(QXmppTransferJob::ProtocolError);
+            }
         }
-    } else if (iq.type() == QXmppIq::Error) {
-        // close the bytestream
-        QXmppIbbCloseIq closeIq;
-        closeIq.setTo(job->d->jid);
-        closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
-        client()->sendPacket(closeIq);
+        return;
+    }
+
+    const int index = ibbPendingIndex(job->d, iq.id());
+    if (index < 0)
+        return;
 
+    if (iq.type() == QXmppIq::Result) {
+        // a data block was acknowledged
+        d->jobsByRequestId.remove(iq.id());
+        job->d->done += job->d->ibbPending.takeAt(index).second;
+        job->updateProgress();
+        d->ibbSendBlocks(job);
+    } else if (iq.type() == QXmppIq::Error) {
+        // the receiver rejects blocks which are out of sequence, so the
+        // blocks following the failed one cannot be delivered either
+        warning(QStringLiteral("In-band bytestream block %1 was rejected").arg(iq.id()));
+        d->ibbClose(job);
         job->terminate(QXmppTransferJob::ProtocolError);
     }
 }
 
 void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
 {
+    QXmppTransferJob *ptr = d->jobsByRequestId.value(iq.id());
+    if (!ptr)
+        return;
 
-    for (auto *ptr : d->jobs) {
-        // handle IQ from proxy
-        if (ptr->direction() == QXmppTransferJob::OutgoingDirection && ptr->d->socksProxy.jid() == iq.from() && ptr->d->requestId == iq.id()) {
-            auto *job = static_cast<QXmppTransferOutgoingJob *>(ptr);
-            if (job->d->socksSocket) {
-                // proxy connection activation result
-                if (iq.type() == QXmppIq::Result) {
-                    // proxy stream activated, start sending data
-                    job->startSending();
-                } else if (iq.type() == QXmppIq::Error) {
-                    // proxy stream not activated, terminate
-                    warning("Could not activate SOCKS5 proxy bytestream");
-                    job->terminate(QXmppTransferJob::ProtocolError);
-                }
-            } else {
-                // we could not get host/port from proxy, proceed without a proxy
-                if (iq.type() == QXmppIq::Error)
-                    socksServerSendOffer(job);
+    // handle IQ from proxy
+    if (ptr->direction() == QXmppTransferJob::OutgoingDirection && ptr->d->socksProxy.jid() == iq.from() && ptr->d->requestId == iq.id()) {
+        auto *job = static_cast<QXmppTransferOutgoingJob *>(ptr);
+        if (job->d->socksSocket) {
+            // proxy connection activation result
+            if (iq.type() == QXmppIq::Result) {
+                // proxy stream activated, start sending data
+                job->startSending();
+            } else if (iq.type() == QXmppIq::Error) {
+                // proxy stream not activated, terminate
+                warning("Could not activate SOCKS5 proxy bytestream");
+                job->terminate(QXmppTransferJob::ProtocolError);
             }
-            return;
+        } else {
+            // we could not get host/port from proxy, proceed without a proxy
+            if (iq.type() == QXmppIq::Error)
+                socksServerSendOffer(job);
         }
+    }
 
-        // handle IQ from peer
-        else if (ptr->d->jid == iq.from() && ptr->d->requestId == iq.id()) {
-            QXmppTransferJob *job = ptr;
-            if (job->direction() == QXmppTransferJob::OutgoingDirection &&
-                job->method() == QXmppTransferJob::InBandMethod) {
-                ibbResponseReceived(iq);
-                return;
-            } else if (job->direction() == QXmppTransferJob::IncomingDirection &&
-                       job->method() == QXmppTransferJob::SocksMethod) {
-                byteStreamResponseReceived(iq);
-                return;
-            } else if (job->direction() == QXmppTransferJob::OutgoingDirection &&
-                       iq.type() == QXmppIq::Error) {
-                // remote party cancelled stream initiation
-                job->terminate(QXmppTransferJob::AbortError);
-                return;
-            }
+    // handle IQ from peer
+    else if (ptr->d->jid == iq.from()) {
+        QXmppTransferJob *job = ptr;
+        if (job->direction() == QXmppTransferJob::OutgoingDirection &&
+            job->method() == QXmppTransferJob::InBandMethod) {
+            ibbResponseReceived(iq);
+        } else if (job->d->requestId != iq.id()) {
+            return;
+        } else if (job->direction() == QXmppTransferJob::IncomingDirection &&
+                   job->method() == QXmppTransferJob::SocksMethod) {
+            byteStreamResponseReceived(iq);
+        } else if (job->direction() == QXmppTransferJob::OutgoingDirection &&
+                   iq.type() == QXmppIq::Error) {
+            // remote party cancelled stream initiation
+            job->terminate(QXmppTransferJob::AbortError);
         }
     }
 }
 
 void QXmppTransferManager::_q_jobDestroyed(QObject *object)
 {
-    d->jobs.removeAll(static_cast<QXmppTransferJob *>(object));
+    auto *job = static_cast<QXmppTransferJob *>(object);
+    d->removeJob(job);
+    d->releaseJob(job);
 }
 
 void QXmppTransferManager::_q_jobError(QXmppTransferJob::Error error)
@@ -1077,13 +2129,11 @@ void QXmppTransferManager::_q_jobError(QXmppTransferJob::Error error)
 
     if (job->direction() == QXmppTransferJob::OutgoingDirection &&
         job->method() == QXmppTransferJob::InBandMethod &&
-        error == QXmppTransferJob::AbortError) {
+        (error == QXmppTransferJob::AbortError ||
+         error == QXmppTransferJob::FileAccessError ||
+         error == QXmppTransferJob::FileCorruptError)) {
         // close the bytestream
-        QXmppIbbCloseIq closeIq;
-        closeIq.setTo(job->d->jid);
-        closeIq.setSid(job->d->sid);
-        job->d->requestId = closeIq.id();
-        client()->sendPacket(closeIq);
+        d->ibbClose(job);
     }
 }
 
@@ -1093,6 +2143,13 @@ void QXmppTransferManager::_q_jobFinished()
     if (!job || !d->jobs.contains(job))
         return;
 
+    // finished jobs no longer receive packets
+    d->unindexJob(job);
+    d->releaseJob(job);
+
+    if (d->finishedJobRetention >= 0)
+        QTimer::singleShot(d->finishedJobRetention, job, &QObject::deleteLater);
+
     emit jobFinished(job);
 }
 
@@ -1146,6 +2203,15 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
     response.setProfile(QXmppStreamInitiationIq::FileTransfer);
     response.setFeatureForm(form);
 
+    // request the missing part of a resumed file
+    if (job->d->rangeOffset > 0) {
+        QXmppTransferFileInfo rangeInfo;
+        rangeInfo.setRangeSupported(true);
+        rangeInfo.setRangeOffset(job->d->rangeOffset);
+        rangeInfo.setRangeHash(job->d->prefixHash);
+        response.setFileInfo(rangeInfo);
+    }
+
     client()->sendPacket(response);
 
     // notify user
@@ -1184,22 +2250,27 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
         device = nullptr;
     }
 
-    // hash file
-    if (device && !device->isSequential()) {
-        QCryptographicHash hash(QCryptographicHash::Md5);
-        QByteArray buffer;
-        while (device->bytesAvailable()) {
-            buffer = device->read(16384);
-            hash.addData(buffer);
-        }
-        device->reset();
-        fileInfo.setHash(hash.result());
-    }
-
     // create job
-    QXmppTransferJob *job = sendFile(jid, device, fileInfo);
+    fileInfo.setHashAlgorithm(d->hashAlgorithm);
+    QXmppTransferJob *job = d->createOutgoingJob(jid, device, fileInfo, QString());
     job->setLocalFileUrl(QUrl::fromLocalFile(filePath));
     job->d->deviceIsOwn = true;
+    if (job->state() == QXmppTransferJob::FinishedState)
+        return job;
+
+    // hash the file in the background, the offer waits for the hash unless
+    // hashing is deferred
+    if (!device->isSequential()) {
+        d->startHasher(job, d->hashAlgorithm);
+        QMetaObject::invokeMethod(job->d->hasher, "hashFile", Qt::QueuedConnection, Q_ARG(QString, filePath));
+        job->d->offerPending = !d->deferredHashing;
+    }
+    if (!job->d->offerPending)
+        d->sendOffer(job);
+
+    // notify user
+    emit jobStarted(job);
+
     return job;
 }
 
@@ -1220,54 +2291,11 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
         return nullptr;
     }
 
-    auto *job = new QXmppTransferOutgoingJob(jid, client(), this);
-    if (sid.isEmpty())
-        job->d->sid = QXmppUtils::generateStanzaHash();
-    else
-        job->d->sid = sid;
-    job->d->fileInfo = fileInfo;
-    job->d->iodevice = device;
-
-    // check file is open
-    if (!device || !device->isReadable()) {
-        job->terminate(QXmppTransferJob::FileAccessError);
-        return job;
-    }
-
-    // check we support some methods
-    if (!d->supportedMethods) {
-        job->terminate(QXmppTransferJob::ProtocolError);
+    QXmppTransferJob *job = d->createOutgoingJob(jid, device, fileInfo, sid);
+    if (job->state() == QXmppTransferJob::FinishedState)
         return job;
-    }
-
-    // collect supported stream methods
-    QXmppDataForm form;
-    form.setType(QXmppDataForm::Form);
 
-    QXmppDataForm::Field methodField(QXmppDataForm::Field::ListSingleField);
-    methodField.setKey("stream-method");
-    if (d->supportedMethods & QXmppTransferJob::InBandMethod)
-        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_ibb)));
-    if (d->supportedMethods & QXmppTransferJob::SocksMethod)
-        methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_bytestreams)));
-    form.setFields(QList<QXmppDataForm::Field>() << methodField);
-
-    // start job
-    d->jobs.append(job);
-
-    connect(job, &QObject::destroyed, this, &QXmppTransferManager::_q_jobDestroyed);
-    connect(job, QOverload<QXmppTransferJob::Error>::of(&QXmppTransferJob::error), this, &QXmppTransferManager::_q_jobError);
-    connect(job, &QXmppTransferJob::finished, this, &QXmppTransferManager::_q_jobFinished);
-
-    QXmppStreamInitiationIq request;
-    request.setType(QXmppIq::Set);
-    request.setTo(jid);
-    request.setProfile(QXmppStreamInitiationIq::FileTransfer);
-    request.setFileInfo(job->d->fileInfo);
-    request.setFeatureForm(form);
-    request.setSiId(job->d->sid);
-    job->d->requestId = request.id();
-    client()->sendPacket(request);
+    d->sendOffer(job);
 
     // notify user
     emit jobStarted(job);
@@ -1277,12 +2305,10 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
 
 void QXmppTransferManager::_q_socksServerConnected(QTcpSocket *socket, const QString &hostName, quint16 port)
 {
-    const QString ownJid = client()->configuration().jid();
-    for (auto *job : d->jobs) {
-        if (hostName == streamHash(job->d->sid, ownJid, job->jid()) && port == 0) {
-            job->d->socksSocket = socket;
-            return;
-        }
+    auto *job = port == 0 ? d->jobsByStreamHash.value(hostName) : nullptr;
+    if (job) {
+        job->d->socksSocket = socket;
+        return;
     }
     warning("QXmppSocksServer got a connection for a unknown stream");
     socket->close();
@@ -1309,6 +2335,12 @@ void QXmppTransferManager::socksServerSendOffer(QXmppTransferJob *job)
     if (!job->d->socksProxy.jid().isEmpty())
         streamHosts.append(job->d->socksProxy);
 
+    // the target identifies the stream to our SOCKS5 server by its hash
+    if (!d->proxyOnly) {
+        job->d->socksStreamHash = streamHash(job->d->sid, ownJid, job->d->jid);
+        d->jobsByStreamHash.insert(job->d->socksStreamHash, job);
+    }
+
     // check we have some stream hosts
     if (!streamHosts.size()) {
         warning("Could not determine local stream hosts");
@@ -1322,7 +2354,7 @@ void QXmppTransferManager::socksServerSendOffer(QXmppTransferJob *job)
     streamIq.setTo(job->d->jid);
     streamIq.setSid(job->d->sid);
     streamIq.setStreamHosts(streamHosts);
-    job->d->requestId = streamIq.id();
+    d->setRequestId(job, streamIq.id());
     client()->sendPacket(streamIq);
 }
 
@@ -1356,6 +2388,23 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         }
     }
 
+    // remote party requested part of the file
+    const QXmppTransferFileInfo rangeInfo = iq.fileInfo();
+    if (rangeInfo.rangeOffset() > 0 || rangeInfo.rangeLength() > 0) {
+        if (job->d->iodevice->isSequential() ||
+            !job->d->iodevice->seek(rangeInfo.rangeOffset())) {
+            job->terminate(QXmppTransferJob::FileAccessError);
+            return;
+        }
+        job->d->rangeOffset = rangeInfo.rangeOffset();
+        job->d->rangeLength = rangeInfo.rangeLength();
+        job->d->done = rangeInfo.rangeOffset();
+
+        // check that the receiver holds the same beginning of the file
+        if (job->d->rangeOffset > 0 && !rangeInfo.rangeHash().isEmpty())
+            d->verifyPrefix(job, rangeInfo.rangeHash());
+    }
+
     // remote party accepted stream initiation
     job->setState(QXmppTransferJob::StartState);
     if (job->method() == QXmppTransferJob::InBandMethod) {
@@ -1366,9 +2415,13 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         openIq.setTo(job->d->jid);
         openIq.setSid(job->d->sid);
         openIq.setBlockSize(job->d->blockSize);
-        job->d->requestId = openIq.id();
+        d->setRequestId(job, openIq.id());
         client()->sendPacket(openIq);
     } else if (job->method() == QXmppTransferJob::SocksMethod) {
+        job->d->blockSize = d->socksBlockSize;
+        job->d->socksLowWatermark = d->socksLowWatermark;
+        job->d->socksHighWatermark = d->socksHighWatermark;
+
         if (!d->proxy.isEmpty()) {
             job->d->socksProxy.setJid(d->proxy);
 
@@ -1377,7 +2430,7 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
             streamIq.setType(QXmppIq::Get);
             streamIq.setTo(job->d->socksProxy.jid());
             streamIq.setSid(job->d->sid);
-            job->d->requestId = streamIq.id();
+            d->setRequestId(job, streamIq.id());
             client()->sendPacket(streamIq);
         } else {
             socksServerSendOffer(job);
@@ -1462,7 +2515,11 @@ void QXmppTransferManager::streamInitiationSetReceived(const QXmppStreamInitiati
     }
 
     // register job
-    d->jobs.append(job);
+    d->addJob(job);
+
+    // hash received data in the background
+    if (!job->d->fileInfo.hash().isEmpty())
+        d->startHasher(job, job->d->fileInfo.hashAlgorithm());
 
     connect(job, &QObject::destroyed, this, &QXmppTransferManager::_q_jobDestroyed);
     connect(job, &QXmppTransferJob::finished, this, &QXmppTransferManager::_q_jobFinished);
@@ -1523,3 +2580,222 @@ void QXmppTransferManager::setSupportedMethods(QXmppTransferJob::Methods methods
 {
     d->supportedMethods = methods;
 }
+
+int QXmppTransferManager::ibbBlockSize() const
+{
+    return d->ibbBlockSize;
+}
+
+///
+/// Sets the block size used for \xep{0047}: In-Band Bytestreams.
+///
+/// For outgoing transfers this is the block size offered to the receiver,
+/// which is halved if the receiver asks for smaller blocks. Incoming
+/// transfers with a larger block size are refused.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setIbbBlockSize(int blockSize)
+{
+    d->ibbBlockSize = blockSize;
+}
+
+int QXmppTransferManager::ibbWindowSize() const
+{
+    return d->ibbWindowSize;
+}
+
+///
+/// Sets the maximum number of unacknowledged data blocks for outgoing
+/// \xep{0047}: In-Band Bytestreams.
+///
+/// With a window size of 1, each block is only sent once the previous one
+/// has been acknowledged, which limits the throughput to one block per
+/// round trip. Larger windows keep several blocks in flight.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setIbbWindowSize(int windowSize)
+{
+    d->ibbWindowSize = windowSize;
+}
+
+int QXmppTransferManager::socksBlockSize() const
+{
+    return d->socksBlockSize;
+}
+
+///
+/// Sets the size of the blocks written to outgoing \xep{0065}: SOCKS5
+/// Bytestreams.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setSocksBlockSize(int blockSize)
+{
+    d->socksBlockSize = qMax(1, blockSize);
+}
+
+qint64 QXmppTransferManager::socksLowWatermark() const
+{
+    return d->socksLowWatermark;
+}
+
+qint64 QXmppTransferManager::socksHighWatermark() const
+{
+    return d->socksHighWatermark;
+}
+
+///
+/// Sets the write buffer watermarks for outgoing \xep{0065}: SOCKS5
+/// Bytestreams.
+///
+/// Once the amount of data waiting to be written to the socket drops to
+/// \a low bytes or less, it is refilled block by block until it reaches
+/// \a high bytes.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setSocksWatermarks(qint64 low, qint64 high)
+{
+    d->socksLowWatermark = low;
+    d->socksHighWatermark = qMax(low, high);
+}
+
+int QXmppTransferManager::socksStaggerDelay() const
+{
+    return d->socksStaggerDelay;
+}
+
+///
+/// Sets the delay in milliseconds after which the next stream host offered
+/// for an incoming \xep{0065}: SOCKS5 Bytestream is tried, while the
+/// previous connection attempts are still pending.
+///
+/// The first stream host to complete the SOCKS5 handshake is used and the
+/// other attempts are cancelled.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setSocksStaggerDelay(int delay)
+{
+    d->socksStaggerDelay = qMax(0, delay);
+}
+
+int QXmppTransferManager::socksMaximumAttempts() const
+{
+    return d->socksMaximumAttempts;
+}
+
+///
+/// Sets the maximum number of stream hosts which are connected to in
+/// parallel for an incoming \xep{0065}: SOCKS5 Bytestream.
+///
+/// A value of 1 tries the stream hosts one after the other.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setSocksMaximumAttempts(int attempts)
+{
+    d->socksMaximumAttempts = qMax(1, attempts);
+}
+
+int QXmppTransferManager::maximumActiveTransfers() const
+{
+    return d->maximumActiveTransfers;
+}
+
+///
+/// Sets the maximum number of outgoing transfers which send data at the same
+/// time. Further transfers are negotiated, but wait for a running transfer to
+/// finish before sending data. A value of 0 disables the limit.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setMaximumActiveTransfers(int maximum)
+{
+    d->maximumActiveTransfers = qMax(0, maximum);
+    d->scheduleTimer->start(0);
+}
+
+qint64 QXmppTransferManager::rateLimit() const
+{
+    return d->rateLimit;
+}
+
+///
+/// Sets the maximum rate in bytes per second shared by all outgoing SOCKS5
+/// and In-Band Bytestreams. A value of 0 disables the limit.
+///
+/// Limiting the rate keeps bandwidth available for the XMPP stream itself.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setRateLimit(qint64 bytesPerSecond)
+{
+    d->rateLimit = qMax<qint64>(0, bytesPerSecond);
+    d->tokenClock.invalidate();
+    d->scheduleTimer->start(0);
+}
+
+int QXmppTransferManager::finishedJobRetention() const
+{
+    return d->finishedJobRetention;
+}
+
+///
+/// Sets the time in milliseconds after which finished jobs are deleted
+/// automatically. A negative value, which is the default, keeps finished
+/// jobs until the application deletes them.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setFinishedJobRetention(int msecs)
+{
+    d->finishedJobRetention = msecs;
+}
+
+QCryptographicHash::Algorithm QXmppTransferManager::hashAlgorithm() const
+{
+    return d->hashAlgorithm;
+}
+
+///
+/// Sets the hash algorithm used for files sent with sendFile(const QString &,
+/// const QString &, const QString &).
+///
+/// Files are hashed on a background thread, and the offer is sent once the
+/// hash is known so the recipient can check the received file.
+///
+/// \sa setDeferredHashing()
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setHashAlgorithm(QCryptographicHash::Algorithm algorithm)
+{
+    d->hashAlgorithm = algorithm;
+}
+
+bool QXmppTransferManager::deferredHashing() const
+{
+    return d->deferredHashing;
+}
+
+///
+/// Sets whether offers for files sent with sendFile(const QString &,
+/// const QString &, const QString &) are sent without waiting for the file
+/// to be hashed.
+///
+/// Deferring the hash lets large transfers start sooner, but the offer does
+/// not carry the hash and the recipient cannot check the file. The hash is
+/// still computed in the background and is available from
+/// QXmppTransferJob::fileInfo() once it is known.
+///
+/// This is disabled by default.
+///
+/// \since QXmpp 1.4
+///
+void QXmppTransferManager::setDeferredHashing(bool deferred)
+{
+    d->deferredHashing = deferred;
+}
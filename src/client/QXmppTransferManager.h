@@ -26,6 +26,7 @@
 
 #include "QXmppClientExtension.h"
 
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QSharedData>
 #include <QUrl>
@@ -56,6 +57,9 @@ public:
     QByteArray hash() const;
     void setHash(const QByteArray &hash);
 
+    QCryptographicHash::Algorithm hashAlgorithm() const;
+    void setHashAlgorithm(QCryptographicHash::Algorithm algorithm);
+
     QString name() const;
     void setName(const QString &name);
 
@@ -65,6 +69,18 @@ public:
     qint64 size() const;
     void setSize(qint64 size);
 
+    bool isRangeSupported() const;
+    void setRangeSupported(bool supported);
+
+    qint64 rangeOffset() const;
+    void setRangeOffset(qint64 offset);
+
+    qint64 rangeLength() const;
+    void setRangeLength(qint64 length);
+
+    QByteArray rangeHash() const;
+    void setRangeHash(const QByteArray &hash);
+
     bool isNull() const;
     QXmppTransferFileInfo &operator=(const QXmppTransferFileInfo &other);
     bool operator==(const QXmppTransferFileInfo &other) const;
@@ -156,6 +172,9 @@ public:
     QString sid() const;
     qint64 speed() const;
 
+    int priority() const;
+    void setPriority(int priority);
+
     // XEP-0096 : File transfer
     QXmppTransferFileInfo fileInfo() const;
     // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
@@ -197,14 +216,18 @@ public Q_SLOTS:
     void abort();
     void accept(const QString &filePath);
     void accept(QIODevice *output);
+    void resume(const QString &filePath);
 
 private Q_SLOTS:
+    void _q_hashFinished(const QByteArray &hash);
+    void _q_prefixHashFinished(const QByteArray &hash);
     void _q_terminated();
 
 private:
     QXmppTransferJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppClient *client, QObject *parent);
     void setState(QXmppTransferJob::State state);
     void terminate(QXmppTransferJob::Error error);
+    void updateProgress();
 
     QXmppTransferJobPrivate *const d;
     friend class QXmppTransferManager;
@@ -241,6 +264,12 @@ class QXMPP_EXPORT QXmppTransferManager : public QXmppClientExtension
     Q_PROPERTY(bool proxyOnly READ proxyOnly WRITE setProxyOnly)
     /// The supported stream methods
     Q_PROPERTY(QXmppTransferJob::Methods supportedMethods READ supportedMethods WRITE setSupportedMethods)
+    /// The block size used for In-Band Bytestreams
+    Q_PROPERTY(int ibbBlockSize READ ibbBlockSize WRITE setIbbBlockSize)
+    /// The maximum number of unacknowledged In-Band Bytestream data blocks
+    Q_PROPERTY(int ibbWindowSize READ ibbWindowSize WRITE setIbbWindowSize)
+    /// The size of the blocks written to SOCKS5 bytestreams
+    Q_PROPERTY(int socksBlockSize READ socksBlockSize WRITE setSocksBlockSize)
 
 public:
     QXmppTransferManager();
@@ -264,6 +293,97 @@ public:
     QXmppTransferJob::Methods supportedMethods() const;
     void setSupportedMethods(QXmppTransferJob::Methods methods);
 
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the block size used for In-Band Bytestreams.
+    ///
+    /// \since QXmpp 1.4
+    int ibbBlockSize() const;
+    void setIbbBlockSize(int blockSize);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the maximum number of unacknowledged In-Band Bytestream data
+    /// blocks.
+    ///
+    /// \since QXmpp 1.4
+    int ibbWindowSize() const;
+    void setIbbWindowSize(int windowSize);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the size of the blocks written to outgoing SOCKS5 bytestreams.
+    ///
+    /// \since QXmpp 1.4
+    int socksBlockSize() const;
+    void setSocksBlockSize(int blockSize);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the amount of buffered data below which outgoing SOCKS5
+    /// bytestreams are refilled.
+    ///
+    /// \since QXmpp 1.4
+    qint64 socksLowWatermark() const;
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the amount of buffered data up to which outgoing SOCKS5
+    /// bytestreams are refilled.
+    ///
+    /// \since QXmpp 1.4
+    qint64 socksHighWatermark() const;
+    void setSocksWatermarks(qint64 low, qint64 high);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the delay in milliseconds between connection attempts to the
+    /// stream hosts of an incoming SOCKS5 bytestream.
+    ///
+    /// \since QXmpp 1.4
+    int socksStaggerDelay() const;
+    void setSocksStaggerDelay(int delay);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the maximum number of parallel connection attempts to the
+    /// stream hosts of an incoming SOCKS5 bytestream.
+    ///
+    /// \since QXmpp 1.4
+    int socksMaximumAttempts() const;
+    void setSocksMaximumAttempts(int attempts);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the hash algorithm used for outgoing files.
+    ///
+    /// \since QXmpp 1.4
+    QCryptographicHash::Algorithm hashAlgorithm() const;
+    void setHashAlgorithm(QCryptographicHash::Algorithm algorithm);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns whether outgoing offers are sent before the file is hashed.
+    ///
+    /// \since QXmpp 1.4
+    bool deferredHashing() const;
+    void setDeferredHashing(bool deferred);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the maximum number of outgoing transfers sending data at the
+    /// same time, or 0 if there is no limit.
+    ///
+    /// \since QXmpp 1.4
+    int maximumActiveTransfers() const;
+    void setMaximumActiveTransfers(int maximum);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the maximum combined rate of outgoing transfers in bytes per
+    /// second, or 0 if there is no limit.
+    ///
+    /// \since QXmpp 1.4
+    qint64 rateLimit() const;
+    void setRateLimit(qint64 bytesPerSecond);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the time in milliseconds after which finished jobs are
+    /// deleted, or a negative value if they are kept.
+    ///
+    /// \since QXmpp 1.4
+    int finishedJobRetention() const;
+    void setFinishedJobRetention(int msecs);
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement &element) override;
@@ -27,6 +27,9 @@
 #include "QXmppByteStreamIq.h"
 #include "QXmppTransferManager.h"
 
+#include <QAtomicInt>
+#include <QHash>
+
 //
 //  W A R N I N G
 //  -------------
@@ -41,6 +44,30 @@
 class QTimer;
 class QXmppSocksClient;
 
+// Computes a file hash on the transfer manager's hashing thread, either by
+// reading a file or from data blocks fed by an incoming transfer.
+class QXmppTransferHasher : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppTransferHasher(QCryptographicHash::Algorithm algorithm);
+    void cancel();
+
+public Q_SLOTS:
+    void addData(const QByteArray &data);
+    void addFileData(const QString &filePath, qint64 length);
+    void hashFile(const QString &filePath);
+    void finish();
+
+Q_SIGNALS:
+    void finished(const QByteArray &hash);
+
+private:
+    QCryptographicHash m_hash;
+    QAtomicInt m_cancelled;
+};
+
 class QXmppTransferIncomingJob : public QXmppTransferJob
 {
     Q_OBJECT
@@ -48,21 +75,22 @@ class QXmppTransferIncomingJob : public QXmppTransferJob
 public:
     QXmppTransferIncomingJob(const QString &jid, QXmppClient *client, QObject *parent);
     void checkData();
-    void connectToHosts(const QXmppByteStreamIq &iq);
+    void connectToHosts(const QXmppByteStreamIq &iq, int staggerDelay, int maximumAttempts);
     bool writeData(const QByteArray &data);
 
 private Q_SLOTS:
-    void _q_candidateDisconnected();
     void _q_candidateReady();
     void _q_disconnected();
     void _q_receiveData();
 
 private:
+    void candidateFailed(QXmppSocksClient *candidate);
     void connectToNextHost();
 
-    QXmppByteStreamIq::StreamHost m_candidateHost;
-    QXmppSocksClient *m_candidateClient;
+    QHash<QXmppSocksClient *, QXmppByteStreamIq::StreamHost> m_candidates;
     QTimer *m_candidateTimer;
+    int m_candidateDelay;
+    int m_maximumCandidates;
     QList<QXmppByteStreamIq::StreamHost> m_streamCandidates;
     QString m_streamOfferId;
     QString m_streamOfferFrom;
@@ -83,6 +111,9 @@ public Q_SLOTS:
 private Q_SLOTS:
     void _q_proxyReady();
     void _q_sendData();
+
+private:
+    friend class QXmppTransferManagerPrivate;
 };
 
 #endif
@@ -0,0 +1,594 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppUploadManager.h"
+
+#include "QXmppClient.h"
+#include "QXmppHttpUploadIq.h"
+#include "QXmppUploadRequestManager.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMimeDatabase>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSet>
+#include <QTimer>
+
+#include <limits>
+
+class QXmppUploadJobPrivate
+{
+public:
+    QXmppUploadJobPrivate();
+    void release(QObject *owner);
+
+    QXmppUploadManager *manager;
+    QString filePath;
+    QString fileName;
+    qint64 fileSize;
+    QString uploadService;
+    QString requestId;
+
+    // upload slot
+    QUrl putUrl;
+    QUrl getUrl;
+    QMap<QString, QString> putHeaders;
+
+    QXmppUploadJob::State state;
+    QXmppUploadJob::Error error;
+    qint64 bytesSent;
+    int retries;
+
+    // upload data
+    QFile *file;
+    uchar *fileMap;
+    QByteArray fileData;
+    QBuffer *buffer;
+    QNetworkReply *reply;
+};
+
+QXmppUploadJobPrivate::QXmppUploadJobPrivate()
+    : manager(nullptr),
+      fileSize(0),
+      state(QXmppUploadJob::QueuedState),
+      error(QXmppUploadJob::NoError),
+      bytesSent(0),
+      retries(0),
+      file(nullptr),
+      fileMap(nullptr),
+      buffer(nullptr),
+      reply(nullptr)
+{
+}
+
+// Cancels the HTTP request and releases the file.
+void QXmppUploadJobPrivate::release(QObject *owner)
+{
+    if (reply) {
+        QObject::disconnect(reply, nullptr, owner, nullptr);
+        reply->abort();
+        reply->deleteLater();
+        reply = nullptr;
+    }
+
+    delete buffer;
+    buffer = nullptr;
+    fileData.clear();
+
+    if (file) {
+        if (fileMap)
+            file->unmap(fileMap);
+        fileMap = nullptr;
+        delete file;
+        file = nullptr;
+    }
+}
+
+QXmppUploadJob::QXmppUploadJob(const QString &filePath, QXmppUploadManager *manager)
+    : QXmppLoggable(manager),
+      d(new QXmppUploadJobPrivate)
+{
+    const QFileInfo info(filePath);
+    d->manager = manager;
+    d->filePath = filePath;
+    d->fileName = info.fileName();
+    d->fileSize = info.size();
+}
+
+QXmppUploadJob::~QXmppUploadJob()
+{
+    d->release(this);
+    delete d;
+}
+
+/// Call this method if you wish to abort the upload.
+
+void QXmppUploadJob::abort()
+{
+    terminate(AbortError);
+}
+
+QString QXmppUploadJob::filePath() const
+{
+    return d->filePath;
+}
+
+qint64 QXmppUploadJob::fileSize() const
+{
+    return d->fileSize;
+}
+
+QXmppUploadJob::State QXmppUploadJob::state() const
+{
+    return d->state;
+}
+
+///
+/// Returns the last error that was encountered.
+///
+QXmppUploadJob::Error QXmppUploadJob::error() const
+{
+    return d->error;
+}
+
+///
+/// Returns the number of bytes which have been uploaded.
+///
+qint64 QXmppUploadJob::bytesSent() const
+{
+    return d->bytesSent;
+}
+
+///
+/// Returns the number of times the HTTP upload has been retried.
+///
+int QXmppUploadJob::retries() const
+{
+    return d->retries;
+}
+
+///
+/// Returns the JID of the upload service which provides the upload slot.
+///
+QString QXmppUploadJob::uploadService() const
+{
+    return d->uploadService;
+}
+
+///
+/// Returns the URL at which the file can be downloaded once the upload is
+/// finished.
+///
+QUrl QXmppUploadJob::getUrl() const
+{
+    return d->getUrl;
+}
+
+void QXmppUploadJob::setState(QXmppUploadJob::State state)
+{
+    if (d->state != state) {
+        d->state = state;
+        emit stateChanged(d->state);
+    }
+}
+
+void QXmppUploadJob::terminate(QXmppUploadJob::Error cause)
+{
+    if (d->state == FinishedState)
+        return;
+
+    d->error = cause;
+    d->state = FinishedState;
+    d->release(this);
+
+    // emit signals later
+    QTimer::singleShot(0, this, [this]() {
+        emit stateChanged(d->state);
+        emit finished();
+    });
+}
+
+class QXmppUploadManagerPrivate
+{
+public:
+    QXmppUploadManagerPrivate(QXmppUploadManager *qq);
+    QXmppUploadJob *createJob(const QString &filePath);
+    void put(QXmppUploadJob *job);
+    void replyFinished(QXmppUploadJob *job);
+    QXmppUploadRequestManager *requestManager();
+    void schedule();
+    QString selectService(qint64 fileSize);
+    void startJob(QXmppUploadJob *job);
+
+    QXmppUploadRequestManager *uploadRequestManager;
+    QNetworkAccessManager *network;
+    int maximumConcurrentUploads;
+    int maximumRetries;
+    int retryDelay;
+
+    QList<QXmppUploadJob *> queuedJobs;
+    QSet<QXmppUploadJob *> activeJobs;
+    QHash<QString, QXmppUploadJob *> jobsByRequestId;
+
+private:
+    QXmppUploadManager *q;
+};
+
+QXmppUploadManagerPrivate::QXmppUploadManagerPrivate(QXmppUploadManager *qq)
+    : uploadRequestManager(nullptr),
+      network(nullptr),
+      maximumConcurrentUploads(2),
+      maximumRetries(2),
+      retryDelay(1000),
+      q(qq)
+{
+}
+
+QXmppUploadJob *QXmppUploadManagerPrivate::createJob(const QString &filePath)
+{
+    auto *job = new QXmppUploadJob(filePath, q);
+    QObject::connect(job, &QXmppUploadJob::finished, q, [this, job]() {
+        queuedJobs.removeAll(job);
+        activeJobs.remove(job);
+        jobsByRequestId.remove(job->d->requestId);
+        emit q->jobFinished(job);
+        schedule();
+    });
+    QObject::connect(job, &QObject::destroyed, q, [this, job]() {
+        queuedJobs.removeAll(job);
+        activeJobs.remove(job);
+        for (auto itr = jobsByRequestId.begin(); itr != jobsByRequestId.end(); ++itr) {
+            if (itr.value() == job) {
+                jobsByRequestId.erase(itr);
+                break;
+            }
+        }
+        schedule();
+    });
+
+    const QFileInfo info(filePath);
+    if (!info.isFile() || !info.isReadable()) {
+        q->warning(QString("Could not read from %1").arg(filePath));
+        job->terminate(QXmppUploadJob::FileAccessError);
+    }
+    return job;
+}
+
+// Starts or restarts the HTTP PUT request of a job.
+void QXmppUploadManagerPrivate::put(QXmppUploadJob *job)
+{
+    auto *jd = job->d;
+
+    QIODevice *device = jd->buffer ? static_cast<QIODevice *>(jd->buffer) : jd->file;
+    if (!device) {
+        jd->file = new QFile(jd->filePath);
+        if (!jd->file->open(QIODevice::ReadOnly) || jd->file->size() != jd->fileSize) {
+            q->warning(QString("Could not read from %1").arg(jd->filePath));
+            job->terminate(QXmppUploadJob::FileAccessError);
+            return;
+        }
+        device = jd->file;
+
+        // local files are mapped, so the network stack reads them without
+        // copying them to the heap first
+        if (jd->fileSize > 0 && jd->fileSize <= std::numeric_limits<int>::max())
+            jd->fileMap = jd->file->map(0, jd->fileSize);
+        if (jd->fileMap) {
+            jd->fileData = QByteArray::fromRawData(reinterpret_cast<const char *>(jd->fileMap), int(jd->fileSize));
+            jd->buffer = new QBuffer(&jd->fileData);
+            jd->buffer->open(QIODevice::ReadOnly);
+            device = jd->buffer;
+        }
+    } else {
+        device->seek(0);
+    }
+
+    QNetworkRequest request(jd->putUrl);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, QMimeDatabase().mimeTypeForFile(jd->filePath).name());
+    request.setHeader(QNetworkRequest::ContentLengthHeader, jd->fileSize);
+    for (auto itr = jd->putHeaders.constBegin(); itr != jd->putHeaders.constEnd(); ++itr)
+        request.setRawHeader(itr.key().toUtf8(), itr.value().toUtf8());
+
+    jd->bytesSent = 0;
+    jd->reply = q->networkAccessManager()->put(request, device);
+    QObject::connect(jd->reply, &QNetworkReply::uploadProgress, job, [job](qint64 sent, qint64) {
+        job->d->bytesSent = sent;
+        emit job->progress(sent, job->d->fileSize);
+    });
+    QObject::connect(jd->reply, &QNetworkReply::finished, job, [this, job]() {
+        replyFinished(job);
+    });
+}
+
+void QXmppUploadManagerPrivate::replyFinished(QXmppUploadJob *job)
+{
+    QNetworkReply *reply = job->d->reply;
+    job->d->reply = nullptr;
+    reply->deleteLater();
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() == QNetworkReply::NoError && status >= 200 && status < 300) {
+        job->d->bytesSent = job->d->fileSize;
+        emit job->progress(job->d->fileSize, job->d->fileSize);
+        job->terminate(QXmppUploadJob::NoError);
+        return;
+    }
+
+    // retry if the server or the network failed, but not if the request
+    // was refused
+    const bool transient = (status == 0 || status >= 500) &&
+        reply->error() != QNetworkReply::OperationCanceledError;
+    if (transient && job->d->retries < maximumRetries) {
+        const int delay = retryDelay << job->d->retries;
+        job->d->retries++;
+        q->warning(QString("HTTP upload of %1 failed, retrying in %2 ms: %3").arg(job->d->filePath, QString::number(delay), reply->errorString()));
+        QTimer::singleShot(delay, job, [this, job]() {
+            if (job->state() == QXmppUploadJob::UploadState)
+                put(job);
+        });
+        return;
+    }
+
+    q->warning(QString("HTTP upload of %1 failed: %2").arg(job->d->filePath, reply->errorString()));
+    job->terminate(QXmppUploadJob::NetworkError);
+}
+
+// Returns the upload request manager, which may have been added to the
+// client after this manager.
+QXmppUploadRequestManager *QXmppUploadManagerPrivate::requestManager()
+{
+    if (!uploadRequestManager && q->client()) {
+        uploadRequestManager = q->client()->findExtension<QXmppUploadRequestManager>();
+        if (uploadRequestManager) {
+            QObject::connect(uploadRequestManager, &QXmppUploadRequestManager::slotReceived,
+                             q, &QXmppUploadManager::_q_slotReceived);
+            QObject::connect(uploadRequestManager, &QXmppUploadRequestManager::requestFailed,
+                             q, &QXmppUploadManager::_q_requestFailed);
+        }
+    }
+    return uploadRequestManager;
+}
+
+// Starts queued jobs as long as the concurrency limit allows it.
+void QXmppUploadManagerPrivate::schedule()
+{
+    while (!queuedJobs.isEmpty() &&
+           (maximumConcurrentUploads <= 0 || activeJobs.size() < maximumConcurrentUploads)) {
+        QXmppUploadJob *job = queuedJobs.takeFirst();
+
+        // the job was aborted while it was queued
+        if (job->state() != QXmppUploadJob::FinishedState)
+            startJob(job);
+    }
+}
+
+// Returns the first discovered upload service which accepts files of the
+// given size.
+QString QXmppUploadManagerPrivate::selectService(qint64 fileSize)
+{
+    if (!requestManager())
+        return QString();
+
+    const auto services = uploadRequestManager->uploadServices();
+    for (const auto &service : services) {
+        if (service.sizeLimit() < 0 || service.sizeLimit() >= fileSize)
+            return service.jid();
+    }
+    return QString();
+}
+
+void QXmppUploadManagerPrivate::startJob(QXmppUploadJob *job)
+{
+    activeJobs.insert(job);
+
+    // the upload slot is already known
+    if (job->d->putUrl.isValid()) {
+        job->setState(QXmppUploadJob::UploadState);
+        put(job);
+        return;
+    }
+
+    job->setState(QXmppUploadJob::RequestState);
+    if (requestManager())
+        job->d->requestId = uploadRequestManager->requestUploadSlot(QFileInfo(job->d->filePath), job->d->uploadService);
+    if (job->d->requestId.isEmpty()) {
+        q->warning(QString("Could not request an upload slot for %1").arg(job->d->filePath));
+        job->terminate(QXmppUploadJob::RequestError);
+        return;
+    }
+    jobsByRequestId.insert(job->d->requestId, job);
+}
+
+QXmppUploadManager::QXmppUploadManager()
+    : d(new QXmppUploadManagerPrivate(this))
+{
+}
+
+QXmppUploadManager::~QXmppUploadManager()
+{
+    delete d;
+}
+
+///
+/// Uploads the file at \a filePath.
+///
+/// An upload slot is requested from \a uploadService. If no upload service is
+/// given, the first discovered service which accepts files of this size is
+/// used.
+///
+/// The returned job belongs to the manager. You can delete it once it is
+/// finished.
+///
+QXmppUploadJob *QXmppUploadManager::uploadFile(const QString &filePath, const QString &uploadService)
+{
+    QXmppUploadJob *job = d->createJob(filePath);
+    if (job->state() == QXmppUploadJob::FinishedState)
+        return job;
+
+    job->d->uploadService = uploadService.isEmpty() ? d->selectService(job->d->fileSize) : uploadService;
+    if (job->d->uploadService.isEmpty()) {
+        warning(QString("No upload service accepts %1").arg(filePath));
+        job->terminate(QXmppUploadJob::NoServiceError);
+        return job;
+    }
+
+    d->queuedJobs << job;
+    d->schedule();
+    return job;
+}
+
+///
+/// Uploads the file at \a filePath to an upload \a slot which was already
+/// requested, for instance using QXmppUploadRequestManager.
+///
+QXmppUploadJob *QXmppUploadManager::uploadFile(const QString &filePath, const QXmppHttpUploadSlotIq &slot)
+{
+    QXmppUploadJob *job = d->createJob(filePath);
+    if (job->state() == QXmppUploadJob::FinishedState)
+        return job;
+
+    if (!slot.putUrl().isValid()) {
+        warning(QString("Invalid upload slot for %1").arg(filePath));
+        job->terminate(QXmppUploadJob::RequestError);
+        return job;
+    }
+
+    job->d->uploadService = slot.from();
+    job->d->putUrl = slot.putUrl();
+    job->d->getUrl = slot.getUrl();
+    job->d->putHeaders = slot.putHeaders();
+
+    d->queuedJobs << job;
+    d->schedule();
+    return job;
+}
+
+int QXmppUploadManager::maximumConcurrentUploads() const
+{
+    return d->maximumConcurrentUploads;
+}
+
+///
+/// Sets the maximum number of simultaneous uploads. Further uploads are
+/// queued until one of the active uploads finishes. 0 means no limit.
+///
+/// The default is 2.
+///
+void QXmppUploadManager::setMaximumConcurrentUploads(int count)
+{
+    d->maximumConcurrentUploads = qMax(0, count);
+    d->schedule();
+}
+
+int QXmppUploadManager::maximumRetries() const
+{
+    return d->maximumRetries;
+}
+
+///
+/// Sets the number of times an upload which failed because of a network or
+/// server error is retried.
+///
+/// The default is 2.
+///
+void QXmppUploadManager::setMaximumRetries(int retries)
+{
+    d->maximumRetries = qMax(0, retries);
+}
+
+int QXmppUploadManager::retryDelay() const
+{
+    return d->retryDelay;
+}
+
+///
+/// Sets the delay in milliseconds before the first retry of a failed upload.
+///
+/// The default is 1000 milliseconds.
+///
+void QXmppUploadManager::setRetryDelay(int delay)
+{
+    d->retryDelay = qMax(0, delay);
+}
+
+///
+/// Returns the QNetworkAccessManager used for the HTTP uploads.
+///
+/// If none was set, the manager creates its own.
+///
+QNetworkAccessManager *QXmppUploadManager::networkAccessManager() const
+{
+    if (!d->network)
+        d->network = new QNetworkAccessManager(const_cast<QXmppUploadManager *>(this));
+    return d->network;
+}
+
+///
+/// Sets the QNetworkAccessManager used for the HTTP uploads, for instance to
+/// share its proxy settings with the rest of the application.
+///
+/// The manager does not take ownership of \a manager.
+///
+void QXmppUploadManager::setNetworkAccessManager(QNetworkAccessManager *manager)
+{
+    d->network = manager;
+}
+
+bool QXmppUploadManager::handleStanza(const QDomElement &element)
+{
+    Q_UNUSED(element)
+    return false;
+}
+
+void QXmppUploadManager::_q_requestFailed(const QXmppHttpUploadRequestIq &request)
+{
+    QXmppUploadJob *job = d->jobsByRequestId.take(request.id());
+    if (!job || job->state() != QXmppUploadJob::RequestState)
+        return;
+
+    warning(QString("The upload service refused to upload %1").arg(job->filePath()));
+    job->terminate(QXmppUploadJob::RequestError);
+}
+
+void QXmppUploadManager::_q_slotReceived(const QXmppHttpUploadSlotIq &slot)
+{
+    QXmppUploadJob *job = d->jobsByRequestId.take(slot.id());
+    if (!job || job->state() != QXmppUploadJob::RequestState)
+        return;
+
+    if (!slot.putUrl().isValid()) {
+        warning(QString("The upload service sent an invalid slot for %1").arg(job->filePath()));
+        job->terminate(QXmppUploadJob::RequestError);
+        return;
+    }
+
+    job->d->putUrl = slot.putUrl();
+    job->d->getUrl = slot.getUrl();
+    job->d->putHeaders = slot.putHeaders();
+    job->setState(QXmppUploadJob::UploadState);
+    d->put(job);
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPUPLOADMANAGER_H
+#define QXMPPUPLOADMANAGER_H
+
+#include "QXmppClientExtension.h"
+
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QXmppHttpUploadRequestIq;
+class QXmppHttpUploadSlotIq;
+class QXmppUploadJobPrivate;
+class QXmppUploadManager;
+class QXmppUploadManagerPrivate;
+
+///
+/// \brief The QXmppUploadJob class represents the upload of a single file
+/// using \xep{0363}: HTTP File Upload.
+///
+/// \sa QXmppUploadManager
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppUploadJob : public QXmppLoggable
+{
+    Q_OBJECT
+    /// The path of the uploaded file
+    Q_PROPERTY(QString filePath READ filePath CONSTANT)
+    /// The size of the uploaded file
+    Q_PROPERTY(qint64 fileSize READ fileSize CONSTANT)
+    /// The job's state
+    Q_PROPERTY(State state READ state NOTIFY stateChanged)
+
+public:
+    /// This enum is used to describe the type of error encountered by an
+    /// upload job.
+    enum Error {
+        NoError = 0,      ///< No error occurred.
+        AbortError,       ///< The upload was aborted.
+        FileAccessError,  ///< The file could not be read.
+        NoServiceError,   ///< No upload service accepts files of this size.
+        RequestError,     ///< The upload service did not provide an upload slot.
+        NetworkError      ///< The HTTP upload failed.
+    };
+    Q_ENUM(Error)
+
+    /// This enum is used to describe the state of an upload job.
+    enum State {
+        QueuedState = 0,   ///< The upload waits for other uploads to finish.
+        RequestState = 1,  ///< An upload slot is being requested.
+        UploadState = 2,   ///< The file is being uploaded.
+        FinishedState = 3  ///< The upload is finished.
+    };
+    Q_ENUM(State)
+
+    ~QXmppUploadJob() override;
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the path of the uploaded file.
+    QString filePath() const;
+    /// Returns the size of the uploaded file.
+    qint64 fileSize() const;
+    /// Returns the job's state.
+    QXmppUploadJob::State state() const;
+
+    QXmppUploadJob::Error error() const;
+    qint64 bytesSent() const;
+    int retries() const;
+    QString uploadService() const;
+    QUrl getUrl() const;
+
+Q_SIGNALS:
+    /// This signal is emitted when the upload job is finished.
+    ///
+    /// You can determine if the job completed successfully by testing whether
+    /// error() returns QXmppUploadJob::NoError.
+    void finished();
+
+    /// This signal is emitted to indicate the progress of the upload.
+    void progress(qint64 sent, qint64 total);
+
+    /// This signal is emitted when the upload job changes state.
+    void stateChanged(QXmppUploadJob::State state);
+
+public Q_SLOTS:
+    void abort();
+
+private:
+    QXmppUploadJob(const QString &filePath, QXmppUploadManager *manager);
+    void setState(QXmppUploadJob::State state);
+    void terminate(QXmppUploadJob::Error error);
+
+    QXmppUploadJobPrivate *const d;
+    friend class QXmppUploadManager;
+    friend class QXmppUploadManagerPrivate;
+};
+
+///
+/// \brief The QXmppUploadManager class uploads files using \xep{0363}: HTTP
+/// File Upload.
+///
+/// It requests upload slots using the QXmppUploadRequestManager, which needs
+/// to be added to the client as well, and then streams the files from disk to
+/// the HTTP server. Uploads which fail because of network or server errors
+/// are retried, and the number of simultaneous uploads is limited.
+///
+/// \code
+/// client->addExtension(new QXmppUploadRequestManager);
+/// auto *manager = new QXmppUploadManager;
+/// client->addExtension(manager);
+///
+/// QXmppUploadJob *job = manager->uploadFile("/home/user/photo.jpg");
+/// connect(job, &QXmppUploadJob::finished, [job]() {
+///     if (job->error() == QXmppUploadJob::NoError)
+///         qDebug() << "uploaded to" << job->getUrl();
+/// });
+/// \endcode
+///
+/// \ingroup Managers
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppUploadManager : public QXmppClientExtension
+{
+    Q_OBJECT
+
+    /// The maximum number of simultaneous uploads
+    Q_PROPERTY(int maximumConcurrentUploads READ maximumConcurrentUploads WRITE setMaximumConcurrentUploads)
+    /// The number of times a failed upload is retried
+    Q_PROPERTY(int maximumRetries READ maximumRetries WRITE setMaximumRetries)
+    /// The delay in milliseconds before the first retry
+    Q_PROPERTY(int retryDelay READ retryDelay WRITE setRetryDelay)
+
+public:
+    QXmppUploadManager();
+    ~QXmppUploadManager() override;
+
+    QXmppUploadJob *uploadFile(const QString &filePath, const QString &uploadService = QString());
+    QXmppUploadJob *uploadFile(const QString &filePath, const QXmppHttpUploadSlotIq &slot);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the maximum number of simultaneous uploads.
+    int maximumConcurrentUploads() const;
+    void setMaximumConcurrentUploads(int count);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the number of times a failed upload is retried.
+    int maximumRetries() const;
+    void setMaximumRetries(int retries);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the delay in milliseconds before the first retry of a failed
+    /// upload. The delay doubles with each further retry.
+    int retryDelay() const;
+    void setRetryDelay(int delay);
+
+    QNetworkAccessManager *networkAccessManager() const;
+    void setNetworkAccessManager(QNetworkAccessManager *manager);
+
+    /// \cond
+    bool handleStanza(const QDomElement &element) override;
+    /// \endcond
+
+Q_SIGNALS:
+    /// This signal is emitted when an upload job is finished.
+    void jobFinished(QXmppUploadJob *job);
+
+private:
+    void _q_requestFailed(const QXmppHttpUploadRequestIq &request);
+    void _q_slotReceived(const QXmppHttpUploadSlotIq &slot);
+
+    QXmppUploadManagerPrivate *const d;
+    friend class QXmppUploadJob;
+    friend class QXmppUploadManagerPrivate;
+};
+
+#endif
@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppSocksProxy.h"
+
+#include "QXmppByteStreamIq.h"
+#include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppServer.h"
+#include "QXmppSocks.h"
+#include "QXmppSocksProxy_p.h"
+
+#include <QCryptographicHash>
+#include <QDomElement>
+#include <QHash>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QTcpSocket>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// maximum amount of data held by the proxy for each direction of a bytestream
+static const int relayBufferSize = 64 * 1024;
+
+// maximum number of relay rounds for one direction before yielding to the
+// event loop, so that a fast sender cannot starve other bytestreams
+static const int relayRounds = 16;
+
+static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QString str = sid + initiatorJid + targetJid;
+    hash.addData(str.toLatin1());
+    return hash.result().toHex();
+}
+
+QXmppSocksProxySession::QXmppSocksProxySession(const QString &hash, QTcpSocket *initiator, QTcpSocket *target, QObject *parent)
+    : QObject(parent),
+      m_hash(hash),
+      m_finished(false)
+{
+    initiator->setParent(this);
+    target->setParent(this);
+
+    m_channels[0].source = initiator;
+    m_channels[0].destination = target;
+    m_channels[1].source = target;
+    m_channels[1].destination = initiator;
+}
+
+QXmppSocksProxySession::~QXmppSocksProxySession()
+{
+#ifdef Q_OS_LINUX
+    for (auto &channel : m_channels) {
+        if (channel.sourceFd >= 0)
+            ::close(channel.sourceFd);
+        if (channel.pipe[0] >= 0)
+            ::close(channel.pipe[0]);
+        if (channel.pipe[1] >= 0)
+            ::close(channel.pipe[1]);
+    }
+#endif
+}
+
+QString QXmppSocksProxySession::hash() const
+{
+    return m_hash;
+}
+
+qint64 QXmppSocksProxySession::initiatorBytes() const
+{
+    return m_channels[0].bytes;
+}
+
+qint64 QXmppSocksProxySession::targetBytes() const
+{
+    return m_channels[1].bytes;
+}
+
+void QXmppSocksProxySession::start()
+{
+#ifdef Q_OS_LINUX
+    if (startSplice())
+        return;
+#endif
+
+    for (auto &channel : m_channels) {
+        channel.source->setReadBufferSize(relayBufferSize);
+        connect(channel.source, &QIODevice::readyRead, this, &QXmppSocksProxySession::_q_readyRead);
+        connect(channel.source, &QAbstractSocket::disconnected, this, &QXmppSocksProxySession::_q_disconnected);
+        connect(channel.destination, &QIODevice::bytesWritten, this, &QXmppSocksProxySession::_q_bytesWritten);
+    }
+
+    // relay any data received before activation
+    for (auto &channel : m_channels)
+        forward(channel);
+}
+
+void QXmppSocksProxySession::finish()
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+
+    for (auto &channel : m_channels) {
+        if (channel.readNotifier)
+            channel.readNotifier->setEnabled(false);
+        if (channel.writeNotifier)
+            channel.writeNotifier->setEnabled(false);
+    }
+    emit finished();
+}
+
+void QXmppSocksProxySession::forward(QXmppSocksProxyChannel &channel)
+{
+    qint64 room = relayBufferSize - channel.destination->bytesToWrite();
+    while (room > 0 && channel.source->bytesAvailable() > 0) {
+        const QByteArray data = channel.source->read(room);
+        if (data.isEmpty())
+            break;
+        channel.destination->write(data);
+        channel.bytes += data.size();
+        room -= data.size();
+    }
+}
+
+void QXmppSocksProxySession::_q_bytesWritten()
+{
+    for (auto &channel : m_channels)
+        forward(channel);
+}
+
+void QXmppSocksProxySession::_q_disconnected()
+{
+    for (auto &channel : m_channels) {
+        if (channel.closed || channel.source->state() != QAbstractSocket::UnconnectedState)
+            continue;
+
+        // relay the remaining data, then close the other connection
+        if (channel.source->isReadable() && channel.destination->isWritable()) {
+            const QByteArray data = channel.source->readAll();
+            channel.destination->write(data);
+            channel.bytes += data.size();
+        }
+        channel.closed = true;
+        channel.destination->disconnectFromHost();
+    }
+
+    if (m_channels[0].closed && m_channels[1].closed)
+        finish();
+}
+
+void QXmppSocksProxySession::_q_readyRead()
+{
+    for (auto &channel : m_channels)
+        forward(channel);
+}
+
+#ifdef Q_OS_LINUX
+// Takes the connections' descriptors away from QTcpSocket and relays data
+// between them through a pipe with splice(), so that it never gets copied
+// to user space.
+bool QXmppSocksProxySession::startSplice()
+{
+    for (auto &channel : m_channels) {
+        channel.source->flush();
+        if (channel.source->bytesAvailable() || channel.source->bytesToWrite())
+            return false;
+    }
+
+    for (auto &channel : m_channels) {
+        if (::pipe2(channel.pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+            return false;
+        channel.sourceFd = ::fcntl(int(channel.source->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+        if (channel.sourceFd < 0)
+            return false;
+    }
+    m_channels[0].destinationFd = m_channels[1].sourceFd;
+    m_channels[1].destinationFd = m_channels[0].sourceFd;
+
+    for (int i = 0; i < 2; ++i) {
+        auto &channel = m_channels[i];
+
+        // the duplicated descriptor keeps the connection open
+        channel.source->abort();
+        channel.source->deleteLater();
+        channel.source = nullptr;
+        channel.destination = nullptr;
+
+        channel.readNotifier = new QSocketNotifier(channel.sourceFd, QSocketNotifier::Read, this);
+        connect(channel.readNotifier, &QSocketNotifier::activated, this, [this, i]() {
+            splice(m_channels[i]);
+        });
+
+        channel.writeNotifier = new QSocketNotifier(channel.destinationFd, QSocketNotifier::Write, this);
+        channel.writeNotifier->setEnabled(false);
+        connect(channel.writeNotifier, &QSocketNotifier::activated, this, [this, i]() {
+            splice(m_channels[i]);
+        });
+    }
+    return true;
+}
+
+void QXmppSocksProxySession::splice(QXmppSocksProxyChannel &channel)
+{
+    if (channel.closed || m_finished)
+        return;
+
+    for (int round = 0; round < relayRounds; ++round) {
+        // move the data held in the pipe to the destination
+        while (channel.pending > 0) {
+            const ssize_t written = ::splice(channel.pipe[0], nullptr, channel.destinationFd, nullptr,
+                                             size_t(channel.pending), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN) {
+                    // wait for the destination to drain
+                    channel.readNotifier->setEnabled(false);
+                    channel.writeNotifier->setEnabled(true);
+                    return;
+                }
+                finish();
+                return;
+            }
+            channel.pending -= written;
+            channel.bytes += written;
+        }
+        channel.writeNotifier->setEnabled(false);
+
+        // fill the pipe from the source
+        const ssize_t received = ::splice(channel.sourceFd, nullptr, channel.pipe[1], nullptr,
+                                      relayBufferSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (received == 0) {
+            // the source closed its end, close ours towards the destination
+            channel.closed = true;
+            channel.readNotifier->setEnabled(false);
+            ::shutdown(channel.destinationFd, SHUT_WR);
+            if (m_channels[0].closed && m_channels[1].closed)
+                finish();
+            return;
+        } else if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                channel.readNotifier->setEnabled(true);
+                return;
+            }
+            finish();
+            return;
+        }
+        channel.pending += received;
+    }
+
+    // let the other connections run, then carry on where we stopped
+    if (channel.pending > 0) {
+        channel.readNotifier->setEnabled(false);
+        channel.writeNotifier->setEnabled(true);
+    } else {
+        channel.readNotifier->setEnabled(true);
+    }
+}
+#endif
+
+class QXmppSocksProxyPrivate
+{
+public:
+    QXmppSocksProxyPrivate();
+
+    QString jid;
+    QString host;
+    quint16 port;
+    QXmppSocksServer *server;
+
+    // connections awaiting activation in the order they arrived, by
+    // destination address
+    QHash<QString, QList<QTcpSocket *>> connections;
+    QSet<QXmppSocksProxySession *> sessions;
+    qint64 bytesRelayed;
+};
+
+QXmppSocksProxyPrivate::QXmppSocksProxyPrivate()
+    : port(7777),
+      server(nullptr),
+      bytesRelayed(0)
+{
+}
+
+QXmppSocksProxy::QXmppSocksProxy()
+    : d(new QXmppSocksProxyPrivate)
+{
+    d->server = new QXmppSocksServer(this);
+    connect(d->server, &QXmppSocksServer::newConnection, this, &QXmppSocksProxy::_q_newConnection);
+}
+
+QXmppSocksProxy::~QXmppSocksProxy()
+{
+    delete d;
+}
+
+QString QXmppSocksProxy::jid() const
+{
+    return d->jid;
+}
+
+///
+/// Sets the JID of the proxy.
+///
+/// If no JID is set, "proxy." followed by the server's domain is used.
+///
+void QXmppSocksProxy::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+QString QXmppSocksProxy::host() const
+{
+    return d->host;
+}
+
+///
+/// Sets the host advertised to clients for connecting to the proxy.
+///
+/// If no host is set, the server's domain is used.
+///
+void QXmppSocksProxy::setHost(const QString &host)
+{
+    d->host = host;
+}
+
+quint16 QXmppSocksProxy::port() const
+{
+    return d->port;
+}
+
+///
+/// Sets the port on which the proxy listens. The default is 7777.
+///
+/// If you set the port to 0, a free port is chosen when the proxy starts,
+/// see serverPort().
+///
+void QXmppSocksProxy::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+///
+/// Returns the port on which the proxy is listening, or 0 if it is not
+/// listening.
+///
+quint16 QXmppSocksProxy::serverPort() const
+{
+    return d->server->serverPort();
+}
+
+///
+/// Returns the number of bytestreams currently being relayed.
+///
+int QXmppSocksProxy::sessionCount() const
+{
+    return d->sessions.size();
+}
+
+///
+/// Returns the total number of bytes relayed by the proxy, in both
+/// directions.
+///
+qint64 QXmppSocksProxy::bytesRelayed() const
+{
+    qint64 bytes = d->bytesRelayed;
+    for (auto *session : qAsConst(d->sessions))
+        bytes += session->initiatorBytes() + session->targetBytes();
+    return bytes;
+}
+
+QStringList QXmppSocksProxy::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppSocksProxy::handleStanza(const QDomElement &element)
+{
+    if (element.attribute("to") != d->jid || element.tagName() != QLatin1String("iq"))
+        return false;
+
+    if (QXmppDiscoveryIq::isDiscoveryIq(element)) {
+        QXmppDiscoveryIq request;
+        request.parse(element);
+        if (request.type() != QXmppIq::Get)
+            return true;
+
+        QXmppDiscoveryIq response;
+        response.setType(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(d->jid);
+        response.setTo(request.from());
+        response.setQueryType(request.queryType());
+        if (request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+            QXmppDiscoveryIq::Identity identity;
+            identity.setCategory("proxy");
+            identity.setType("bytestreams");
+            identity.setName("SOCKS5 Bytestreams");
+            response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+            response.setFeatures(QStringList() << ns_disco_info << ns_bytestreams);
+        }
+        server()->sendPacket(response);
+        return true;
+    }
+
+    if (QXmppByteStreamIq::isByteStreamIq(element)) {
+        QXmppByteStreamIq request;
+        request.parse(element);
+
+        if (request.type() == QXmppIq::Get) {
+            // the client asks for our network address
+            QXmppByteStreamIq::StreamHost streamHost;
+            streamHost.setJid(d->jid);
+            streamHost.setHost(d->host);
+            streamHost.setPort(serverPort());
+
+            QXmppByteStreamIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(d->jid);
+            response.setTo(request.from());
+            response.setStreamHosts(QList<QXmppByteStreamIq::StreamHost>() << streamHost);
+            server()->sendPacket(response);
+
+        } else if (request.type() == QXmppIq::Set) {
+            // the initiator asks us to activate the bytestream
+            const QString hash = streamHash(request.sid(), request.from(), request.activate());
+            const QList<QTcpSocket *> sockets = d->connections.value(hash);
+
+            QXmppIq response;
+            response.setId(request.id());
+            response.setFrom(d->jid);
+            response.setTo(request.from());
+
+            if (sockets.size() != 2) {
+                warning(QString("Could not activate bytestream %1").arg(hash));
+                response.setType(QXmppIq::Error);
+                response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+                server()->sendPacket(response);
+                return true;
+            }
+
+            d->connections.remove(hash);
+            for (auto *socket : sockets)
+                disconnect(socket, &QAbstractSocket::disconnected, this, &QXmppSocksProxy::_q_socketDisconnected);
+
+            // the target connects first, the initiator once it has been told
+            // which stream host the target used
+            auto *session = new QXmppSocksProxySession(hash, sockets.at(1), sockets.at(0), this);
+            connect(session, &QXmppSocksProxySession::finished, this, &QXmppSocksProxy::_q_sessionFinished);
+            d->sessions.insert(session);
+            setGauge("proxy65.session.count", d->sessions.size());
+            info(QString("Activated bytestream %1").arg(hash));
+            session->start();
+
+            response.setType(QXmppIq::Result);
+            server()->sendPacket(response);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool QXmppSocksProxy::start()
+{
+    if (d->jid.isEmpty() && server())
+        d->jid = "proxy." + server()->domain();
+    if (d->host.isEmpty() && server())
+        d->host = server()->domain();
+
+    if (!d->server->listen(d->port)) {
+        warning(QString("Could not start SOCKS5 proxy on port %1").arg(d->port));
+        return false;
+    }
+    info(QString("SOCKS5 proxy %1 listening on port %2").arg(d->jid, QString::number(serverPort())));
+    return true;
+}
+
+void QXmppSocksProxy::stop()
+{
+    d->server->close();
+
+    const auto connections = d->connections;
+    d->connections.clear();
+    for (const auto &sockets : connections) {
+        for (auto *socket : sockets) {
+            socket->disconnect(this);
+            delete socket;
+        }
+    }
+
+    const auto sessions = d->sessions;
+    d->sessions.clear();
+    qDeleteAll(sessions);
+    setGauge("proxy65.session.count", 0);
+}
+
+void QXmppSocksProxy::_q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port)
+{
+    Q_UNUSED(port)
+
+    socket->setParent(this);
+
+    // only the target and the initiator may connect
+    if (d->connections.value(hostName).size() >= 2) {
+        warning(QString("Refusing extra connection for bytestream %1").arg(hostName));
+        connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
+        QMetaObject::invokeMethod(socket, "disconnectFromHost", Qt::QueuedConnection);
+        return;
+    }
+
+    d->connections[hostName].append(socket);
+    connect(socket, &QAbstractSocket::disconnected, this, &QXmppSocksProxy::_q_socketDisconnected);
+}
+
+void QXmppSocksProxy::_q_sessionFinished()
+{
+    auto *session = qobject_cast<QXmppSocksProxySession *>(sender());
+    if (!session || !d->sessions.remove(session))
+        return;
+
+    const qint64 bytes = session->initiatorBytes() + session->targetBytes();
+    d->bytesRelayed += bytes;
+    updateCounter("proxy65.transfer.bytes", bytes);
+    setGauge("proxy65.session.count", d->sessions.size());
+    info(QString("Closed bytestream %1 after relaying %2 bytes").arg(session->hash(), QString::number(bytes)));
+
+    emit sessionFinished(session->hash(), session->initiatorBytes(), session->targetBytes());
+    session->deleteLater();
+}
+
+void QXmppSocksProxy::_q_socketDisconnected()
+{
+    auto *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+
+    for (auto it = d->connections.begin(); it != d->connections.end(); ++it) {
+        if (it->removeOne(socket)) {
+            if (it->isEmpty())
+                d->connections.erase(it);
+            break;
+        }
+    }
+    socket->deleteLater();
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSOCKSPROXY_H
+#define QXMPPSOCKSPROXY_H
+
+#include "QXmppServerExtension.h"
+
+class QTcpSocket;
+class QXmppSocksProxyPrivate;
+
+///
+/// \brief The QXmppSocksProxy class is a QXmppServer extension which provides
+/// a SOCKS5 bytestreams proxy as defined by \xep{0065}: SOCKS5 Bytestreams.
+///
+/// Parties which cannot reach each other directly can use the proxy as a
+/// stream host: both connect to it using the same destination address and the
+/// initiator then activates the bytestream, after which the proxy relays the
+/// data between the two connections.
+///
+/// On Linux, the data is relayed using splice() so that it never needs to be
+/// copied to user space.
+///
+/// \code
+/// QXmppSocksProxy *proxy = new QXmppSocksProxy;
+/// proxy->setHost("198.51.100.1");
+/// proxy->setPort(7777);
+/// server->addExtension(proxy);
+/// \endcode
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppSocksProxy : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "proxy65")
+
+    /// The JID of the proxy
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+    /// The host advertised to clients for connecting to the proxy
+    Q_PROPERTY(QString host READ host WRITE setHost)
+    /// The port on which the proxy listens
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+
+public:
+    QXmppSocksProxy();
+    ~QXmppSocksProxy() override;
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the JID of the proxy.
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the host advertised to clients for connecting to the proxy.
+    QString host() const;
+    void setHost(const QString &host);
+
+    // documentation needs to be here, see https://stackoverflow.com/questions/49192523/
+    /// Returns the port on which the proxy listens.
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    quint16 serverPort() const;
+
+    int sessionCount() const;
+    qint64 bytesRelayed() const;
+
+    /// \cond
+    QStringList discoveryItems() const override;
+    bool handleStanza(const QDomElement &element) override;
+    bool start() override;
+    void stop() override;
+    /// \endcond
+
+Q_SIGNALS:
+    /// This signal is emitted when a relayed bytestream is closed.
+    ///
+    /// \param hash The destination address both parties connected with.
+    /// \param initiatorBytes The number of bytes relayed from the initiator
+    /// to the target.
+    /// \param targetBytes The number of bytes relayed from the target to
+    /// the initiator.
+    void sessionFinished(const QString &hash, qint64 initiatorBytes, qint64 targetBytes);
+
+private Q_SLOTS:
+    void _q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port);
+    void _q_sessionFinished();
+    void _q_socketDisconnected();
+
+private:
+    QXmppSocksProxyPrivate *const d;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSOCKSPROXY_P_H
+#define QXMPPSOCKSPROXY_P_H
+
+#include <QObject>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppSocksProxy class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QSocketNotifier;
+class QTcpSocket;
+
+// One direction of a relayed bytestream.
+struct QXmppSocksProxyChannel
+{
+    QTcpSocket *source = nullptr;
+    QTcpSocket *destination = nullptr;
+    qint64 bytes = 0;
+    bool closed = false;
+
+    // splice() relay
+    int sourceFd = -1;
+    int destinationFd = -1;
+    int pipe[2] = { -1, -1 };
+    qint64 pending = 0;
+    QSocketNotifier *readNotifier = nullptr;
+    QSocketNotifier *writeNotifier = nullptr;
+};
+
+// Relays data between the two connections of an activated bytestream.
+class QXmppSocksProxySession : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppSocksProxySession(const QString &hash, QTcpSocket *initiator, QTcpSocket *target, QObject *parent);
+    ~QXmppSocksProxySession() override;
+
+    QString hash() const;
+    qint64 initiatorBytes() const;
+    qint64 targetBytes() const;
+    void start();
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void _q_bytesWritten();
+    void _q_disconnected();
+    void _q_readyRead();
+
+private:
+    void finish();
+    void forward(QXmppSocksProxyChannel &channel);
+#ifdef Q_OS_LINUX
+    bool startSplice();
+    void splice(QXmppSocksProxyChannel &channel);
+#endif
+
+    QString m_hash;
+    QXmppSocksProxyChannel m_channels[2];
+    bool m_finished;
+};
+
+#endif
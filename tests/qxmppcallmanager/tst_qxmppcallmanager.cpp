@@ -24,10 +24,17 @@
 #include "QXmppCallManager.h"
 #include "QXmppClient.h"
 #include "QXmppServer.h"
+#include "QXmppStun.h"
 
+#include <gst/gst.h>
+
+#include "stunserver.h"
 #include "util.h"
 #include <QBuffer>
+#include <QDomDocument>
 #include <QObject>
+#include <QSignalSpy>
+#include <QTimer>
 
 class tst_QXmppCallManager : public QObject
 {
@@ -73,12 +80,47 @@ void tst_QXmppCallManager::testCall()
     server.setPasswordChecker(&passwordChecker);
     server.listenForClients(testHost, testPort);
 
+    // the sender learns its server-reflexive candidates after initiating
+    // the session, from a STUN server which answers after a delay with a
+    // made-up public address
+    TestStunServer stunServer;
+    stunServer.setDelay(100);
+    stunServer.setMappedHost(QHostAddress(QStringLiteral("192.0.2.1")));
+    QVERIFY(stunServer.bind());
+
     // prepare sender
     QXmppClient sender;
     auto *senderManager = new QXmppCallManager;
+    senderManager->setStunServer(QHostAddress::LocalHost, stunServer.port());
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
+    // record the candidates announced by the sender
+    QStringList announcedIds;
+    QStringList trickledTypes;
+    connect(&sender, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type != QXmppLogger::SentMessage || !doc.setContent(text, true))
+            return;
+
+        const QDomElement jingle = doc.documentElement().firstChildElement(QStringLiteral("jingle"));
+        const QString action = jingle.attribute(QStringLiteral("action"));
+        if (action != QStringLiteral("session-initiate") && action != QStringLiteral("transport-info"))
+            return;
+
+        for (QDomElement content = jingle.firstChildElement(QStringLiteral("content"));
+             !content.isNull();
+             content = content.nextSiblingElement(QStringLiteral("content"))) {
+            for (QDomElement candidate = content.firstChildElement(QStringLiteral("transport")).firstChildElement(QStringLiteral("candidate"));
+                 !candidate.isNull();
+                 candidate = candidate.nextSiblingElement(QStringLiteral("candidate"))) {
+                announcedIds << candidate.attribute(QStringLiteral("id"));
+                if (action == QStringLiteral("transport-info"))
+                    trickledTypes << candidate.attribute(QStringLiteral("type"));
+            }
+        }
+    });
+
     QEventLoop senderLoop;
     connect(&sender, &QXmppClient::connected, &senderLoop, &QEventLoop::quit);
     connect(&sender, &QXmppClient::disconnected, &senderLoop, &QEventLoop::quit);
@@ -116,6 +158,21 @@ void tst_QXmppCallManager::testCall()
     QEventLoop loop;
     QXmppCall *senderCall = senderManager->call("receiver@localhost/QXmpp");
     QVERIFY(senderCall);
+
+    // feed a test tone into the sender's audio stream
+    QVERIFY(senderCall->audioStream());
+    senderCall->audioStream()->setSendPadCallback([](GstPad *pad) {
+        GstElement *encoderBin = gst_pad_get_parent_element(pad);
+        GstObject *pipeline = gst_element_get_parent(encoderBin);
+        GstElement *source = gst_parse_bin_from_description("audiotestsrc is-live=true ! audioconvert ! audioresample", TRUE, nullptr);
+        gst_bin_add(GST_BIN(pipeline), source);
+        GstPad *sourcePad = gst_element_get_static_pad(source, "src");
+        gst_pad_link(sourcePad, pad);
+        gst_object_unref(sourcePad);
+        gst_element_sync_state_with_parent(source);
+        gst_object_unref(pipeline);
+        gst_object_unref(encoderBin);
+    });
     connect(senderCall, &QXmppCall::connected, &loop, &QEventLoop::quit);
     loop.exec();
     QVERIFY(receiverCall);
@@ -126,11 +183,29 @@ void tst_QXmppCallManager::testCall()
     QCOMPARE(receiverCall->direction(), QXmppCall::IncomingDirection);
     QCOMPARE(receiverCall->state(), QXmppCall::ActiveState);
 
+    // transport-info only carries the candidates gathered after the
+    // session-initiate, and no candidate is announced twice
+    QTRY_VERIFY(!trickledTypes.isEmpty());
+    for (const auto &candidateType : qAsConst(trickledTypes))
+        QCOMPARE(candidateType, QStringLiteral("srflx"));
+    QCOMPARE(announcedIds.removeDuplicates(), 0);
+
     // exchange some media
     qDebug() << "======== TALK ========";
+    QCOMPARE(senderCall->statisticsInterval(), 5000);
+    senderCall->setStatisticsInterval(500);
+    QSignalSpy statisticsSpy(senderCall, &QXmppCall::statisticsUpdated);
     QTimer::singleShot(2000, &loop, &QEventLoop::quit);
     loop.exec();
 
+    // quality statistics are reported for the audio stream
+    QVERIFY(!statisticsSpy.isEmpty());
+    const QList<QXmppCallStats> statistics = senderCall->statistics();
+    QCOMPARE(statistics.size(), 1);
+    QCOMPARE(statistics.first().media(), QStringLiteral("audio"));
+    QVERIFY(statistics.first().packetsSent() > 0);
+    QVERIFY(statistics.first().bytesSent() > 0);
+
     // hangup call
     qDebug() << "======== HANGUP ========";
     connect(senderCall, &QXmppCall::finished, &loop, &QEventLoop::quit);
@@ -23,7 +23,10 @@
  */
 
 #include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
 #include "QXmppLogger.h"
+#include "QXmppMamManager.h"
 #include "QXmppMessage.h"
 #include "QXmppRosterManager.h"
 #include "QXmppVCardManager.h"
@@ -43,6 +46,7 @@ private slots:
     void testSendMessage();
 
     void testIndexOfExtension();
+    void testCapabilities();
 
 private:
     QXmppClient *client;
@@ -104,5 +108,31 @@ void tst_QXmppClient::testIndexOfExtension()
     QCOMPARE(client->indexOfExtension<QXmppVCardManager>(), 1);
 }
 
+void tst_QXmppClient::testCapabilities()
+{
+    QXmppClient client;
+    auto *discoManager = client.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(discoManager);
+
+    const QByteArray ver = discoManager->capabilities().verificationString();
+    QCOMPARE(discoManager->capabilities().verificationString(), ver);
+    QVERIFY(!discoManager->capabilities().features().contains(QStringLiteral("urn:xmpp:mam:2")));
+
+    // adding an extension changes the features
+    auto *mamManager = new QXmppMamManager;
+    client.addExtension(mamManager);
+    QVERIFY(discoManager->capabilities().features().contains(QStringLiteral("urn:xmpp:mam:2")));
+    const QByteArray mamVer = discoManager->capabilities().verificationString();
+    QVERIFY(mamVer != ver);
+
+    // changing the identity changes the verification string
+    discoManager->setClientName(QStringLiteral("tst_QXmppClient"));
+    QVERIFY(discoManager->capabilities().verificationString() != mamVer);
+
+    // removing the extension restores the previous features
+    client.removeExtension(mamManager);
+    QVERIFY(!discoManager->capabilities().features().contains(QStringLiteral("urn:xmpp:mam:2")));
+}
+
 QTEST_MAIN(tst_QXmppClient)
 #include "tst_qxmppclient.moc"
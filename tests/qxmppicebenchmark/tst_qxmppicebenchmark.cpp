@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppStun.h"
+#include "QXmppStun_p.h"
+
+#include "stunserver.h"
+#include "util.h"
+#include <algorithm>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QObject>
+#include <QTimer>
+#include <QUdpSocket>
+
+// Measures ICE connectivity establishment and TURN relaying between peers
+// on the loopback interface.
+//
+// Each side of an ICE session binds one host candidate per loopback address
+// (127.0.0.1, 127.0.0.2, ...). The candidates are not exchanged directly:
+// every one of them is advertised through a shaping relay which forwards
+// datagrams to the real candidate, dropping and delaying them as requested
+// by the benchmark row. The time to connect is measured over a number of
+// sessions (QXMPP_BENCHMARK_TRIALS, 20 by default) and the median is
+// reported as the benchmark result.
+//
+// TURN throughput is measured by relaying datagrams through an in-process
+// STUN/TURN server to an echoing peer and back, and is reported in packets
+// per second (shown by QtTest as frames per second).
+//
+// If QXMPP_BENCHMARK_OUTPUT is set, the full distributions are also written
+// to that path as a JSON array.
+
+typedef QPair<QHostAddress, quint16> Address;
+
+// A UDP relay standing in for a lossy, high latency network path.
+//
+// Datagrams received on the front socket are forwarded to the target from a
+// back socket dedicated to their sender, and replies received on that back
+// socket are forwarded to the sender from the front socket.
+class ShapingRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    ShapingRelay(const QHostAddress &host, quint16 port, int loss, int delay, QObject *parent = nullptr)
+        : QObject(parent),
+          m_target(host, port),
+          m_loss(loss),
+          m_delay(delay)
+    {
+        connect(&m_front, &QIODevice::readyRead, this, &ShapingRelay::frontReadyRead);
+    }
+
+    bool bind()
+    {
+        return m_front.bind(QHostAddress::LocalHost, 0);
+    }
+
+    QHostAddress host() const
+    {
+        return m_front.localAddress();
+    }
+
+    quint16 port() const
+    {
+        return m_front.localPort();
+    }
+
+private slots:
+    void frontReadyRead()
+    {
+        QHostAddress host;
+        quint16 port;
+        while (m_front.hasPendingDatagrams()) {
+            QByteArray buffer(int(m_front.pendingDatagramSize()), Qt::Uninitialized);
+            m_front.readDatagram(buffer.data(), buffer.size(), &host, &port);
+
+            const Address sender(host, port);
+            QUdpSocket *back = m_backs.value(sender);
+            if (!back) {
+                back = new QUdpSocket(this);
+                if (!back->bind(QHostAddress::LocalHost, 0)) {
+                    delete back;
+                    continue;
+                }
+                connect(back, &QIODevice::readyRead, this, [this, back, sender]() {
+                    backReadyRead(back, sender);
+                });
+                m_backs.insert(sender, back);
+            }
+            forward(back, buffer, m_target);
+        }
+    }
+
+private:
+    void backReadyRead(QUdpSocket *back, const Address &sender)
+    {
+        while (back->hasPendingDatagrams()) {
+            QByteArray buffer(int(back->pendingDatagramSize()), Qt::Uninitialized);
+            back->readDatagram(buffer.data(), buffer.size());
+            forward(&m_front, buffer, sender);
+        }
+    }
+
+    void forward(QUdpSocket *socket, const QByteArray &data, const Address &address)
+    {
+        if (m_loss && qrand() % 100 < m_loss)
+            return;
+
+        if (m_delay) {
+            QTimer::singleShot(m_delay, socket, [socket, data, address]() {
+                socket->writeDatagram(data, address.first, address.second);
+            });
+        } else {
+            socket->writeDatagram(data, address.first, address.second);
+        }
+    }
+
+    QUdpSocket m_front;
+    QHash<Address, QUdpSocket *> m_backs;
+    Address m_target;
+    int m_loss;
+    int m_delay;
+};
+
+// Advertises the local candidates of one party to the other, each through
+// its own shaping relay.
+static bool exchangeCandidates(QXmppIceConnection *from, QXmppIceConnection *to, int loss, int delay, QObject *owner)
+{
+    const auto &candidates = from->localCandidates();
+    for (auto candidate : candidates) {
+        auto *relay = new ShapingRelay(candidate.host(), candidate.port(), loss, delay, owner);
+        if (!relay->bind())
+            return false;
+        candidate.setHost(relay->host());
+        candidate.setPort(relay->port());
+        to->addRemoteCandidate(candidate);
+    }
+    return true;
+}
+
+// Returns the value below which the given fraction of the sorted samples lie.
+static qint64 percentile(const QList<qint64> &samples, int percent)
+{
+    if (samples.isEmpty())
+        return -1;
+    return samples.at(qMin(samples.size() - 1, samples.size() * percent / 100));
+}
+
+static QJsonObject distribution(QList<qint64> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    QJsonObject object;
+    object["min"] = samples.isEmpty() ? -1 : samples.first();
+    object["median"] = percentile(samples, 50);
+    object["p90"] = percentile(samples, 90);
+    object["max"] = samples.isEmpty() ? -1 : samples.last();
+    return object;
+}
+
+class tst_QXmppIceBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkConnect_data();
+    void benchmarkConnect();
+    void benchmarkTurnRelay_data();
+    void benchmarkTurnRelay();
+
+private:
+    int m_trials;
+    QJsonArray m_results;
+};
+
+void tst_QXmppIceBenchmark::initTestCase()
+{
+    bool ok = false;
+    m_trials = qgetenv("QXMPP_BENCHMARK_TRIALS").toInt(&ok);
+    if (!ok || m_trials <= 0)
+        m_trials = 20;
+}
+
+void tst_QXmppIceBenchmark::cleanupTestCase()
+{
+    const QString outputPath = QString::fromLocal8Bit(qgetenv("QXMPP_BENCHMARK_OUTPUT"));
+    if (!outputPath.isEmpty()) {
+        QFile output(outputPath);
+        QVERIFY2(output.open(QIODevice::WriteOnly | QIODevice::Truncate), qPrintable(output.errorString()));
+        output.write(QJsonDocument(m_results).toJson());
+    }
+}
+
+void tst_QXmppIceBenchmark::benchmarkConnect_data()
+{
+    QTest::addColumn<int>("candidates");
+    QTest::addColumn<int>("loss");
+    QTest::addColumn<int>("delay");
+    QTest::addColumn<bool>("aggressive");
+
+    const QList<int> candidateCounts = QList<int>() << 1 << 4 << 8;
+    const QList<QPair<int, int>> paths = QList<QPair<int, int>>()
+        << qMakePair(0, 0) << qMakePair(10, 0) << qMakePair(0, 50) << qMakePair(10, 50);
+
+    for (const auto candidates : candidateCounts) {
+        for (const auto &path : paths) {
+            for (const auto aggressive : { true, false }) {
+                const QByteArray name = QString("%1 candidates %2% loss %3ms %4")
+                                            .arg(QString::number(candidates), QString::number(path.first), QString::number(path.second), aggressive ? "aggressive" : "regular")
+                                            .toLatin1();
+                QTest::newRow(name.constData()) << candidates << path.first << path.second << aggressive;
+            }
+        }
+    }
+}
+
+void tst_QXmppIceBenchmark::benchmarkConnect()
+{
+    QFETCH(int, candidates);
+    QFETCH(int, loss);
+    QFETCH(int, delay);
+    QFETCH(bool, aggressive);
+
+    QList<QHostAddress> addresses;
+    for (int i = 1; i <= candidates; ++i)
+        addresses << QHostAddress(quint32(0x7f000000 + i));
+
+    QList<qint64> connectTimes;
+    QList<qint64> validPairTimes;
+    int failures = 0;
+
+    for (int trial = 0; trial < m_trials; ++trial) {
+        QObject relays;
+
+        QXmppIceConnection clientL;
+        clientL.setIceControlling(true);
+        clientL.setAggressiveNomination(aggressive);
+        clientL.addComponent(1024);
+        clientL.addComponent(1025);
+
+        QXmppIceConnection clientR;
+        clientR.setIceControlling(false);
+        clientR.addComponent(1024);
+        clientR.addComponent(1025);
+
+        if (!clientL.bind(addresses) || !clientR.bind(addresses))
+            QSKIP("Could not bind to the loopback addresses");
+
+        clientL.setRemoteUser(clientR.localUser());
+        clientL.setRemotePassword(clientR.localPassword());
+        clientR.setRemoteUser(clientL.localUser());
+        clientR.setRemotePassword(clientL.localPassword());
+        QVERIFY(exchangeCandidates(&clientR, &clientL, loss, delay, &relays));
+        QVERIFY(exchangeCandidates(&clientL, &clientR, loss, delay, &relays));
+
+        QElapsedTimer timer;
+        timer.start();
+        clientL.connectToHost();
+        clientR.connectToHost();
+
+        while (!(clientL.isConnected() && clientR.isConnected()) && timer.elapsed() < 30000)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+
+        if (clientL.isConnected() && clientR.isConnected()) {
+            connectTimes << timer.elapsed();
+            validPairTimes << clientL.timeToFirstValidPair();
+        } else {
+            failures++;
+        }
+    }
+
+    const QJsonObject connectDistribution = distribution(connectTimes);
+    const QJsonObject validPairDistribution = distribution(validPairTimes);
+    qDebug("time to connected (ms): min %d, median %d, p90 %d, max %d, %d/%d failed",
+           connectDistribution["min"].toInt(),
+           connectDistribution["median"].toInt(),
+           connectDistribution["p90"].toInt(),
+           connectDistribution["max"].toInt(),
+           failures,
+           m_trials);
+    QVERIFY2(!connectTimes.isEmpty(), "No ICE session connected");
+    QTest::setBenchmarkResult(connectDistribution["median"].toDouble(), QTest::WalltimeMilliseconds);
+
+    QJsonObject result;
+    result["benchmark"] = QStringLiteral("connect");
+    result["candidates"] = candidates;
+    result["loss"] = loss;
+    result["delay"] = delay;
+    result["aggressive"] = aggressive;
+    result["trials"] = m_trials;
+    result["failures"] = failures;
+    result["timeToConnected"] = connectDistribution;
+    result["timeToFirstValidPair"] = validPairDistribution;
+    m_results.append(result);
+}
+
+void tst_QXmppIceBenchmark::benchmarkTurnRelay_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("window");
+
+    QTest::newRow("audio window 16") << 172 << 16;
+    QTest::newRow("audio window 64") << 172 << 64;
+    QTest::newRow("video window 16") << 1200 << 16;
+    QTest::newRow("video window 64") << 1200 << 64;
+}
+
+// Datagrams are sent by a TURN client, relayed to a peer which echoes them
+// back, and relayed again to the client. At most "window" datagrams are in
+// flight at any time.
+void tst_QXmppIceBenchmark::benchmarkTurnRelay()
+{
+    QFETCH(int, size);
+    QFETCH(int, window);
+
+    const int total = 20000;
+
+    TestStunServer server;
+    QVERIFY(server.bind());
+
+    TestEchoPeer peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+
+    QXmppTurnAllocation allocation;
+    allocation.setServer(QHostAddress::LocalHost, server.port());
+    allocation.connectToHost();
+    QTRY_COMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+
+    const QByteArray payload(size, 'x');
+    int sent = total;
+    int received = 0;
+    connect(&allocation, &QXmppIceTransport::datagramReceived, this, [&](const QByteArray &, const QHostAddress &, quint16) {
+        received++;
+        if (sent < total) {
+            allocation.writeDatagram(payload, peer.localAddress(), peer.localPort());
+            sent++;
+        }
+    });
+
+    // the first datagram binds the channel, wait for one to come back
+    for (int i = 0; i < 5 && !received; ++i) {
+        allocation.writeDatagram(payload, peer.localAddress(), peer.localPort());
+        waitForCount(received, 1, 1000);
+    }
+    QVERIFY(received > 0);
+
+    QElapsedTimer timer;
+    timer.start();
+    received = 0;
+    sent = 0;
+    for (; sent < window; ++sent)
+        allocation.writeDatagram(payload, peer.localAddress(), peer.localPort());
+
+    // lost datagrams shrink the window, stop when it is exhausted
+    int last = -1;
+    while (received < total && received != last) {
+        last = received;
+        waitForCount(received, last + 1, 1000);
+    }
+    const qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+    QVERIFY(received > 0);
+
+    const double packetsPerSecond = received * 1000.0 / elapsed;
+    QTest::setBenchmarkResult(packetsPerSecond, QTest::FramesPerSecond);
+
+    QJsonObject result;
+    result["benchmark"] = QStringLiteral("turn-relay");
+    result["size"] = size;
+    result["window"] = window;
+    result["sent"] = sent;
+    result["received"] = received;
+    result["milliseconds"] = elapsed;
+    result["packetsPerSecond"] = packetsPerSecond;
+    m_results.append(result);
+}
+
+QTEST_MAIN(tst_QXmppIceBenchmark)
+#include "tst_qxmppicebenchmark.moc"
@@ -23,8 +23,39 @@
 
 #include "QXmppStun.h"
 
+#include "stunserver.h"
 #include "util.h"
+#include <QElapsedTimer>
 #include <QHostInfo>
+#include <QSignalSpy>
+#include <QUdpSocket>
+
+static void exchangeCredentials(QXmppIceConnection *clientL, QXmppIceConnection *clientR)
+{
+    clientL->setRemoteUser(clientR->localUser());
+    clientL->setRemotePassword(clientR->localPassword());
+    clientR->setRemoteUser(clientL->localUser());
+    clientR->setRemotePassword(clientL->localPassword());
+}
+
+static void exchangeCandidates(QXmppIceConnection *clientL, QXmppIceConnection *clientR)
+{
+    const auto &rLocalCandidates = clientR->localCandidates();
+    for (const auto &candidate : rLocalCandidates)
+        clientL->addRemoteCandidate(candidate);
+    const auto &lLocalCandidates = clientL->localCandidates();
+    for (const auto &candidate : lLocalCandidates)
+        clientR->addRemoteCandidate(candidate);
+}
+
+static bool waitForConnected(QXmppIceConnection *clientL, QXmppIceConnection *clientR)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!(clientL->isConnected() && clientR->isConnected()) && timer.elapsed() < 10000)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    return clientL->isConnected() && clientR->isConnected();
+}
 
 class tst_QXmppIceConnection : public QObject
 {
@@ -33,7 +64,12 @@ class tst_QXmppIceConnection : public QObject
 private slots:
     void testBind();
     void testBindStun();
+    void testConnect_data();
     void testConnect();
+    void testTrickle();
+    void testTurnLateRelayed();
+    void benchmarkSetup_data();
+    void benchmarkSetup();
 };
 
 void tst_QXmppIceConnection::testBind()
@@ -112,8 +148,17 @@ void tst_QXmppIceConnection::testBindStun()
     QVERIFY(foundReflexive);
 }
 
+void tst_QXmppIceConnection::testConnect_data()
+{
+    QTest::addColumn<bool>("aggressive");
+
+    QTest::newRow("aggressive nomination") << true;
+    QTest::newRow("regular nomination") << false;
+}
+
 void tst_QXmppIceConnection::testConnect()
 {
+    QFETCH(bool, aggressive);
     const int componentId = 1024;
 
     QXmppLogger logger;
@@ -123,6 +168,11 @@ void tst_QXmppIceConnection::testConnect()
     connect(&clientL, &QXmppLoggable::logMessage,
             &logger, &QXmppLogger::log);
     clientL.setIceControlling(true);
+    QVERIFY(clientL.aggressiveNomination());
+    clientL.setAggressiveNomination(aggressive);
+    QCOMPARE(clientL.checkInterval(), 50);
+    clientL.setCheckInterval(20);
+    QCOMPARE(clientL.checkInterval(), 20);
     clientL.addComponent(componentId);
     clientL.bind(QXmppIceComponent::discoverAddresses());
 
@@ -160,6 +210,202 @@ void tst_QXmppIceConnection::testConnect()
     loop.exec();
     QVERIFY(clientL.isConnected());
     QVERIFY(clientR.isConnected());
+
+    // timings are recorded
+    QVERIFY(clientL.timeToFirstValidPair() >= 0);
+    QVERIFY(clientL.timeToNominated() >= clientL.timeToFirstValidPair());
+    QVERIFY(clientR.timeToFirstValidPair() >= 0);
+    QVERIFY(clientR.timeToNominated() >= clientR.timeToFirstValidPair());
+
+    // media is passed through once connected
+    const QByteArray rtpPacket("\x80\x60\x00\x01\x00\x00\x00\xa0\x12\x34\x56\x78payload", 19);
+    QSignalSpy receivedSpy(clientR.component(componentId), &QXmppIceComponent::datagramReceived);
+    QCOMPARE(clientL.component(componentId)->sendDatagram(rtpPacket), qint64(rtpPacket.size()));
+    QVERIFY(receivedSpy.wait());
+    QCOMPARE(receivedSpy.first().first().toByteArray(), rtpPacket);
+}
+
+void tst_QXmppIceConnection::testTrickle()
+{
+    const int componentId = 1024;
+
+    // a STUN/TURN server which answers long after the host candidates
+    // could have connected
+    TestStunServer server;
+    server.setDelay(3000);
+    QVERIFY(server.bind());
+
+    QXmppIceConnection clientL;
+    clientL.setIceControlling(true);
+    clientL.setStunServer(QHostAddress::LocalHost, server.port());
+    clientL.setTurnServer(QHostAddress::LocalHost, server.port());
+    clientL.addComponent(componentId);
+    QVERIFY(clientL.bind(QList<QHostAddress>() << QHostAddress::LocalHost));
+
+    QXmppIceConnection clientR;
+    clientR.setIceControlling(false);
+    clientR.setStunServer(QHostAddress::LocalHost, server.port());
+    clientR.setTurnServer(QHostAddress::LocalHost, server.port());
+    clientR.addComponent(componentId);
+    QVERIFY(clientR.bind(QList<QHostAddress>() << QHostAddress::LocalHost));
+
+    // start checking before any candidate is known
+    exchangeCredentials(&clientL, &clientR);
+    clientL.connectToHost();
+    clientR.connectToHost();
+    QTest::qWait(200);
+    QVERIFY(!clientL.isConnected());
+    QVERIFY(!clientR.isConnected());
+
+    // candidates are passed one by one as they are gathered, and join the
+    // checklist mid-check
+    QStringList trickledIds;
+    QList<QXmppJingleCandidate::Type> trickledTypes;
+    auto trickle = [&trickledIds, &trickledTypes](QXmppIceConnection *from, QXmppIceConnection *to) {
+        const auto candidates = from->localCandidates();
+        for (const auto &candidate : candidates) {
+            if (trickledIds.contains(candidate.id()))
+                continue;
+            trickledIds << candidate.id();
+            trickledTypes << candidate.type();
+            to->addRemoteCandidate(candidate);
+        }
+    };
+    connect(&clientL, &QXmppIceConnection::localCandidatesChanged, this, [&]() {
+        trickle(&clientL, &clientR);
+    });
+    connect(&clientR, &QXmppIceConnection::localCandidatesChanged, this, [&]() {
+        trickle(&clientR, &clientL);
+    });
+    trickle(&clientL, &clientR);
+    trickle(&clientR, &clientL);
+    QVERIFY(waitForConnected(&clientL, &clientR));
+
+    // the host candidates connected while gathering was still going on
+    QCOMPARE(clientL.gatheringState(), QXmppIceConnection::BusyGatheringState);
+    QCOMPARE(clientR.gatheringState(), QXmppIceConnection::BusyGatheringState);
+    QVERIFY(!trickledTypes.isEmpty());
+    for (const auto type : qAsConst(trickledTypes))
+        QCOMPARE(type, QXmppJingleCandidate::HostType);
+}
+
+void tst_QXmppIceConnection::testTurnLateRelayed()
+{
+    const int componentId = 1024;
+
+    TestStunServer turnServer;
+    QVERIFY(turnServer.bind());
+
+    // a remote party which never answers, so that the checks keep going
+    QUdpSocket peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+
+    QXmppIceConnection client;
+    client.setIceControlling(true);
+    client.setTurnServer(QHostAddress::LocalHost, turnServer.port());
+    client.addComponent(componentId);
+    QVERIFY(client.bind(QList<QHostAddress>() << QHostAddress::LocalHost));
+    client.setRemoteUser(QStringLiteral("peer"));
+    client.setRemotePassword(QStringLiteral("peerpassword"));
+
+    // the remote candidate is known before the allocation is granted
+    QXmppJingleCandidate remote;
+    remote.setComponent(componentId);
+    remote.setFoundation(QStringLiteral("1"));
+    remote.setHost(QHostAddress::LocalHost);
+    remote.setId(QStringLiteral("peer1"));
+    remote.setPort(peer.localPort());
+    remote.setPriority(2130706431);
+    remote.setProtocol(QStringLiteral("udp"));
+    remote.setType(QXmppJingleCandidate::HostType);
+    client.addRemoteCandidate(remote);
+    client.connectToHost();
+
+    auto hasRelayedCandidate = [&client]() -> bool {
+        const auto candidates = client.localCandidates();
+        for (const auto &candidate : candidates) {
+            if (candidate.type() == QXmppJingleCandidate::RelayedType)
+                return true;
+        }
+        return false;
+    };
+    QTRY_VERIFY(hasRelayedCandidate());
+
+    // the late relayed candidate was paired with the remote candidate, and
+    // checking the pair binds a channel to it
+    auto hasPeerBinding = [&turnServer, &peer]() -> bool {
+        const auto bindings = turnServer.bindings();
+        for (const auto &binding : bindings) {
+            if (binding.second == peer.localPort())
+                return true;
+        }
+        return false;
+    };
+    QTRY_VERIFY(hasPeerBinding());
+}
+
+// Measures the time from binding the sockets until both parties are
+// connected, with a STUN server which takes 250 ms to answer. Without
+// trickling, candidates are only exchanged once gathering completes.
+
+void tst_QXmppIceConnection::benchmarkSetup_data()
+{
+    QTest::addColumn<bool>("trickle");
+
+    QTest::newRow("full gathering") << false;
+    QTest::newRow("trickle") << true;
+}
+
+void tst_QXmppIceConnection::benchmarkSetup()
+{
+    QFETCH(bool, trickle);
+    const int componentId = 1024;
+
+    QList<QHostAddress> addresses;
+    for (const auto &address : QXmppIceComponent::discoverAddresses()) {
+        if (address.protocol() == QAbstractSocket::IPv4Protocol)
+            addresses << address;
+    }
+    if (addresses.isEmpty())
+        QSKIP("No IPv4 address available");
+
+    TestStunServer stunServer;
+    stunServer.setDelay(250);
+    QVERIFY(stunServer.bind(addresses.first()));
+
+    QBENCHMARK_ONCE {
+        QXmppIceConnection clientL;
+        clientL.setIceControlling(true);
+        clientL.setStunServer(addresses.first(), stunServer.port());
+        clientL.addComponent(componentId);
+
+        QXmppIceConnection clientR;
+        clientR.setIceControlling(false);
+        clientR.setStunServer(addresses.first(), stunServer.port());
+        clientR.addComponent(componentId);
+
+        QVERIFY(clientL.bind(addresses));
+        QVERIFY(clientR.bind(addresses));
+        exchangeCredentials(&clientL, &clientR);
+
+        if (trickle) {
+            // send host candidates now and the others as they are gathered
+            connect(&clientL, &QXmppIceConnection::localCandidatesChanged, this, [&]() {
+                exchangeCandidates(&clientL, &clientR);
+            });
+            connect(&clientR, &QXmppIceConnection::localCandidatesChanged, this, [&]() {
+                exchangeCandidates(&clientL, &clientR);
+            });
+        } else {
+            QTRY_COMPARE(clientL.gatheringState(), QXmppIceConnection::CompleteGatheringState);
+            QTRY_COMPARE(clientR.gatheringState(), QXmppIceConnection::CompleteGatheringState);
+        }
+        exchangeCandidates(&clientL, &clientR);
+
+        clientL.connectToHost();
+        clientR.connectToHost();
+        QVERIFY(waitForConnected(&clientL, &clientR));
+    }
 }
 
 QTEST_MAIN(tst_QXmppIceConnection)
@@ -21,6 +21,8 @@
  *
  */
 
+#include "QXmppClient.h"
+#include "QXmppLogger.h"
 #include "QXmppMamManager.h"
 #include "QXmppMessage.h"
 
@@ -46,6 +48,30 @@ public:
     void compareResultSetReplys(const QXmppResultSetReply &lhs, const QXmppResultSetReply &rhs) const;
 };
 
+class TestMessageStore : public QXmppMamMessageStore
+{
+public:
+    QString lastArchiveId(const QString &jid) override
+    {
+        return m_lastArchiveIds.value(jid);
+    }
+
+    bool containsMessage(const QString &jid, const QString &stanzaId) override
+    {
+        return m_stanzaIds.value(jid).contains(stanzaId);
+    }
+
+    void storeMessages(const QString &jid, const QList<QXmppMessage> &messages, const QString &lastArchiveId) override
+    {
+        for (const auto &message : messages)
+            m_stanzaIds[jid] << message.stanzaId();
+        m_lastArchiveIds.insert(jid, lastArchiveId);
+    }
+
+    QMap<QString, QStringList> m_stanzaIds;
+    QMap<QString, QString> m_lastArchiveIds;
+};
+
 class tst_QXmppMamManager : public QObject
 {
     Q_OBJECT
@@ -59,6 +85,10 @@ private slots:
     void testHandleResultIq_data();
     void testHandleResultIq();
 
+    void testSynchronize();
+    void testSynchronizeReconnect();
+    void testBatchDelivery();
+
 private:
     QXmppMamTestHelper m_helper;
     QXmppMamManager m_manager;
@@ -226,6 +256,232 @@ void tst_QXmppMamManager::testHandleResultIq()
     QCOMPARE(m_helper.m_signalTriggered, accept);
 }
 
+static QDomElement parseElement(QDomDocument &doc, const QString &xml)
+{
+    doc.setContent(xml, true);
+    return doc.documentElement();
+}
+
+static QString archivedMessage(const QString &queryId, const QString &archiveId, const QString &body)
+{
+    return QStringLiteral("<message to='juliet@capulet.lit/chamber' from='juliet@capulet.lit'>"
+                          "<result xmlns='urn:xmpp:mam:2' queryid='%1' id='%2'>"
+                          "<forwarded xmlns='urn:xmpp:forward:0'>"
+                          "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+                          "<message xmlns='jabber:client' to='juliet@capulet.lit/balcony' from='romeo@montague.lit/orchard' type='chat'>"
+                          "<body>%3</body>"
+                          "</message>"
+                          "</forwarded>"
+                          "</result>"
+                          "</message>")
+        .arg(queryId, archiveId, body);
+}
+
+static QString finIq(const QString &queryId, const QString &last, bool complete)
+{
+    return QStringLiteral("<iq type='result' id='%1'>"
+                          "<fin xmlns='urn:xmpp:mam:2'%2>"
+                          "<set xmlns='http://jabber.org/protocol/rsm'>%3</set>"
+                          "</fin>"
+                          "</iq>")
+        .arg(queryId,
+             complete ? QStringLiteral(" complete='true'") : QString(),
+             last.isEmpty() ? QString() : QStringLiteral("<last>%1</last>").arg(last));
+}
+
+void tst_QXmppMamManager::testSynchronize()
+{
+    const QString romeo = QStringLiteral("romeo@montague.lit");
+    const QString nurse = QStringLiteral("nurse@capulet.lit");
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppMamManager;
+    client.addExtension(manager);
+
+    TestMessageStore store;
+    store.m_lastArchiveIds.insert(romeo, QStringLiteral("a1"));
+    store.m_stanzaIds[romeo] << QStringLiteral("a2");
+    manager->setMessageStore(&store);
+    manager->setMaximumConcurrentSynchronizations(1);
+
+    // record the ids and RSM positions of the queries sent
+    QStringList queryIds;
+    QStringList afters;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type != QXmppLogger::SentMessage || !doc.setContent(text, true))
+            return;
+        const QDomElement query = doc.documentElement().firstChildElement(QStringLiteral("query"));
+        if (query.namespaceURI() == QStringLiteral("urn:xmpp:mam:2")) {
+            queryIds << doc.documentElement().attribute(QStringLiteral("id"));
+            afters << query.firstChildElement(QStringLiteral("set")).firstChildElement(QStringLiteral("after")).text();
+        }
+    });
+
+    QList<QXmppMessage> synchronized;
+    QStringList finished;
+    connect(manager, &QXmppMamManager::messagesSynchronized, this, [&](const QString &jid, const QList<QXmppMessage> &messages) {
+        QCOMPARE(jid, romeo);
+        synchronized << messages;
+    });
+    connect(manager, &QXmppMamManager::synchronizationFinished, this, [&](const QString &jid) {
+        finished << jid;
+    });
+
+    manager->synchronize(QStringList { romeo, nurse });
+    QVERIFY(manager->isSynchronizing(romeo));
+    QVERIFY(manager->isSynchronizing(nurse));
+
+    // only one synchronization runs at a time, continuing from the store
+    QCOMPARE(queryIds.size(), 1);
+    QCOMPARE(afters.first(), QStringLiteral("a1"));
+
+    // the first page contains an already stored message
+    QDomDocument doc;
+    QVERIFY(manager->handleStanza(parseElement(doc, archivedMessage(queryIds.first(), QStringLiteral("a2"), QStringLiteral("known")))));
+    QVERIFY(manager->handleStanza(parseElement(doc, archivedMessage(queryIds.first(), QStringLiteral("a3"), QStringLiteral("new")))));
+    QVERIFY(synchronized.isEmpty());
+    QVERIFY(manager->handleStanza(parseElement(doc, finIq(queryIds.first(), QStringLiteral("a3"), false))));
+
+    QCOMPARE(synchronized.size(), 1);
+    QCOMPARE(synchronized.first().body(), QStringLiteral("new"));
+    QCOMPARE(synchronized.first().stanzaId(), QStringLiteral("a3"));
+    QCOMPARE(store.m_lastArchiveIds.value(romeo), QStringLiteral("a3"));
+
+    // the next page is requested automatically
+    QCOMPARE(queryIds.size(), 2);
+    QCOMPARE(afters.last(), QStringLiteral("a3"));
+    QVERIFY(manager->handleStanza(parseElement(doc, finIq(queryIds.last(), QString(), true))));
+    QCOMPARE(finished, QStringList { romeo });
+    QVERIFY(!manager->isSynchronizing(romeo));
+
+    // now the queued conversation is synchronized
+    QCOMPARE(queryIds.size(), 3);
+    QCOMPARE(afters.last(), QString());
+    manager->cancelSynchronization(nurse);
+    QVERIFY(!manager->isSynchronizing(nurse));
+    QVERIFY(manager->handleStanza(parseElement(doc, finIq(queryIds.last(), QString(), true))));
+    QCOMPARE(finished, QStringList { romeo });
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppMamManager::testSynchronizeReconnect()
+{
+    const QString romeo = QStringLiteral("romeo@montague.lit");
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppMamManager;
+    client.addExtension(manager);
+
+    TestMessageStore store;
+    store.m_lastArchiveIds.insert(romeo, QStringLiteral("a1"));
+    manager->setMessageStore(&store);
+
+    QStringList queryIds;
+    QStringList afters;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type != QXmppLogger::SentMessage || !doc.setContent(text, true))
+            return;
+        const QDomElement query = doc.documentElement().firstChildElement(QStringLiteral("query"));
+        if (query.namespaceURI() == QStringLiteral("urn:xmpp:mam:2")) {
+            queryIds << doc.documentElement().attribute(QStringLiteral("id"));
+            afters << query.firstChildElement(QStringLiteral("set")).firstChildElement(QStringLiteral("after")).text();
+        }
+    });
+
+    QList<QXmppMessage> synchronized;
+    connect(manager, &QXmppMamManager::messagesSynchronized, this, [&](const QString &, const QList<QXmppMessage> &messages) {
+        synchronized << messages;
+    });
+
+    manager->synchronize(QStringList { romeo });
+    QCOMPARE(queryIds.size(), 1);
+    QCOMPARE(afters.last(), QStringLiteral("a1"));
+
+    // the connection drops in the middle of a page
+    QDomDocument doc;
+    QVERIFY(manager->handleStanza(parseElement(doc, archivedMessage(queryIds.last(), QStringLiteral("a2"), QStringLiteral("first")))));
+    emit client.connected();
+
+    // the page is requested again from its start
+    QCOMPARE(queryIds.size(), 2);
+    QCOMPARE(afters.last(), QStringLiteral("a1"));
+    QVERIFY(synchronized.isEmpty());
+    QCOMPARE(store.m_lastArchiveIds.value(romeo), QStringLiteral("a1"));
+
+    QVERIFY(manager->handleStanza(parseElement(doc, archivedMessage(queryIds.last(), QStringLiteral("a2"), QStringLiteral("first")))));
+    QVERIFY(manager->handleStanza(parseElement(doc, archivedMessage(queryIds.last(), QStringLiteral("a3"), QStringLiteral("second")))));
+    QVERIFY(manager->handleStanza(parseElement(doc, finIq(queryIds.last(), QString(), true))));
+
+    // no message was lost, and the last archive id was taken from the page
+    QCOMPARE(synchronized.size(), 2);
+    QCOMPARE(synchronized.at(0).body(), QStringLiteral("first"));
+    QCOMPARE(synchronized.at(1).body(), QStringLiteral("second"));
+    QCOMPARE(store.m_lastArchiveIds.value(romeo), QStringLiteral("a3"));
+    QVERIFY(!manager->isSynchronizing(romeo));
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppMamManager::testBatchDelivery()
+{
+    QXmppMamManager manager;
+    manager.setBatchDeliveryEnabled(true);
+    QVERIFY(manager.isBatchDeliveryEnabled());
+
+    int singleMessages = 0;
+    QList<QXmppMamArchivedMessage> batch;
+    QStringList order;
+    connect(&manager, &QXmppMamManager::archivedMessageReceived, this, [&]() {
+        singleMessages++;
+    });
+    connect(&manager, &QXmppMamManager::archivedMessagesReceived, this, [&](const QString &queryId, const QList<QXmppMamArchivedMessage> &messages) {
+        QCOMPARE(queryId, QStringLiteral("q1"));
+        batch = messages;
+        order << QStringLiteral("batch");
+    });
+    connect(&manager, &QXmppMamManager::resultsRecieved, this, [&]() {
+        order << QStringLiteral("results");
+    });
+
+    // the records refer to the received documents, so keep them separate
+    QDomDocument doc1, doc2, doc3;
+    QVERIFY(manager.handleStanza(parseElement(doc1, archivedMessage(QStringLiteral("q1"), QStringLiteral("a1"), QStringLiteral("first")))));
+    QVERIFY(manager.handleStanza(parseElement(doc2, archivedMessage(QStringLiteral("q1"), QStringLiteral("a2"), QStringLiteral("second")))));
+    QVERIFY(batch.isEmpty());
+
+    QVERIFY(manager.handleStanza(parseElement(doc3, finIq(QStringLiteral("q1"), QStringLiteral("a2"), true))));
+    QCOMPARE(singleMessages, 0);
+    QCOMPARE(order, (QStringList { QStringLiteral("batch"), QStringLiteral("results") }));
+    QCOMPARE(batch.size(), 2);
+
+    const auto &record = batch.first();
+    QCOMPARE(record.queryId(), QStringLiteral("q1"));
+    QCOMPARE(record.archiveId(), QStringLiteral("a1"));
+    QCOMPARE(record.stanzaId(), QString());
+    QCOMPARE(record.from(), QStringLiteral("romeo@montague.lit/orchard"));
+    QCOMPARE(record.stamp(), QDateTime(QDate(2010, 7, 10), QTime(23, 8, 25), Qt::UTC));
+    QCOMPARE(record.element().tagName(), QStringLiteral("forwarded"));
+
+    const QXmppMessage message = record.message();
+    QCOMPARE(message.body(), QStringLiteral("first"));
+    QCOMPARE(message.from(), QStringLiteral("romeo@montague.lit/orchard"));
+    QCOMPARE(message.stamp(), record.stamp());
+    QCOMPARE(batch.last().message().body(), QStringLiteral("second"));
+}
+
 void QXmppMamTestHelper::archivedMessageReceived(const QString &queryId, const QXmppMessage &message)
 {
     m_signalTriggered = true;
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMucManager.h"
+
+#include "util.h"
+#include <QObject>
+#include <QSignalSpy>
+
+class tst_QXmppMucManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testJoin();
+    void testBulkJoin();
+
+private:
+    QXmppPresence occupantPresence(const QString &nick, const QList<int> &statusCodes = {}) const;
+
+    QXmppClient *m_client;
+    QXmppMucManager *m_manager;
+    QXmppMucRoom *m_room;
+};
+
+void tst_QXmppMucManager::init()
+{
+    m_client = new QXmppClient;
+    m_manager = new QXmppMucManager;
+    m_client->addExtension(m_manager);
+
+    m_room = m_manager->addRoom(QStringLiteral("coven@chat.shakespeare.lit"));
+    m_room->setNickName(QStringLiteral("thirdwitch"));
+}
+
+void tst_QXmppMucManager::cleanup()
+{
+    delete m_client;
+}
+
+QXmppPresence tst_QXmppMucManager::occupantPresence(const QString &nick, const QList<int> &statusCodes) const
+{
+    QXmppMucItem item;
+    item.setAffiliation(QXmppMucItem::MemberAffiliation);
+    item.setRole(QXmppMucItem::ParticipantRole);
+
+    QXmppPresence presence;
+    presence.setFrom(QStringLiteral("coven@chat.shakespeare.lit/") + nick);
+    presence.setType(QXmppPresence::Available);
+    presence.setMucItem(item);
+    presence.setMucStatusCodes(statusCodes);
+    return presence;
+}
+
+void tst_QXmppMucManager::testJoin()
+{
+    QSignalSpy addedSpy(m_room, &QXmppMucRoom::participantAdded);
+    QSignalSpy loadedSpy(m_room, &QXmppMucRoom::participantsLoaded);
+    QSignalSpy joinedSpy(m_room, &QXmppMucRoom::joined);
+
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("firstwitch")));
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("secondwitch")));
+    QCOMPARE(addedSpy.count(), 2);
+    QVERIFY(!m_room->isJoined());
+
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("thirdwitch"), { 110 }));
+    QCOMPARE(addedSpy.count(), 3);
+    QCOMPARE(loadedSpy.count(), 0);
+    QCOMPARE(joinedSpy.count(), 1);
+    QVERIFY(m_room->isJoined());
+    QCOMPARE(m_room->participantCount(), 3);
+}
+
+void tst_QXmppMucManager::testBulkJoin()
+{
+    m_room->setBulkJoinEnabled(true);
+    QVERIFY(m_room->isBulkJoinEnabled());
+
+    QSignalSpy addedSpy(m_room, &QXmppMucRoom::participantAdded);
+    QSignalSpy removedSpy(m_room, &QXmppMucRoom::participantRemoved);
+    QSignalSpy changedSpy(m_room, &QXmppMucRoom::participantsChanged);
+    QSignalSpy loadedSpy(m_room, &QXmppMucRoom::participantsLoaded);
+    QSignalSpy joinedSpy(m_room, &QXmppMucRoom::joined);
+
+    // occupants are collected silently
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("secondwitch")));
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("firstwitch")));
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("fourthwitch")));
+
+    QXmppPresence unavailable;
+    unavailable.setFrom(QStringLiteral("coven@chat.shakespeare.lit/fourthwitch"));
+    unavailable.setType(QXmppPresence::Unavailable);
+    emit m_client->presenceReceived(unavailable);
+
+    QCOMPARE(addedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(changedSpy.count(), 0);
+    QCOMPARE(m_room->participantCount(), 2);
+
+    // our own presence publishes the snapshot
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("thirdwitch"), { 110 }));
+    QCOMPARE(addedSpy.count(), 0);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(joinedSpy.count(), 1);
+    QCOMPARE(loadedSpy.count(), 1);
+
+    const QStringList expected = {
+        QStringLiteral("coven@chat.shakespeare.lit/firstwitch"),
+        QStringLiteral("coven@chat.shakespeare.lit/secondwitch"),
+        QStringLiteral("coven@chat.shakespeare.lit/thirdwitch"),
+    };
+    QCOMPARE(loadedSpy.first().first().toStringList(), expected);
+    QCOMPARE(m_room->participants(), expected);
+    QVERIFY(m_room->isJoined());
+
+    // later changes are reported incrementally
+    emit m_client->presenceReceived(occupantPresence(QStringLiteral("fourthwitch")));
+    QCOMPARE(addedSpy.count(), 1);
+    QCOMPARE(addedSpy.first().first().toString(), QStringLiteral("coven@chat.shakespeare.lit/fourthwitch"));
+    QCOMPARE(changedSpy.count(), 2);
+    QCOMPARE(m_room->participantCount(), 4);
+
+    emit m_client->presenceReceived(unavailable);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(changedSpy.count(), 3);
+    QCOMPARE(m_room->participants(), expected);
+}
+
+QTEST_MAIN(tst_QXmppMucManager)
+#include "tst_qxmppmucmanager.moc"
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServer.h"
+#include "QXmppSocks.h"
+#include "QXmppSocksProxy.h"
+
+#include "util.h"
+#include <QCryptographicHash>
+#include <QDomDocument>
+#include <QSignalSpy>
+
+static const char *initiatorJid = "initiator@localhost/QXmpp";
+static const char *targetJid = "target@localhost/QXmpp";
+
+class tst_QXmppSocksProxy : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testActivateUnknown();
+    void testRelay();
+    void testRelayLarge();
+
+private:
+    bool activate(const QString &sid);
+    bool connectClient(QXmppSocksClient *client, const QString &sid);
+
+    QXmppServer *m_server;
+    QXmppSocksProxy *m_proxy;
+};
+
+void tst_QXmppSocksProxy::init()
+{
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+
+    m_proxy = new QXmppSocksProxy;
+    m_proxy->setJid("proxy.localhost");
+    m_proxy->setHost("127.0.0.1");
+    m_proxy->setPort(0);
+    m_server->addExtension(m_proxy);
+    QVERIFY(m_proxy->start());
+    QVERIFY(m_proxy->serverPort() != 0);
+}
+
+void tst_QXmppSocksProxy::cleanup()
+{
+    m_proxy->stop();
+    delete m_server;
+}
+
+bool tst_QXmppSocksProxy::activate(const QString &sid)
+{
+    QDomDocument doc;
+    doc.setContent(QStringLiteral("<iq type=\"set\" id=\"activate1\" from=\"%1\" to=\"proxy.localhost\">"
+                                  "<query xmlns=\"http://jabber.org/protocol/bytestreams\" sid=\"%2\">"
+                                  "<activate>%3</activate>"
+                                  "</query>"
+                                  "</iq>")
+                       .arg(initiatorJid, sid, targetJid),
+                   true);
+    return m_proxy->handleStanza(doc.documentElement());
+}
+
+bool tst_QXmppSocksProxy::connectClient(QXmppSocksClient *client, const QString &sid)
+{
+    const QString hash = QCryptographicHash::hash(QString(sid + initiatorJid + targetJid).toLatin1(), QCryptographicHash::Sha1).toHex();
+
+    QSignalSpy ready(client, &QXmppSocksClient::ready);
+    client->connectToHost(hash, 0);
+    return ready.wait();
+}
+
+void tst_QXmppSocksProxy::testActivateUnknown()
+{
+    QVERIFY(activate("unknown"));
+    QCOMPARE(m_proxy->sessionCount(), 0);
+}
+
+void tst_QXmppSocksProxy::testRelay()
+{
+    QXmppSocksClient target("127.0.0.1", m_proxy->serverPort());
+    QXmppSocksClient initiator("127.0.0.1", m_proxy->serverPort());
+    QVERIFY(connectClient(&target, "sid1"));
+    QVERIFY(connectClient(&initiator, "sid1"));
+
+    QVERIFY(activate("sid1"));
+    QCOMPARE(m_proxy->sessionCount(), 1);
+
+    // data is relayed in both directions
+    initiator.write("hello");
+    QTRY_COMPARE(target.bytesAvailable(), qint64(5));
+    QCOMPARE(target.readAll(), QByteArray("hello"));
+
+    target.write("world!");
+    QTRY_COMPARE(initiator.bytesAvailable(), qint64(6));
+    QCOMPARE(initiator.readAll(), QByteArray("world!"));
+
+    // closing one end closes the bytestream
+    QSignalSpy finished(m_proxy, &QXmppSocksProxy::sessionFinished);
+    initiator.disconnectFromHost();
+    QVERIFY(finished.count() || finished.wait());
+    QCOMPARE(finished.first().at(1).toLongLong(), qint64(5));
+    QCOMPARE(finished.first().at(2).toLongLong(), qint64(6));
+    QCOMPARE(m_proxy->sessionCount(), 0);
+    QCOMPARE(m_proxy->bytesRelayed(), qint64(11));
+    QTRY_COMPARE(target.state(), QAbstractSocket::UnconnectedState);
+}
+
+void tst_QXmppSocksProxy::testRelayLarge()
+{
+    // more data than the proxy relays in one go, so that it has to yield
+    // and carry on
+    const QByteArray data(4 * 1024 * 1024, 'x');
+
+    QXmppSocksClient target("127.0.0.1", m_proxy->serverPort());
+    QXmppSocksClient initiator("127.0.0.1", m_proxy->serverPort());
+    QVERIFY(connectClient(&target, "sid1"));
+    QVERIFY(connectClient(&initiator, "sid1"));
+    QVERIFY(activate("sid1"));
+
+    QByteArray received;
+    connect(&target, &QIODevice::readyRead, this, [&]() {
+        received += target.readAll();
+    });
+
+    initiator.write(data);
+    QTRY_COMPARE_WITH_TIMEOUT(received.size(), data.size(), 30000);
+    QCOMPARE(received, data);
+}
+
+QTEST_MAIN(tst_QXmppSocksProxy)
+#include "tst_qxmppsocksproxy.moc"
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServer.h"
+#include "QXmppSocks.h"
+#include "QXmppSocksProxy.h"
+
+#include "util.h"
+#include <QCryptographicHash>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTimer>
+
+// Measures the throughput of a bytestream relayed by the SOCKS5 proxy over
+// the loopback interface.
+
+static const char *initiatorJid = "initiator@localhost/QXmpp";
+static const char *targetJid = "target@localhost/QXmpp";
+
+class tst_QXmppSocksProxyBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void benchmarkRelay();
+
+private:
+    bool activate(const QString &sid);
+    bool connectClient(QXmppSocksClient *client, const QString &sid);
+
+    QXmppServer *m_server;
+    QXmppSocksProxy *m_proxy;
+};
+
+void tst_QXmppSocksProxyBenchmark::init()
+{
+    m_server = new QXmppServer;
+    m_server->setDomain("localhost");
+
+    m_proxy = new QXmppSocksProxy;
+    m_proxy->setJid("proxy.localhost");
+    m_proxy->setHost("127.0.0.1");
+    m_proxy->setPort(0);
+    m_server->addExtension(m_proxy);
+    QVERIFY(m_proxy->start());
+    QVERIFY(m_proxy->serverPort() != 0);
+}
+
+void tst_QXmppSocksProxyBenchmark::cleanup()
+{
+    m_proxy->stop();
+    delete m_server;
+}
+
+bool tst_QXmppSocksProxyBenchmark::activate(const QString &sid)
+{
+    QDomDocument doc;
+    doc.setContent(QStringLiteral("<iq type=\"set\" id=\"activate1\" from=\"%1\" to=\"proxy.localhost\">"
+                                  "<query xmlns=\"http://jabber.org/protocol/bytestreams\" sid=\"%2\">"
+                                  "<activate>%3</activate>"
+                                  "</query>"
+                                  "</iq>")
+                       .arg(initiatorJid, sid, targetJid),
+                   true);
+    return m_proxy->handleStanza(doc.documentElement());
+}
+
+bool tst_QXmppSocksProxyBenchmark::connectClient(QXmppSocksClient *client, const QString &sid)
+{
+    const QString hash = QCryptographicHash::hash(QString(sid + initiatorJid + targetJid).toLatin1(), QCryptographicHash::Sha1).toHex();
+
+    QSignalSpy ready(client, &QXmppSocksClient::ready);
+    client->connectToHost(hash, 0);
+    return ready.wait();
+}
+
+void tst_QXmppSocksProxyBenchmark::benchmarkRelay()
+{
+    const qint64 total = 256 * 1024 * 1024;
+    const QByteArray chunk(1024 * 1024, 'x');
+
+    QXmppSocksClient target("127.0.0.1", m_proxy->serverPort());
+    QXmppSocksClient initiator("127.0.0.1", m_proxy->serverPort());
+    QVERIFY(connectClient(&target, "sid1"));
+    QVERIFY(connectClient(&initiator, "sid1"));
+    QVERIFY(activate("sid1"));
+
+    qint64 sent = 0;
+    qint64 received = 0;
+    QEventLoop loop;
+
+    auto send = [&]() {
+        while (sent < total && initiator.bytesToWrite() < 4 * chunk.size()) {
+            initiator.write(chunk);
+            sent += chunk.size();
+        }
+    };
+    connect(&initiator, &QIODevice::bytesWritten, &loop, send);
+    connect(&target, &QIODevice::readyRead, &loop, [&]() {
+        received += target.readAll().size();
+        if (received >= total)
+            loop.quit();
+    });
+
+    // give up rather than hang if the relay stalls
+    QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+
+    QElapsedTimer timer;
+    timer.start();
+    send();
+    loop.exec();
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+
+    QCOMPARE(received, total);
+    QTest::setBenchmarkResult(total * 1000.0 / elapsed, QTest::BytesPerSecond);
+}
+
+QTEST_MAIN(tst_QXmppSocksProxyBenchmark)
+#include "tst_qxmppsocksproxybenchmark.moc"
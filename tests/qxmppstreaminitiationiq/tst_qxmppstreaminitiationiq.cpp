@@ -36,6 +36,7 @@ private slots:
     void testFileInfo();
     void testOffer();
     void testResult();
+    void testResultRange();
 };
 
 void tst_QXmppStreamInitiationIq::testFileInfo_data()
@@ -44,6 +45,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
     QTest::addColumn<QDateTime>("date");
     QTest::addColumn<QString>("description");
     QTest::addColumn<QByteArray>("hash");
+    QTest::addColumn<int>("hashAlgorithm");
     QTest::addColumn<QString>("name");
     QTest::addColumn<qint64>("size");
 
@@ -52,6 +54,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime()
         << QString()
         << QByteArray()
+        << int(QCryptographicHash::Md5)
         << QString("test.txt")
         << qint64(1022);
 
@@ -66,6 +69,20 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime(QDate(1969, 7, 21), QTime(2, 56, 15), Qt::UTC)
         << QString("This is a test. If this were a real file...")
         << QByteArray::fromHex("552da749930852c69ae5d2141d3766b1")
+        << int(QCryptographicHash::Md5)
+        << QString("test.txt")
+        << qint64(1022);
+
+    QTest::newRow("sha-256")
+        << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" "
+                      "name=\"test.txt\" "
+                      "size=\"1022\">"
+                      "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=</hash>"
+                      "</file>")
+        << QDateTime()
+        << QString()
+        << QByteArray::fromHex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855")
+        << int(QCryptographicHash::Sha256)
         << QString("test.txt")
         << qint64(1022);
 }
@@ -76,6 +93,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QFETCH(QDateTime, date);
     QFETCH(QString, description);
     QFETCH(QByteArray, hash);
+    QFETCH(int, hashAlgorithm);
     QFETCH(QString, name);
     QFETCH(qint64, size);
 
@@ -84,6 +102,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QCOMPARE(info.date(), date);
     QCOMPARE(info.description(), description);
     QCOMPARE(info.hash(), hash);
+    QCOMPARE(int(info.hashAlgorithm()), hashAlgorithm);
     QCOMPARE(info.name(), name);
     QCOMPARE(info.size(), size);
     serializePacket(info, xml);
@@ -135,5 +154,32 @@ void tst_QXmppStreamInitiationIq::testResult()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppStreamInitiationIq::testResultRange()
+{
+    QByteArray xml(
+        "<iq id=\"offer1\" to=\"sender@jabber.org/resource\" type=\"result\">"
+        "<si xmlns=\"http://jabber.org/protocol/si\">"
+        "<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+        "<range offset=\"128\" length=\"256\"/>"
+        "</file>"
+        "<feature xmlns=\"http://jabber.org/protocol/feature-neg\">"
+        "<x xmlns=\"jabber:x:data\" type=\"submit\">"
+        "<field type=\"list-single\" var=\"stream-method\">"
+        "<value>http://jabber.org/protocol/bytestreams</value>"
+        "</field>"
+        "</x>"
+        "</feature>"
+        "</si>"
+        "</iq>");
+
+    QXmppStreamInitiationIq iq;
+    parsePacket(iq, xml);
+    QVERIFY(!iq.fileInfo().isNull());
+    QVERIFY(iq.fileInfo().isRangeSupported());
+    QCOMPARE(iq.fileInfo().rangeOffset(), qint64(128));
+    QCOMPARE(iq.fileInfo().rangeLength(), qint64(256));
+    serializePacket(iq, xml);
+}
+
 QTEST_MAIN(tst_QXmppStreamInitiationIq)
 #include "tst_qxmppstreaminitiationiq.moc"
@@ -24,6 +24,7 @@
 #include "QXmppStun.h"
 
 #include "util.h"
+#include <QMessageAuthenticationCode>
 #include <QObject>
 
 class tst_QXmppStunMessage : public QObject
@@ -37,8 +38,47 @@ private slots:
     void testIPv6Address();
     void testXorIPv4Address();
     void testXorIPv6Address();
+    void testDecodeIntegrity();
+    void testDecodeTruncated();
+    void testEncodeBuffer();
+    void benchmarkDecode_data();
+    void benchmarkDecode();
+    void benchmarkEncode_data();
+    void benchmarkEncode();
 };
 
+static QXmppStunMessage bindingMessage(bool response)
+{
+    QXmppStunMessage msg;
+    msg.setId(QByteArray("0123456789ab"));
+    if (response) {
+        msg.setType(QXmppStunMessage::Binding | QXmppStunMessage::Response);
+        msg.xorMappedHost = QHostAddress("192.0.2.1");
+        msg.xorMappedPort = 32853;
+    } else {
+        msg.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+        msg.setUsername(QStringLiteral("evtj:h6vY"));
+        msg.setPriority(0x6e0001ff);
+        msg.iceControlling = QByteArray("\x93\x2f\xf9\xb1\x51\x26\x3b\x36", 8);
+        msg.useCandidate = true;
+    }
+    return msg;
+}
+
+static void addBindingRows()
+{
+    QTest::addColumn<bool>("response");
+    QTest::addColumn<QByteArray>("key");
+    QTest::addColumn<bool>("fingerprint");
+
+    QTest::newRow("request") << false << QByteArray() << false;
+    QTest::newRow("request integrity") << false << QByteArray("VOkJxbRl1RmTxUk/WvJxBt") << false;
+    QTest::newRow("request integrity fingerprint") << false << QByteArray("VOkJxbRl1RmTxUk/WvJxBt") << true;
+    QTest::newRow("response") << true << QByteArray() << false;
+    QTest::newRow("response integrity") << true << QByteArray("VOkJxbRl1RmTxUk/WvJxBt") << false;
+    QTest::newRow("response integrity fingerprint") << true << QByteArray("VOkJxbRl1RmTxUk/WvJxBt") << true;
+}
+
 void tst_QXmppStunMessage::testFingerprint()
 {
     // without fingerprint
@@ -132,5 +172,118 @@ void tst_QXmppStunMessage::testXorIPv6Address()
     QCOMPARE(msg2.xorMappedPort, quint16(12345));
 }
 
+void tst_QXmppStunMessage::testDecodeIntegrity()
+{
+    const QByteArray key("somesecret");
+    const QByteArray packet = bindingMessage(false).encode(key, true);
+
+    // correct key
+    QXmppStunMessage msg;
+    QStringList errors;
+    QVERIFY(msg.decode(packet, key, &errors));
+    QVERIFY(errors.isEmpty());
+    QCOMPARE(msg.type(), quint16(QXmppStunMessage::Binding | QXmppStunMessage::Request));
+    QCOMPARE(msg.id(), QByteArray("0123456789ab"));
+    QCOMPARE(msg.username(), QStringLiteral("evtj:h6vY"));
+    QCOMPARE(msg.priority(), quint32(0x6e0001ff));
+    QCOMPARE(msg.iceControlling, QByteArray("\x93\x2f\xf9\xb1\x51\x26\x3b\x36", 8));
+    QVERIFY(msg.useCandidate);
+
+    // reusable context
+    QMessageAuthenticationCode integrity(QCryptographicHash::Sha1, key);
+    QByteArray buffer;
+    bindingMessage(false).encode(&buffer, &integrity, true);
+    QCOMPARE(buffer, packet);
+    for (int i = 0; i < 2; ++i) {
+        QXmppStunMessage msg4;
+        QVERIFY(msg4.decode(packet.constData(), packet.size(), &integrity));
+    }
+
+    // wrong key
+    QXmppStunMessage msg2;
+    QVERIFY(!msg2.decode(packet, QByteArray("othersecret"), &errors));
+    QCOMPARE(errors, QStringList() << QStringLiteral("Bad message integrity"));
+
+    // corrupted fingerprint
+    QByteArray corrupted = packet;
+    corrupted[corrupted.size() - 1] = corrupted.at(corrupted.size() - 1) ^ 0x01;
+    errors.clear();
+    QXmppStunMessage msg3;
+    QVERIFY(!msg3.decode(corrupted, key, &errors));
+    QCOMPARE(errors, QStringList() << QStringLiteral("Bad fingerprint"));
+}
+
+void tst_QXmppStunMessage::testDecodeTruncated()
+{
+    // header announces 8 bytes, attribute announces 8 bytes
+    const QByteArray packet("\x00\x01\x00\x08\x21\x12\xA4\x42\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x80\x22\x00\x08\x51\x58\x6d\x70", 28);
+
+    QXmppStunMessage msg;
+    QStringList errors;
+    QVERIFY(!msg.decode(packet, QByteArray(), &errors));
+    QCOMPARE(errors, QStringList() << QStringLiteral("Received a truncated STUN attribute"));
+
+    // errors are optional
+    QVERIFY(!msg.decode(packet.constData(), 10));
+}
+
+void tst_QXmppStunMessage::testEncodeBuffer()
+{
+    const QByteArray key("somesecret");
+    const QXmppStunMessage request = bindingMessage(false);
+    const QXmppStunMessage response = bindingMessage(true);
+
+    QByteArray buffer;
+    request.encode(&buffer, key, true);
+    QCOMPARE(buffer, request.encode(key, true));
+
+    // the storage is reused for the next message
+    const char *data = buffer.constData();
+    response.encode(&buffer, key, true);
+    QCOMPARE(buffer, response.encode(key, true));
+    QCOMPARE(buffer.constData(), data);
+}
+
+// The benchmarks below measure the time taken to process a single packet,
+// the inverse of which is the number of packets per second.
+
+void tst_QXmppStunMessage::benchmarkDecode_data()
+{
+    addBindingRows();
+}
+
+void tst_QXmppStunMessage::benchmarkDecode()
+{
+    QFETCH(bool, response);
+    QFETCH(QByteArray, key);
+    QFETCH(bool, fingerprint);
+
+    const QByteArray packet = bindingMessage(response).encode(key, fingerprint);
+    QBENCHMARK {
+        QXmppStunMessage msg;
+        if (!msg.decode(packet, key))
+            QFAIL("Could not decode packet");
+    }
+}
+
+void tst_QXmppStunMessage::benchmarkEncode_data()
+{
+    addBindingRows();
+}
+
+void tst_QXmppStunMessage::benchmarkEncode()
+{
+    QFETCH(bool, response);
+    QFETCH(QByteArray, key);
+    QFETCH(bool, fingerprint);
+
+    const QXmppStunMessage msg = bindingMessage(response);
+    QByteArray buffer;
+    QBENCHMARK {
+        msg.encode(&buffer, key, fingerprint);
+    }
+    QVERIFY(buffer.size() > 20);
+}
+
 QTEST_MAIN(tst_QXmppStunMessage)
 #include "tst_qxmppstunmessage.moc"
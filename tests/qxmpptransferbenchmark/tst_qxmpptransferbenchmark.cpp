@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppClient.h"
+#include "QXmppServer.h"
+#include "QXmppSocksProxy.h"
+#include "QXmppTransferManager.h"
+
+#include "util.h"
+#include <ctime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QObject>
+#include <QTemporaryDir>
+
+// Measures file transfer throughput between two clients connected to an
+// in-process server over the loopback interface.
+//
+// The wall clock throughput of each row is reported as the benchmark result,
+// so it can be collected with the usual QtTest output formats (-csv, -xml,
+// -junitxml). If QXMPP_BENCHMARK_OUTPUT is set, the throughput and the CPU
+// time spent per MiB are also written to that path as a JSON array.
+
+static const char *benchmarkDomain = "localhost";
+static const quint16 benchmarkPort = 12346;
+static const qint64 mebibyte = 1024 * 1024;
+
+class tst_QXmppTransferBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkTransfer_data();
+    void benchmarkTransfer();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user);
+    QString filePath(qint64 fileSize);
+
+    QXmppLogger m_logger;
+    TestPasswordChecker m_passwordChecker;
+    QXmppServer m_server;
+    QXmppClient m_sender;
+    QXmppClient m_receiver;
+    QXmppTransferManager *m_senderManager;
+    QXmppTransferManager *m_receiverManager;
+    QTemporaryDir m_tempDir;
+    QJsonArray m_results;
+};
+
+bool tst_QXmppTransferBenchmark::connectClient(QXmppClient *client, const QString &user)
+{
+    QEventLoop loop;
+    connect(client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+    connect(client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+
+    QXmppConfiguration config;
+    config.setDomain(benchmarkDomain);
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(benchmarkPort);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+// Returns the path of a file filled with pseudo-random data, creating it
+// on first use.
+QString tst_QXmppTransferBenchmark::filePath(qint64 fileSize)
+{
+    const QString path = m_tempDir.filePath(QString("send-%1.bin").arg(fileSize));
+    if (QFileInfo(path).size() == fileSize)
+        return path;
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return QString();
+
+    QByteArray block(64 * 1024, Qt::Uninitialized);
+    quint32 seed = 0x9e3779b9;
+    for (qint64 written = 0; written < fileSize; written += block.size()) {
+        for (int i = 0; i < block.size(); ++i) {
+            seed = seed * 1664525 + 1013904223;
+            block[i] = char(seed >> 24);
+        }
+        file.write(block.constData(), qMin<qint64>(block.size(), fileSize - written));
+    }
+    return path;
+}
+
+void tst_QXmppTransferBenchmark::initTestCase()
+{
+    QVERIFY(m_tempDir.isValid());
+
+    //m_logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    // prepare server, with a SOCKS5 bytestreams proxy
+    m_passwordChecker.addCredentials("sender", "testpwd");
+    m_passwordChecker.addCredentials("receiver", "testpwd");
+
+    auto *proxy = new QXmppSocksProxy;
+    proxy->setJid(QString("proxy.%1").arg(benchmarkDomain));
+    proxy->setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    proxy->setPort(0);
+
+    m_server.setDomain(benchmarkDomain);
+    m_server.setLogger(&m_logger);
+    m_server.setPasswordChecker(&m_passwordChecker);
+    m_server.addExtension(proxy);
+    QVERIFY(m_server.listenForClients(QHostAddress::LocalHost, benchmarkPort));
+
+    // prepare clients
+    m_senderManager = new QXmppTransferManager;
+    m_sender.addExtension(m_senderManager);
+    m_sender.setLogger(&m_logger);
+    QVERIFY(connectClient(&m_sender, "sender"));
+
+    m_receiverManager = new QXmppTransferManager;
+    m_receiverManager->setSupportedMethods(QXmppTransferJob::AnyMethod);
+    connect(m_receiverManager, &QXmppTransferManager::fileReceived, this, [this](QXmppTransferJob *job) {
+        job->accept(m_tempDir.filePath(QString("receive-%1.bin").arg(job->sid())));
+    });
+    m_receiver.addExtension(m_receiverManager);
+    m_receiver.setLogger(&m_logger);
+    QVERIFY(connectClient(&m_receiver, "receiver"));
+}
+
+void tst_QXmppTransferBenchmark::cleanupTestCase()
+{
+    m_sender.disconnectFromServer();
+    m_receiver.disconnectFromServer();
+
+    const QString outputPath = QString::fromLocal8Bit(qgetenv("QXMPP_BENCHMARK_OUTPUT"));
+    if (!outputPath.isEmpty()) {
+        QFile output(outputPath);
+        QVERIFY2(output.open(QIODevice::WriteOnly | QIODevice::Truncate), qPrintable(output.errorString()));
+        output.write(QJsonDocument(m_results).toJson());
+    }
+}
+
+void tst_QXmppTransferBenchmark::benchmarkTransfer_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<qint64>("fileSize");
+    QTest::addColumn<int>("blockSize");
+
+    const QStringList methods = QStringList() << "socks" << "socks-proxy" << "ibb";
+    const QList<qint64> fileSizes = QList<qint64>() << 256 * 1024 << 4 * mebibyte << 32 * mebibyte;
+    const QList<int> blockSizes = QList<int>() << 4096 << 16384;
+
+    for (const auto &method : methods) {
+        for (const auto fileSize : fileSizes) {
+            for (const auto blockSize : blockSizes) {
+                const QByteArray name = QString("%1 %2KiB block %3").arg(method, QString::number(fileSize / 1024), QString::number(blockSize)).toLatin1();
+                QTest::newRow(name.constData()) << method << fileSize << blockSize;
+            }
+        }
+    }
+}
+
+void tst_QXmppTransferBenchmark::benchmarkTransfer()
+{
+    QFETCH(QString, method);
+    QFETCH(qint64, fileSize);
+    QFETCH(int, blockSize);
+
+    const QString path = filePath(fileSize);
+    QVERIFY(!path.isEmpty());
+
+    if (method == "ibb") {
+        m_senderManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+        m_senderManager->setIbbBlockSize(blockSize);
+    } else {
+        m_senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+        m_senderManager->setSocksBlockSize(blockSize);
+    }
+    if (method == "socks-proxy") {
+        m_senderManager->setProxy(QString("proxy.%1").arg(benchmarkDomain));
+        m_senderManager->setProxyOnly(true);
+    } else {
+        m_senderManager->setProxy(QString());
+        m_senderManager->setProxyOnly(false);
+    }
+
+    QXmppTransferJob *receiverJob = nullptr;
+    QEventLoop loop;
+    auto conn = connect(m_receiverManager, &QXmppTransferManager::jobFinished, &loop, [&](QXmppTransferJob *job) {
+        receiverJob = job;
+        loop.quit();
+    });
+
+    const std::clock_t cpuStart = std::clock();
+    QElapsedTimer timer;
+    timer.start();
+
+    QXmppTransferJob *senderJob = m_senderManager->sendFile("receiver@localhost/QXmpp", path);
+    QVERIFY(senderJob);
+    loop.exec();
+
+    const qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+    const double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    disconnect(conn);
+
+    QVERIFY(receiverJob);
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverJob->method(), method == "ibb" ? QXmppTransferJob::InBandMethod : QXmppTransferJob::SocksMethod);
+    QCOMPARE(QFileInfo(receiverJob->localFileUrl().toLocalFile()).size(), fileSize);
+    QFile::remove(receiverJob->localFileUrl().toLocalFile());
+
+    const double bytesPerSecond = fileSize * 1000.0 / elapsed;
+    QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+
+    QJsonObject result;
+    result["method"] = method;
+    result["fileSize"] = fileSize;
+    result["blockSize"] = blockSize;
+    result["milliseconds"] = elapsed;
+    result["bytesPerSecond"] = bytesPerSecond;
+    result["cpuMillisecondsPerMiB"] = cpuSeconds * 1000.0 * mebibyte / fileSize;
+    m_results.append(result);
+}
+
+QTEST_MAIN(tst_QXmppTransferBenchmark)
+#include "tst_qxmpptransferbenchmark.moc"
@@ -23,11 +23,185 @@
 
 #include "QXmppClient.h"
 #include "QXmppServer.h"
+#include "QXmppSocks.h"
 #include "QXmppTransferManager.h"
 
 #include "util.h"
 #include <QBuffer>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QObject>
+#include <QPointer>
+#include <QSignalSpy>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+
+// Simulates a remote party which accepts In-Band Bytestreams and
+// acknowledges every request after the given round trip time.
+class TestIbbPeer : public QObject
+{
+public:
+    TestIbbPeer(QXmppClient *client, QXmppLogger *logger, int roundTripTime)
+        : m_client(client), m_roundTripTime(roundTripTime)
+    {
+        connect(logger, &QXmppLogger::message, this, &TestIbbPeer::handleMessage);
+    }
+
+    QString jid() const
+    {
+        return QStringLiteral("receiver@localhost/QXmpp");
+    }
+
+    void acceptOffer(QXmppTransferManager *manager, const QString &offerId, qint64 rangeOffset = 0, const QByteArray &rangeHash = QByteArray())
+    {
+        const QString hash = rangeHash.isEmpty() ? QString() : QStringLiteral("<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">%1</hash>").arg(QString::fromLatin1(rangeHash.toBase64()));
+        const QString range = rangeOffset ? QStringLiteral("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+                                                           "<range offset=\"%1\">%2</range>"
+                                                           "</file>")
+                                                .arg(QString::number(rangeOffset), hash)
+                                          : QString();
+
+        QDomDocument doc;
+        doc.setContent(QStringLiteral(
+                           "<iq type=\"result\" id=\"%1\" from=\"%2\">"
+                           "<si xmlns=\"http://jabber.org/protocol/si\">"
+                           "%3"
+                           "<feature xmlns=\"http://jabber.org/protocol/feature-neg\">"
+                           "<x xmlns=\"jabber:x:data\" type=\"submit\">"
+                           "<field var=\"stream-method\"><value>http://jabber.org/protocol/ibb</value></field>"
+                           "</x>"
+                           "</feature>"
+                           "</si>"
+                           "</iq>")
+                           .arg(offerId, jid(), range),
+                       true);
+        manager->handleStanza(doc.documentElement());
+    }
+
+    QStringList offerIds;
+    QStringList offerHashes;
+    QStringList dataSids;
+    int received = 0;
+    int inFlight = 0;
+    int maxInFlight = 0;
+
+private:
+    void handleMessage(QXmppLogger::MessageType type, const QString &text)
+    {
+        QDomDocument doc;
+        if (type != QXmppLogger::SentMessage || !doc.setContent(text, true))
+            return;
+
+        const QDomElement element = doc.documentElement();
+        if (element.tagName() != QStringLiteral("iq") || element.attribute(QStringLiteral("type")) != QStringLiteral("set"))
+            return;
+
+        const QString id = element.attribute(QStringLiteral("id"));
+        if (!element.firstChildElement(QStringLiteral("si")).isNull()) {
+            offerIds << id;
+            offerHashes << element.firstChildElement(QStringLiteral("si")).firstChildElement(QStringLiteral("file")).attribute(QStringLiteral("hash"));
+            return;
+        }
+
+        const QDomElement data = element.firstChildElement(QStringLiteral("data"));
+        const bool isData = !data.isNull();
+        if (isData) {
+            dataSids << data.attribute(QStringLiteral("sid"));
+            received += QByteArray::fromBase64(data.text().toLatin1()).size();
+            maxInFlight = qMax(maxInFlight, ++inFlight);
+        }
+
+        QTimer::singleShot(m_roundTripTime, this, [this, id, isData]() {
+            if (isData)
+                inFlight--;
+
+            QXmppIq ack(QXmppIq::Result);
+            ack.setId(id);
+            ack.setFrom(jid());
+            emit m_client->iqReceived(ack);
+        });
+    }
+
+    QXmppClient *m_client;
+    int m_roundTripTime;
+};
+
+// Simulates a remote party which offers a file, and either sends it over an
+// In-Band Bytestream or offers SOCKS5 stream hosts.
+class TestSender
+{
+public:
+    TestSender(QXmppTransferManager *manager)
+        : m_manager(manager)
+    {
+    }
+
+    QString jid() const
+    {
+        return QStringLiteral("sender@localhost/QXmpp");
+    }
+
+    void offer(const QString &sid, const QString &file, const QString &method = QStringLiteral("http://jabber.org/protocol/ibb"))
+    {
+        send(QStringLiteral("<iq type=\"set\" id=\"offer-%1\" from=\"%2\">"
+                            "<si xmlns=\"http://jabber.org/protocol/si\" id=\"%1\" profile=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+                            "%3"
+                            "<feature xmlns=\"http://jabber.org/protocol/feature-neg\">"
+                            "<x xmlns=\"jabber:x:data\" type=\"form\">"
+                            "<field var=\"stream-method\" type=\"list-single\">"
+                            "<option><value>%4</value></option>"
+                            "</field>"
+                            "</x>"
+                            "</feature>"
+                            "</si>"
+                            "</iq>")
+                 .arg(sid, jid(), file, method));
+    }
+
+    void offerStreamHosts(const QString &sid, const QList<QPair<QString, quint16>> &hosts)
+    {
+        QString streamHosts;
+        for (const auto &host : hosts) {
+            streamHosts += QStringLiteral("<streamhost jid=\"%1\" host=\"127.0.0.1\" port=\"%2\"/>")
+                               .arg(host.first, QString::number(host.second));
+        }
+        send(QStringLiteral("<iq type=\"set\" id=\"hosts-%1\" from=\"%2\">"
+                            "<query xmlns=\"http://jabber.org/protocol/bytestreams\" sid=\"%1\" mode=\"tcp\">%3</query>"
+                            "</iq>")
+                 .arg(sid, jid(), streamHosts));
+    }
+
+    void sendData(const QString &sid, const QByteArray &data)
+    {
+        send(QStringLiteral("<iq type=\"set\" id=\"open-%1\" from=\"%2\">"
+                            "<open xmlns=\"http://jabber.org/protocol/ibb\" sid=\"%1\" block-size=\"4096\"/>"
+                            "</iq>")
+                 .arg(sid, jid()));
+        for (int seq = 0; seq * 4096 < data.size(); ++seq) {
+            send(QStringLiteral("<iq type=\"set\" id=\"data-%1-%3\" from=\"%2\">"
+                                "<data xmlns=\"http://jabber.org/protocol/ibb\" sid=\"%1\" seq=\"%3\">%4</data>"
+                                "</iq>")
+                     .arg(sid, jid(), QString::number(seq), QString::fromLatin1(data.mid(seq * 4096, 4096).toBase64())));
+        }
+        send(QStringLiteral("<iq type=\"set\" id=\"close-%1\" from=\"%2\">"
+                            "<close xmlns=\"http://jabber.org/protocol/ibb\" sid=\"%1\"/>"
+                            "</iq>")
+                 .arg(sid, jid()));
+    }
+
+private:
+    void send(const QString &xml)
+    {
+        QDomDocument doc;
+        QVERIFY(doc.setContent(xml, true));
+        QVERIFY(m_manager->handleStanza(doc.documentElement()));
+    }
+
+    QXmppTransferManager *m_manager;
+};
 
 class tst_QXmppTransferManager : public QObject
 {
@@ -37,6 +211,21 @@ private slots:
     void init();
     void testSendFile_data();
     void testSendFile();
+    void testSendTruncatedFile();
+    void testSendFileHash_data();
+    void testSendFileHash();
+    void testReceiveHash_data();
+    void testReceiveHash();
+    void testSocksStreamHosts_data();
+    void testSocksStreamHosts();
+    void testScheduler();
+    void testFinishedJobRetention();
+    void testSendRange_data();
+    void testSendRange();
+    void testReceiveRange_data();
+    void testReceiveRange();
+    void benchmarkInBandWindow_data();
+    void benchmarkInBandWindow();
 
     void acceptFile(QXmppTransferJob *job);
 
@@ -63,27 +252,47 @@ void tst_QXmppTransferManager::testSendFile_data()
 {
     QTest::addColumn<QXmppTransferJob::Method>("senderMethods");
     QTest::addColumn<QXmppTransferJob::Method>("receiverMethods");
+    QTest::addColumn<int>("ibbBlockSize");
+    QTest::addColumn<int>("ibbWindowSize");
+    QTest::addColumn<bool>("localFile");
     QTest::addColumn<bool>("works");
 
-    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << 4096 << 1 << false << true;
+    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << 4096 << 1 << false << true;
+    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << 4096 << 1 << false << true;
 
-    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false;
+    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << 4096 << 1 << false << true;
+    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << 4096 << 1 << false << true;
+    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << 4096 << 1 << false << false;
 
-    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false;
-    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("inband window 4") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << 4096 << 4 << false << true;
+    QTest::newRow("inband window 16") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << 1024 << 16 << false << true;
+    QTest::newRow("inband smaller blocks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << 16384 << 4 << false << true;
+
+    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << 4096 << 1 << false << true;
+    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << 4096 << 1 << false << false;
+    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << 4096 << 1 << false << true;
+    QTest::newRow("socks local file") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << 4096 << 1 << true << true;
 }
 
 void tst_QXmppTransferManager::testSendFile()
 {
     QFETCH(QXmppTransferJob::Method, senderMethods);
     QFETCH(QXmppTransferJob::Method, receiverMethods);
+    QFETCH(int, ibbBlockSize);
+    QFETCH(int, ibbWindowSize);
+    QFETCH(bool, localFile);
     QFETCH(bool, works);
 
+    // files on disk are sent from memory mapped windows
+    QString filePath = QStringLiteral(":/test.svg");
+    QTemporaryDir tempDir;
+    if (localFile) {
+        QVERIFY(tempDir.isValid());
+        filePath = tempDir.filePath(QStringLiteral("test.svg"));
+        QVERIFY(QFile::copy(QStringLiteral(":/test.svg"), filePath));
+    }
+
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
     const quint16 testPort = 12345;
@@ -106,6 +315,10 @@ void tst_QXmppTransferManager::testSendFile()
     QXmppClient sender;
     auto *senderManager = new QXmppTransferManager;
     senderManager->setSupportedMethods(senderMethods);
+    senderManager->setIbbBlockSize(ibbBlockSize);
+    senderManager->setIbbWindowSize(ibbWindowSize);
+    senderManager->setSocksBlockSize(1024);
+    senderManager->setSocksWatermarks(2048, 4096);
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
@@ -144,9 +357,9 @@ void tst_QXmppTransferManager::testSendFile()
 
     // send file
     QEventLoop loop;
-    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", filePath);
     QVERIFY(senderJob);
-    QCOMPARE(senderJob->localFileUrl(), QUrl::fromLocalFile(":/test.svg"));
+    QCOMPARE(senderJob->localFileUrl(), QUrl::fromLocalFile(filePath));
     connect(senderJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
     loop.exec();
 
@@ -167,6 +380,11 @@ void tst_QXmppTransferManager::testSendFile()
         QVERIFY(expectedFile.open(QIODevice::ReadOnly));
         const QByteArray expectedData = expectedFile.readAll();
         QCOMPARE(receiverBuffer.data(), expectedData);
+
+        // the hash was part of the offer, and checked by the receiver
+        const QByteArray expectedHash = QCryptographicHash::hash(expectedData, QCryptographicHash::Md5);
+        QCOMPARE(senderJob->fileHash(), expectedHash);
+        QCOMPARE(receiverJob->fileHash(), expectedHash);
     } else {
         QCOMPARE(senderJob->state(), QXmppTransferJob::FinishedState);
         QCOMPARE(senderJob->error(), QXmppTransferJob::AbortError);
@@ -177,5 +395,674 @@ void tst_QXmppTransferManager::testSendFile()
     }
 }
 
+void tst_QXmppTransferManager::testSendTruncatedFile()
+{
+    // the file is sent from 1 MiB windows, it loses its second one while
+    // the first is being sent
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString filePath = tempDir.filePath(QStringLiteral("test.bin"));
+    QFile file(filePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(QByteArray(3 * 1024 * 1024, 'x')), qint64(3 * 1024 * 1024));
+    file.close();
+
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    QXmppLogger logger;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, testPort);
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    senderManager->setRateLimit(1024 * 1024);
+    sender.addExtension(senderManager);
+    sender.setLogger(&logger);
+    QSignalSpy senderConnected(&sender, &QXmppClient::connected);
+    config.setUser("sender");
+    sender.connectToServer(config);
+    QVERIFY(senderConnected.wait());
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    connect(receiverManager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+    receiver.addExtension(receiverManager);
+    receiver.setLogger(&logger);
+    QSignalSpy receiverConnected(&receiver, &QXmppClient::connected);
+    config.setUser("receiver");
+    receiver.connectToServer(config);
+    QVERIFY(receiverConnected.wait());
+
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", filePath);
+    QVERIFY(senderJob);
+    connect(senderJob, &QXmppTransferJob::progress, this, [&filePath]() {
+        QFile::resize(filePath, 1024 * 1024);
+    });
+
+    // the missing window fails the transfer instead of faulting
+    QSignalSpy finished(senderJob, &QXmppTransferJob::finished);
+    QVERIFY(finished.wait(10000));
+    QCOMPARE(senderJob->error(), QXmppTransferJob::FileAccessError);
+}
+
+void tst_QXmppTransferManager::testSendFileHash_data()
+{
+    QTest::addColumn<bool>("deferred");
+
+    QTest::newRow("hash in offer") << false;
+    QTest::newRow("deferred hash") << true;
+}
+
+void tst_QXmppTransferManager::testSendFileHash()
+{
+    QFETCH(bool, deferred);
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setHashAlgorithm(QCryptographicHash::Md5);
+    manager->setDeferredHashing(deferred);
+    QCOMPARE(manager->deferredHashing(), deferred);
+    client.addExtension(manager);
+
+    TestIbbPeer peer(&client, &logger, 0);
+
+    QFile expectedFile(QStringLiteral(":/test.svg"));
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedHash = QCryptographicHash::hash(expectedFile.readAll(), QCryptographicHash::Md5);
+
+    QXmppTransferJob *job = manager->sendFile(peer.jid(), QStringLiteral(":/test.svg"));
+    QVERIFY(job);
+    QCOMPARE(job->state(), QXmppTransferJob::OfferState);
+
+    if (deferred) {
+        // the offer goes out at once, without the hash
+        QCOMPARE(peer.offerIds.size(), 1);
+        QCOMPARE(peer.offerHashes.first(), QString());
+    } else {
+        // the offer waits for the hash
+        QCOMPARE(peer.offerIds.size(), 0);
+        QTRY_COMPARE(peer.offerIds.size(), 1);
+        QCOMPARE(peer.offerHashes.first(), QString::fromLatin1(expectedHash.toHex()));
+    }
+    QTRY_COMPARE(job->fileHash(), expectedHash);
+
+    job->abort();
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::testReceiveHash_data()
+{
+    QTest::addColumn<QString>("algorithm");
+    QTest::addColumn<bool>("corrupt");
+
+    QTest::newRow("md5") << QStringLiteral("md5") << false;
+    QTest::newRow("md5 corrupt") << QStringLiteral("md5") << true;
+    QTest::newRow("sha-256") << QStringLiteral("sha-256") << false;
+    QTest::newRow("sha-256 corrupt") << QStringLiteral("sha-256") << true;
+}
+
+void tst_QXmppTransferManager::testReceiveHash()
+{
+    QFETCH(QString, algorithm);
+    QFETCH(bool, corrupt);
+
+    QXmppClient client;
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    client.addExtension(manager);
+    connect(manager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+
+    TestSender sender(manager);
+
+    const QByteArray data(10000, 'x');
+    QByteArray sent = data;
+    if (corrupt)
+        sent[5000] = 'y';
+
+    QString file;
+    if (algorithm == QStringLiteral("md5")) {
+        file = QStringLiteral("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.bin\" size=\"%1\" hash=\"%2\"/>")
+                   .arg(QString::number(data.size()), QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex()));
+    } else {
+        file = QStringLiteral("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.bin\" size=\"%1\">"
+                              "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">%2</hash>"
+                              "</file>")
+                   .arg(QString::number(data.size()), QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha256).toBase64()));
+    }
+
+    sender.offer(QStringLiteral("sid1"), file);
+    QVERIFY(receiverJob);
+    QCOMPARE(receiverJob->fileInfo().hashAlgorithm(), algorithm == QStringLiteral("md5") ? QCryptographicHash::Md5 : QCryptographicHash::Sha256);
+
+    QSignalSpy finished(receiverJob, &QXmppTransferJob::finished);
+    sender.sendData(QStringLiteral("sid1"), sent);
+    QVERIFY(finished.wait());
+
+    // the received data was checked against the hash of the offer
+    QCOMPARE(receiverBuffer.data(), sent);
+    QCOMPARE(receiverJob->error(), corrupt ? QXmppTransferJob::FileCorruptError : QXmppTransferJob::NoError);
+}
+
+void tst_QXmppTransferManager::testSocksStreamHosts_data()
+{
+    QTest::addColumn<QStringList>("hosts");
+    QTest::addColumn<int>("staggerDelay");
+
+    // failed hosts are replaced without waiting for the stagger delay, which
+    // is longer than the test is willing to wait
+    QTest::newRow("refused first")
+        << (QStringList() << "refused" << "working") << 60000;
+    QTest::newRow("refused twice")
+        << (QStringList() << "refused" << "refused" << "working") << 60000;
+
+    // hosts which do not answer are raced after the stagger delay, while
+    // their connections are still pending
+    QTest::newRow("blackholed first")
+        << (QStringList() << "blackholed" << "working") << 200;
+    QTest::newRow("blackholed twice")
+        << (QStringList() << "blackholed" << "blackholed" << "working") << 200;
+    QTest::newRow("blackholed and refused")
+        << (QStringList() << "blackholed" << "refused" << "working") << 200;
+
+    // hosts after the winner are not tried
+    QTest::newRow("working first")
+        << (QStringList() << "working" << "blackholed") << 200;
+}
+
+void tst_QXmppTransferManager::testSocksStreamHosts()
+{
+    QFETCH(QStringList, hosts);
+    QFETCH(int, staggerDelay);
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    manager->setSocksStaggerDelay(staggerDelay);
+    manager->setSocksMaximumAttempts(3);
+    client.addExtension(manager);
+    connect(manager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+
+    // the order in which the stream hosts are connected to
+    QStringList connections;
+
+    // a stream host which accepts connections but never answers
+    QTcpServer blackholed;
+    QVERIFY(blackholed.listen(QHostAddress::LocalHost));
+    QList<QTcpSocket *> blackholedSockets;
+    connect(&blackholed, &QTcpServer::newConnection, this, [&]() {
+        while (blackholed.hasPendingConnections()) {
+            blackholedSockets << blackholed.nextPendingConnection();
+            connections << QStringLiteral("blackholed");
+        }
+    });
+
+    // a port nobody listens on
+    QTcpServer closed;
+    QVERIFY(closed.listen(QHostAddress::LocalHost));
+    const quint16 refusedPort = closed.serverPort();
+    closed.close();
+
+    // a working stream host, which records how many of the silent
+    // connections are still pending when it is connected to
+    QXmppSocksServer working;
+    QVERIFY(working.listen());
+    QTcpSocket *workingSocket = nullptr;
+    int pendingWhenWorking = -1;
+    connect(&working, &QXmppSocksServer::newConnection, this, [&](QTcpSocket *socket, const QString &, quint16) {
+        workingSocket = socket;
+        connections << QStringLiteral("working");
+        pendingWhenWorking = 0;
+        for (auto *blackholedSocket : qAsConst(blackholedSockets)) {
+            if (blackholedSocket->state() == QAbstractSocket::ConnectedState)
+                pendingWhenWorking++;
+        }
+    });
+
+    QList<QPair<QString, quint16>> streamHosts;
+    QStringList expectedConnections;
+    for (int i = 0; i < hosts.size(); ++i) {
+        const QString jid = QStringLiteral("%1-%2").arg(hosts.at(i), QString::number(i));
+        if (hosts.at(i) == QStringLiteral("blackholed")) {
+            streamHosts << qMakePair(jid, blackholed.serverPort());
+        } else if (hosts.at(i) == QStringLiteral("refused")) {
+            streamHosts << qMakePair(jid, refusedPort);
+        } else {
+            streamHosts << qMakePair(jid, working.serverPort());
+        }
+        if (!expectedConnections.contains(QStringLiteral("working")) && hosts.at(i) != QStringLiteral("refused"))
+            expectedConnections << hosts.at(i);
+    }
+
+    // the stream host used is acknowledged to the sender
+    QString streamHostUsed;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type != QXmppLogger::SentMessage || !doc.setContent(text, true))
+            return;
+        const QDomElement used = doc.documentElement().firstChildElement(QStringLiteral("query")).firstChildElement(QStringLiteral("streamhost-used"));
+        if (!used.isNull())
+            streamHostUsed = used.attribute(QStringLiteral("jid"));
+    });
+
+    const QByteArray data(10000, 'x');
+    TestSender sender(manager);
+    sender.offer(QStringLiteral("sid1"),
+                 QStringLiteral("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.bin\" size=\"%1\"/>").arg(data.size()),
+                 QStringLiteral("http://jabber.org/protocol/bytestreams"));
+    QVERIFY(receiverJob);
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::StartState);
+
+    sender.offerStreamHosts(QStringLiteral("sid1"), streamHosts);
+
+    QTRY_VERIFY(!streamHostUsed.isEmpty());
+    QVERIFY(workingSocket);
+    QCOMPARE(streamHostUsed, QStringLiteral("working-%1").arg(hosts.indexOf(QStringLiteral("working"))));
+    QCOMPARE(receiverJob->state(), QXmppTransferJob::TransferState);
+
+    // the silent hosts were raced rather than waited for
+    QCOMPARE(pendingWhenWorking, expectedConnections.count(QStringLiteral("blackholed")));
+
+    // the losing connections are cancelled
+    for (auto *socket : qAsConst(blackholedSockets))
+        QTRY_COMPARE(socket->state(), QAbstractSocket::UnconnectedState);
+
+    // hosts are tried in order, and none after the winner
+    if (hosts.indexOf(QStringLiteral("working")) < hosts.size() - 1)
+        QTest::qWait(staggerDelay * 2);
+    QCOMPARE(connections, expectedConnections);
+
+    // the file is received over the winning connection
+    QSignalSpy finished(receiverJob, &QXmppTransferJob::finished);
+    workingSocket->write(data);
+    QVERIFY(finished.wait());
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverBuffer.data(), data);
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::testScheduler()
+{
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    manager->setMaximumActiveTransfers(1);
+    client.addExtension(manager);
+
+    TestIbbPeer peer(&client, &logger, 0);
+
+    const QByteArray payload(32 * 1024, 'x');
+    QBuffer buffer1, buffer2;
+    buffer1.setData(payload);
+    buffer2.setData(payload);
+    QVERIFY(buffer1.open(QIODevice::ReadOnly));
+    QVERIFY(buffer2.open(QIODevice::ReadOnly));
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setSize(payload.size());
+
+    QXmppTransferJob *job1 = manager->sendFile(peer.jid(), &buffer1, fileInfo, QStringLiteral("sid1"));
+    QXmppTransferJob *job2 = manager->sendFile(peer.jid(), &buffer2, fileInfo, QStringLiteral("sid2"));
+    QCOMPARE(peer.offerIds.size(), 2);
+
+    QSignalSpy finished2(job2, &QXmppTransferJob::finished);
+    QElapsedTimer timer;
+    timer.start();
+
+    // only one job sends data at a time
+    peer.acceptOffer(manager, peer.offerIds.at(0));
+    peer.acceptOffer(manager, peer.offerIds.at(1));
+    QVERIFY(finished2.wait());
+    QCOMPARE(job1->error(), QXmppTransferJob::NoError);
+    QCOMPARE(job2->error(), QXmppTransferJob::NoError);
+    QCOMPARE(peer.received, 2 * payload.size());
+    QCOMPARE(peer.dataSids.indexOf(QStringLiteral("sid2")), peer.dataSids.lastIndexOf(QStringLiteral("sid1")) + 1);
+
+    // the rate limit is shared by all jobs
+    manager->setMaximumActiveTransfers(0);
+    manager->setRateLimit(128 * 1024);
+
+    QBuffer buffer3, buffer4;
+    buffer3.setData(payload);
+    buffer4.setData(payload);
+    QVERIFY(buffer3.open(QIODevice::ReadOnly));
+    QVERIFY(buffer4.open(QIODevice::ReadOnly));
+
+    QXmppTransferJob *job3 = manager->sendFile(peer.jid(), &buffer3, fileInfo, QStringLiteral("sid3"));
+    QXmppTransferJob *job4 = manager->sendFile(peer.jid(), &buffer4, fileInfo, QStringLiteral("sid4"));
+    job4->setPriority(1);
+
+    QStringList finishOrder;
+    connect(job3, &QXmppTransferJob::finished, this, [&finishOrder]() {
+        finishOrder << QStringLiteral("sid3");
+    });
+    connect(job4, &QXmppTransferJob::finished, this, [&finishOrder]() {
+        finishOrder << QStringLiteral("sid4");
+    });
+
+    QSignalSpy finished3(job3, &QXmppTransferJob::finished);
+    QSignalSpy finished4(job4, &QXmppTransferJob::finished);
+    timer.restart();
+    peer.acceptOffer(manager, peer.offerIds.at(2));
+    peer.acceptOffer(manager, peer.offerIds.at(3));
+    QVERIFY(finished3.wait());
+    QVERIFY(finished4.count() || finished4.wait());
+
+    // 64 KiB at 128 KiB/s, minus the initial burst
+    QVERIFY(timer.elapsed() >= 250);
+    QCOMPARE(job3->error(), QXmppTransferJob::NoError);
+    QCOMPARE(job4->error(), QXmppTransferJob::NoError);
+
+    // the job with the higher priority was offered the bandwidth first, even
+    // though it was accepted last
+    QCOMPARE(finishOrder, (QStringList { QStringLiteral("sid4"), QStringLiteral("sid3") }));
+    const int lastIndex3 = peer.dataSids.lastIndexOf(QStringLiteral("sid3"));
+    const int lastIndex4 = peer.dataSids.lastIndexOf(QStringLiteral("sid4"));
+    QVERIFY(lastIndex4 < lastIndex3);
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::testFinishedJobRetention()
+{
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setFinishedJobRetention(0);
+    client.addExtension(manager);
+
+    TestIbbPeer peer(&client, &logger, 0);
+
+    QBuffer buffer;
+    buffer.setData(QByteArray(1024, 'x'));
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setSize(buffer.size());
+
+    QPointer<QXmppTransferJob> job = manager->sendFile(peer.jid(), &buffer, fileInfo);
+    QVERIFY(job);
+    QCOMPARE(peer.offerIds.size(), 1);
+
+    // the remote party declines the offer
+    QXmppIq response(QXmppIq::Error);
+    response.setId(peer.offerIds.first());
+    response.setFrom(peer.jid());
+    response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Forbidden));
+    emit client.iqReceived(response);
+
+    QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(job->error(), QXmppTransferJob::AbortError);
+
+    // the finished job is deleted automatically
+    QTRY_VERIFY(job.isNull());
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::testSendRange_data()
+{
+    QTest::addColumn<bool>("useFile");
+    QTest::addColumn<QByteArray>("prefix");
+    QTest::addColumn<QXmppTransferJob::Error>("error");
+
+    const QByteArray prefix(6000, 'x');
+    QByteArray otherPrefix = prefix;
+    otherPrefix[3000] = 'y';
+
+    QTest::newRow("buffer") << false << QByteArray() << QXmppTransferJob::NoError;
+    QTest::newRow("buffer same prefix") << false << prefix << QXmppTransferJob::NoError;
+    QTest::newRow("buffer other prefix") << false << otherPrefix << QXmppTransferJob::FileCorruptError;
+    QTest::newRow("file same prefix") << true << prefix << QXmppTransferJob::NoError;
+    QTest::newRow("file other prefix") << true << otherPrefix << QXmppTransferJob::FileCorruptError;
+}
+
+void tst_QXmppTransferManager::testSendRange()
+{
+    QFETCH(bool, useFile);
+    QFETCH(QByteArray, prefix);
+    QFETCH(QXmppTransferJob::Error, error);
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    client.addExtension(manager);
+
+    TestIbbPeer peer(&client, &logger, 0);
+
+    const QByteArray data(10000, 'x');
+    QTemporaryDir dir;
+    QBuffer buffer;
+    QXmppTransferJob *job;
+    if (useFile) {
+        QVERIFY(dir.isValid());
+        const QString filePath = dir.filePath(QStringLiteral("test.bin"));
+        QFile file(filePath);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(data);
+        file.close();
+
+        job = manager->sendFile(peer.jid(), filePath);
+    } else {
+        buffer.setData(data);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+        QXmppTransferFileInfo fileInfo;
+        fileInfo.setSize(buffer.size());
+        job = manager->sendFile(peer.jid(), &buffer, fileInfo);
+    }
+    QVERIFY(job);
+    QVERIFY(job->fileInfo().isRangeSupported());
+    QTRY_COMPARE(peer.offerIds.size(), 1);
+
+    // the remote party only requests the end of the file, and the sender
+    // checks that the remote party holds the same beginning
+    const QByteArray rangeHash = prefix.isEmpty() ? QByteArray() : QCryptographicHash::hash(prefix, QCryptographicHash::Sha256);
+    QSignalSpy finished(job, &QXmppTransferJob::finished);
+    peer.acceptOffer(manager, peer.offerIds.first(), 6000, rangeHash);
+    QVERIFY(finished.count() || finished.wait());
+    QCOMPARE(job->error(), error);
+    QCOMPARE(peer.received, error == QXmppTransferJob::NoError ? 4000 : 0);
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::testReceiveRange_data()
+{
+    QTest::addColumn<bool>("corrupt");
+
+    QTest::newRow("same prefix") << false;
+    QTest::newRow("corrupt prefix") << true;
+}
+
+void tst_QXmppTransferManager::testReceiveRange()
+{
+    QFETCH(bool, corrupt);
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    client.addExtension(manager);
+
+    // capture the answer to the offer
+    QDomElement rangeElement;
+    QDomDocument answer;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type == QXmppLogger::SentMessage && doc.setContent(text, true) &&
+            doc.documentElement().attribute(QStringLiteral("type")) == QStringLiteral("result") &&
+            !doc.documentElement().firstChildElement(QStringLiteral("si")).isNull()) {
+            answer = doc;
+            rangeElement = doc.documentElement().firstChildElement(QStringLiteral("si")).firstChildElement(QStringLiteral("file")).firstChildElement(QStringLiteral("range"));
+        }
+    });
+
+    // part of the file was received before
+    QByteArray data(10000, 'x');
+    for (int i = 0; i < data.size(); ++i)
+        data[i] = char(i % 251);
+    QByteArray prefix = data.left(6000);
+    if (corrupt)
+        prefix[3000] = 'y';
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString filePath = dir.filePath(QStringLiteral("test.bin"));
+    QFile file(filePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(prefix);
+    file.close();
+
+    QXmppTransferJob *job = nullptr;
+    connect(manager, &QXmppTransferManager::fileReceived, this, [&](QXmppTransferJob *offered) {
+        job = offered;
+        offered->resume(filePath);
+    });
+
+    TestSender sender(manager);
+    sender.offer(QStringLiteral("sid1"),
+                 QStringLiteral("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.bin\" size=\"%1\">"
+                                "<range/>"
+                                "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">%2</hash>"
+                                "</file>")
+                     .arg(QString::number(data.size()), QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha256).toBase64())));
+    QVERIFY(job);
+
+    // the missing part is requested along with the hash of the received part
+    QTRY_VERIFY(!rangeElement.isNull());
+    QCOMPARE(rangeElement.attribute(QStringLiteral("offset")), QStringLiteral("6000"));
+    const QDomElement hashElement = rangeElement.firstChildElement(QStringLiteral("hash"));
+    QCOMPARE(hashElement.namespaceURI(), QStringLiteral("urn:xmpp:hashes:2"));
+    QCOMPARE(hashElement.attribute(QStringLiteral("algo")), QStringLiteral("sha-256"));
+    QCOMPARE(QByteArray::fromBase64(hashElement.text().toLatin1()), QCryptographicHash::hash(prefix, QCryptographicHash::Sha256));
+    QCOMPARE(job->state(), QXmppTransferJob::StartState);
+
+    // a sender ignoring the hash sends the rest, and the file hash catches
+    // a corrupt beginning
+    QSignalSpy finished(job, &QXmppTransferJob::finished);
+    sender.sendData(QStringLiteral("sid1"), data.mid(6000));
+    QVERIFY(finished.count() || finished.wait());
+    QCOMPARE(job->error(), corrupt ? QXmppTransferJob::FileCorruptError : QXmppTransferJob::NoError);
+
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), prefix + data.mid(6000));
+
+    client.setLogger(nullptr);
+}
+
+void tst_QXmppTransferManager::benchmarkInBandWindow_data()
+{
+    QTest::addColumn<int>("roundTripTime");
+    QTest::addColumn<int>("windowSize");
+
+    for (int rtt : { 0, 10, 50 }) {
+        for (int windowSize : { 1, 4, 16 }) {
+            QTest::newRow(qPrintable(QStringLiteral("rtt %1ms - window %2").arg(rtt).arg(windowSize)))
+                << rtt << windowSize;
+        }
+    }
+}
+
+void tst_QXmppTransferManager::benchmarkInBandWindow()
+{
+    QFETCH(int, roundTripTime);
+    QFETCH(int, windowSize);
+
+    const QByteArray payload(128 * 1024, 'x');
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    auto *manager = new QXmppTransferManager;
+    manager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    manager->setIbbWindowSize(windowSize);
+    client.addExtension(manager);
+
+    TestIbbPeer peer(&client, &logger, roundTripTime);
+
+    QBuffer buffer;
+    buffer.setData(payload);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setName(QStringLiteral("payload.bin"));
+    fileInfo.setSize(payload.size());
+
+    QXmppTransferJob *job = manager->sendFile(peer.jid(), &buffer, fileInfo);
+    QVERIFY(job);
+    QCOMPARE(peer.offerIds.size(), 1);
+
+    QEventLoop loop;
+    connect(job, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+
+    QElapsedTimer timer;
+    timer.start();
+    peer.acceptOffer(manager, peer.offerIds.first());
+    loop.exec();
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+
+    QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(job->error(), QXmppTransferJob::NoError);
+    QCOMPARE(peer.received, payload.size());
+    QVERIFY(peer.maxInFlight <= windowSize);
+
+    QTest::setBenchmarkResult(payload.size() * 1000.0 / elapsed, QTest::BytesPerSecond);
+
+    client.setLogger(nullptr);
+}
+
 QTEST_MAIN(tst_QXmppTransferManager)
 #include "tst_qxmpptransfermanager.moc"
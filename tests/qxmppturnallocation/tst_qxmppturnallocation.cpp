@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppStun_p.h"
+
+#include "stunserver.h"
+#include "util.h"
+#include <QObject>
+
+// number of datagrams relayed per benchmark iteration
+static const int burstSize = 64;
+
+class tst_QXmppTurnAllocation : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRelay_data();
+    void testRelay();
+    void benchmarkRelay_data();
+    void benchmarkRelay();
+};
+
+void tst_QXmppTurnAllocation::testRelay_data()
+{
+    QTest::addColumn<bool>("padding");
+
+    QTest::newRow("unpadded") << false;
+    QTest::newRow("padded") << true;
+}
+
+void tst_QXmppTurnAllocation::testRelay()
+{
+    QFETCH(bool, padding);
+
+    TestStunServer server;
+    server.setPadding(padding);
+    QVERIFY(server.bind());
+
+    TestEchoPeer peers[2];
+    for (auto &peer : peers)
+        QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+
+    QXmppTurnAllocation allocation;
+    allocation.setServer(QHostAddress::LocalHost, server.port());
+
+    QList<QByteArray> received;
+    QList<quint16> ports;
+    connect(&allocation, &QXmppIceTransport::datagramReceived, this, [&](const QByteArray &data, const QHostAddress &host, quint16 port) {
+        QCOMPARE(host, QHostAddress(QHostAddress::LocalHost));
+        received << data;
+        ports << port;
+    });
+
+    allocation.connectToHost();
+    QTRY_COMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+    QCOMPARE(allocation.relayedHost(), QHostAddress(QHostAddress::LocalHost));
+    QVERIFY(allocation.relayedPort() != 0);
+
+    // alternate between two peers, payload sizes are not multiples of 4
+    for (int i = 0; i < 10; ++i) {
+        const QByteArray payload = QByteArray(17 + i, char('a' + i));
+        QCOMPARE(allocation.writeDatagram(payload, QHostAddress::LocalHost, peers[i % 2].localPort()), qint64(payload.size()));
+    }
+    QTRY_COMPARE(received.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(received.at(i), QByteArray(17 + i, char('a' + i)));
+        QCOMPARE(ports.at(i), peers[i % 2].localPort());
+    }
+
+    // each peer was bound to its own channel exactly once
+    const auto bindings = server.bindings();
+    QCOMPARE(bindings.size(), 2);
+    QCOMPARE(bindings.at(0), qMakePair(quint16(0x4000), peers[0].localPort()));
+    QCOMPARE(bindings.at(1), qMakePair(quint16(0x4001), peers[1].localPort()));
+    const auto channels = server.channels();
+    QCOMPARE(channels.size(), 10);
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(channels.at(i), quint16(0x4000 + i % 2));
+
+    // payloads which do not fit in a ChannelData frame are rejected
+    QCOMPARE(allocation.writeDatagram(QByteArray(0x10000, 'x'), QHostAddress::LocalHost, peers[0].localPort()), qint64(-1));
+}
+
+// Each iteration relays a burst of datagrams through the TURN server and
+// waits for all of them to come back, the number of packets per second is
+// burstSize divided by the time per iteration.
+
+void tst_QXmppTurnAllocation::benchmarkRelay_data()
+{
+    QTest::addColumn<int>("size");
+
+    QTest::newRow("audio") << 172;
+    QTest::newRow("video") << 1200;
+}
+
+void tst_QXmppTurnAllocation::benchmarkRelay()
+{
+    QFETCH(int, size);
+
+    TestStunServer server;
+    QVERIFY(server.bind());
+
+    TestEchoPeer peers[4];
+    for (auto &peer : peers)
+        QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+
+    QXmppTurnAllocation allocation;
+    allocation.setServer(QHostAddress::LocalHost, server.port());
+    allocation.connectToHost();
+    QTRY_COMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+
+    int received = 0;
+    connect(&allocation, &QXmppIceTransport::datagramReceived, this, [&received](const QByteArray &, const QHostAddress &, quint16) {
+        received++;
+    });
+
+    // spread the traffic over several channels
+    const QByteArray payload(size, 'x');
+    QBENCHMARK {
+        received = 0;
+        for (int i = 0; i < burstSize; ++i)
+            allocation.writeDatagram(payload, QHostAddress::LocalHost, peers[i % 4].localPort());
+        QTRY_COMPARE(received, burstSize);
+    }
+}
+
+QTEST_MAIN(tst_QXmppTurnAllocation)
+#include "tst_qxmppturnallocation.moc"
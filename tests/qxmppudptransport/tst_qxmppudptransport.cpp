@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppStun_p.h"
+
+#include "util.h"
+#include <QObject>
+#include <QUdpSocket>
+
+// number of datagrams sent per benchmark iteration
+static const int burstSize = 64;
+
+class tst_QXmppUdpTransport : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testReceive();
+    void benchmarkLoopback();
+};
+
+static QByteArray testDatagram(int index)
+{
+    // datagrams of any size are delivered, whether they are read first or
+    // in a batch
+    if (index % 25 == 0)
+        return QByteArray(9000 + index, 'z') + QByteArray::number(index);
+    return QByteArray(20 + (index * 37) % 1200, char('a' + index % 26)) + QByteArray::number(index);
+}
+
+void tst_QXmppUdpTransport::testReceive()
+{
+    auto *receiverSocket = new QUdpSocket;
+    QVERIFY(receiverSocket->bind(QHostAddress::LocalHost, 0));
+    QXmppUdpTransport receiver(receiverSocket);
+    receiverSocket->setParent(&receiver);
+
+    QList<QByteArray> received;
+    QList<quint16> ports;
+    connect(&receiver, &QXmppIceTransport::datagramReceived, this, [&](const QByteArray &data, const QHostAddress &host, quint16 port) {
+        QCOMPARE(host, QHostAddress(QHostAddress::LocalHost));
+        received << data;
+        ports << port;
+    });
+
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+    for (int i = 0; i < 100; ++i)
+        QCOMPARE(sender.writeDatagram(testDatagram(i), QHostAddress::LocalHost, receiverSocket->localPort()), qint64(testDatagram(i).size()));
+
+    // datagrams arrive in order, including those received in batches
+    QTRY_COMPARE(received.size(), 100);
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(received.at(i), testDatagram(i));
+        QCOMPARE(ports.at(i), sender.localPort());
+    }
+}
+
+// Each iteration sends a burst of datagrams over the loopback interface and
+// waits for all of them to be received, the number of packets per second is
+// burstSize divided by the time per iteration.
+
+void tst_QXmppUdpTransport::benchmarkLoopback()
+{
+    auto *senderSocket = new QUdpSocket;
+    QVERIFY(senderSocket->bind(QHostAddress::LocalHost, 0));
+    QXmppUdpTransport sender(senderSocket);
+    senderSocket->setParent(&sender);
+
+    auto *receiverSocket = new QUdpSocket;
+    QVERIFY(receiverSocket->bind(QHostAddress::LocalHost, 0));
+    QXmppUdpTransport receiver(receiverSocket);
+    receiverSocket->setParent(&receiver);
+
+    int received = 0;
+    connect(&receiver, &QXmppIceTransport::datagramReceived, this, [&received](const QByteArray &, const QHostAddress &, quint16) {
+        received++;
+    });
+
+    // the size of an audio RTP packet
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < burstSize; ++i)
+        datagrams << QByteArray(172, 'x');
+
+    QBENCHMARK {
+        received = 0;
+        for (const auto &datagram : qAsConst(datagrams))
+            sender.writeDatagram(datagram, QHostAddress::LocalHost, receiverSocket->localPort());
+        QTRY_COMPARE(received, burstSize);
+    }
+}
+
+QTEST_MAIN(tst_QXmppUdpTransport)
+#include "tst_qxmppudptransport.moc"
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppHttpUploadIq.h"
+#include "QXmppUploadManager.h"
+#include "QXmppUploadRequestManager.h"
+
+#include "util.h"
+#include <QSignalSpy>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+
+// In-process stand-in for an HTTP upload server, which stores the body of
+// PUT requests.
+class TestHttpServer : public QTcpServer
+{
+public:
+    TestHttpServer()
+    {
+        connect(this, &QTcpServer::newConnection, this, &TestHttpServer::handleConnection);
+    }
+
+    QUrl url(const QString &path) const
+    {
+        return QUrl(QStringLiteral("http://127.0.0.1:%1/%2").arg(QString::number(serverPort()), path));
+    }
+
+    // number of requests to answer with an error before accepting uploads
+    int failures = 0;
+    int responseDelay = 0;
+
+    int requests = 0;
+    int active = 0;
+    int maxActive = 0;
+    QByteArray body;
+    QMap<QByteArray, QByteArray> headers;
+
+private:
+    void handleConnection()
+    {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            connect(socket, &QIODevice::readyRead, this, [this, socket]() {
+                handleData(socket);
+            });
+            connect(socket, &QAbstractSocket::disconnected, this, [this, socket]() {
+                m_buffers.remove(socket);
+                socket->deleteLater();
+            });
+        }
+    }
+
+    void handleData(QTcpSocket *socket)
+    {
+        QByteArray &buffer = m_buffers[socket];
+        buffer += socket->readAll();
+
+        const int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        QMap<QByteArray, QByteArray> requestHeaders;
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        for (int i = 1; i < lines.size(); ++i) {
+            const int colon = lines[i].indexOf(':');
+            if (colon > 0)
+                requestHeaders.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+        }
+
+        const int contentLength = requestHeaders.value("content-length").toInt();
+        if (buffer.size() < headerEnd + 4 + contentLength)
+            return;
+
+        const QByteArray requestBody = buffer.mid(headerEnd + 4, contentLength);
+        buffer.remove(0, headerEnd + 4 + contentLength);
+
+        requests++;
+        maxActive = qMax(maxActive, ++active);
+
+        const bool fail = failures > 0;
+        if (fail) {
+            failures--;
+        } else {
+            body = requestBody;
+            headers = requestHeaders;
+        }
+
+        QTimer::singleShot(responseDelay, socket, [this, socket, fail]() {
+            active--;
+            if (fail)
+                socket->write("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            else
+                socket->write("HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n");
+        });
+    }
+
+    QHash<QTcpSocket *, QByteArray> m_buffers;
+};
+
+class tst_QXmppUploadManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testUpload_data();
+    void testUpload();
+    void testRetry_data();
+    void testRetry();
+    void testAbort();
+    void testAbortQueued();
+    void testConcurrency_data();
+    void testConcurrency();
+    void testServiceSelection();
+
+private:
+    QString createFile(const QString &name, const QByteArray &data);
+    QXmppHttpUploadSlotIq createSlot(const QString &name);
+
+    QTemporaryDir m_dir;
+    TestHttpServer *m_server;
+    QXmppClient *m_client;
+    QXmppUploadManager *m_manager;
+};
+
+void tst_QXmppUploadManager::init()
+{
+    m_server = new TestHttpServer;
+    m_server->setParent(this);
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+
+    m_client = new QXmppClient(this);
+    m_client->addExtension(new QXmppUploadRequestManager);
+    m_manager = new QXmppUploadManager;
+    m_manager->setRetryDelay(0);
+    m_client->addExtension(m_manager);
+}
+
+void tst_QXmppUploadManager::cleanup()
+{
+    delete m_client;
+    delete m_server;
+}
+
+QString tst_QXmppUploadManager::createFile(const QString &name, const QByteArray &data)
+{
+    const QString path = m_dir.path() + "/" + name;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+        return QString();
+    return path;
+}
+
+QXmppHttpUploadSlotIq tst_QXmppUploadManager::createSlot(const QString &name)
+{
+    QMap<QString, QString> headers;
+    headers.insert("Authorization", "Basic Base64String==");
+
+    QXmppHttpUploadSlotIq slot;
+    slot.setFrom("upload.localhost");
+    slot.setPutUrl(m_server->url(name));
+    slot.setGetUrl(QUrl("https://download.localhost/" + name));
+    slot.setPutHeaders(headers);
+    return slot;
+}
+
+void tst_QXmppUploadManager::testUpload_data()
+{
+    QTest::addColumn<int>("fileSize");
+
+    QTest::newRow("empty") << 0;
+    QTest::newRow("small") << 2280;
+    QTest::newRow("large") << 4 * 1024 * 1024;
+}
+
+void tst_QXmppUploadManager::testUpload()
+{
+    QFETCH(int, fileSize);
+
+    QByteArray data(fileSize, Qt::Uninitialized);
+    for (int i = 0; i < fileSize; ++i)
+        data[i] = char(i % 251);
+    const QString path = createFile("test.bin", data);
+    QVERIFY(!path.isEmpty());
+
+    QXmppUploadJob *job = m_manager->uploadFile(path, createSlot("test.bin"));
+    QCOMPARE(job->state(), QXmppUploadJob::UploadState);
+    QCOMPARE(job->fileSize(), qint64(fileSize));
+
+    QSignalSpy progress(job, &QXmppUploadJob::progress);
+    QSignalSpy finished(job, &QXmppUploadJob::finished);
+    QVERIFY(finished.wait());
+
+    QCOMPARE(job->state(), QXmppUploadJob::FinishedState);
+    QCOMPARE(job->error(), QXmppUploadJob::NoError);
+    QCOMPARE(job->bytesSent(), qint64(fileSize));
+    QCOMPARE(job->getUrl(), QUrl("https://download.localhost/test.bin"));
+    QCOMPARE(job->uploadService(), QString("upload.localhost"));
+    QVERIFY(!progress.isEmpty());
+    QCOMPARE(progress.last().at(0).toLongLong(), qint64(fileSize));
+    QCOMPARE(progress.last().at(1).toLongLong(), qint64(fileSize));
+
+    QCOMPARE(m_server->requests, 1);
+    QCOMPARE(m_server->body, data);
+    QCOMPARE(m_server->headers.value("authorization"), QByteArray("Basic Base64String=="));
+}
+
+void tst_QXmppUploadManager::testRetry_data()
+{
+    QTest::addColumn<int>("failures");
+    QTest::addColumn<int>("error");
+    QTest::addColumn<int>("requests");
+
+    QTest::newRow("no failure") << 0 << int(QXmppUploadJob::NoError) << 1;
+    QTest::newRow("one failure") << 1 << int(QXmppUploadJob::NoError) << 2;
+    QTest::newRow("too many failures") << 3 << int(QXmppUploadJob::NetworkError) << 3;
+}
+
+void tst_QXmppUploadManager::testRetry()
+{
+    QFETCH(int, failures);
+    QFETCH(int, error);
+    QFETCH(int, requests);
+
+    const QByteArray data(64 * 1024, 'x');
+    const QString path = createFile("retry.bin", data);
+    QVERIFY(!path.isEmpty());
+
+    m_server->failures = failures;
+    m_manager->setMaximumRetries(2);
+
+    QXmppUploadJob *job = m_manager->uploadFile(path, createSlot("retry.bin"));
+    QSignalSpy finished(job, &QXmppUploadJob::finished);
+    QVERIFY(finished.wait());
+
+    QCOMPARE(int(job->error()), error);
+    QCOMPARE(m_server->requests, requests);
+    QCOMPARE(job->retries(), requests - 1);
+    if (job->error() == QXmppUploadJob::NoError)
+        QCOMPARE(m_server->body, data);
+}
+
+void tst_QXmppUploadManager::testAbort()
+{
+    const QString path = createFile("abort.bin", QByteArray(1024 * 1024, 'x'));
+    QVERIFY(!path.isEmpty());
+
+    m_server->responseDelay = 5000;
+
+    QXmppUploadJob *job = m_manager->uploadFile(path, createSlot("abort.bin"));
+    QCOMPARE(job->state(), QXmppUploadJob::UploadState);
+
+    QSignalSpy finished(job, &QXmppUploadJob::finished);
+    job->abort();
+    QCOMPARE(job->state(), QXmppUploadJob::FinishedState);
+    QCOMPARE(job->error(), QXmppUploadJob::AbortError);
+    QVERIFY(finished.wait());
+    QCOMPARE(finished.size(), 1);
+}
+
+void tst_QXmppUploadManager::testAbortQueued()
+{
+    const QString path = createFile("queued.bin", QByteArray(16 * 1024, 'x'));
+    QVERIFY(!path.isEmpty());
+
+    m_server->responseDelay = 50;
+    m_manager->setMaximumConcurrentUploads(1);
+
+    QXmppUploadJob *first = m_manager->uploadFile(path, createSlot("first.bin"));
+    QXmppUploadJob *second = m_manager->uploadFile(path, createSlot("second.bin"));
+    QCOMPARE(second->state(), QXmppUploadJob::QueuedState);
+
+    QSignalSpy jobFinished(m_manager, &QXmppUploadManager::jobFinished);
+    second->abort();
+    QTRY_COMPARE(jobFinished.size(), 2);
+    QCOMPARE(first->error(), QXmppUploadJob::NoError);
+
+    // the aborted job is not started once the first one is done
+    QCOMPARE(second->state(), QXmppUploadJob::FinishedState);
+    QCOMPARE(second->error(), QXmppUploadJob::AbortError);
+    QCOMPARE(m_server->requests, 1);
+}
+
+void tst_QXmppUploadManager::testConcurrency_data()
+{
+    QTest::addColumn<int>("maximumConcurrentUploads");
+
+    QTest::newRow("one") << 1;
+    QTest::newRow("two") << 2;
+}
+
+void tst_QXmppUploadManager::testConcurrency()
+{
+    QFETCH(int, maximumConcurrentUploads);
+
+    const QString path = createFile("concurrent.bin", QByteArray(16 * 1024, 'x'));
+    QVERIFY(!path.isEmpty());
+
+    m_server->responseDelay = 50;
+    m_manager->setMaximumConcurrentUploads(maximumConcurrentUploads);
+
+    QList<QXmppUploadJob *> jobs;
+    for (int i = 0; i < 4; ++i)
+        jobs << m_manager->uploadFile(path, createSlot(QString("concurrent%1.bin").arg(i)));
+    QCOMPARE(jobs.last()->state(), QXmppUploadJob::QueuedState);
+
+    QSignalSpy jobFinished(m_manager, &QXmppUploadManager::jobFinished);
+    QTRY_COMPARE(jobFinished.size(), jobs.size());
+    for (auto *job : jobs)
+        QCOMPARE(job->error(), QXmppUploadJob::NoError);
+
+    QCOMPARE(m_server->requests, jobs.size());
+    QVERIFY(m_server->maxActive <= maximumConcurrentUploads);
+}
+
+void tst_QXmppUploadManager::testServiceSelection()
+{
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    m_client->setLogger(&logger);
+
+    QStringList requestTargets;
+    connect(&logger, &QXmppLogger::message, this, [&requestTargets](QXmppLogger::MessageType type, const QString &text) {
+        QDomDocument doc;
+        if (type == QXmppLogger::SentMessage && doc.setContent(text, true))
+            requestTargets << doc.documentElement().attribute("to");
+    });
+
+    auto addService = [this](const QString &jid, qint64 sizeLimit) {
+        QDomDocument doc;
+        doc.setContent(QStringLiteral("<iq from='%1' id='disco1' to='romeo@localhost/QXmpp' type='result'>"
+                                      "<query xmlns='http://jabber.org/protocol/disco#info'>"
+                                      "<identity category='store' type='file' name='HTTP File Upload'/>"
+                                      "<feature var='urn:xmpp:http:upload:0'/>"
+                                      "<x type='result' xmlns='jabber:x:data'>"
+                                      "<field var='FORM_TYPE' type='hidden'><value>urn:xmpp:http:upload:0</value></field>"
+                                      "<field var='max-file-size'><value>%2</value></field>"
+                                      "</x>"
+                                      "</query>"
+                                      "</iq>")
+                           .arg(jid, QString::number(sizeLimit)),
+                       true);
+        m_client->findExtension<QXmppDiscoveryManager>()->handleStanza(doc.documentElement());
+    };
+
+    const QString path = createFile("service.bin", QByteArray(2000, 'x'));
+    QVERIFY(!path.isEmpty());
+
+    // no service accepts the file
+    addService("small.localhost", 1000);
+    QXmppUploadJob *job = m_manager->uploadFile(path);
+    QCOMPARE(job->state(), QXmppUploadJob::FinishedState);
+    QCOMPARE(job->error(), QXmppUploadJob::NoServiceError);
+    QVERIFY(requestTargets.isEmpty());
+
+    // the slot is requested from the service which accepts the file,
+    // the request fails as the client is not connected
+    addService("large.localhost", 1000000);
+    job = m_manager->uploadFile(path);
+    QCOMPARE(job->uploadService(), QString("large.localhost"));
+    QCOMPARE(requestTargets, QStringList() << "large.localhost");
+    QCOMPARE(job->error(), QXmppUploadJob::RequestError);
+
+    m_client->setLogger(nullptr);
+}
+
+QTEST_MAIN(tst_QXmppUploadManager)
+#include "tst_qxmppuploadmanager.moc"
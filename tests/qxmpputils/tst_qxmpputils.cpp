@@ -25,7 +25,9 @@
 #include "QXmppUtils.h"
 
 #include "util.h"
+#include <QMessageAuthenticationCode>
 #include <QObject>
+#include <QRegExp>
 
 class tst_QXmppUtils : public QObject
 {
@@ -36,8 +38,80 @@ private slots:
     void testHmac();
     void testJid();
     void testMime();
+    void testDatetime_data();
+    void testDatetime();
+    void testDatetimeInvalid_data();
+    void testDatetimeInvalid();
     void testTimezoneOffset();
     void testStanzaHash();
+
+    void benchmarkCrc32_data();
+    void benchmarkCrc32();
+    void benchmarkHmacSha1_data();
+    void benchmarkHmacSha1();
+    void benchmarkDatetimeFromString_data();
+    void benchmarkDatetimeFromString();
+    void benchmarkDatetimeToString_data();
+    void benchmarkDatetimeToString();
+};
+
+// bitwise CRC32, used as reference
+static quint32 legacyCrc32(const QByteArray &in)
+{
+    quint32 result = 0xffffffff;
+    for (char n : in) {
+        result ^= quint8(n);
+        for (int k = 0; k < 8; ++k)
+            result = (result & 1) ? (result >> 1) ^ 0xedb88320 : (result >> 1);
+    }
+    return result ^ 0xffffffff;
+}
+
+// previous QRegExp and format string based implementations, used as reference
+static QDateTime legacyDatetimeFromString(const QString &str)
+{
+    QRegExp tzRe(QStringLiteral("(Z|([+-])([0-9]{2}):([0-9]{2}))"));
+    int tzPos = tzRe.indexIn(str, 19);
+    if (str.size() < 20 || tzPos < 0)
+        return QDateTime();
+
+    QDateTime dt = QDateTime::fromString(str.left(19), QStringLiteral("yyyy-MM-ddThh:mm:ss"));
+    dt.setTimeSpec(Qt::UTC);
+
+    if (tzPos > 20 && str.at(19) == '.') {
+        QString millis = (str.mid(20, tzPos - 20) + QStringLiteral("000")).left(3);
+        dt = dt.addMSecs(millis.toInt());
+    }
+
+    if (tzRe.cap(1) != QStringLiteral("Z")) {
+        int offset = tzRe.cap(3).toInt() * 3600 + tzRe.cap(4).toInt() * 60;
+        if (tzRe.cap(2) == QStringLiteral("+"))
+            dt = dt.addSecs(-offset);
+        else
+            dt = dt.addSecs(offset);
+    }
+    return dt;
+}
+
+static QString legacyDatetimeToString(const QDateTime &dt)
+{
+    QDateTime utc = dt.toUTC();
+    if (utc.time().msec())
+        return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ss.zzzZ"));
+    else
+        return utc.toString(QStringLiteral("yyyy-MM-ddThh:mm:ssZ"));
+}
+
+// time stamps as sent by various servers and clients
+static const QStringList datetimeCorpus = {
+    QStringLiteral("2010-07-10T23:08:25Z"),
+    QStringLiteral("2020-03-26T20:30:41.678Z"),
+    QStringLiteral("2002-09-10T23:41:07+02:00"),
+    QStringLiteral("1969-07-20T21:56:15-05:00"),
+    QStringLiteral("2006-12-19T17:58:35.123456Z"),
+    QStringLiteral("2014-02-14T13:44:45.1Z"),
+    QStringLiteral("2019-11-02T08:15:00.000+05:30"),
+    QStringLiteral("2021-01-09T12:00:00.999999-09:30"),
 };
 
 void tst_QXmppUtils::testCrc32()
@@ -47,6 +121,23 @@ void tst_QXmppUtils::testCrc32()
 
     crc = QXmppUtils::generateCrc32(QByteArray("Hi There"));
     QCOMPARE(crc, 0xDB143BBEu);
+
+    crc = QXmppUtils::generateCrc32(QByteArray("123456789"));
+    QCOMPARE(crc, 0xCBF43926u);
+
+    crc = QXmppUtils::generateCrc32(QByteArray("The quick brown fox jumps over the lazy dog"));
+    QCOMPARE(crc, 0x414FA339u);
+
+    // all lengths and alignments
+    QByteArray data;
+    for (int i = 0; i < 300; ++i)
+        data.append(char(i * 7 + 3));
+    for (int offset = 0; offset < 8; ++offset) {
+        for (int size = 0; size < data.size() - offset; size += 13) {
+            const QByteArray slice = data.mid(offset, size);
+            QCOMPARE(QXmppUtils::generateCrc32(slice), legacyCrc32(slice));
+        }
+    }
 }
 
 void tst_QXmppUtils::testHmac()
@@ -59,6 +150,24 @@ void tst_QXmppUtils::testHmac()
 
     hmac = QXmppUtils::generateHmacMd5(QByteArray(16, '\xaa'), QByteArray(50, '\xdd'));
     QCOMPARE(hmac, QByteArray::fromHex("56be34521d144c88dbb8c733f0e8b3f6"));
+
+    // RFC 2202 test cases for HMAC-SHA1
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(20, '\x0b'), QByteArray("Hi There"));
+    QCOMPARE(hmac, QByteArray::fromHex("b617318655057264e28bc0b6fb378c8ef146be00"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray("Jefe"), QByteArray("what do ya want for nothing?"));
+    QCOMPARE(hmac, QByteArray::fromHex("effcdf6ae5eb2fa2d27416d5f184df9c259a7c79"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(20, '\xaa'), QByteArray(50, '\xdd'));
+    QCOMPARE(hmac, QByteArray::fromHex("125d7342b9ac11cd91a39af48aa17b4f63f175d3"));
+
+    // keys longer than the block size are hashed first
+    const QByteArray longKeyText("Test Using Larger Than Block-Size Key - Hash Key First");
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(80, '\xaa'), longKeyText);
+    QCOMPARE(hmac, QByteArray::fromHex("aa4ae5e15272d00e95705637ce8a3b55ed402112"));
+
+    hmac = QXmppUtils::generateHmacMd5(QByteArray(80, '\xaa'), longKeyText);
+    QCOMPARE(hmac, QByteArray::fromHex("6b1ab7fe4bd7bf8f0b62e6ce61b9d0cd"));
 }
 
 void tst_QXmppUtils::testJid()
@@ -113,6 +222,71 @@ void tst_QXmppUtils::testMime()
 }
 #endif
 
+void tst_QXmppUtils::testDatetime_data()
+{
+    QTest::addColumn<QString>("string");
+    QTest::addColumn<QDateTime>("datetime");
+
+    QTest::newRow("utc")
+        << QStringLiteral("2010-07-10T23:08:25Z")
+        << QDateTime(QDate(2010, 7, 10), QTime(23, 8, 25), Qt::UTC);
+    QTest::newRow("millis")
+        << QStringLiteral("2020-03-26T20:30:41.678Z")
+        << QDateTime(QDate(2020, 3, 26), QTime(20, 30, 41, 678), Qt::UTC);
+    QTest::newRow("micros")
+        << QStringLiteral("2006-12-19T17:58:35.123456Z")
+        << QDateTime(QDate(2006, 12, 19), QTime(17, 58, 35, 123), Qt::UTC);
+    QTest::newRow("short-fraction")
+        << QStringLiteral("2014-02-14T13:44:45.1Z")
+        << QDateTime(QDate(2014, 2, 14), QTime(13, 44, 45, 100), Qt::UTC);
+    QTest::newRow("positive-offset")
+        << QStringLiteral("2002-09-10T23:41:07+02:00")
+        << QDateTime(QDate(2002, 9, 10), QTime(21, 41, 7), Qt::UTC);
+    QTest::newRow("negative-offset")
+        << QStringLiteral("1969-07-20T21:56:15-05:00")
+        << QDateTime(QDate(1969, 7, 21), QTime(2, 56, 15), Qt::UTC);
+    QTest::newRow("fraction-offset")
+        << QStringLiteral("2019-11-02T08:15:00.250+05:30")
+        << QDateTime(QDate(2019, 11, 2), QTime(2, 45, 0, 250), Qt::UTC);
+}
+
+void tst_QXmppUtils::testDatetime()
+{
+    QFETCH(QString, string);
+    QFETCH(QDateTime, datetime);
+
+    const QDateTime parsed = QXmppUtils::datetimeFromString(string);
+    QCOMPARE(parsed, datetime);
+    QCOMPARE(parsed.timeSpec(), Qt::UTC);
+    QCOMPARE(parsed, legacyDatetimeFromString(string));
+
+    QCOMPARE(QXmppUtils::datetimeToString(datetime), legacyDatetimeToString(datetime));
+    QCOMPARE(QXmppUtils::datetimeFromString(QXmppUtils::datetimeToString(datetime)), datetime);
+}
+
+void tst_QXmppUtils::testDatetimeInvalid_data()
+{
+    QTest::addColumn<QString>("string");
+
+    QTest::newRow("empty") << QString();
+    QTest::newRow("no-timezone") << QStringLiteral("2010-07-10T23:08:25");
+    QTest::newRow("date-only") << QStringLiteral("2010-07-10Z");
+    QTest::newRow("bad-separator") << QStringLiteral("2010-07-10 23:08:25Z");
+    QTest::newRow("bad-month") << QStringLiteral("2010-13-10T23:08:25Z");
+    QTest::newRow("bad-day") << QStringLiteral("2010-02-30T23:08:25Z");
+    QTest::newRow("bad-hour") << QStringLiteral("2010-07-10T24:08:25Z");
+    QTest::newRow("bad-timezone") << QStringLiteral("2010-07-10T23:08:25+0200");
+    QTest::newRow("letters") << QStringLiteral("20a0-07-10T23:08:25Z");
+}
+
+void tst_QXmppUtils::testDatetimeInvalid()
+{
+    QFETCH(QString, string);
+
+    QVERIFY(!QXmppUtils::datetimeFromString(string).isValid());
+    QVERIFY(!legacyDatetimeFromString(string).isValid());
+}
+
 void tst_QXmppUtils::testTimezoneOffset()
 {
     // parsing
@@ -144,5 +318,113 @@ void tst_QXmppUtils::testStanzaHash()
     QCOMPARE(hash.count('-'), 4);
 }
 
+void tst_QXmppUtils::benchmarkCrc32_data()
+{
+    QTest::addColumn<bool>("legacy");
+    QTest::addColumn<int>("size");
+
+    for (int size : { 100, 1500 }) {
+        QTest::newRow(qPrintable(QStringLiteral("legacy %1").arg(size))) << true << size;
+        QTest::newRow(qPrintable(QStringLiteral("fast %1").arg(size))) << false << size;
+    }
+}
+
+void tst_QXmppUtils::benchmarkCrc32()
+{
+    QFETCH(bool, legacy);
+    QFETCH(int, size);
+
+    const QByteArray data(size, 'x');
+    if (legacy) {
+        QBENCHMARK {
+            legacyCrc32(data);
+        }
+    } else {
+        QBENCHMARK {
+            QXmppUtils::generateCrc32(data);
+        }
+    }
+}
+
+void tst_QXmppUtils::benchmarkHmacSha1_data()
+{
+    QTest::addColumn<bool>("reuse");
+
+    QTest::newRow("one-shot") << false;
+    QTest::newRow("reused context") << true;
+}
+
+void tst_QXmppUtils::benchmarkHmacSha1()
+{
+    QFETCH(bool, reuse);
+
+    // the size of a typical ICE connectivity check
+    const QByteArray key("VOkJxbRl1RmTxUk/WvJxBt");
+    const QByteArray text(76, 'x');
+    if (reuse) {
+        QMessageAuthenticationCode mac(QCryptographicHash::Sha1, key);
+        QBENCHMARK {
+            mac.reset();
+            mac.addData(text);
+            mac.result();
+        }
+    } else {
+        QBENCHMARK {
+            QXmppUtils::generateHmacSha1(key, text);
+        }
+    }
+}
+
+void tst_QXmppUtils::benchmarkDatetimeFromString_data()
+{
+    QTest::addColumn<bool>("legacy");
+
+    QTest::newRow("legacy") << true;
+    QTest::newRow("fast") << false;
+}
+
+void tst_QXmppUtils::benchmarkDatetimeFromString()
+{
+    QFETCH(bool, legacy);
+
+    if (legacy) {
+        QBENCHMARK {
+            for (const auto &string : datetimeCorpus)
+                legacyDatetimeFromString(string);
+        }
+    } else {
+        QBENCHMARK {
+            for (const auto &string : datetimeCorpus)
+                QXmppUtils::datetimeFromString(string);
+        }
+    }
+}
+
+void tst_QXmppUtils::benchmarkDatetimeToString_data()
+{
+    benchmarkDatetimeFromString_data();
+}
+
+void tst_QXmppUtils::benchmarkDatetimeToString()
+{
+    QFETCH(bool, legacy);
+
+    QList<QDateTime> datetimes;
+    for (const auto &string : datetimeCorpus)
+        datetimes << QXmppUtils::datetimeFromString(string);
+
+    if (legacy) {
+        QBENCHMARK {
+            for (const auto &datetime : qAsConst(datetimes))
+                legacyDatetimeToString(datetime);
+        }
+    } else {
+        QBENCHMARK {
+            for (const auto &datetime : qAsConst(datetimes))
+                QXmppUtils::datetimeToString(datetime);
+        }
+    }
+}
+
 QTEST_MAIN(tst_QXmppUtils)
 #include "tst_qxmpputils.moc"
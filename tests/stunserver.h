@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Authors:
+ *  Jeremy Lainé
+ *  Manjeet Dahiya
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppStun.h"
+
+#include <QTimer>
+#include <QUdpSocket>
+#include <QtEndian>
+
+// A STUN/TURN server standing in for a real one in tests.
+//
+// It answers binding requests, and grants allocations and channel bindings
+// without authentication. Data from a client is only accepted as
+// ChannelData, data from peers is only relayed once the peer is bound to a
+// channel.
+class TestStunServer : public QObject
+{
+public:
+    typedef QPair<QHostAddress, quint16> Address;
+
+    TestStunServer(QObject *parent = nullptr)
+        : QObject(parent),
+          m_delay(0),
+          m_padding(false)
+    {
+        connect(&m_socket, &QIODevice::readyRead, this, [this]() {
+            readyRead();
+        });
+    }
+
+    ~TestStunServer() override
+    {
+        qDeleteAll(m_allocations);
+    }
+
+    bool bind(const QHostAddress &address = QHostAddress::LocalHost)
+    {
+        return m_socket.bind(address, 0);
+    }
+
+    quint16 port() const
+    {
+        return m_socket.localPort();
+    }
+
+    // Delays the responses by the given number of milliseconds, like a
+    // distant or busy server would.
+    void setDelay(int delay)
+    {
+        m_delay = delay;
+    }
+
+    // Reports the given host as mapped address instead of the sender's.
+    void setMappedHost(const QHostAddress &host)
+    {
+        m_mappedHost = host;
+    }
+
+    // Pads ChannelData sent to clients to a multiple of 4 bytes, as over
+    // stream transports.
+    void setPadding(bool padding)
+    {
+        m_padding = padding;
+    }
+
+    // Returns the channel numbers and peer ports of the channel bindings,
+    // in the order they were requested.
+    QList<QPair<quint16, quint16>> bindings() const
+    {
+        return m_bindings;
+    }
+
+    // Returns the channel numbers of the ChannelData received from clients.
+    QList<quint16> channels() const
+    {
+        return m_channels;
+    }
+
+private:
+    struct Allocation
+    {
+        QUdpSocket *relay;
+        QHash<quint16, Address> peers;
+        QHash<Address, quint16> channels;
+    };
+
+    void readyRead()
+    {
+        QHostAddress host;
+        quint16 port;
+        while (m_socket.hasPendingDatagrams()) {
+            QByteArray buffer(int(m_socket.pendingDatagramSize()), Qt::Uninitialized);
+            m_socket.readDatagram(buffer.data(), buffer.size(), &host, &port);
+
+            const Address client(host, port);
+            if (buffer.size() >= 4 && (buffer[0] & 0xc0) == 0x40)
+                handleChannelData(buffer, client);
+            else
+                handleStun(buffer, client);
+        }
+    }
+
+    void handleChannelData(const QByteArray &buffer, const Address &client)
+    {
+        const uchar *header = reinterpret_cast<const uchar *>(buffer.constData());
+        const quint16 channel = qFromBigEndian<quint16>(header);
+        const quint16 length = qFromBigEndian<quint16>(header + 2);
+        m_channels << channel;
+
+        const Allocation *allocation = m_allocations.value(client);
+        if (!allocation)
+            return;
+
+        const auto peer = allocation->peers.constFind(channel);
+        if (peer == allocation->peers.constEnd() || length > buffer.size() - 4)
+            return;
+
+        allocation->relay->writeDatagram(buffer.constData() + 4, length, peer->first, peer->second);
+    }
+
+    void handleStun(const QByteArray &buffer, const Address &client)
+    {
+        QXmppStunMessage request;
+        if (!request.decode(buffer) || request.messageClass() != QXmppStunMessage::Request)
+            return;
+
+        QXmppStunMessage response;
+        response.setType(request.messageMethod() | QXmppStunMessage::Response);
+        response.setId(request.id());
+
+        Allocation *allocation = m_allocations.value(client);
+        switch (request.messageMethod()) {
+        case QXmppStunMessage::Binding:
+            response.xorMappedHost = m_mappedHost.isNull() ? client.first : m_mappedHost;
+            response.xorMappedPort = client.second;
+            break;
+        case QXmppStunMessage::Allocate:
+            if (!allocation) {
+                allocation = new Allocation;
+                allocation->relay = new QUdpSocket(this);
+                if (!allocation->relay->bind(QHostAddress::LocalHost, 0)) {
+                    delete allocation->relay;
+                    delete allocation;
+                    return;
+                }
+                connect(allocation->relay, &QIODevice::readyRead, this, [this, allocation, client]() {
+                    relayReadyRead(allocation, client);
+                });
+                m_allocations.insert(client, allocation);
+            }
+            response.xorMappedHost = m_mappedHost.isNull() ? client.first : m_mappedHost;
+            response.xorMappedPort = client.second;
+            response.xorRelayedHost = allocation->relay->localAddress();
+            response.xorRelayedPort = allocation->relay->localPort();
+            response.setLifetime(600);
+            break;
+        case QXmppStunMessage::ChannelBind:
+            if (!allocation)
+                return;
+            m_bindings << qMakePair(request.channelNumber(), request.xorPeerPort);
+            allocation->peers.insert(request.channelNumber(), Address(request.xorPeerHost, request.xorPeerPort));
+            allocation->channels.insert(Address(request.xorPeerHost, request.xorPeerPort), request.channelNumber());
+            break;
+        case QXmppStunMessage::Refresh:
+            response.setLifetime(request.lifetime());
+            break;
+        default:
+            return;
+        }
+        write(response.encode(), client);
+    }
+
+    void relayReadyRead(Allocation *allocation, const Address &client)
+    {
+        QHostAddress host;
+        quint16 port;
+        while (allocation->relay->hasPendingDatagrams()) {
+            const int size = int(allocation->relay->pendingDatagramSize());
+            const int padding = m_padding ? (4 - size % 4) % 4 : 0;
+            QByteArray frame(4 + size + padding, '\0');
+            allocation->relay->readDatagram(frame.data() + 4, size, &host, &port);
+
+            const auto channel = allocation->channels.constFind(Address(host, port));
+            if (channel == allocation->channels.constEnd())
+                continue;
+
+            uchar *header = reinterpret_cast<uchar *>(frame.data());
+            qToBigEndian<quint16>(*channel, header);
+            qToBigEndian<quint16>(quint16(size), header + 2);
+            m_socket.writeDatagram(frame, client.first, client.second);
+        }
+    }
+
+    void write(const QByteArray &data, const Address &client)
+    {
+        if (m_delay) {
+            QUdpSocket *socket = &m_socket;
+            QTimer::singleShot(m_delay, socket, [socket, data, client]() {
+                socket->writeDatagram(data, client.first, client.second);
+            });
+        } else {
+            m_socket.writeDatagram(data, client.first, client.second);
+        }
+    }
+
+    QUdpSocket m_socket;
+    QHash<Address, Allocation *> m_allocations;
+    QList<QPair<quint16, quint16>> m_bindings;
+    QList<quint16> m_channels;
+    QHostAddress m_mappedHost;
+    int m_delay;
+    bool m_padding;
+};
+
+// A peer which sends every datagram it receives back to its sender.
+class TestEchoPeer : public QUdpSocket
+{
+public:
+    TestEchoPeer(QObject *parent = nullptr)
+        : QUdpSocket(parent)
+    {
+        connect(this, &QIODevice::readyRead, this, [this]() {
+            QHostAddress host;
+            quint16 port;
+            while (hasPendingDatagrams()) {
+                QByteArray buffer(int(pendingDatagramSize()), Qt::Uninitialized);
+                readDatagram(buffer.data(), buffer.size(), &host, &port);
+                writeDatagram(buffer, host, port);
+            }
+        });
+    }
+};
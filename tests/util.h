@@ -63,6 +63,17 @@ QDomElement writePacketToDom(T packet)
     return doc.documentElement();
 }
 
+// Processes events until count reaches the expected value or the timeout
+// expires, for waits which must not fail the test.
+inline bool waitForCount(const int &count, int expected, int timeout = 5000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (count < expected && timer.elapsed() < timeout)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    return count >= expected;
+}
+
 class TestPasswordChecker : public QXmppPasswordChecker
 {
 public: